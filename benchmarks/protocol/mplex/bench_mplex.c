@@ -0,0 +1,928 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "protocol/mplex/protocol_mplex.h"
+#include "transport/connection.h"
+
+#ifdef LIBP2P_BENCH_NOISE
+#include "peer_id/peer_id.h"
+#include "peer_id/peer_id_ed25519.h"
+#include "protocol/noise/protocol_noise.h"
+#include "security/security.h"
+#endif
+
+/*
+ * Mplex throughput / latency benchmark.
+ *
+ * Two mplex sessions are connected back to back over a non-blocking
+ * AF_UNIX socketpair. mplex has no reader thread of its own, so each
+ * session is driven by a thread running libp2p_mplex_process_loop().
+ * Receive-side backpressure is enabled so bulk transfers pause the
+ * sender instead of resetting streams. The scenarios match bench_yamux
+ * so the two muxers can be compared side by side:
+ *
+ *   - small message rate (one frame per message) on one stream
+ *   - single-stream bulk throughput
+ *   - aggregate throughput with 1/10/100/1000 concurrent streams
+ *   - stream open/close rate
+ *   - request/response latency percentiles on one stream
+ *
+ * A further mplex-only scenario measures the stream table on its own:
+ * frames are dispatched straight into a session over a connection that
+ * discards writes, with BENCH_TABLE_STREAMS streams open at once, so the
+ * per-stream lookup and cleanup cost shows without any I/O in the way.
+ *
+ * When the build has the Noise module (LIBP2P_BENCH_NOISE), --noise runs
+ * the same scenarios with both ends of the socketpair secured by a Noise
+ * XX handshake first, so the cost of the transport encryption under each
+ * muxer workload can be read off against a plain run.
+ *
+ * Usage: bench_mplex [--bytes MiB] [--iters N] [--format text|csv|json] [--noise]
+ */
+
+#define BENCH_WINDOW (1024 * 1024)
+#define BENCH_CHUNK (16 * 1024)
+#define BENCH_MSG 64
+#define BENCH_INFLIGHT 128
+#define BENCH_SMALL_PER_ITER 20
+#define BENCH_TABLE_STREAMS 20000
+
+typedef enum
+{
+    FMT_TEXT,
+    FMT_CSV,
+    FMT_JSON
+} out_fmt_t;
+
+typedef struct
+{
+    int fd;
+    _Atomic uint64_t deadline_at; /* 0 = none; monotonic ms, like TCP */
+} sock_ctx_t;
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+static ssize_t sock_read(libp2p_conn_t *c, void *buf, size_t len)
+{
+    sock_ctx_t *s = c->ctx;
+    uint64_t deadline_at = atomic_load(&s->deadline_at);
+    uint64_t now = now_ms();
+    if (deadline_at > now)
+    {
+        struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+        if (poll(&pfd, 1, (int)(deadline_at - now)) == 0)
+            return LIBP2P_CONN_ERR_AGAIN;
+    }
+    ssize_t n = read(s->fd, buf, len);
+    if (n > 0)
+        return n;
+    if (n == 0)
+        return LIBP2P_CONN_ERR_EOF;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return LIBP2P_CONN_ERR_AGAIN;
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static ssize_t sock_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    sock_ctx_t *s = c->ctx;
+    ssize_t n = write(s->fd, buf, len);
+    if (n >= 0)
+        return n;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return LIBP2P_CONN_ERR_AGAIN;
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static libp2p_conn_err_t sock_deadline(libp2p_conn_t *c, uint64_t ms)
+{
+    sock_ctx_t *s = c->ctx;
+    atomic_store(&s->deadline_at, ms ? now_ms() + ms : 0);
+    return LIBP2P_CONN_OK;
+}
+
+static libp2p_conn_err_t sock_wait(libp2p_conn_t *c, uint64_t ms)
+{
+    sock_ctx_t *s = c->ctx;
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+    int r = poll(&pfd, 1, (int)ms);
+    if (r > 0)
+        return LIBP2P_CONN_OK;
+    return r == 0 || errno == EINTR ? LIBP2P_CONN_ERR_AGAIN : LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static const multiaddr_t *sock_addr(libp2p_conn_t *c)
+{
+    (void)c;
+    return NULL;
+}
+
+static libp2p_conn_err_t sock_close(libp2p_conn_t *c)
+{
+    sock_ctx_t *s = c->ctx;
+    if (s->fd >= 0)
+    {
+        shutdown(s->fd, SHUT_RDWR);
+        close(s->fd);
+        s->fd = -1;
+    }
+    return LIBP2P_CONN_OK;
+}
+
+static void sock_free(libp2p_conn_t *c) { free(c->ctx); }
+
+static const libp2p_conn_vtbl_t SOCK_VTBL = {
+    .read = sock_read,
+    .write = sock_write,
+    .set_deadline = sock_deadline,
+    .wait_readable = sock_wait,
+    .local_addr = sock_addr,
+    .remote_addr = sock_addr,
+    .close = sock_close,
+    .free = sock_free,
+};
+
+typedef struct
+{
+    libp2p_conn_t cconn;
+    libp2p_conn_t sconn;
+    libp2p_conn_t *cwire; /* what the sessions run on: the socketpair */
+    libp2p_conn_t *swire; /* ends, or Noise conns wrapping them */
+#ifdef LIBP2P_BENCH_NOISE
+    libp2p_security_t *csec;
+    libp2p_security_t *ssec;
+#endif
+    libp2p_mplex_ctx_t *cli;
+    libp2p_mplex_ctx_t *srv;
+    pthread_t cli_th;
+    pthread_t srv_th;
+    int threads;
+} session_pair_t;
+
+static int g_noise; /* --noise */
+
+#ifdef LIBP2P_BENCH_NOISE
+typedef struct
+{
+    libp2p_security_t *sec;
+    libp2p_conn_t *raw;
+    int initiator;
+    libp2p_conn_t *out;
+    peer_id_t *peer;
+    libp2p_security_err_t rc;
+} handshake_arg_t;
+
+static void *handshake_thread(void *arg)
+{
+    handshake_arg_t *a = arg;
+    a->rc = a->initiator ? libp2p_security_secure_outbound(a->sec, a->raw, NULL, &a->out, &a->peer)
+                         : libp2p_security_secure_inbound(a->sec, a->raw, &a->out, &a->peer);
+    if (a->peer)
+    {
+        peer_id_destroy(a->peer);
+        free(a->peer);
+        a->peer = NULL;
+    }
+    return NULL;
+}
+
+/* Run a Noise XX handshake over the socketpair; on success the sessions
+ * run on the secured conns, which own the raw ends. */
+static int pair_secure(session_pair_t *p)
+{
+    static const uint8_t id_cli[32] = {0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+                                       0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60};
+    static const uint8_t id_srv[32] = {0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6, 0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f,
+                                       0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab, 0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb};
+    libp2p_noise_config_t ccfg = {.identity_private_key = id_cli,
+                                  .identity_private_key_len = sizeof(id_cli),
+                                  .identity_key_type = PEER_ID_ED25519_KEY_TYPE};
+    libp2p_noise_config_t scfg = {.identity_private_key = id_srv,
+                                  .identity_private_key_len = sizeof(id_srv),
+                                  .identity_key_type = PEER_ID_ED25519_KEY_TYPE};
+    p->csec = libp2p_noise_security_new(&ccfg);
+    p->ssec = libp2p_noise_security_new(&scfg);
+    if (!p->csec || !p->ssec)
+        return -1;
+
+    handshake_arg_t c = {.sec = p->csec, .raw = &p->cconn, .initiator = 1, .rc = LIBP2P_SECURITY_ERR_INTERNAL};
+    handshake_arg_t s = {.sec = p->ssec, .raw = &p->sconn, .initiator = 0, .rc = LIBP2P_SECURITY_ERR_INTERNAL};
+    pthread_t th;
+    if (pthread_create(&th, NULL, handshake_thread, &s) != 0)
+        return -1;
+    handshake_thread(&c);
+    pthread_join(th, NULL);
+    if (c.out)
+        p->cwire = c.out;
+    if (s.out)
+        p->swire = s.out;
+    return c.rc == LIBP2P_SECURITY_OK && s.rc == LIBP2P_SECURITY_OK ? 0 : -1;
+}
+#endif
+
+static void *loop_thread(void *arg)
+{
+    libp2p_mplex_process_loop((libp2p_mplex_ctx_t *)arg);
+    return NULL;
+}
+
+static int pair_open(session_pair_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        return -1;
+    int buf = 1024 * 1024;
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(sv[i], F_SETFL, O_NONBLOCK);
+        setsockopt(sv[i], SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+        setsockopt(sv[i], SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    }
+    sock_ctx_t *a = malloc(sizeof(*a));
+    sock_ctx_t *b = malloc(sizeof(*b));
+    if (!a || !b)
+    {
+        free(a);
+        free(b);
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    a->fd = sv[0];
+    b->fd = sv[1];
+    atomic_init(&a->deadline_at, 0);
+    atomic_init(&b->deadline_at, 0);
+    p->cconn.vt = &SOCK_VTBL;
+    p->cconn.ctx = a;
+    p->sconn.vt = &SOCK_VTBL;
+    p->sconn.ctx = b;
+    p->cwire = &p->cconn;
+    p->swire = &p->sconn;
+#ifdef LIBP2P_BENCH_NOISE
+    if (g_noise && pair_secure(p) != 0)
+        return -1;
+#endif
+    p->cli = libp2p_mplex_ctx_new(p->cwire);
+    p->srv = libp2p_mplex_ctx_new(p->swire);
+    if (!p->cli || !p->srv)
+        return -1;
+    libp2p_mplex_set_backpressure(p->cli, BENCH_WINDOW, BENCH_WINDOW / 4, 0);
+    libp2p_mplex_set_backpressure(p->srv, BENCH_WINDOW, BENCH_WINDOW / 4, 0);
+    if (pthread_create(&p->cli_th, NULL, loop_thread, p->cli) != 0)
+        return -1;
+    p->threads = 1;
+    if (pthread_create(&p->srv_th, NULL, loop_thread, p->srv) != 0)
+        return -1;
+    p->threads = 2;
+    return 0;
+}
+
+static void pair_close(session_pair_t *p)
+{
+    libp2p_mplex_stop(p->cli);
+    libp2p_mplex_stop(p->srv);
+    if (p->threads > 0)
+        pthread_join(p->cli_th, NULL);
+    if (p->threads > 1)
+        pthread_join(p->srv_th, NULL);
+    libp2p_mplex_ctx_free(p->cli);
+    libp2p_mplex_ctx_free(p->srv);
+    /* a Noise conn frees the raw end it wraps */
+    libp2p_conn_free(p->cwire);
+    libp2p_conn_free(p->swire);
+#ifdef LIBP2P_BENCH_NOISE
+    libp2p_security_free(p->csec);
+    libp2p_security_free(p->ssec);
+#endif
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int open_stream(libp2p_mplex_ctx_t *ctx, uint64_t *id)
+{
+    return libp2p_mplex_stream_open(ctx, NULL, 0, id) == LIBP2P_MPLEX_OK ? 0 : -1;
+}
+
+/* Accept polls: the session thread queues streams as their NEW frame arrives. */
+static int accept_stream(libp2p_mplex_ctx_t *ctx, uint64_t *id)
+{
+    uint64_t deadline = now_ns() + 5000000000ULL;
+    for (;;)
+    {
+        libp2p_mplex_stream_t *st = NULL;
+        if (libp2p_mplex_accept_stream(ctx, &st) == LIBP2P_MPLEX_OK && st)
+        {
+            *id = st->id;
+            return 0;
+        }
+        if (now_ns() > deadline)
+            return -1;
+        sched_yield();
+    }
+}
+
+static int send_all(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, const uint8_t *buf, size_t len)
+{
+    while (len)
+    {
+        size_t n = len > BENCH_CHUNK ? BENCH_CHUNK : len;
+        if (libp2p_mplex_stream_send(ctx, id, initiator, buf, n) != LIBP2P_MPLEX_OK)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_exact(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, uint8_t *buf, size_t len)
+{
+    while (len)
+    {
+        size_t n = 0;
+        if (libp2p_mplex_stream_recv_timeout(ctx, id, initiator, buf, len, &n, 5000) != LIBP2P_MPLEX_OK)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* ------------------------------------------------------------------ */
+/* Small message rate                                                   */
+/* ------------------------------------------------------------------ */
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    size_t bytes;
+    int rc;
+} drain_arg_t;
+
+static void *drain_thread(void *arg)
+{
+    drain_arg_t *a = arg;
+    uint64_t id = 0;
+    uint8_t buf[BENCH_CHUNK];
+    if (accept_stream(a->ctx, &id) != 0)
+    {
+        a->rc = -1;
+        return NULL;
+    }
+    while (a->bytes)
+    {
+        size_t n = 0;
+        if (libp2p_mplex_stream_recv_timeout(a->ctx, id, 0, buf, sizeof(buf), &n, 5000) != LIBP2P_MPLEX_OK)
+        {
+            a->rc = -1;
+            return NULL;
+        }
+        a->bytes -= n < a->bytes ? n : a->bytes;
+    }
+    return NULL;
+}
+
+static int bench_small_msgs(size_t count, double *per_s)
+{
+    session_pair_t p;
+    if (pair_open(&p) != 0)
+        return -1;
+    drain_arg_t da = {.ctx = p.srv, .bytes = count * BENCH_MSG, .rc = 0};
+    pthread_t th;
+    pthread_create(&th, NULL, drain_thread, &da);
+
+    uint64_t id = 0;
+    uint8_t msg[BENCH_MSG];
+    memset(msg, 0x3c, sizeof(msg));
+    int rc = open_stream(p.cli, &id);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count && rc == 0; i++)
+        rc = libp2p_mplex_stream_send(p.cli, id, 1, msg, sizeof(msg)) == LIBP2P_MPLEX_OK ? 0 : -1;
+    pthread_join(th, NULL);
+    uint64_t elapsed = now_ns() - start;
+    if (da.rc != 0)
+        rc = -1;
+    *per_s = (double)count / ((double)elapsed / 1e9);
+    pair_close(&p);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Throughput with N concurrent streams                                 */
+/* ------------------------------------------------------------------ */
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    size_t nstreams;
+    size_t per_stream;
+    uint64_t *ids;
+    int rc;
+} sink_arg_t;
+
+static void *sink_thread(void *arg)
+{
+    sink_arg_t *a = arg;
+    size_t *got = calloc(a->nstreams, sizeof(*got));
+    uint8_t *buf = malloc(BENCH_CHUNK * 4);
+    a->rc = (got && buf) ? 0 : -1;
+    for (size_t i = 0; i < a->nstreams && a->rc == 0; i++)
+    {
+        if (accept_stream(a->ctx, &a->ids[i]) != 0)
+            a->rc = -1;
+    }
+
+    size_t done = 0;
+    while (a->rc == 0 && done < a->nstreams)
+    {
+        int progress = 0;
+        for (size_t i = 0; i < a->nstreams; i++)
+        {
+            if (got[i] >= a->per_stream)
+                continue;
+            size_t n = 0;
+            libp2p_mplex_err_t rc;
+            if (a->nstreams == 1)
+                rc = libp2p_mplex_stream_recv_timeout(a->ctx, a->ids[i], 0, buf, BENCH_CHUNK * 4, &n, 5000);
+            else
+                rc = libp2p_mplex_stream_recv(a->ctx, a->ids[i], 0, buf, BENCH_CHUNK * 4, &n);
+            if (rc)
+            {
+                a->rc = -1;
+                break;
+            }
+            if (n == 0)
+                continue;
+            got[i] += n;
+            progress = 1;
+            if (got[i] >= a->per_stream)
+                done++;
+        }
+        if (!progress)
+            sched_yield();
+    }
+    free(buf);
+    free(got);
+    return NULL;
+}
+
+static int bench_throughput(size_t nstreams, size_t total, double *mib_s)
+{
+    session_pair_t p;
+    if (pair_open(&p) != 0)
+        return -1;
+
+    size_t per_stream = total / nstreams;
+    if (per_stream == 0)
+        per_stream = 1;
+    uint64_t *cids = calloc(nstreams, sizeof(*cids));
+    uint64_t *sids = calloc(nstreams, sizeof(*sids));
+    size_t *sent = calloc(nstreams, sizeof(*sent));
+    uint8_t *payload = malloc(BENCH_CHUNK);
+    if (!cids || !sids || !sent || !payload)
+        return -1;
+    memset(payload, 0xa5, BENCH_CHUNK);
+
+    sink_arg_t sa = {.ctx = p.srv, .nstreams = nstreams, .per_stream = per_stream, .ids = sids, .rc = 0};
+    pthread_t th;
+    pthread_create(&th, NULL, sink_thread, &sa);
+
+    int rc = 0;
+    for (size_t i = 0; i < nstreams && rc == 0; i++)
+        rc = open_stream(p.cli, &cids[i]);
+
+    uint64_t start = now_ns();
+    size_t done = 0;
+    while (rc == 0 && done < nstreams)
+    {
+        for (size_t i = 0; i < nstreams; i++)
+        {
+            if (sent[i] >= per_stream)
+                continue;
+            size_t n = per_stream - sent[i];
+            if (n > BENCH_CHUNK)
+                n = BENCH_CHUNK;
+            if (libp2p_mplex_stream_send(p.cli, cids[i], 1, payload, n) != LIBP2P_MPLEX_OK)
+            {
+                rc = -1;
+                break;
+            }
+            sent[i] += n;
+            if (sent[i] >= per_stream)
+                done++;
+        }
+    }
+    pthread_join(th, NULL);
+    uint64_t elapsed = now_ns() - start;
+    if (sa.rc != 0)
+        rc = -1;
+
+    *mib_s = ((double)per_stream * (double)nstreams / (1024.0 * 1024.0)) / ((double)elapsed / 1e9);
+
+    free(payload);
+    free(sent);
+    free(sids);
+    free(cids);
+    pair_close(&p);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Stream open/close rate                                               */
+/* ------------------------------------------------------------------ */
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    size_t iters;
+    int rc;
+} closer_arg_t;
+
+static void *closer_thread(void *arg)
+{
+    closer_arg_t *a = arg;
+    for (size_t i = 0; i < a->iters; i++)
+    {
+        uint64_t id = 0;
+        if (accept_stream(a->ctx, &id) != 0)
+        {
+            a->rc = -1;
+            return NULL;
+        }
+        uint8_t b;
+        size_t n = 0;
+        /* wait for the dialer's close, then close our half */
+        libp2p_mplex_stream_recv_timeout(a->ctx, id, 0, &b, 1, &n, 5000);
+        libp2p_mplex_stream_close(a->ctx, id, 0);
+    }
+    return NULL;
+}
+
+static int bench_open_close(size_t iters, double *per_s)
+{
+    session_pair_t p;
+    if (pair_open(&p) != 0)
+        return -1;
+    closer_arg_t ca = {.ctx = p.srv, .iters = iters, .rc = 0};
+    pthread_t th;
+    pthread_create(&th, NULL, closer_thread, &ca);
+
+    /* bound the streams in flight the same way bench_yamux does */
+    uint64_t inflight[BENCH_INFLIGHT];
+    int rc = 0;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < iters + BENCH_INFLIGHT && rc == 0; i++)
+    {
+        uint64_t *slot = &inflight[i % BENCH_INFLIGHT];
+        if (i >= BENCH_INFLIGHT)
+        {
+            /* EOF, or the stream is already gone once both halves closed */
+            uint8_t b;
+            size_t n = 0;
+            libp2p_mplex_err_t rrc = libp2p_mplex_stream_recv_timeout(p.cli, *slot, 1, &b, 1, &n, 5000);
+            if (rrc != LIBP2P_MPLEX_ERR_EOF && rrc != LIBP2P_MPLEX_ERR_PROTO_MAL)
+                rc = -1;
+        }
+        if (i >= iters || rc != 0)
+            continue;
+        rc = open_stream(p.cli, slot);
+        if (rc == 0 && libp2p_mplex_stream_close(p.cli, *slot, 1) != LIBP2P_MPLEX_OK)
+            rc = -1;
+    }
+    pthread_join(th, NULL);
+    uint64_t elapsed = now_ns() - start;
+    if (ca.rc != 0)
+        rc = -1;
+    *per_s = (double)iters / ((double)elapsed / 1e9);
+    pair_close(&p);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Stream table with many streams open                                  */
+/* ------------------------------------------------------------------ */
+
+static ssize_t null_read(libp2p_conn_t *c, void *buf, size_t len)
+{
+    (void)c;
+    (void)buf;
+    (void)len;
+    return LIBP2P_CONN_ERR_AGAIN;
+}
+
+static ssize_t null_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    (void)c;
+    (void)buf;
+    return (ssize_t)len;
+}
+
+static libp2p_conn_err_t null_deadline(libp2p_conn_t *c, uint64_t ms)
+{
+    (void)c;
+    (void)ms;
+    return LIBP2P_CONN_OK;
+}
+
+static libp2p_conn_err_t null_close(libp2p_conn_t *c)
+{
+    (void)c;
+    return LIBP2P_CONN_OK;
+}
+
+static void null_free(libp2p_conn_t *c) { (void)c; }
+
+static const libp2p_conn_vtbl_t NULL_VTBL = {
+    .read = null_read,
+    .write = null_write,
+    .set_deadline = null_deadline,
+    .local_addr = sock_addr,
+    .remote_addr = sock_addr,
+    .close = null_close,
+    .free = null_free,
+};
+
+/*
+ * Open BENCH_TABLE_STREAMS streams with one message each, read them back in
+ * reverse so lookups do not follow insertion order, then close them all.
+ * per_s receives the rate of each phase in streams per second.
+ */
+static int bench_stream_table(double per_s[3])
+{
+    libp2p_conn_t conn = {.vt = &NULL_VTBL, .ctx = NULL};
+    libp2p_mplex_ctx_t *ctx = libp2p_mplex_ctx_new(&conn);
+    if (!ctx)
+        return -1;
+
+    libp2p_mplex_frame_t fr;
+    uint64_t t[4];
+    int rc = 0;
+
+    t[0] = now_ns();
+    for (uint64_t id = 1; id <= BENCH_TABLE_STREAMS && rc == 0; id++)
+    {
+        libp2p_mplex_stream_t *st = NULL;
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_NEW_STREAM};
+        if (libp2p_mplex_dispatch_frame(ctx, &fr) != LIBP2P_MPLEX_OK || libp2p_mplex_accept_stream(ctx, &st) != LIBP2P_MPLEX_OK)
+            rc = -1;
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"x", .data_len = 1};
+        if (rc == 0 && libp2p_mplex_dispatch_frame(ctx, &fr) != LIBP2P_MPLEX_OK)
+            rc = -1;
+    }
+
+    t[1] = now_ns();
+    for (uint64_t id = BENCH_TABLE_STREAMS; id >= 1 && rc == 0; id--)
+    {
+        uint8_t b;
+        size_t n = 0;
+        if (libp2p_mplex_stream_recv(ctx, id, 0, &b, 1, &n) != LIBP2P_MPLEX_OK || n != 1)
+            rc = -1;
+    }
+
+    t[2] = now_ns();
+    for (uint64_t id = 1; id <= BENCH_TABLE_STREAMS && rc == 0; id++)
+    {
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_CLOSE_INITIATOR};
+        if (libp2p_mplex_dispatch_frame(ctx, &fr) != LIBP2P_MPLEX_OK || libp2p_mplex_stream_close(ctx, id, 0) != LIBP2P_MPLEX_OK)
+            rc = -1;
+    }
+    t[3] = now_ns();
+
+    for (int i = 0; i < 3; i++)
+        per_s[i] = (double)BENCH_TABLE_STREAMS / ((double)(t[i + 1] - t[i]) / 1e9);
+    libp2p_mplex_ctx_free(ctx);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Request/response latency                                             */
+/* ------------------------------------------------------------------ */
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    size_t iters;
+    int rc;
+} echo_arg_t;
+
+static void *echo_thread(void *arg)
+{
+    echo_arg_t *a = arg;
+    uint64_t id = 0;
+    if (accept_stream(a->ctx, &id) != 0)
+    {
+        a->rc = -1;
+        return NULL;
+    }
+    uint8_t msg[BENCH_MSG];
+    for (size_t i = 0; i < a->iters; i++)
+    {
+        if (recv_exact(a->ctx, id, 0, msg, sizeof(msg)) != 0 || send_all(a->ctx, id, 0, msg, sizeof(msg)) != 0)
+        {
+            a->rc = -1;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int bench_latency(size_t iters, double pct_us[4])
+{
+    session_pair_t p;
+    if (pair_open(&p) != 0)
+        return -1;
+    uint64_t *samples = malloc(iters * sizeof(*samples));
+    if (!samples)
+        return -1;
+    echo_arg_t ea = {.ctx = p.srv, .iters = iters, .rc = 0};
+    pthread_t th;
+    pthread_create(&th, NULL, echo_thread, &ea);
+
+    uint64_t id = 0;
+    int rc = open_stream(p.cli, &id);
+    uint8_t msg[BENCH_MSG];
+    memset(msg, 0x5a, sizeof(msg));
+    for (size_t i = 0; i < iters && rc == 0; i++)
+    {
+        uint64_t t0 = now_ns();
+        if (send_all(p.cli, id, 1, msg, sizeof(msg)) != 0 || recv_exact(p.cli, id, 1, msg, sizeof(msg)) != 0)
+            rc = -1;
+        samples[i] = now_ns() - t0;
+    }
+    pthread_join(th, NULL);
+    if (ea.rc != 0)
+        rc = -1;
+
+    if (rc == 0)
+    {
+        qsort(samples, iters, sizeof(*samples), cmp_u64);
+        const double q[3] = {0.50, 0.90, 0.99};
+        for (int i = 0; i < 3; i++)
+            pct_us[i] = (double)samples[(size_t)(q[i] * (double)(iters - 1))] / 1000.0;
+        pct_us[3] = (double)samples[iters - 1] / 1000.0;
+    }
+    free(samples);
+    pair_close(&p);
+    return rc;
+}
+
+/* ------------------------------------------------------------------ */
+/* Reporting                                                            */
+/* ------------------------------------------------------------------ */
+
+typedef struct
+{
+    const char *name;
+    const char *unit;
+    double value;
+} result_t;
+
+static void report(out_fmt_t fmt, const result_t *r, size_t n)
+{
+    if (fmt == FMT_CSV)
+    {
+        printf("metric,value,unit\n");
+        for (size_t i = 0; i < n; i++)
+            printf("%s,%.3f,%s\n", r[i].name, r[i].value, r[i].unit);
+        return;
+    }
+    if (fmt == FMT_JSON)
+    {
+        printf("{\"benchmark\":\"%s\",\"results\":[", g_noise ? "mplex+noise" : "mplex");
+        for (size_t i = 0; i < n; i++)
+            printf("%s{\"metric\":\"%s\",\"value\":%.3f,\"unit\":\"%s\"}", i ? "," : "", r[i].name, r[i].value, r[i].unit);
+        printf("]}\n");
+        return;
+    }
+    printf("=== Benchmark Results for %s ===\n", g_noise ? "mplex over Noise" : "mplex");
+    for (size_t i = 0; i < n; i++)
+        printf("%-28s: %12.2f %s\n", r[i].name, r[i].value, r[i].unit);
+}
+
+int main(int argc, char **argv)
+{
+    /* a session may still write after its peer has shut down */
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t total_mib = 64;
+    size_t iters = 5000;
+    out_fmt_t fmt = FMT_TEXT;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc)
+            total_mib = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--iters") == 0 && i + 1 < argc)
+            iters = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc)
+        {
+            const char *f = argv[++i];
+            fmt = strcmp(f, "csv") == 0 ? FMT_CSV : strcmp(f, "json") == 0 ? FMT_JSON : FMT_TEXT;
+        }
+#ifdef LIBP2P_BENCH_NOISE
+        else if (strcmp(argv[i], "--noise") == 0)
+            g_noise = 1;
+#endif
+        else
+        {
+#ifdef LIBP2P_BENCH_NOISE
+            fprintf(stderr, "usage: %s [--bytes MiB] [--iters N] [--format text|csv|json] [--noise]\n", argv[0]);
+#else
+            fprintf(stderr, "usage: %s [--bytes MiB] [--iters N] [--format text|csv|json]\n", argv[0]);
+#endif
+            return 1;
+        }
+    }
+    if (total_mib == 0 || iters == 0)
+    {
+        fprintf(stderr, "--bytes and --iters must be positive\n");
+        return 1;
+    }
+
+    size_t total = total_mib * 1024 * 1024;
+    result_t res[16];
+    size_t nres = 0;
+    static const size_t concurrency[] = {1, 10, 100, 1000};
+    static const char *const names[] = {"throughput_1_stream", "throughput_10_streams", "throughput_100_streams",
+                                        "throughput_1000_streams"};
+
+    double msgs = 0;
+    if (bench_small_msgs(iters * BENCH_SMALL_PER_ITER, &msgs) != 0)
+    {
+        fprintf(stderr, "small message benchmark failed\n");
+        return 1;
+    }
+    res[nres++] = (result_t){"small_msg_rate", "frames/s", msgs};
+
+    for (size_t i = 0; i < sizeof(concurrency) / sizeof(concurrency[0]); i++)
+    {
+        double mib_s = 0;
+        if (bench_throughput(concurrency[i], total, &mib_s) != 0)
+        {
+            fprintf(stderr, "%s failed\n", names[i]);
+            return 1;
+        }
+        res[nres++] = (result_t){names[i], "MiB/s", mib_s};
+    }
+
+    double rate = 0;
+    if (bench_open_close(iters, &rate) != 0)
+    {
+        fprintf(stderr, "open/close benchmark failed\n");
+        return 1;
+    }
+    res[nres++] = (result_t){"stream_open_close", "streams/s", rate};
+
+    double pct[4] = {0};
+    if (bench_latency(iters, pct) != 0)
+    {
+        fprintf(stderr, "latency benchmark failed\n");
+        return 1;
+    }
+    res[nres++] = (result_t){"rtt_p50", "us", pct[0]};
+    res[nres++] = (result_t){"rtt_p90", "us", pct[1]};
+    res[nres++] = (result_t){"rtt_p99", "us", pct[2]};
+    res[nres++] = (result_t){"rtt_max", "us", pct[3]};
+
+    double table[3] = {0};
+    if (bench_stream_table(table) != 0)
+    {
+        fprintf(stderr, "stream table benchmark failed\n");
+        return 1;
+    }
+    res[nres++] = (result_t){"stream_table_open_msg", "streams/s", table[0]};
+    res[nres++] = (result_t){"stream_table_recv", "streams/s", table[1]};
+    res[nres++] = (result_t){"stream_table_close", "streams/s", table[2]};
+
+    report(fmt, res, nres);
+    return 0;
+}
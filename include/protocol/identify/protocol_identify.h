@@ -36,8 +36,36 @@ typedef struct libp2p_identify
     size_t observed_addr_len;  /**< Length of observed address */
     char **protocols;          /**< Array of supported protocol strings */
     size_t num_protocols;      /**< Number of supported protocols */
+    void *arena;               /**< Block holding the message and all fields, or NULL */
 } libp2p_identify_t;
 
+/** @brief Bytes of one field inside an encoded identify message */
+typedef struct
+{
+    const uint8_t *data; /**< First byte (NULL if the field is absent) */
+    size_t len;          /**< Length in bytes; strings are not NUL-terminated */
+} libp2p_identify_field_t;
+
+/**
+ * @brief Identify message decoded in place.
+ *
+ * Every field points into the buffer passed to ::libp2p_identify_view_decode,
+ * which must outlive the view. Repeated fields are walked with
+ * ::libp2p_identify_view_next_listen_addr and
+ * ::libp2p_identify_view_next_protocol.
+ */
+typedef struct
+{
+    const uint8_t *buf;                       /**< Encoded message */
+    size_t len;                               /**< Length of @p buf */
+    libp2p_identify_field_t protocol_version; /**< Protocol version string */
+    libp2p_identify_field_t agent_version;    /**< Agent version string */
+    libp2p_identify_field_t public_key;       /**< Peer's public key */
+    libp2p_identify_field_t observed_addr;    /**< Observed address from remote peer */
+    size_t num_listen_addrs;                  /**< Number of listening addresses */
+    size_t num_protocols;                     /**< Number of supported protocols */
+} libp2p_identify_view_t;
+
 /**
  * @brief Decode an identify message from protobuf bytes.
  *
@@ -48,6 +76,53 @@ typedef struct libp2p_identify
  */
 int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identify_t **out_msg);
 
+/**
+ * @brief Decode an identify message without allocating.
+ *
+ * Validates the whole message; on success @p out describes it by
+ * pointing into @p buf.
+ *
+ * @param buf Input buffer containing protobuf-encoded identify message
+ * @param len Length of input buffer
+ * @param out View to fill
+ * @return 0 on success, negative on error
+ */
+int libp2p_identify_view_decode(const uint8_t *buf, size_t len, libp2p_identify_view_t *out);
+
+/**
+ * @brief Get the next listen address of a view.
+ *
+ * @param view Decoded view
+ * @param it Iterator state; start at zero
+ * @param out Next address
+ * @return 1 if @p out was set, 0 when all addresses have been visited
+ */
+int libp2p_identify_view_next_listen_addr(const libp2p_identify_view_t *view, size_t *it, libp2p_identify_field_t *out);
+
+/**
+ * @brief Get the next protocol ID of a view.
+ *
+ * @param view Decoded view
+ * @param it Iterator state; start at zero
+ * @param out Next protocol ID
+ * @return 1 if @p out was set, 0 when all protocols have been visited
+ */
+int libp2p_identify_view_next_protocol(const libp2p_identify_view_t *view, size_t *it, libp2p_identify_field_t *out);
+
+/**
+ * @brief Decode an identify message into a single allocation.
+ *
+ * Produces the same message as ::libp2p_identify_message_decode, but the
+ * struct, its arrays and copies of all fields share one block, recorded in
+ * @c arena. Free it with ::libp2p_identify_free.
+ *
+ * @param buf Input buffer containing protobuf-encoded identify message
+ * @param len Length of input buffer
+ * @param out_msg Output pointer to decoded identify message (caller must free)
+ * @return 0 on success, negative on error
+ */
+int libp2p_identify_message_decode_arena(const uint8_t *buf, size_t len, libp2p_identify_t **out_msg);
+
 /**
  * @brief Encode an identify message to protobuf bytes.
  *
@@ -107,10 +182,10 @@ int libp2p_identify_register_handler(libp2p_protocol_handler_registry_t *registr
 /**
  * @brief Send an identify request using an existing protocol handler context.
  *
- * This function uses the existing mplex context from the protocol handler
- * to open a new stream for the identify protocol.
+ * This function opens the identify stream on the protocol handler's muxer
+ * session, so the handler thread may keep running meanwhile.
  *
- * @param handler_ctx Protocol handler context with existing mplex session
+ * @param handler_ctx Protocol handler context with an active muxer session
  * @param response_handler Callback for handling the response
  * @param user_data User context passed to response handler
  * @return 0 on success, negative on error
@@ -118,6 +193,75 @@ int libp2p_identify_register_handler(libp2p_protocol_handler_registry_t *registr
 int libp2p_identify_send_request_with_context(libp2p_protocol_handler_ctx_t *handler_ctx, libp2p_identify_response_handler_t response_handler,
                                               void *user_data);
 
+/**
+ * @brief Identify responder that serves a pre-encoded local record.
+ *
+ * The local record is encoded once, without its observed address, and kept
+ * until ::libp2p_identify_service_update replaces it. Answering a request
+ * only appends the requesting connection's remote address and sends the
+ * result, so nothing is built or freed per request.
+ *
+ * The service does not watch the host: whoever changes the listen
+ * addresses, the registered protocols or the keys must call
+ * ::libp2p_identify_service_update, or peers keep receiving the old record.
+ */
+typedef struct libp2p_identify_service libp2p_identify_service_t;
+
+/**
+ * @brief Create an identify service.
+ *
+ * The record is copied; later changes to @p local are not seen until
+ * ::libp2p_identify_service_update is called.
+ *
+ * @param local Local record; @c observed_addr is ignored
+ * @return New service or NULL on error
+ */
+libp2p_identify_service_t *libp2p_identify_service_new(const libp2p_identify_t *local);
+
+/**
+ * @brief Replace the local record, e.g. after listen addresses or
+ * protocols changed.
+ *
+ * Responses already being sent keep the previous encoding.
+ *
+ * @param svc Identify service
+ * @param local New local record; @c observed_addr is ignored
+ * @return 0 on success, negative on error (the old record stays in use)
+ */
+int libp2p_identify_service_update(libp2p_identify_service_t *svc, const libp2p_identify_t *local);
+
+/**
+ * @brief Encode the response the service would send.
+ *
+ * @param svc Identify service
+ * @param observed_addr Address to report as observed (may be NULL)
+ * @param observed_addr_len Length of @p observed_addr
+ * @param out_buf Output buffer containing encoded message (caller must free)
+ * @param out_len Output length of encoded buffer
+ * @return 0 on success, negative on error
+ */
+int libp2p_identify_service_encode(libp2p_identify_service_t *svc, const uint8_t *observed_addr, size_t observed_addr_len, uint8_t **out_buf,
+                                   size_t *out_len);
+
+/**
+ * @brief Answer identify requests from a service.
+ *
+ * Alternative to ::libp2p_identify_register_handler. The service must
+ * outlive the registration.
+ *
+ * @param registry Protocol handler registry
+ * @param svc Identify service
+ * @return 0 on success, negative on error
+ */
+int libp2p_identify_service_register(libp2p_protocol_handler_registry_t *registry, libp2p_identify_service_t *svc);
+
+/**
+ * @brief Free an identify service.
+ *
+ * @param svc Service to free (may be NULL)
+ */
+void libp2p_identify_service_free(libp2p_identify_service_t *svc);
+
 #ifdef __cplusplus
 }
 #endif
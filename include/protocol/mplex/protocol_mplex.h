@@ -6,7 +6,7 @@ extern "C" {
 #endif
 
 #include "protocol/mplex/protocol_mplex_queue.h"
-#include "protocol/mplex/protocol_mplex_stream_array.h"
+#include "protocol/mplex/protocol_mplex_stream_map.h"
 #include "transport/connection.h"
 #include "transport/muxer.h"
 #include <stdint.h>
@@ -94,19 +94,36 @@ typedef struct libp2p_mplex_stream
     uint8_t *buf;        /**< Data buffer.                  */
     size_t buf_len;      /**< Size of @p buf.               */
     size_t buf_pos;      /**< Current read position.        */
+    size_t buf_cap;      /**< Allocated size of @p buf.     */
+    int over_high;       /**< Unread data above high water. */
 } libp2p_mplex_stream_t;
 
+struct libp2p_mplex_parser;
+
 /**
  * @brief Context used by the mplex multiplexer.
  */
 typedef struct
 {
     libp2p_conn_t *conn;              /**< Underlying connection.        */
-    mplex_stream_array_t streams;        /**< Active streams list.          */
+    mplex_stream_map_t streams;       /**< Active streams by key.        */
     uint64_t next_stream_id;          /**< Next stream id to assign.     */
     mplex_stream_queue_t incoming;    /**< Queue of incoming streams.    */
     atomic_bool stop;                 /**< Stop processing flag.         */
     pthread_mutex_t mtx;              /**< Protects context state.       */
+    pthread_mutex_t rd_mtx;           /**< Serialises frame readers.     */
+    struct libp2p_mplex_parser *parser; /**< Incremental frame parser.   */
+    uint8_t *rbuf;                    /**< Bytes read but not parsed.    */
+    size_t rbuf_len;                  /**< Valid bytes in @p rbuf.       */
+    size_t rbuf_pos;                  /**< Parse position in @p rbuf.    */
+    size_t recv_high;                 /**< Per-stream pause threshold.   */
+    size_t recv_low;                  /**< Per-stream resume threshold.  */
+    size_t recv_cap;                  /**< Session-wide buffered limit.  */
+    size_t buffered;                  /**< Unread bytes in all streams.  */
+    size_t num_over_high;             /**< Streams above @p recv_high.   */
+    pthread_cond_t drained;           /**< Signalled when reads resume.  */
+    pthread_cond_t readable;          /**< Signalled on stream activity. */
+    size_t recv_waiters;              /**< Threads blocked on @p readable. */
 } libp2p_mplex_ctx_t;
 
 /**
@@ -134,6 +151,13 @@ libp2p_mplex_err_t libp2p_mplex_negotiate_inbound(libp2p_conn_t *conn, uint64_t
  */
 libp2p_muxer_t *libp2p_mplex_new(void);
 
+/**
+ * @brief Muxer operations for streams that carry a bare mplex context.
+ *
+ * @return The mplex dispatch table.
+ */
+const libp2p_muxer_vtbl_t *libp2p_mplex_vtbl(void);
+
 /**
  * @brief Send a frame over the raw connection.
  *
@@ -143,9 +167,22 @@ libp2p_muxer_t *libp2p_mplex_new(void);
  */
 libp2p_mplex_err_t libp2p_mplex_send_frame(libp2p_conn_t *conn, const libp2p_mplex_frame_t *fr);
 
+/**
+ * @brief Send several frames over the raw connection in as few writes as possible.
+ *
+ * @param conn   Connection to write to.
+ * @param frames Frames to send, in order.
+ * @param count  Number of frames.
+ * @return Error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_send_frames(libp2p_conn_t *conn, const libp2p_mplex_frame_t *frames, size_t count);
+
 /**
  * @brief Read the next frame from the connection.
  *
+ * The payload, if any, is taken from the shared buffer pool and released
+ * by ::libp2p_mplex_frame_free.
+ *
  * @param conn Connection to read from.
  * @param out  Output frame structure.
  * @return Error code.
@@ -282,6 +319,27 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
  */
 libp2p_mplex_err_t libp2p_mplex_stream_recv(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, uint8_t *buf, size_t max_len, size_t *out_len);
 
+/**
+ * @brief Receive data from a stream, waiting up to a deadline for it to arrive.
+ *
+ * Sleeps until the frame dispatcher signals activity on the context. If no
+ * other thread is processing frames, the caller reads the connection
+ * itself, so this works with or without a processing loop.
+ *
+ * @param ctx        Mplex context.
+ * @param id         Stream identifier.
+ * @param initiator  Non-zero if reading the initiator side.
+ * @param buf        Destination buffer.
+ * @param max_len    Size of @p buf.
+ * @param out_len    Number of bytes actually read.
+ * @param timeout_ms Maximum wait in milliseconds, negative to wait forever.
+ * @return LIBP2P_MPLEX_OK with data, LIBP2P_MPLEX_ERR_TIMEOUT if nothing
+ *         arrived in time, LIBP2P_MPLEX_ERR_EOF once the remote closed or
+ *         the context was stopped, or another error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_stream_recv_timeout(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, uint8_t *buf, size_t max_len,
+                                                    size_t *out_len, int timeout_ms);
+
 /**
  * @brief Accept the next incoming stream, if any.
  *
@@ -294,11 +352,85 @@ libp2p_mplex_err_t libp2p_mplex_accept_stream(libp2p_mplex_ctx_t *ctx, libp2p_mp
 /**
  * @brief Process a single frame from the connection.
  *
+ * Reads from the connection in chunks; bytes beyond the dispatched frame
+ * are kept for the next call.
+ *
  * @param ctx Mplex context.
  * @return Error code.
  */
 libp2p_mplex_err_t libp2p_mplex_process_one(libp2p_mplex_ctx_t *ctx);
 
+/**
+ * @brief Wait for a frame, then dispatch every frame available without blocking.
+ *
+ * Handles up to 64 frames per call, so event loops pay one wakeup per
+ * burst rather than one per frame.
+ *
+ * @param ctx        Mplex context.
+ * @param out_frames Optional count of frames dispatched.
+ * @return LIBP2P_MPLEX_OK, LIBP2P_MPLEX_ERR_AGAIN when reading is paused
+ *         or the context was stopped, or an error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_process_ready(libp2p_mplex_ctx_t *ctx, size_t *out_frames);
+
+/**
+ * @brief Enable receive-side backpressure instead of reset-on-overflow.
+ *
+ * Once a stream holds more than @p high unread bytes, or all streams
+ * together hold more than @p session_cap, the context stops reading frames
+ * from the connection. Reading resumes once every stream is back at or
+ * below @p low and the session total is under the cap. While paused,
+ * ::libp2p_mplex_process_one returns LIBP2P_MPLEX_ERR_AGAIN without
+ * touching the connection, so the transport's own flow control slows the
+ * peer down. As mplex has no per-stream windows, a stream that is never
+ * drained stalls every stream on the session.
+ *
+ * @param ctx         Mplex context.
+ * @param high        Per-stream high watermark in bytes, 0 to disable.
+ * @param low         Per-stream low watermark; clamped to @p high / 2
+ *                    when not below @p high.
+ * @param session_cap Limit for all streams together, 0 for none.
+ * @return Error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_set_backpressure(libp2p_mplex_ctx_t *ctx, size_t high, size_t low, size_t session_cap);
+
+/**
+ * @brief Check whether reading is paused by backpressure.
+ *
+ * Event loops driving ::libp2p_mplex_ctx_feed should stop polling the
+ * connection for input while this returns non-zero.
+ *
+ * @param ctx Mplex context.
+ * @return Non-zero if frames should not be read right now.
+ */
+int libp2p_mplex_recv_paused(libp2p_mplex_ctx_t *ctx);
+
+/**
+ * @brief Block while backpressure pauses reading.
+ *
+ * Returns as soon as a consumer drains enough data, the context is
+ * stopped, or @p timeout_ms elapses.
+ *
+ * @param ctx        Mplex context.
+ * @param timeout_ms Upper bound on the wait in milliseconds, negative to
+ *                   wait until reading resumes or the context is stopped.
+ */
+void libp2p_mplex_wait_resume(libp2p_mplex_ctx_t *ctx, int timeout_ms);
+
+/**
+ * @brief Dispatch every frame contained in bytes read by the caller.
+ *
+ * Intended for event loops that own the connection reads. Chunks may split
+ * frames at any byte; partial frames are kept until the next call. Must
+ * not be mixed with ::libp2p_mplex_process_one on the same context.
+ *
+ * @param ctx  Mplex context.
+ * @param data Received bytes.
+ * @param len  Number of bytes in @p data.
+ * @return Error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_ctx_feed(libp2p_mplex_ctx_t *ctx, const uint8_t *data, size_t len);
+
 /**
  * @brief Signal the processing loop to stop.
  *
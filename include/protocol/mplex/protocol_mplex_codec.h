@@ -8,18 +8,51 @@ extern "C"
 {
 #endif
 
+/**
+ * @brief Maximum encoded size of a frame header (id/flag and length varints).
+ */
+#define MPLEX_MAX_HDR_LEN 20
+
+/**
+ * @brief Encode the header and length varints of a frame.
+ *
+ * @param fr      Frame to encode.
+ * @param out     Destination buffer of at least MPLEX_MAX_HDR_LEN bytes.
+ * @param out_len Receives the number of bytes written.
+ * @return LIBP2P_MPLEX_OK on success or an error code on failure.
+ */
+libp2p_mplex_err_t libp2p_mplex_encode_header(const libp2p_mplex_frame_t *fr, uint8_t out[MPLEX_MAX_HDR_LEN], size_t *out_len);
+
 /**
  * @brief Encode and send a single mplex frame over the connection.
  *
+ * Header and payload leave in one write for all but very large payloads.
+ *
  * @param conn Connection to send on.
  * @param fr   Frame to encode and transmit.
  * @return LIBP2P_MPLEX_OK on success or an error code on failure.
  */
 libp2p_mplex_err_t libp2p_mplex_send_frame(libp2p_conn_t *conn, const libp2p_mplex_frame_t *fr);
 
+/**
+ * @brief Send several frames, possibly for different streams, in one call.
+ *
+ * Frames are packed back to back and written in as few writes as possible.
+ * Nothing is written if any frame is malformed.
+ *
+ * @param conn   Connection to send on.
+ * @param frames Frames to send, in order.
+ * @param count  Number of frames.
+ * @return LIBP2P_MPLEX_OK on success or an error code on failure.
+ */
+libp2p_mplex_err_t libp2p_mplex_send_frames(libp2p_conn_t *conn, const libp2p_mplex_frame_t *frames, size_t count);
+
 /**
  * @brief Read the next frame from the connection.
  *
+ * The payload, if any, is taken from the shared buffer pool and released
+ * by ::libp2p_mplex_frame_free.
+ *
  * @param conn Connection to read from.
  * @param out  Output frame structure.
  * @return Error code.
@@ -76,6 +109,80 @@ libp2p_mplex_err_t libp2p_mplex_close_stream(libp2p_conn_t *conn, uint64_t id, i
  */
 libp2p_mplex_err_t libp2p_mplex_reset_stream(libp2p_conn_t *conn, uint64_t id, int initiator);
 
+/**
+ * @brief Callback receiving each frame decoded by a ::libp2p_mplex_parser_t.
+ *
+ * The frame and its payload are only valid for the duration of the call.
+ *
+ * @param arg Opaque argument given to ::libp2p_mplex_parser_feed.
+ * @param fr  Decoded frame.
+ * @return LIBP2P_MPLEX_OK to continue parsing, any other code to stop.
+ */
+typedef libp2p_mplex_err_t (*libp2p_mplex_frame_cb)(void *arg, const libp2p_mplex_frame_t *fr);
+
+/**
+ * @brief Resumable mplex frame parser.
+ *
+ * Consumes byte chunks of any size, as delivered by the transport or a
+ * secure channel, and emits every frame completed by a chunk. Payloads
+ * that lie entirely inside a chunk are handed out as slices of it without
+ * copying; only payloads split across chunks are assembled internally.
+ */
+typedef struct libp2p_mplex_parser
+{
+    int state;                /**< Current field being decoded.     */
+    uint8_t varint[10];       /**< Bytes of the varint in progress. */
+    size_t varint_len;        /**< Number of bytes in @p varint.    */
+    uint64_t id;              /**< Stream id of the current frame.  */
+    libp2p_mplex_flag_t flag; /**< Flag of the current frame.       */
+    size_t payload_len;       /**< Payload length of the frame.     */
+    uint8_t *payload;         /**< Assembly buffer for split data.  */
+    size_t payload_have;      /**< Bytes assembled so far.          */
+    size_t payload_cap;       /**< Allocated size of @p payload.    */
+} libp2p_mplex_parser_t;
+
+/**
+ * @brief Initialise a parser waiting for the start of a frame.
+ *
+ * @param p Parser to initialise.
+ */
+void libp2p_mplex_parser_init(libp2p_mplex_parser_t *p);
+
+/**
+ * @brief Release buffers held by a parser.
+ *
+ * @param p Parser to clean up.
+ */
+void libp2p_mplex_parser_free(libp2p_mplex_parser_t *p);
+
+/**
+ * @brief Check whether the parser sits on a frame boundary.
+ *
+ * @param p Parser to query.
+ * @return Non-zero if no partial frame is buffered.
+ */
+int libp2p_mplex_parser_idle(const libp2p_mplex_parser_t *p);
+
+/**
+ * @brief Feed bytes to the parser.
+ *
+ * Every frame completed by @p data is passed to @p cb in order. A callback
+ * returning LIBP2P_MPLEX_ERR_AGAIN pauses parsing right after that frame;
+ * the remaining bytes are left unconsumed so they can be fed again later.
+ * Parsing stops at the first malformed frame or other callback error.
+ *
+ * @param p            Parser state.
+ * @param data         Received bytes.
+ * @param len          Number of bytes in @p data.
+ * @param cb           Frame callback.
+ * @param arg          Opaque argument for @p cb.
+ * @param out_consumed Optional count of bytes consumed from @p data.
+ * @return LIBP2P_MPLEX_OK, LIBP2P_MPLEX_ERR_PROTO_MAL for malformed input,
+ *         or the error returned by @p cb.
+ */
+libp2p_mplex_err_t libp2p_mplex_parser_feed(libp2p_mplex_parser_t *p, const uint8_t *data, size_t len, libp2p_mplex_frame_cb cb, void *arg,
+                                            size_t *out_consumed);
+
 #ifdef __cplusplus
 }
 #endif
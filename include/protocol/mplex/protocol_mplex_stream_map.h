@@ -0,0 +1,46 @@
+#ifndef PROTOCOL_MPLEX_STREAM_MAP_H
+#define PROTOCOL_MPLEX_STREAM_MAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct libp2p_mplex_stream;
+
+/**
+ * @brief Number of released stream objects kept for reuse.
+ */
+#define MPLEX_STREAM_POOL 64
+
+/**
+ * Open-addressed hash map of mplex streams keyed by (id, initiator).
+ *
+ * Also owns a small pool of released stream objects so that short-lived
+ * streams do not hit the allocator on every open and close.
+ */
+typedef struct
+{
+    struct libp2p_mplex_stream **slots; /**< Linear-probed slot table.  */
+    size_t cap;                         /**< Slot count (power of two). */
+    size_t len;                         /**< Number of stored streams.  */
+    struct libp2p_mplex_stream *spare[MPLEX_STREAM_POOL]; /**< Pool.    */
+    size_t spare_len;                   /**< Streams in @p spare.       */
+} mplex_stream_map_t;
+
+void mplex_stream_map_init(mplex_stream_map_t *m);
+void mplex_stream_map_free(mplex_stream_map_t *m);
+struct libp2p_mplex_stream *mplex_stream_map_find(const mplex_stream_map_t *m, uint64_t id, int initiator);
+int mplex_stream_map_insert(mplex_stream_map_t *m, struct libp2p_mplex_stream *s);
+struct libp2p_mplex_stream *mplex_stream_map_remove(mplex_stream_map_t *m, uint64_t id, int initiator);
+struct libp2p_mplex_stream *mplex_stream_map_next(const mplex_stream_map_t *m, size_t *it);
+struct libp2p_mplex_stream *mplex_stream_map_alloc(mplex_stream_map_t *m);
+void mplex_stream_map_release(mplex_stream_map_t *m, struct libp2p_mplex_stream *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROTOCOL_MPLEX_STREAM_MAP_H */
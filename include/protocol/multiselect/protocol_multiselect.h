@@ -42,6 +42,13 @@ typedef struct
 {
     uint64_t handshake_timeout_ms; /**< 0 → no timeout. */
     bool enable_ls;                /**< Listener answers `ls` requests. */
+    /**
+     * Optional listener lookup used instead of scanning the supported list,
+     * which then only answers `ls`. Lets a caller with many protocols (or
+     * prefix/version matching) decide in O(1).
+     */
+    bool (*supports)(const char *protocol_id, void *arg);
+    void *supports_arg;            /**< Passed to @c supports. */
 } libp2p_multiselect_config_t;
 
 /**
@@ -54,7 +61,7 @@ typedef struct
  */
 static inline libp2p_multiselect_config_t libp2p_multiselect_config_default(void)
 {
-    return (libp2p_multiselect_config_t){.handshake_timeout_ms = 0, .enable_ls = false};
+    return (libp2p_multiselect_config_t){.handshake_timeout_ms = 0, .enable_ls = false, .supports = NULL, .supports_arg = NULL};
 }
 
 /**
@@ -70,6 +77,38 @@ static inline libp2p_multiselect_config_t libp2p_multiselect_config_default(void
  */
 libp2p_multiselect_err_t libp2p_multiselect_dial(libp2p_conn_t *conn, const char *const proposals[], uint64_t timeout_ms, const char **accepted_out);
 
+/**
+ * @brief Start an optimistic (lazy) dial for a single protocol.
+ *
+ * Writes the multistream header and @p protocol_id in one flight and
+ * returns without waiting for the reply, so the caller can send its first
+ * application bytes right behind the proposal instead of one round trip
+ * later. The listener's echoes stay queued on the connection; call
+ * ::libp2p_multiselect_dial_lazy_confirm before the first application read.
+ *
+ * If the remote does not support @p protocol_id, anything written before
+ * the confirmation is read as a further proposal and the negotiation
+ * fails, so only use this when the protocol is expected to be supported.
+ *
+ * @param conn        Raw connection (not consumed).
+ * @param protocol_id Protocol to select (UTF-8, no ‘\n’).
+ */
+libp2p_multiselect_err_t libp2p_multiselect_dial_lazy(libp2p_conn_t *conn, const char *protocol_id);
+
+/**
+ * @brief Finish a lazy dial by validating the listener's reply.
+ *
+ * Reads the header echo and the answer to the proposal sent by
+ * ::libp2p_multiselect_dial_lazy.
+ *
+ * @param conn        Connection passed to the lazy dial.
+ * @param protocol_id Protocol that was proposed.
+ * @param timeout_ms  0 → no timeout.
+ * @return LIBP2P_MULTISELECT_OK once the protocol is confirmed,
+ *         LIBP2P_MULTISELECT_ERR_UNAVAIL if the remote answered `na`.
+ */
+libp2p_multiselect_err_t libp2p_multiselect_dial_lazy_confirm(libp2p_conn_t *conn, const char *protocol_id, uint64_t timeout_ms);
+
 /**
  * @brief Listen-side protocol negotiation.
  *
@@ -77,7 +116,8 @@ libp2p_multiselect_err_t libp2p_multiselect_dial(libp2p_conn_t *conn, const char
  * @p cfg, responds with the full list before waiting for the final choice.
  *
  * @param conn          Raw connection (not consumed).
- * @param supported     NULL-terminated array of supported protocol ids.
+ * @param supported     NULL-terminated array of supported protocol ids
+ *                      (consulted only for `ls` when @c cfg->supports is set).
  * @param cfg           Optional config (NULL → defaults).
  * @param accepted_out  Pointer to the entry actually selected (may be NULL).
  */
@@ -121,6 +121,136 @@ libp2p_security_err_t libp2p_noise_negotiate_inbound(
 
 /** @} */
 
+/**
+ * @name Message-level handshake
+ *
+ * The XX handshake as three discrete messages, for callers that drive many
+ * handshakes from one event loop. The caller owns all I/O: it sends what
+ * ::libp2p_noise_handshake_write produces and feeds each received message
+ * body to ::libp2p_noise_handshake_read, in the order given by
+ * ::libp2p_noise_handshake_action. Nothing here blocks.
+ * @{
+ */
+
+/** Largest handshake frame, including its 2-byte length prefix. */
+#define LIBP2P_NOISE_HS_MAX_FRAME (2 + 65535)
+
+/** Opaque in-progress handshake. */
+typedef struct libp2p_noise_handshake libp2p_noise_handshake_t;
+
+/** Number of messages in the XX pattern. */
+#define LIBP2P_NOISE_HS_MESSAGES 3
+
+/**
+ * @brief Where the time of one handshake went.
+ *
+ * Message @c i is timed from the end of the previous message (or the start
+ * of the handshake) until this side finished writing or processing it, so
+ * for a received message it includes waiting for the peer. The identity
+ * payload is built and signed inside the message that carries it.
+ */
+typedef struct {
+    uint64_t msg_us[LIBP2P_NOISE_HS_MESSAGES]; /**< Per XX message, in µs.          */
+    uint64_t verify_us;                        /**< Remote identity signature check. */
+    int remote_key_type;                       /**< Remote identity key type, or -1. */
+} libp2p_noise_hs_stats_t;
+
+/**
+ * @brief What a handshake needs next.
+ */
+typedef enum {
+    LIBP2P_NOISE_HS_WRITE = 0,  /**< Produce and send the next message.  */
+    LIBP2P_NOISE_HS_READ = 1,   /**< Receive the next message.           */
+    LIBP2P_NOISE_HS_DONE = 2,   /**< All messages exchanged; finish it.  */
+    LIBP2P_NOISE_HS_FAILED = 3  /**< The handshake cannot continue.      */
+} libp2p_noise_hs_action_t;
+
+/**
+ * @brief Start a handshake with the keys of a Noise security instance.
+ *
+ * @param sec          Noise security instance (must outlive the handshake).
+ * @param initiator    Non-zero on the dialing side.
+ * @param remote_hint  Expected remote peer, checked on the initiator only
+ *                     (may be NULL; must outlive the handshake).
+ * @return New handshake or NULL on failure.
+ */
+libp2p_noise_handshake_t *libp2p_noise_handshake_new(libp2p_security_t *sec, int initiator, const peer_id_t *remote_hint);
+
+/**
+ * @brief Next step of the handshake.
+ */
+libp2p_noise_hs_action_t libp2p_noise_handshake_action(const libp2p_noise_handshake_t *hs);
+
+/**
+ * @brief Produce the next handshake message.
+ *
+ * Writes a complete frame, 2-byte big-endian length prefix included, so the
+ * output can be sent as is.
+ *
+ * @param hs      Handshake whose action is ::LIBP2P_NOISE_HS_WRITE.
+ * @param out     Output buffer.
+ * @param cap     Capacity of @p out (::LIBP2P_NOISE_HS_MAX_FRAME always fits).
+ * @param out_len Receives the frame length.
+ */
+libp2p_noise_err_t libp2p_noise_handshake_write(libp2p_noise_handshake_t *hs, uint8_t *out, size_t cap, size_t *out_len);
+
+/**
+ * @brief Consume one received handshake message.
+ *
+ * Verifies the peer's identity payload when the message carries one.
+ *
+ * @param hs  Handshake whose action is ::LIBP2P_NOISE_HS_READ.
+ * @param msg Message body without its length prefix; decrypted in place.
+ * @param len Body length.
+ */
+libp2p_noise_err_t libp2p_noise_handshake_read(libp2p_noise_handshake_t *hs, uint8_t *msg, size_t len);
+
+/**
+ * @brief Wrap @p raw in the secured connection once the handshake is done.
+ *
+ * Fails with ::LIBP2P_NOISE_ERR_HANDSHAKE if the remote peer does not match
+ * the hint given to ::libp2p_noise_handshake_new.
+ *
+ * @param hs          Handshake whose action is ::LIBP2P_NOISE_HS_DONE.
+ * @param raw         Connection the handshake ran on (owned by @p out).
+ * @param out         Receives the secured connection.
+ * @param remote_peer Receives the verified remote identity (may be NULL).
+ */
+libp2p_noise_err_t libp2p_noise_handshake_finish(libp2p_noise_handshake_t *hs, libp2p_conn_t *raw, libp2p_conn_t **out,
+                                                 peer_id_t **remote_peer);
+
+/**
+ * @brief Copy the timings gathered so far.
+ *
+ * @param hs  Handshake.
+ * @param out Destination.
+ */
+void libp2p_noise_handshake_get_stats(const libp2p_noise_handshake_t *hs, libp2p_noise_hs_stats_t *out);
+
+/**
+ * @brief Run a whole handshake on @p raw, blocking between messages.
+ *
+ * This is what the security vtable's secure_outbound/secure_inbound do;
+ * it additionally reports the handshake timings.
+ *
+ * @param sec         Noise security instance.
+ * @param raw         Connection (owned by @p out on success).
+ * @param initiator   Non-zero on the dialing side.
+ * @param remote_hint Expected remote peer (initiator only, may be NULL).
+ * @param out         Receives the secured connection.
+ * @param remote_peer Receives the remote identity (may be NULL).
+ * @param stats       Receives the timings, also on failure (may be NULL).
+ */
+libp2p_security_err_t libp2p_noise_handshake_run(libp2p_security_t *sec, libp2p_conn_t *raw, int initiator, const peer_id_t *remote_hint,
+                                                 libp2p_conn_t **out, peer_id_t **remote_peer, libp2p_noise_hs_stats_t *stats);
+
+/**
+ * @brief Free a handshake and any state it still owns.
+ */
+void libp2p_noise_handshake_free(libp2p_noise_handshake_t *hs);
+
+/** @} */
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
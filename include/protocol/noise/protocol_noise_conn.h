@@ -18,7 +18,9 @@ extern "C" {
  * @brief Wrap a raw connection with Noise framing and cipher states.
  *
  * The returned connection takes ownership of @p raw on success and uses the
- * provided cipher states for encryption and decryption.
+ * provided cipher states for encryption and decryption. A write that
+ * returns LIBP2P_CONN_ERR_AGAIN has already encrypted its record; retry it
+ * with the same bytes, as with TLS.
  *
  * @param raw             Raw connection to wrap.
  * @param send            Initialized sending cipher state.
@@ -8,8 +8,12 @@ extern "C"
 
 #include "peer_id/peer_id.h"
 #include "protocol/mplex/protocol_mplex.h"
+#include "protocol/protocol_support_cache.h"
 #include "transport/connection.h"
+#include "transport/muxer.h"
 #include "transport/upgrader.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -25,6 +29,21 @@ extern "C"
 /** @brief Maximum length for protocol IDs */
 #define LIBP2P_PROTOCOL_ID_MAX_LEN 256
 
+/** @brief Default time libp2p_stream_read() waits for data, in milliseconds */
+#define LIBP2P_STREAM_READ_TIMEOUT_MS 30000
+
+/** @brief Time an inbound stream gets to finish multistream negotiation, in milliseconds */
+#define LIBP2P_PROTOCOL_NEGOTIATION_TIMEOUT_MS 5000
+
+/** @brief Protocols an inbound stream may propose before it is dropped */
+#define LIBP2P_PROTOCOL_MAX_PROPOSALS 8
+
+/** @brief Default number of handler worker threads per registry */
+#define LIBP2P_PROTOCOL_HANDLER_WORKERS 4
+
+/** @brief Default capacity of the inbound stream queue per registry */
+#define LIBP2P_PROTOCOL_HANDLER_QUEUE 256
+
 /** @brief Protocol handler error codes */
 typedef enum
 {
@@ -34,7 +53,9 @@ typedef enum
     LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND = -3,
     LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT = -4,
     LIBP2P_PROTOCOL_HANDLER_ERR_STREAM = -5,
-    LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL = -6
+    LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL = -6,
+    LIBP2P_PROTOCOL_HANDLER_ERR_TIMEOUT = -7,
+    LIBP2P_PROTOCOL_HANDLER_ERR_BUSY = -8
 } libp2p_protocol_handler_err_t;
 
 /** @brief Represents a logical stream for a protocol */
@@ -45,6 +66,11 @@ struct libp2p_stream
     int initiator;         /**< Non-zero if this side opened the stream */
     char *protocol_id;     /**< Negotiated protocol ID */
     void *ctx;             /**< Internal context for stream management */
+    int read_timeout_ms;   /**< Read deadline; 0 for the default, negative for none */
+    const libp2p_muxer_vtbl_t *muxer; /**< Muxer operations on @p ctx (NULL means mplex) */
+    int negotiation;       /**< 1 while the multistream reply is unread, -1 if it was rejected */
+    libp2p_protocol_support_cache_t *support; /**< Cache told the negotiation outcome (may be NULL) */
+    libp2p_muxer_t *session; /**< Muxer session owned by the stream, freed with it (may be NULL) */
 };
 
 /**
@@ -59,31 +85,74 @@ struct libp2p_stream
  */
 typedef int (*libp2p_protocol_handler_t)(libp2p_stream_t *stream, void *user_data);
 
-/** @brief Protocol handler registry entry */
-typedef struct libp2p_protocol_handler_entry
+/** @brief Protocol handler registry entry (private to the registry) */
+typedef struct libp2p_protocol_handler_entry libp2p_protocol_handler_entry_t;
+
+/** @brief Immutable lookup snapshot of a registry (private to the registry) */
+struct libp2p_protocol_table;
+
+struct libp2p_protocol_handler_job;
+
+/** @brief Bounded worker pool that runs inbound stream handlers */
+typedef struct
 {
-    char protocol_id[LIBP2P_PROTOCOL_ID_MAX_LEN];
-    libp2p_protocol_handler_t handler;
-    void *user_data;
-    struct libp2p_protocol_handler_entry *next;
-} libp2p_protocol_handler_entry_t;
+    pthread_t *threads;                       /**< Worker threads (started lazily) */
+    size_t num_threads;                       /**< Configured worker count */
+    size_t started;                           /**< Workers actually running */
+    struct libp2p_protocol_handler_job *head; /**< Oldest queued stream */
+    struct libp2p_protocol_handler_job *tail; /**< Newest queued stream */
+    size_t queued;                            /**< Current queue depth */
+    size_t queue_cap;                         /**< Maximum queue depth */
+    size_t peak_queued;                       /**< Highest queue depth seen */
+    size_t running;                           /**< Workers executing a stream */
+    uint64_t completed;                       /**< Streams handled to completion */
+    uint64_t rejected;                        /**< Streams reset because the queue was full */
+    int shutdown;                             /**< Set when the registry is freed */
+    pthread_mutex_t mutex;                    /**< Protects the pool */
+    pthread_cond_t cond;                      /**< Signalled when work is queued */
+} libp2p_protocol_handler_pool_t;
 
-/** @brief Protocol handler registry */
+/**
+ * @brief Protocol handler registry
+ *
+ * Lookups read an immutable hash table snapshot without locking. Writers
+ * rebuild and publish a new snapshot under @p mutex and free the old one
+ * once no lookup that started before the swap is still running.
+ */
 typedef struct
 {
-    libp2p_protocol_handler_entry_t *handlers;
-    pthread_mutex_t mutex;
+    libp2p_protocol_handler_entry_t *handlers;     /**< Registered entries (writers only) */
+    struct libp2p_protocol_table *_Atomic table;  /**< Current lookup snapshot */
+    atomic_size_t readers[2];                      /**< Lookups in flight, by epoch parity */
+    atomic_uint epoch;                             /**< Bumped whenever a snapshot is retired */
+    pthread_mutex_t mutex;                         /**< Serializes writers */
+    libp2p_protocol_handler_pool_t pool;           /**< Workers shared by every connection */
+    libp2p_protocol_support_cache_t *support;      /**< Protocols each remote peer accepts */
 } libp2p_protocol_handler_registry_t;
 
+/** @brief Snapshot of a registry's worker pool counters */
+typedef struct
+{
+    size_t workers;     /**< Worker threads running */
+    size_t queued;      /**< Streams waiting for a worker */
+    size_t peak_queued; /**< Highest queue depth seen */
+    size_t running;     /**< Streams being negotiated or handled */
+    uint64_t completed; /**< Streams handled to completion */
+    uint64_t rejected;  /**< Streams reset by the queue or protocol limits */
+} libp2p_protocol_handler_stats_t;
+
 /** @brief Protocol handler context for managing streams */
 typedef struct
 {
     libp2p_protocol_handler_registry_t *registry;
     libp2p_uconn_t *uconn;
-    void *muxer_ctx; /**< Muxer-specific context (e.g., libp2p_mplex_ctx_t *) */
+    libp2p_muxer_t muxer; /**< Session of the connection's negotiated muxer */
+    void *muxer_ctx;      /**< Muxer-specific context (same as muxer.ctx) */
     pthread_t handler_thread;
     int stop_flag;
     pthread_mutex_t mutex;
+    size_t pending;      /**< Streams queued or running on the worker pool */
+    pthread_cond_t idle;  /**< Signalled when @p pending drops to zero */
 } libp2p_protocol_handler_ctx_t;
 
 /* ===== Registry Management ===== */
@@ -118,22 +187,118 @@ void libp2p_protocol_handler_registry_free(libp2p_protocol_handler_registry_t *r
 int libp2p_register_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id, libp2p_protocol_handler_t handler,
                                      void *user_data);
 
+/**
+ * @brief Register a handler for every protocol ID starting with a prefix.
+ *
+ * Exact registrations take precedence; among prefix and version handlers
+ * the longest registered string wins.
+ *
+ * @param registry Protocol handler registry
+ * @param prefix Protocol ID prefix (e.g., "/myapp/")
+ * @param handler Callback function to handle streams
+ * @param user_data User context passed to handler
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_register_protocol_prefix_handler(libp2p_protocol_handler_registry_t *registry, const char *prefix, libp2p_protocol_handler_t handler,
+                                            void *user_data);
+
+/**
+ * @brief Register a handler for a range of versions of one protocol.
+ *
+ * Matches IDs of the form @p base followed by a dotted version
+ * ("MAJOR[.MINOR[.PATCH]]", missing parts read as 0) with
+ * @p min_version <= version < @p max_version. The handler is registered
+ * under @p base, so only one version range can exist per base.
+ *
+ * @param registry Protocol handler registry
+ * @param base Protocol ID up to the version (e.g., "/meshsub/")
+ * @param min_version Lowest accepted version (e.g., "1.0.0")
+ * @param max_version First rejected version (NULL for no upper bound)
+ * @param handler Callback function to handle streams
+ * @param user_data User context passed to handler
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_register_protocol_version_handler(libp2p_protocol_handler_registry_t *registry, const char *base, const char *min_version,
+                                             const char *max_version, libp2p_protocol_handler_t handler, void *user_data);
+
 /**
  * @brief Unregister a protocol handler.
  *
  * @param registry Protocol handler registry
- * @param protocol_id Protocol identifier to unregister
+ * @param protocol_id Protocol identifier, prefix or version base to unregister
  * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
  */
 int libp2p_unregister_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id);
 
+/**
+ * @brief Check whether a protocol ID has a handler.
+ *
+ * Takes no lock. The signature matches the @c supports hook of
+ * ::libp2p_multiselect_config_t, so a registry can answer multistream
+ * proposals directly.
+ *
+ * @param protocol_id Requested protocol ID
+ * @param registry Protocol handler registry
+ * @return true if an exact, prefix or version handler matches
+ */
+bool libp2p_protocol_handler_supports(const char *protocol_id, void *registry);
+
+/**
+ * @brief Cache of the protocols remote peers accept.
+ *
+ * Outbound streams opened through a handler context record their
+ * negotiation outcome here, and identify stores each peer's advertised
+ * protocol list.
+ *
+ * @param registry Protocol handler registry
+ * @return The registry's support cache, or NULL
+ */
+libp2p_protocol_support_cache_t *libp2p_protocol_handler_support_cache(libp2p_protocol_handler_registry_t *registry);
+
+/**
+ * @brief Size the worker pool that runs inbound stream handlers.
+ *
+ * Negotiation and handler execution for inbound streams happen on these
+ * workers, so a slow handler never stalls frame processing. Streams that
+ * arrive while the queue is full are reset. Must be called before the
+ * first connection is started.
+ *
+ * @param registry Protocol handler registry
+ * @param workers Number of worker threads (0 for the default)
+ * @param queue_cap Maximum queued streams (0 for the default)
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_protocol_handler_set_workers(libp2p_protocol_handler_registry_t *registry, size_t workers, size_t queue_cap);
+
+/**
+ * @brief Limit how many streams of one protocol are handled at once.
+ *
+ * Streams negotiated while the limit is reached are reset.
+ *
+ * @param registry Protocol handler registry
+ * @param protocol_id Registered protocol identifier
+ * @param max_concurrent Maximum concurrent handler calls (0 = unlimited)
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_protocol_handler_set_concurrency(libp2p_protocol_handler_registry_t *registry, const char *protocol_id, size_t max_concurrent);
+
+/**
+ * @brief Read the worker pool counters.
+ *
+ * @param registry Protocol handler registry
+ * @param out Receives the counters
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_protocol_handler_get_stats(libp2p_protocol_handler_registry_t *registry, libp2p_protocol_handler_stats_t *out);
+
 /* ===== Stream Management ===== */
 
 /**
  * @brief Create a protocol handler context for an upgraded connection.
  *
  * This sets up automatic stream handling for the connection using the
- * provided protocol registry.
+ * provided protocol registry. A session of the muxer negotiated by the
+ * upgrader is created on the connection; connections without one use mplex.
  *
  * @param registry Protocol handler registry
  * @param uconn Upgraded connection to manage
@@ -144,8 +309,9 @@ libp2p_protocol_handler_ctx_t *libp2p_protocol_handler_ctx_new(libp2p_protocol_h
 /**
  * @brief Start the protocol handler for a connection.
  *
- * This starts a background thread that listens for incoming streams
- * and dispatches them to registered protocol handlers.
+ * This starts a background thread that accepts incoming streams and
+ * queues them for the registry's workers. The thread sleeps in the muxer
+ * until the peer opens a stream.
  *
  * @param ctx Protocol handler context
  * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
@@ -155,6 +321,9 @@ int libp2p_protocol_handler_start(libp2p_protocol_handler_ctx_t *ctx);
 /**
  * @brief Stop the protocol handler.
  *
+ * Ends the connection's muxer session; the context can only be freed
+ * afterwards.
+ *
  * @param ctx Protocol handler context
  */
 void libp2p_protocol_handler_stop(libp2p_protocol_handler_ctx_t *ctx);
@@ -174,6 +343,15 @@ void libp2p_protocol_handler_ctx_free(libp2p_protocol_handler_ctx_t *ctx);
  * This function opens a new stream to the remote peer and performs
  * multiselect negotiation for the specified protocol.
  *
+ * The multistream header and the proposal go out in one write and the
+ * call returns once the remote has confirmed the protocol, so a refused
+ * protocol fails here with LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT.
+ *
+ * The stream gets a muxer session of its own on @p uconn and tears it down
+ * in libp2p_stream_free(), so nothing else may run a session on the same
+ * connection meanwhile. Use a handler context and
+ * libp2p_protocol_handler_open_stream() for more than one stream.
+ *
  * @param uconn Upgraded connection
  * @param protocol_id Protocol to negotiate
  * @param stream Output stream on success
@@ -181,6 +359,49 @@ void libp2p_protocol_handler_ctx_free(libp2p_protocol_handler_ctx_t *ctx);
  */
 int libp2p_protocol_open_stream(libp2p_uconn_t *uconn, const char *protocol_id, libp2p_stream_t **stream);
 
+/**
+ * @brief Open a protocol stream on a connection managed by a handler context.
+ *
+ * The stream shares the context's muxer session, so this may be called
+ * while the handler thread is running.
+ *
+ * When the registry's support cache knows the peer accepts @p protocol_id,
+ * negotiation is optimistic: the call returns without waiting for the
+ * reply, the caller's first write shares the flight with the proposal, and
+ * the reply is validated on the first read. Use
+ * libp2p_stream_await_protocol() to wait for it explicitly. Otherwise the
+ * call waits for the confirmation, since bytes written behind a refused
+ * proposal would be read as further proposals.
+ *
+ * @param ctx Protocol handler context
+ * @param protocol_id Protocol to negotiate
+ * @param stream Output stream on success
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_protocol_handler_open_stream(libp2p_protocol_handler_ctx_t *ctx, const char *protocol_id, libp2p_stream_t **stream);
+
+/**
+ * @brief Open a stream for the first protocol in a preference list that the
+ * remote peer accepts.
+ *
+ * Consults the registry's support cache: a protocol the peer is known to
+ * accept is proposed alone and confirmed lazily, like
+ * ::libp2p_protocol_handler_open_stream. Otherwise the candidates the peer
+ * has not rejected are proposed in order on one stream until one is
+ * accepted, and each answer is recorded. Peers running this library
+ * drop a stream after ::LIBP2P_PROTOCOL_MAX_PROPOSALS refusals. The
+ * chosen ID is in @c (*stream)->protocol_id.
+ *
+ * @param ctx Protocol handler context
+ * @param protocol_ids Candidate protocol IDs, most preferred first
+ * @param num_protocols Number of candidates
+ * @param stream Output stream on success
+ * @return LIBP2P_PROTOCOL_HANDLER_OK, LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND
+ *         if the peer accepts none of them, or another error code
+ */
+int libp2p_protocol_handler_open_stream_any(libp2p_protocol_handler_ctx_t *ctx, const char *const *protocol_ids, size_t num_protocols,
+                                            libp2p_stream_t **stream);
+
 /**
  * @brief Open a protocol stream using existing mplex context.
  *
@@ -198,23 +419,78 @@ int libp2p_protocol_open_stream_with_context(libp2p_mplex_ctx_t *mx, libp2p_ucon
 /**
  * @brief Send data on a protocol stream.
  *
+ * A muxer with flow control may accept only part of @p data when the peer
+ * keeps its window closed past the stream timeout; the count is short then.
+ *
  * @param stream Protocol stream
  * @param data Data to send
  * @param len Length of data
- * @return Number of bytes sent or negative error code
+ * @return Number of bytes sent, LIBP2P_PROTOCOL_HANDLER_ERR_TIMEOUT if
+ *         nothing could be sent in time, or another negative error code
  */
 ssize_t libp2p_stream_write(libp2p_stream_t *stream, const void *data, size_t len);
 
 /**
  * @brief Receive data from a protocol stream.
  *
+ * Blocks until data arrives, the remote closes the stream, or the
+ * stream's read deadline expires.
+ *
  * @param stream Protocol stream
  * @param buf Buffer for received data
  * @param len Maximum bytes to receive
- * @return Number of bytes received or negative error code
+ * @return Number of bytes received, 0 at end of stream,
+ *         LIBP2P_PROTOCOL_HANDLER_ERR_TIMEOUT if the deadline expired,
+ *         or another negative error code
  */
 ssize_t libp2p_stream_read(libp2p_stream_t *stream, void *buf, size_t len);
 
+/**
+ * @brief Send a varint length-prefixed message on a stream.
+ *
+ * @param stream Protocol stream
+ * @param data Message body
+ * @param len Length of @p data
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_stream_write_lp(libp2p_stream_t *stream, const void *data, size_t len);
+
+/**
+ * @brief Receive one varint length-prefixed message from a stream.
+ *
+ * Reads exactly one message, leaving any following bytes on the stream.
+ * The body is NUL-terminated, so it must be shorter than @p max_len.
+ *
+ * @param stream Protocol stream
+ * @param buf Buffer for the message body
+ * @param max_len Size of @p buf
+ * @return Length of the message or negative error code
+ */
+ssize_t libp2p_stream_read_lp(libp2p_stream_t *stream, void *buf, size_t max_len);
+
+/**
+ * @brief Wait for the remote to confirm the stream's protocol.
+ *
+ * Streams opened optimistically leave the multistream reply pending;
+ * this reads it now instead of on the first libp2p_stream_read().
+ * Returns immediately for streams whose negotiation already finished.
+ *
+ * @param stream Protocol stream
+ * @return LIBP2P_PROTOCOL_HANDLER_OK, or LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT
+ *         if the remote rejected the protocol or the reply was malformed
+ */
+int libp2p_stream_await_protocol(libp2p_stream_t *stream);
+
+/**
+ * @brief Set how long libp2p_stream_read() waits for data.
+ *
+ * @param stream Protocol stream
+ * @param timeout_ms Deadline in milliseconds; 0 restores
+ *        LIBP2P_STREAM_READ_TIMEOUT_MS, negative waits indefinitely
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+int libp2p_stream_set_read_timeout(libp2p_stream_t *stream, int timeout_ms);
+
 /**
  * @brief Close a protocol stream.
  *
@@ -0,0 +1,117 @@
+#ifndef LIBP2P_PROTOCOL_SUPPORT_CACHE_H
+#define LIBP2P_PROTOCOL_SUPPORT_CACHE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "peer_id/peer_id.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file protocol_support_cache.h
+ * @brief Per-peer record of the protocol IDs each peer accepts.
+ *
+ * Outbound stream opens consult the cache to propose a protocol the peer is
+ * known to speak first and to skip the ones it turned down, so talking to
+ * peers on older protocol versions does not cost a multistream `na` round
+ * trip on every stream. The cache learns from negotiation outcomes and from
+ * the protocol list in a peer's identify record. It is bounded; the least
+ * recently used peer is dropped when it is full.
+ */
+
+/** @brief Default number of peers remembered */
+#define LIBP2P_PROTOCOL_SUPPORT_PEERS 1024
+
+/** @brief Maximum protocol IDs remembered per peer */
+#define LIBP2P_PROTOCOL_SUPPORT_MAX_IDS 128
+
+/** @brief Default time a rejection, or absence from an advertised list, is trusted, in milliseconds */
+#define LIBP2P_PROTOCOL_SUPPORT_REJECT_TTL_MS (10 * 60 * 1000)
+
+/** @brief What the cache knows about a peer and a protocol */
+typedef enum
+{
+    LIBP2P_PROTOCOL_SUPPORT_UNKNOWN = 0,    /**< Never negotiated or advertised */
+    LIBP2P_PROTOCOL_SUPPORT_SUPPORTED = 1,  /**< Accepted or advertised by the peer */
+    LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED = 2 /**< Rejected, or missing from a recent identify list */
+} libp2p_protocol_support_t;
+
+/** @brief Opaque, thread-safe support cache */
+typedef struct libp2p_protocol_support_cache libp2p_protocol_support_cache_t;
+
+/**
+ * @brief Create a support cache.
+ *
+ * @param max_peers Peers to remember (0 for ::LIBP2P_PROTOCOL_SUPPORT_PEERS)
+ * @return New cache or NULL on allocation failure
+ */
+libp2p_protocol_support_cache_t *libp2p_protocol_support_cache_new(size_t max_peers);
+
+/**
+ * @brief Free a support cache.
+ *
+ * @param cache Cache to free (may be NULL)
+ */
+void libp2p_protocol_support_cache_free(libp2p_protocol_support_cache_t *cache);
+
+/**
+ * @brief Set how long rejections and advertised lists rule a protocol out.
+ *
+ * Applies to outcomes and lists recorded afterwards.
+ *
+ * @param cache Support cache
+ * @param ttl_ms Lifetime in milliseconds (0 for ::LIBP2P_PROTOCOL_SUPPORT_REJECT_TTL_MS)
+ */
+void libp2p_protocol_support_set_reject_ttl(libp2p_protocol_support_cache_t *cache, uint64_t ttl_ms);
+
+/**
+ * @brief Record the outcome of a negotiation.
+ *
+ * @param cache Support cache
+ * @param peer Remote peer
+ * @param protocol_id Proposed protocol ID
+ * @param supported Non-zero if the peer accepted it, zero if it answered `na`
+ */
+void libp2p_protocol_support_record(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer, const char *protocol_id, int supported);
+
+/**
+ * @brief Replace what is known about a peer with its advertised protocols.
+ *
+ * Intended for the protocol list of an identify record: afterwards, IDs on
+ * the list read as supported and all others as unsupported until the
+ * rejection lifetime passes, after which they are unknown again.
+ *
+ * @param cache Support cache
+ * @param peer Remote peer
+ * @param protocols Protocol IDs the peer advertises
+ * @param num_protocols Number of entries in @p protocols
+ */
+void libp2p_protocol_support_set_protocols(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer, const char *const *protocols,
+                                           size_t num_protocols);
+
+/**
+ * @brief Look up whether a peer accepts a protocol.
+ *
+ * @param cache Support cache
+ * @param peer Remote peer
+ * @param protocol_id Protocol ID
+ * @return What is known; UNKNOWN for NULL arguments
+ */
+libp2p_protocol_support_t libp2p_protocol_support_lookup(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer, const char *protocol_id);
+
+/**
+ * @brief Drop everything known about a peer.
+ *
+ * @param cache Support cache
+ * @param peer Remote peer
+ */
+void libp2p_protocol_support_forget(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBP2P_PROTOCOL_SUPPORT_CACHE_H */
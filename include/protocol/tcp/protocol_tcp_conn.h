@@ -36,7 +36,7 @@ typedef struct tcp_conn_ctx {
     multiaddr_t *local;       /**< cached local multiaddr              */
     multiaddr_t *remote;      /**< cached peer multiaddr (nullable)    */
     atomic_bool  closed;      /**< fast-path closed check              */
-    uint64_t     deadline_at; /**< 0 = none; monotonic ms              */
+    _Atomic uint64_t deadline_at; /**< 0 = none; monotonic ms     */
 } tcp_conn_ctx_t;
 
 /**
@@ -68,6 +68,16 @@ ssize_t tcp_conn_write(libp2p_conn_t *c, const void *buf, size_t len);
  */
 libp2p_conn_err_t tcp_conn_set_deadline(libp2p_conn_t *c, uint64_t ms);
 
+/**
+ * @brief Wait until the socket is readable, leaving the deadline alone.
+ *
+ * @param c          Connection to wait on.
+ * @param timeout_ms Longest wait in milliseconds.
+ * @return LIBP2P_CONN_OK when readable, LIBP2P_CONN_ERR_AGAIN on timeout,
+ *         or another error code.
+ */
+libp2p_conn_err_t tcp_conn_wait_readable(libp2p_conn_t *c, uint64_t timeout_ms);
+
 /**
  * @brief Return the cached local multiaddress.
  *
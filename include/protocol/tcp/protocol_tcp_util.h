@@ -42,6 +42,9 @@ int pct_encode_iface(const char *iface, char *out, size_t out_len);
 /** Return the current monotonic time in milliseconds. */
 uint64_t now_mono_ms(void);
 
+/** Return the current monotonic time in microseconds. */
+uint64_t now_mono_us(void);
+
 /** Add seconds and nanoseconds safely to a timespec. */
 void timespec_add_safe(struct timespec *ts, int64_t add_sec, long add_nsec);
 
@@ -7,6 +7,8 @@ extern "C"
 #endif
 
 #include "protocol/yamux/protocol_yamux_queue.h"
+#include "protocol/yamux/protocol_yamux_sched.h"
+#include "protocol/yamux/protocol_yamux_timer.h"
 #include "transport/connection.h"
 #include "transport/muxer.h"
 #include <stdatomic.h>
@@ -90,10 +92,33 @@ typedef struct libp2p_yamux_stream
     int reset;            /**< Stream was reset.             */
     int acked;            /**< Stream was acknowledged.      */
     uint8_t *buf;         /**< Data buffer.                  */
-    size_t buf_len;       /**< Size of @p buf.               */
+    size_t buf_len;       /**< Bytes stored in @p buf.       */
     size_t buf_pos;       /**< Current read position.        */
+    size_t buf_cap;       /**< Allocated size of @p buf.     */
+    pthread_cond_t cond;  /**< Signaled on data/state change. */
+    int waiters;          /**< Threads blocked on @p cond.   */
+    uint32_t weight;      /**< Send scheduler weight (>= 1). */
+    int touched;          /**< Pending wake in a dispatch batch. */
+    uint32_t withheld;    /**< Consumed bytes not yet credited. */
 } libp2p_yamux_stream_t;
 
+/** @brief Number of outstanding pings tracked per session. */
+#define LIBP2P_YAMUX_PING_SLOTS 64
+
+/**
+ * @brief Round-trip time statistics derived from ping ACKs.
+ *
+ * Smoothing follows RFC 6298 (alpha = 1/8, beta = 1/4).
+ */
+typedef struct
+{
+    uint64_t srtt_us;     /**< Smoothed RTT in microseconds.    */
+    uint64_t rttvar_us;   /**< RTT variance in microseconds.    */
+    uint64_t min_rtt_us;  /**< Minimum RTT observed.            */
+    uint64_t last_rtt_us; /**< Most recent RTT sample.          */
+    uint64_t samples;     /**< Number of samples (0 = no data). */
+} libp2p_yamux_rtt_t;
+
 struct libp2p_yamux_ctx;
 
 /**
@@ -118,24 +143,43 @@ typedef struct libp2p_yamux_ctx
     libp2p_yamux_stream_t **streams; /**< Active streams array.         */
     size_t num_streams;              /**< Number of streams in array.   */
     uint32_t next_stream_id;         /**< Next stream id to assign.     */
+    uint32_t max_remote_id;          /**< Highest peer-opened id seen.  */
     int dialer;                      /**< Non-zero if we initiated.     */
     yamux_stream_queue_t incoming;   /**< Queue of incoming streams.    */
+    yamux_send_sched_t sched;        /**< Outbound frame scheduler.     */
     atomic_bool stop;                /**< Stop processing flag.         */
     pthread_mutex_t mtx;             /**< Protects context state.       */
     uint32_t max_window;             /**< Maximum window size.          */
     size_t ack_backlog;              /**< Streams opened but unacked.   */
     uint64_t keepalive_ms;           /**< Interval between pings (ms).  */
-    pthread_t keepalive_th;          /**< Background ping thread.       */
-    int keepalive_active;            /**< Non-zero while thread runs.   */
+    uint64_t next_keepalive_ms;      /**< Next keepalive due (mono ms). */
+    uint32_t keepalive_seq;          /**< Value of the next keepalive.  */
+    uint32_t deferred_seq;           /**< Keepalive value to send.      */
+    atomic_uint deferred;            /**< Timer work for the reader.    */
+    uint64_t ping_timeout_ms;        /**< Unanswered ping limit (ms).   */
+    uint64_t idle_timeout_ms;        /**< Close after idle (ms).        */
+    atomic_uint_fast64_t last_activity_ms; /**< Last stream traffic.    */
+    yamux_timer_entry_t timer;       /**< Shared timer registration.    */
     libp2p_yamux_goaway_t goaway_code; /**< Last GoAway code received.   */
     int goaway_received;             /**< Non-zero if GoAway seen.      */
     libp2p_yamux_ping_cb ping_cb;    /**< Optional ping callback.       */
     void *ping_arg;                  /**< Opaque callback argument.     */
     struct yamux_ping_pending {
         uint32_t value;              /**< Ping value sent.              */
-        uint64_t sent_ms;            /**< Timestamp when sent.          */
-    } *pings;                        /**< Outstanding pings.            */
+        uint64_t sent_us;            /**< Monotonic send time (us).     */
+        int in_use;                  /**< Non-zero while outstanding.   */
+    } pings[LIBP2P_YAMUX_PING_SLOTS]; /**< Ring indexed by value.       */
     size_t num_pings;                /**< Number of outstanding pings.  */
+    libp2p_yamux_rtt_t rtt;          /**< Smoothed RTT statistics.      */
+    uint8_t *rbuf;                   /**< Inbound read-ahead buffer.    */
+    size_t rbuf_len;                 /**< Bytes stored in @p rbuf.      */
+    size_t rbuf_pos;                 /**< Start of unparsed bytes.      */
+    size_t rbuf_cap;                 /**< Allocated size of @p rbuf.    */
+    size_t mem_used;                 /**< Bytes buffered in streams.    */
+    size_t mem_limit;                /**< Session budget (0 = none).    */
+    size_t num_withheld;             /**< Streams with withheld credit. */
+    pthread_t reader_th;             /**< Session reader thread.        */
+    atomic_int reader_active;        /**< Non-zero while reader runs.   */
 } libp2p_yamux_ctx_t;
 
 /**
@@ -166,13 +210,29 @@ libp2p_muxer_t *libp2p_yamux_new(void);
 /**
  * @brief Send a ping frame with specified value.
  *
+ * Outstanding pings are tracked in LIBP2P_YAMUX_PING_SLOTS slots indexed by
+ * value. A ping whose slot still holds an unanswered ping with another
+ * value is refused, so the earlier one keeps counting toward the ping
+ * timeout; resending an unanswered value keeps its original send time.
+ *
  * @param ctx Yamux context
  * @param value Ping value to send
- * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ * @return LIBP2P_YAMUX_OK on success, LIBP2P_YAMUX_ERR_AGAIN when the slot
+ *         is taken, error code otherwise
  */
 libp2p_yamux_err_t libp2p_yamux_ctx_ping(libp2p_yamux_ctx_t *ctx,
                                          uint32_t value);
 
+/**
+ * @brief Snapshot the session's RTT statistics.
+ *
+ * @param ctx Yamux context
+ * @param out Receives the statistics; @c samples is 0 until the first
+ *            ping has been acknowledged
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_get_rtt(libp2p_yamux_ctx_t *ctx, libp2p_yamux_rtt_t *out);
+
 /**
  * @brief Set ping callback for handling ping responses.
  *
@@ -196,6 +256,9 @@ libp2p_yamux_err_t libp2p_yamux_send_frame(libp2p_conn_t *conn, const libp2p_yam
 /**
  * @brief Read a yamux frame from the connection.
  *
+ * The payload, if any, is taken from the shared buffer pool and released
+ * by ::libp2p_yamux_frame_free.
+ *
  * @param conn Connection to read from
  * @param out Frame structure to populate
  * @return LIBP2P_YAMUX_OK on success, error code otherwise
@@ -292,12 +355,78 @@ libp2p_yamux_ctx_t *libp2p_yamux_ctx_new(libp2p_conn_t *conn, int dialer, uint32
 /**
  * @brief Enable keepalive pings on the yamux context.
  *
+ * Pings are scheduled on the process-wide yamux timer thread rather than
+ * a per-session thread.
+ *
  * @param ctx Yamux context
  * @param interval_ms Interval between pings in milliseconds
  * @return LIBP2P_YAMUX_OK on success, error code otherwise
  */
 libp2p_yamux_err_t libp2p_yamux_enable_keepalive(libp2p_yamux_ctx_t *ctx, uint64_t interval_ms);
 
+/**
+ * @brief Fail the session when a ping stays unanswered.
+ *
+ * If the oldest outstanding ping is not acknowledged within
+ * @p timeout_ms the connection is closed and all blocked readers are
+ * woken.
+ *
+ * @param ctx Yamux context
+ * @param timeout_ms Ping timeout in milliseconds (0 disables)
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_set_ping_timeout(libp2p_yamux_ctx_t *ctx, uint64_t timeout_ms);
+
+/**
+ * @brief Close the session after a period without streams or traffic.
+ *
+ * Once no streams are open and no stream frames have been exchanged for
+ * @p timeout_ms, the session is stopped with a GoAway.
+ *
+ * @param ctx Yamux context
+ * @param timeout_ms Idle timeout in milliseconds (0 disables)
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_set_idle_timeout(libp2p_yamux_ctx_t *ctx, uint64_t timeout_ms);
+
+/**
+ * @brief Cap the bytes buffered across all streams of a session.
+ *
+ * Every stream receive buffer charges against the session budget and a
+ * process-wide budget shared by all sessions. While either is exhausted,
+ * window updates for consumed data are withheld, so peers stall rather
+ * than grow the buffers further. Withheld credit is returned once usage
+ * falls back under the limits. Stream windows still bound each stream.
+ *
+ * @param ctx Yamux context
+ * @param bytes Session budget in bytes (0 disables)
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_set_memory_limit(libp2p_yamux_ctx_t *ctx, size_t bytes);
+
+/**
+ * @brief Bytes currently buffered across the session's streams.
+ *
+ * @param ctx Yamux context
+ * @param out Receives the number of buffered bytes
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_get_memory_usage(libp2p_yamux_ctx_t *ctx, size_t *out);
+
+/**
+ * @brief Cap the bytes buffered by all yamux sessions in the process.
+ *
+ * @param bytes Process-wide budget in bytes (0 disables)
+ */
+void libp2p_yamux_set_process_memory_limit(size_t bytes);
+
+/**
+ * @brief Bytes currently buffered by all yamux sessions in the process.
+ *
+ * @return Buffered byte count
+ */
+size_t libp2p_yamux_process_memory_usage(void);
+
 /**
  * @brief Free resources allocated for yamux context.
  *
@@ -326,6 +455,27 @@ libp2p_yamux_err_t libp2p_yamux_stream_open(libp2p_yamux_ctx_t *ctx, uint32_t *o
  */
 libp2p_yamux_err_t libp2p_yamux_stream_send(libp2p_yamux_ctx_t *ctx, uint32_t id, const uint8_t *data, size_t data_len, uint16_t flags);
 
+/**
+ * @brief Send data on a stream, waiting for the peer to open the window.
+ *
+ * The data goes out in pieces no larger than the current send window.
+ * When the window is exhausted the caller sleeps on the stream until a
+ * window update, a reset or session teardown arrives.
+ *
+ * @param ctx Yamux context
+ * @param id Stream identifier
+ * @param data Data to send
+ * @param data_len Length of data
+ * @param out_sent Bytes handed to the session, also on failure
+ * @param timeout_ms Maximum time to wait for window in milliseconds (0
+ *        waits forever)
+ * @return LIBP2P_YAMUX_OK once all data was sent, LIBP2P_YAMUX_ERR_TIMEOUT
+ *         if the window stayed closed until the deadline, error code
+ *         otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_stream_send_timeout(libp2p_yamux_ctx_t *ctx, uint32_t id, const uint8_t *data, size_t data_len,
+                                                    size_t *out_sent, uint64_t timeout_ms);
+
 /**
  * @brief Close a stream gracefully.
  *
@@ -344,6 +494,19 @@ libp2p_yamux_err_t libp2p_yamux_stream_close(libp2p_yamux_ctx_t *ctx, uint32_t i
  */
 libp2p_yamux_err_t libp2p_yamux_stream_reset(libp2p_yamux_ctx_t *ctx, uint32_t id);
 
+/**
+ * @brief Set the send scheduler weight of a stream.
+ *
+ * Streams with pending data share the connection in proportion to their
+ * weights; control frames are always sent first.
+ *
+ * @param ctx Yamux context
+ * @param id Stream identifier
+ * @param weight Relative weight (0 is treated as 1)
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_stream_set_weight(libp2p_yamux_ctx_t *ctx, uint32_t id, uint32_t weight);
+
 /**
  * @brief Process an incoming yamux frame.
  *
@@ -365,6 +528,27 @@ libp2p_yamux_err_t libp2p_yamux_dispatch_frame(libp2p_yamux_ctx_t *ctx, const li
  */
 libp2p_yamux_err_t libp2p_yamux_stream_recv(libp2p_yamux_ctx_t *ctx, uint32_t id, uint8_t *buf, size_t max_len, size_t *out_len);
 
+/**
+ * @brief Receive data from a stream, blocking until data arrives.
+ *
+ * Intended for use together with libp2p_yamux_start_reader() (or any
+ * other thread pumping libp2p_yamux_process_one()). The caller sleeps on
+ * the stream's condition variable and is woken as soon as data, a FIN,
+ * a RST or session teardown is dispatched.
+ *
+ * @param ctx Yamux context
+ * @param id Stream identifier
+ * @param buf Buffer to store received data
+ * @param max_len Maximum bytes to receive
+ * @param out_len Pointer to store actual bytes received
+ * @param timeout_ms Maximum time to wait in milliseconds (0 waits forever)
+ * @return LIBP2P_YAMUX_OK on success, LIBP2P_YAMUX_ERR_TIMEOUT if the
+ *         deadline expired, LIBP2P_YAMUX_ERR_EOF once the remote side or
+ *         the session closed, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_stream_recv_timeout(libp2p_yamux_ctx_t *ctx, uint32_t id, uint8_t *buf, size_t max_len, size_t *out_len,
+                                                    uint64_t timeout_ms);
+
 /**
  * @brief Accept an incoming stream.
  *
@@ -374,6 +558,31 @@ libp2p_yamux_err_t libp2p_yamux_stream_recv(libp2p_yamux_ctx_t *ctx, uint32_t id
  */
 libp2p_yamux_err_t libp2p_yamux_accept_stream(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t **out);
 
+/**
+ * @brief Accept an incoming stream, blocking until one arrives.
+ *
+ * @param ctx Yamux context
+ * @param out Pointer to store accepted stream
+ * @param timeout_ms Maximum time to wait in milliseconds (0 waits forever)
+ * @return LIBP2P_YAMUX_OK on success, LIBP2P_YAMUX_ERR_TIMEOUT if the
+ *         deadline expired, LIBP2P_YAMUX_ERR_EOF if the session stopped
+ */
+libp2p_yamux_err_t libp2p_yamux_accept_stream_timeout(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t **out, uint64_t timeout_ms);
+
+/**
+ * @brief Start a dedicated session reader thread.
+ *
+ * The thread runs libp2p_yamux_process_loop() until the session stops or
+ * the connection fails, waking blocked readers and acceptors as frames
+ * are dispatched. Once started, callers must not invoke
+ * libp2p_yamux_process_one() themselves. libp2p_yamux_ctx_free() shuts
+ * the connection down to unblock the reader before joining it.
+ *
+ * @param ctx Yamux context
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_start_reader(libp2p_yamux_ctx_t *ctx);
+
 /**
  * @brief Process one incoming frame from the connection.
  *
@@ -382,6 +591,22 @@ libp2p_yamux_err_t libp2p_yamux_accept_stream(libp2p_yamux_ctx_t *ctx, libp2p_ya
  */
 libp2p_yamux_err_t libp2p_yamux_process_one(libp2p_yamux_ctx_t *ctx);
 
+/**
+ * @brief Process every frame already available on the connection.
+ *
+ * Blocks until at least one frame arrives, then reads ahead as much as
+ * the connection has buffered and applies up to 64 complete frames under
+ * a single acquisition of the session lock. Each affected stream is woken
+ * once per batch and replies (ACKs, window updates, pong) are written
+ * together. Partial frames stay buffered for the next call, so this may
+ * be mixed freely with libp2p_yamux_process_one().
+ *
+ * @param ctx Yamux context
+ * @param out_frames Optional pointer receiving the number of frames applied
+ * @return LIBP2P_YAMUX_OK on success, error code otherwise
+ */
+libp2p_yamux_err_t libp2p_yamux_process_batch(libp2p_yamux_ctx_t *ctx, size_t *out_frames);
+
 /**
  * @brief Stop yamux processing gracefully.
  *
@@ -399,6 +624,8 @@ void libp2p_yamux_shutdown(libp2p_yamux_ctx_t *ctx);
 /**
  * @brief Main processing loop for yamux frames.
  *
+ * Repeatedly calls libp2p_yamux_process_batch() until the session stops.
+ *
  * @param ctx Yamux context
  * @return LIBP2P_YAMUX_OK when loop exits normally, error code otherwise
  */
@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdint.h>
+#include <time.h>
 
 /**
  * @file protocol_yamux_queue.h
@@ -58,6 +59,28 @@ void yq_push(yamux_stream_queue_t *q, struct libp2p_yamux_stream *s);
  */
 struct libp2p_yamux_stream *yq_pop(yamux_stream_queue_t *q);
 
+/**
+ * @brief Pop the next stream, blocking until one arrives.
+ *
+ * The wait ends early when @p cancel becomes true and the queue is
+ * woken via yq_wake_all(). @p deadline is an absolute time on the clock
+ * the queue's condition variable was initialised with (monotonic where
+ * available).
+ *
+ * @param q        The queue to pop from.
+ * @param deadline Absolute deadline or NULL to wait indefinitely.
+ * @param cancel   Optional flag that aborts the wait when set.
+ * @return         The next stream or NULL on timeout/cancellation.
+ */
+struct libp2p_yamux_stream *yq_pop_wait(yamux_stream_queue_t *q, const struct timespec *deadline, const atomic_bool *cancel);
+
+/**
+ * @brief Wake every thread blocked in yq_pop_wait().
+ *
+ * @param q      The queue to signal.
+ */
+void yq_wake_all(yamux_stream_queue_t *q);
+
 /**
  * @brief Get the length of the queue.
  *
@@ -0,0 +1,183 @@
+#ifndef PROTOCOL_YAMUX_SCHED_H
+#define PROTOCOL_YAMUX_SCHED_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "transport/connection.h"
+
+/**
+ * @file protocol_yamux_sched.h
+ * @brief Outbound frame scheduler for a yamux session.
+ *
+ * Frames are queued per stream and drained by a single writer using
+ * deficit round-robin, so a stream pushing a large payload cannot starve
+ * other streams. Control frames (pings, window updates, go-away) bypass
+ * the stream queues and are always written first. Whichever sender finds
+ * the scheduler idle becomes the writer and coalesces queued frames into
+ * large writes until nothing is pending. Session readers only send frames
+ * without payload and never wait for a full connection, so two peers
+ * reading each other cannot deadlock on writes.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Bytes a stream of weight 1 may send per round-robin visit. */
+#define YAMUX_SCHED_QUANTUM (16 * 1024)
+
+/** @brief Upper bound on bytes coalesced into a single connection write. */
+#define YAMUX_SCHED_BATCH (64 * 1024)
+
+/** @brief Stall after which a write fails once the session is closing. */
+#define YAMUX_SCHED_STALL_MS 1000
+
+/** @brief Flow id used for control frames. */
+#define YAMUX_SCHED_CONTROL 0
+
+/**
+ * @brief One encoded frame (header followed by payload).
+ */
+typedef struct yamux_send_entry {
+    struct yamux_send_entry *next; /**< Next frame in the same queue. */
+    size_t len;                    /**< Total encoded length.         */
+    size_t payload_len;            /**< Payload bytes (DRR cost).     */
+    uint8_t bytes[];               /**< Header followed by payload.   */
+} yamux_send_entry_t;
+
+/**
+ * @brief Per-stream queue with pending frames.
+ */
+typedef struct yamux_send_flow {
+    uint32_t id;                   /**< Stream identifier.            */
+    uint32_t weight;               /**< Relative share of bandwidth.  */
+    size_t deficit;                /**< DRR credit in bytes.          */
+    yamux_send_entry_t *head;      /**< Oldest pending frame.         */
+    yamux_send_entry_t *tail;      /**< Newest pending frame.         */
+    struct yamux_send_flow *next;  /**< Next flow in the active ring. */
+} yamux_send_flow_t;
+
+/**
+ * @brief Session send scheduler.
+ */
+typedef struct {
+    pthread_mutex_t mtx;           /**< Protects scheduler state.     */
+    yamux_send_entry_t *ctl_head;  /**< Pending control frames.       */
+    yamux_send_entry_t *ctl_tail;  /**< Last control frame.           */
+    yamux_send_flow_t *active;     /**< Flows with pending frames.    */
+    yamux_send_flow_t *active_tail;/**< Last flow in the ring.        */
+    yamux_send_flow_t *spare;      /**< Recycled flow objects.        */
+    size_t pending_bytes;          /**< Bytes queued but not written. */
+    int writing;                   /**< Non-zero while a writer runs. */
+    int closing;                   /**< Write stalls become fatal.    */
+    unsigned long rounds;          /**< Writers that went idle.       */
+    pthread_cond_t idle;           /**< Signalled when a writer ends. */
+    libp2p_conn_err_t err;         /**< Sticky write error.           */
+    uint8_t *batch;                /**< Coalescing buffer.            */
+    size_t batch_cap;              /**< Capacity of @p batch.         */
+    yamux_send_entry_t *out_chain; /**< Frames being written.         */
+    const uint8_t *out;            /**< Bytes being written.          */
+    size_t out_len;                /**< Length of @p out.             */
+    size_t out_off;                /**< Bytes of @p out written.      */
+} yamux_send_sched_t;
+
+/**
+ * @brief Initialise an empty scheduler.
+ *
+ * @param s Scheduler to initialise.
+ */
+void ys_init(yamux_send_sched_t *s);
+
+/**
+ * @brief Drop all pending frames and release scheduler resources.
+ *
+ * @param s Scheduler to destroy.
+ */
+void ys_free(yamux_send_sched_t *s);
+
+/**
+ * @brief Allocate an entry holding a 12-byte header and optional payload.
+ *
+ * Entries live in buffers from the shared pool (see transport/buf_pool.h)
+ * and must be released with ::ys_chain_free.
+ *
+ * @param hdr         Encoded frame header.
+ * @param payload     Payload bytes (may be NULL when @p payload_len is 0).
+ * @param payload_len Number of payload bytes.
+ * @return New entry or NULL on allocation failure.
+ */
+yamux_send_entry_t *ys_entry_new(const uint8_t hdr[12], const uint8_t *payload, size_t payload_len);
+
+/**
+ * @brief Release a chain of entries created by ::ys_entry_new.
+ *
+ * @param e First entry of the chain (may be NULL).
+ */
+void ys_chain_free(yamux_send_entry_t *e);
+
+/**
+ * @brief Queue a chain of entries on a flow.
+ *
+ * The chain is appended atomically so frames of a single send are never
+ * interleaved with another send on the same stream.
+ *
+ * @param s      Scheduler.
+ * @param chain  First entry of a NULL-terminated chain.
+ * @param flow   Stream id or YAMUX_SCHED_CONTROL.
+ * @param weight Stream weight (ignored for control frames, 0 means 1).
+ * @return LIBP2P_CONN_OK or the sticky error if the writer has failed
+ *         (the chain is freed in that case).
+ */
+libp2p_conn_err_t ys_push(yamux_send_sched_t *s, yamux_send_entry_t *chain, uint32_t flow, uint32_t weight);
+
+/**
+ * @brief Write all pending frames.
+ *
+ * If another sender is already writing, waits until it has drained the
+ * queues, including the caller's frames. A full connection is treated as
+ * backpressure and retried; only connection errors (or a stall once
+ * ::ys_close was called) fail, and then every queued frame is dropped.
+ *
+ * @param s    Scheduler.
+ * @param conn Connection to write to.
+ * @return LIBP2P_CONN_OK when the frames were written, otherwise the
+ *         error that dropped them.
+ */
+libp2p_conn_err_t ys_flush(yamux_send_sched_t *s, libp2p_conn_t *conn);
+
+/**
+ * @brief Write pending frames without payload without blocking.
+ *
+ * Meant for session readers: control frames and header-only stream frames
+ * (ACK, RST) are written until the connection would block, and whatever
+ * does not fit stays queued for the next writer. Returns at once when
+ * another writer is active, since every writer sends these first.
+ *
+ * @param s    Scheduler.
+ * @param conn Connection to write to.
+ * @return LIBP2P_CONN_OK or the sticky connection error.
+ */
+libp2p_conn_err_t ys_flush_control(yamux_send_sched_t *s, libp2p_conn_t *conn);
+
+/**
+ * @brief Mark the session as closing so stalled writes fail.
+ *
+ * @param s Scheduler.
+ */
+void ys_close(yamux_send_sched_t *s);
+
+/**
+ * @brief Number of queued bytes not yet written.
+ *
+ * @param s Scheduler.
+ * @return Pending byte count.
+ */
+size_t ys_pending(yamux_send_sched_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROTOCOL_YAMUX_SCHED_H */
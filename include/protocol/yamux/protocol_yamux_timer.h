@@ -0,0 +1,86 @@
+#ifndef PROTOCOL_YAMUX_TIMER_H
+#define PROTOCOL_YAMUX_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @file protocol_yamux_timer.h
+ * @brief Process-wide timer service shared by all yamux sessions.
+ *
+ * A single background thread keeps a min-heap of armed entries ordered by
+ * due time and runs each entry's callback when it expires. The thread is
+ * started on demand when the first entry is armed and exits once the heap
+ * is empty, so idle processes carry no timer thread at all.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Timer callback.
+ *
+ * Runs on the timer thread without any timer lock held.
+ *
+ * @param arg    Opaque argument registered with the entry.
+ * @param now_ms Current monotonic time in milliseconds.
+ * @return Next absolute due time in monotonic ms, or 0 to disarm.
+ */
+typedef uint64_t (*yamux_timer_fn)(void *arg, uint64_t now_ms);
+
+/**
+ * @brief Timer registration embedded in its owner.
+ */
+typedef struct yamux_timer_entry {
+    yamux_timer_fn fn;    /**< Callback to run when due.              */
+    void *arg;            /**< Opaque callback argument.              */
+    uint64_t due;         /**< Absolute due time (monotonic ms).      */
+    uint64_t rearm_due;   /**< Arm request made while fn was running. */
+    size_t slot;          /**< Heap index or SIZE_MAX when not queued. */
+    int armed;            /**< Non-zero while the owner wants ticks.  */
+} yamux_timer_entry_t;
+
+/**
+ * @brief Prepare an entry for use; it starts disarmed.
+ *
+ * @param e   Entry to initialise.
+ * @param fn  Callback to run when the entry expires.
+ * @param arg Opaque argument passed to @p fn.
+ */
+void ytimer_init(yamux_timer_entry_t *e, yamux_timer_fn fn, void *arg);
+
+/**
+ * @brief Arm (or re-arm) an entry to fire at @p due_ms.
+ *
+ * If the entry is already armed for an earlier time the earlier time wins.
+ *
+ * @param e      Entry to arm.
+ * @param due_ms Absolute due time in monotonic milliseconds.
+ * @return 0 on success, -1 if the timer thread could not be started.
+ */
+int ytimer_arm(yamux_timer_entry_t *e, uint64_t due_ms);
+
+/**
+ * @brief Disarm an entry and wait for a running callback to finish.
+ *
+ * After this returns the callback will not run again until re-armed, so
+ * the owner may be freed. Must not be called from the entry's own
+ * callback.
+ *
+ * @param e Entry to disarm.
+ */
+void ytimer_disarm(yamux_timer_entry_t *e);
+
+/**
+ * @brief Number of entries currently scheduled (for diagnostics).
+ *
+ * @return Armed entry count.
+ */
+size_t ytimer_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROTOCOL_YAMUX_TIMER_H */
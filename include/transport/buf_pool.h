@@ -0,0 +1,137 @@
+#ifndef LIBP2P_BUF_POOL_H
+#define LIBP2P_BUF_POOL_H
+
+/**
+ * @file buf_pool.h
+ * @brief Size-classed, thread-caching pool of reference counted buffers.
+ *
+ * Frame payloads in the muxers and record buffers in the Noise transport are
+ * allocated from this pool instead of malloc. Requests are rounded up to a
+ * power-of-two size class between ::LIBP2P_BUF_MIN_SIZE and
+ * ::LIBP2P_BUF_MAX_SIZE. Each thread keeps a small cache of free blocks per
+ * class and exchanges batches with a shared, locked free list, so in steady
+ * state an allocation is a pointer pop from the calling thread's cache.
+ * Larger requests fall back to malloc and are freed on their last release.
+ *
+ * Every buffer carries a reference count starting at one. A layer that hands
+ * a buffer to another passes its reference along; a layer that wants to keep
+ * a view while someone else also holds it takes another one with
+ * ::libp2p_buf_retain. The block returns to the pool on the last
+ * ::libp2p_buf_release, which may happen on any thread.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Smallest size class in bytes. */
+#define LIBP2P_BUF_MIN_SIZE 256
+
+/** @brief Largest pooled size class in bytes; bigger requests use malloc. */
+#define LIBP2P_BUF_MAX_SIZE (64 * 1024)
+
+/** @brief Free blocks each thread caches per size class. */
+#define LIBP2P_BUF_THREAD_CACHE 16
+
+/** @brief Bytes per size class kept on the shared free list. */
+#define LIBP2P_BUF_SHARED_BYTES (1024 * 1024)
+
+/**
+ * @brief A reference to a byte range inside a pooled buffer.
+ *
+ * @p base is the buffer returned by ::libp2p_buf_alloc and owns one
+ * reference; @p data and @p len describe the bytes of interest.
+ */
+typedef struct
+{
+    uint8_t *base; /**< Pooled buffer holding the bytes (owns a ref). */
+    uint8_t *data; /**< First byte of the slice.                      */
+    size_t len;    /**< Number of bytes in the slice.                 */
+} libp2p_buf_slice_t;
+
+/**
+ * @brief Pool counters, summed over all size classes.
+ */
+typedef struct
+{
+    uint64_t misses;    /**< Pooled-class allocations that hit malloc.  */
+    uint64_t oversized; /**< Requests above ::LIBP2P_BUF_MAX_SIZE.      */
+    size_t shared_free; /**< Blocks currently on the shared free lists. */
+} libp2p_buf_pool_stats_t;
+
+/**
+ * @brief Allocate a buffer of at least @p size bytes.
+ *
+ * The contents are uninitialised and the reference count is one.
+ *
+ * @param size Requested size in bytes (0 is treated as 1).
+ * @return Buffer pointer or NULL on allocation failure.
+ */
+uint8_t *libp2p_buf_alloc(size_t size);
+
+/**
+ * @brief Take an additional reference to a buffer.
+ *
+ * @param buf Buffer from ::libp2p_buf_alloc (may be NULL).
+ * @return @p buf, for convenience.
+ */
+uint8_t *libp2p_buf_retain(uint8_t *buf);
+
+/**
+ * @brief Drop a reference; the block is recycled when none remain.
+ *
+ * @param buf Buffer from ::libp2p_buf_alloc (may be NULL).
+ */
+void libp2p_buf_release(uint8_t *buf);
+
+/**
+ * @brief Usable size of a buffer, i.e. its size class.
+ *
+ * @param buf Buffer from ::libp2p_buf_alloc.
+ * @return Capacity in bytes, or 0 for NULL.
+ */
+size_t libp2p_buf_capacity(const uint8_t *buf);
+
+/**
+ * @brief Make @p out a view of @p len bytes at @p off within @p base.
+ *
+ * Takes a new reference to @p base; release it with
+ * ::libp2p_buf_slice_release.
+ *
+ * @param out  Slice to fill.
+ * @param base Buffer from ::libp2p_buf_alloc.
+ * @param off  Offset of the first byte.
+ * @param len  Number of bytes.
+ */
+void libp2p_buf_slice(libp2p_buf_slice_t *out, uint8_t *base, size_t off, size_t len);
+
+/**
+ * @brief Release the reference held by a slice and clear it.
+ *
+ * @param s Slice to release (may be NULL or empty).
+ */
+void libp2p_buf_slice_release(libp2p_buf_slice_t *s);
+
+/**
+ * @brief Return the calling thread's cached blocks to the shared lists.
+ *
+ * Runs automatically when a thread exits; long-lived threads that stop
+ * doing I/O may call it to hand their cache back early.
+ */
+void libp2p_buf_pool_flush_thread(void);
+
+/**
+ * @brief Snapshot the pool counters.
+ *
+ * @param out Destination for the counters.
+ */
+void libp2p_buf_pool_get_stats(libp2p_buf_pool_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBP2P_BUF_POOL_H */
@@ -58,6 +58,25 @@ libp2p_conn_err_t libp2p_conn_read_exact(libp2p_conn_t *c,
                                          uint8_t *buf,
                                          size_t len);
 
+/**
+ * @brief Read whatever is available, waiting up to @p wait_ms for data.
+ *
+ * Connections with a @c wait_readable operation (TCP, and Noise on top of
+ * it) sleep in the kernel until bytes arrive or the wait ends; data is
+ * returned as soon as it is readable. The connection deadline is left
+ * alone, so other users of the connection keep theirs. A read that still
+ * reports AGAIN (no such operation, or only part of a record arrived) is
+ * followed by a ~1ms back-off, so callers looping on this never spin.
+ *
+ * @param c       Connection handle.
+ * @param buf     Destination buffer.
+ * @param len     Size of @p buf.
+ * @param wait_ms Longest time to wait for data (must be non-zero).
+ * @return Bytes read, LIBP2P_CONN_ERR_AGAIN if nothing arrived in time, or
+ *         another negative libp2p_conn_err_t.
+ */
+ssize_t libp2p_conn_read_wait(libp2p_conn_t *c, void *buf, size_t len, uint64_t wait_ms);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
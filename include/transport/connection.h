@@ -70,6 +70,16 @@ typedef struct
      */
     libp2p_conn_err_t (*set_deadline)(libp2p_conn_t *self, uint64_t ms);
 
+    /**
+     * @brief Wait up to @p timeout_ms for data to read, without touching
+     *        the deadline.  Optional; may be NULL.
+     *
+     * @return LIBP2P_CONN_OK once a read would not block (including on EOF
+     *         or error, which the read then reports), LIBP2P_CONN_ERR_AGAIN
+     *         if the time ran out, or another negative libp2p_conn_err_t.
+     */
+    libp2p_conn_err_t (*wait_readable)(libp2p_conn_t *self, uint64_t timeout_ms);
+
     /* Metadata accessors */
 
     const multiaddr_t *(*local_addr)(libp2p_conn_t *self);
@@ -89,7 +99,9 @@ typedef struct
 struct libp2p_connection
 {
     const libp2p_conn_vtbl_t *vt;
-    void                     *ctx;  /**< Transport-specific state. */
+    void                     *ctx;        /**< Transport-specific state. */
+    uint64_t                  connect_us; /**< Time the dial took in µs; 0 if
+                                               accepted or not measured.  */
 };
 
 /* Convenience inline wrappers */
@@ -25,20 +25,46 @@ typedef enum
     LIBP2P_MUXER_OK = 0,
     LIBP2P_MUXER_ERR_NULL_PTR = -1,
     LIBP2P_MUXER_ERR_HANDSHAKE = -2,
-    LIBP2P_MUXER_ERR_INTERNAL = -3
+    LIBP2P_MUXER_ERR_INTERNAL = -3,
+    LIBP2P_MUXER_ERR_TIMEOUT = -4,
+    LIBP2P_MUXER_ERR_EOF = -5
 } libp2p_muxer_err_t;
 
 /**
  * @brief Dispatch table for muxer operations.
+ *
+ * The muxers in an upgrader config are shared templates. For each upgraded
+ * connection, copy the template's @c vt into a fresh ::libp2p_muxer_t and
+ * call @c session_new to attach the per-connection state in @c ctx.
+ * @c accept_stream blocks until the peer opens a stream. It returns
+ * LIBP2P_MUXER_ERR_EOF once the session ends or @c session_stop is called.
+ * @c stream_read honours the stream's read timeout and returns 0 at end of
+ * stream, LIBP2P_MUXER_ERR_TIMEOUT when the deadline expires and another
+ * negative code on failure. @c stream_write returns the number of bytes
+ * accepted; a muxer with flow control waits up to the same timeout for
+ * the peer to open its window and may then return a short count, or
+ * LIBP2P_MUXER_ERR_TIMEOUT when nothing could be sent.
+ *
+ * @c protocol_id is the multistream-select id of the muxer. The upgrader
+ * offers the ids of all configured muxers in a single negotiation and only
+ * falls back to @c negotiate for muxers that leave it NULL.
  */
 struct libp2p_muxer_vtbl
 {
+    const char *protocol_id;
     int (*negotiate)(libp2p_muxer_t *mx, libp2p_conn_t *c, uint64_t timeout_ms, bool inbound);
     int (*open_stream)(libp2p_muxer_t *mx, const uint8_t *name, size_t name_len, libp2p_stream_t **out);
     ssize_t (*stream_read)(libp2p_stream_t *s, void *buf, size_t len);
     ssize_t (*stream_write)(libp2p_stream_t *s, const void *buf, size_t len);
     void (*stream_close)(libp2p_stream_t *s);
     void (*free)(libp2p_muxer_t *mx);
+
+    /* Per-connection session; the session lives in mx->ctx */
+    int (*session_new)(libp2p_muxer_t *mx, libp2p_conn_t *c, bool dialer);
+    int (*accept_stream)(libp2p_muxer_t *mx, libp2p_stream_t **out);
+    void (*session_stop)(libp2p_muxer_t *mx);
+    void (*session_free)(libp2p_muxer_t *mx);
+    void (*stream_reset)(libp2p_stream_t *s);
 };
 typedef struct libp2p_muxer_vtbl libp2p_muxer_vtbl_t;
 
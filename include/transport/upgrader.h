@@ -37,6 +37,37 @@ extern "C" {
 struct libp2p_security; /* Noise, TLS, etc. (defined elsewhere) */
 struct libp2p_muxer;    /* Yamux, MPLEX, … (defined elsewhere)  */
 
+/**
+ * @brief Steps of connection setup timed by the upgrader.
+ */
+typedef enum
+{
+    LIBP2P_UPGRADE_PHASE_CONNECT = 0,  /**< Transport connect (dialed only).     */
+    LIBP2P_UPGRADE_PHASE_SECURITY,     /**< Security multistream-select.         */
+    LIBP2P_UPGRADE_PHASE_NOISE_MSG1,   /**< Noise XX message 1 (-> e).           */
+    LIBP2P_UPGRADE_PHASE_NOISE_MSG2,   /**< Noise XX message 2 (<- e, ee, s, es). */
+    LIBP2P_UPGRADE_PHASE_NOISE_MSG3,   /**< Noise XX message 3 (-> s, se).       */
+    LIBP2P_UPGRADE_PHASE_VERIFY,       /**< Remote identity signature check.     */
+    LIBP2P_UPGRADE_PHASE_MUXER,        /**< Muxer multistream-select.            */
+    LIBP2P_UPGRADE_PHASE_COUNT
+} libp2p_upgrade_phase_t;
+
+/**
+ * @brief Where the setup time of one connection went.
+ *
+ * The Noise message phases include the time spent waiting for the peer, so
+ * a slow remote shows up in the message it was expected to send. The
+ * verify phase is part of the message carrying the remote identity and is
+ * also reported on its own.
+ */
+typedef struct
+{
+    uint64_t phase_us[LIBP2P_UPGRADE_PHASE_COUNT]; /**< Per phase, in µs.            */
+    uint32_t measured;        /**< Bit (1u << phase) set for each measured phase.     */
+    uint64_t total_us;        /**< Security select through muxer select, in µs.       */
+    int      remote_key_type; /**< Remote identity key type (0=RSA … 3=ECDSA) or -1.  */
+} libp2p_upgrade_timings_t;
+
 /**
  * @brief Secured + multiplexed connection produced by the upgrader.
  */
@@ -44,6 +75,8 @@ struct libp2p_upgraded_conn {
     libp2p_conn_t           *conn;
     peer_id_t               *remote_peer;
     const libp2p_muxer_t    *muxer;
+    bool                     dialer;      /**< True if this side dialed. */
+    libp2p_upgrade_timings_t timings;     /**< How long setup took.      */
 };
 typedef struct libp2p_upgraded_conn libp2p_uconn_t;
 
@@ -60,7 +93,8 @@ typedef enum
     LIBP2P_UPGRADER_ERR_SECURITY   = -3,  /**< No mutually supported security proto.   */
     LIBP2P_UPGRADER_ERR_MUXER      = -4,  /**< No mutually supported muxer proto.      */
     LIBP2P_UPGRADER_ERR_HANDSHAKE  = -5,  /**< Security handshake failed.             */
-    LIBP2P_UPGRADER_ERR_INTERNAL   = -6   /**< Unexpected internal failure.            */
+    LIBP2P_UPGRADER_ERR_INTERNAL   = -6,  /**< Unexpected internal failure.            */
+    LIBP2P_UPGRADER_ERR_AGAIN      = -7   /**< Nonblocking upgrade must wait for I/O.  */
 } libp2p_upgrader_err_t;
 
 /**
@@ -90,6 +124,11 @@ typedef struct
     /* Handshake deadline (0 → no timeout) */
     uint64_t handshake_timeout_ms;
 
+    /* Called with every successful upgrade before it is returned (may be
+     * NULL). Runs on the upgrading thread and must not block. */
+    void (*on_timings)(const libp2p_uconn_t *uc, void *arg);
+    void *on_timings_arg;
+
 } libp2p_upgrader_config_t;
 
 /**
@@ -106,7 +145,9 @@ static inline libp2p_upgrader_config_t libp2p_upgrader_config_default(void)
         .n_security           = 0,
         .muxers               = NULL,
         .n_muxers             = 0,
-        .handshake_timeout_ms = 0};
+        .handshake_timeout_ms = 0,
+        .on_timings           = NULL,
+        .on_timings_arg       = NULL};
 }
 
 /**
@@ -230,6 +271,153 @@ libp2p_upgrader_free(libp2p_upgrader_t *u)
         u->vt->free(u);
 }
 
+/**
+ * @name Setup timing statistics
+ * @{
+ */
+
+/** Buckets per histogram: bucket @c i counts samples below 2^i µs. */
+#define LIBP2P_UPGRADE_HIST_BUCKETS 32
+
+/** Identity key types tracked separately for signature verification. */
+#define LIBP2P_UPGRADE_KEY_TYPES 4
+
+/**
+ * @brief Log2 histogram of durations in microseconds.
+ *
+ * Samples of 2^31 µs or more land in the last bucket.
+ */
+typedef struct
+{
+    uint64_t count;                                 /**< Samples recorded.  */
+    uint64_t sum_us;                                /**< Sum of samples.    */
+    uint64_t max_us;                                /**< Largest sample.    */
+    uint64_t buckets[LIBP2P_UPGRADE_HIST_BUCKETS];  /**< See above.         */
+} libp2p_upgrade_hist_t;
+
+/**
+ * @brief Aggregate timings of all successful upgrades of an upgrader.
+ */
+typedef struct
+{
+    libp2p_upgrade_hist_t phase[LIBP2P_UPGRADE_PHASE_COUNT];   /**< Per phase.         */
+    libp2p_upgrade_hist_t total;                              /**< Whole upgrade.     */
+    libp2p_upgrade_hist_t verify_by_key[LIBP2P_UPGRADE_KEY_TYPES]; /**< Verify per remote key type. */
+    uint64_t              failures;                           /**< Failed upgrades.   */
+} libp2p_upgrader_stats_t;
+
+/**
+ * @brief Snapshot the aggregate timings of an upgrader.
+ *
+ * @param u   Upgrader instance.
+ * @param out Destination.
+ * @return LIBP2P_UPGRADER_OK or LIBP2P_UPGRADER_ERR_NULL_PTR.
+ */
+libp2p_upgrader_err_t libp2p_upgrader_get_stats(libp2p_upgrader_t *u, libp2p_upgrader_stats_t *out);
+
+/**
+ * @brief Clear the aggregate timings of an upgrader.
+ *
+ * @param u Upgrader instance.
+ */
+void libp2p_upgrader_reset_stats(libp2p_upgrader_t *u);
+
+/** @} */
+
+/**
+ * @name Nonblocking upgrades
+ *
+ * The blocking upgrade calls above tie up a thread per handshake. An
+ * upgrade op runs the same negotiation (security multistream-select, the
+ * Noise XX handshake, muxer multistream-select) as a resumable state
+ * machine instead, so a single event-loop thread can drive thousands of
+ * handshakes at once:
+ *
+ *   1. create the op for a connected, nonblocking raw connection;
+ *   2. call ::libp2p_upgrade_op_step whenever the socket becomes ready
+ *      (and once right after creation);
+ *   3. on ::LIBP2P_UPGRADER_ERR_AGAIN, wait for the readiness reported by
+ *      ::libp2p_upgrade_op_wants or the time from
+ *      ::libp2p_upgrade_op_deadline, whichever comes first;
+ *   4. on ::LIBP2P_UPGRADER_OK take the upgraded connection; on any other
+ *      code the upgrade failed. Either way, free the op.
+ *
+ * Steps never wait: reads and writes that would block return AGAIN and
+ * resume where they stopped on the next step. Only muxers that advertise a
+ * protocol id can be negotiated this way.
+ * @{
+ */
+
+/** Opaque in-progress upgrade. */
+typedef struct libp2p_upgrade_op libp2p_upgrade_op_t;
+
+/** The op waits for the connection to become readable. */
+#define LIBP2P_UPGRADE_WANT_READ  0x1
+/** The op waits for the connection to become writable. */
+#define LIBP2P_UPGRADE_WANT_WRITE 0x2
+
+/**
+ * @brief Start a nonblocking outbound upgrade.
+ *
+ * The op takes ownership of @p raw, clears its deadline and frees it on
+ * failure. The handshake deadline of the upgrader applies from now.
+ *
+ * @param u           Upgrader (must outlive the op).
+ * @param raw         Connected raw transport connection.
+ * @param remote_hint Optional expected remote peer (must outlive the op).
+ * @return New op or NULL on error, in which case @p raw is not consumed.
+ */
+libp2p_upgrade_op_t *libp2p_upgrade_op_new_outbound(libp2p_upgrader_t *u,
+                                                    libp2p_conn_t     *raw,
+                                                    const peer_id_t   *remote_hint);
+
+/**
+ * @brief Start a nonblocking inbound upgrade.
+ *
+ * See ::libp2p_upgrade_op_new_outbound for ownership rules.
+ *
+ * @param u   Upgrader (must outlive the op).
+ * @param raw Accepted raw transport connection.
+ * @return New op or NULL on error.
+ */
+libp2p_upgrade_op_t *libp2p_upgrade_op_new_inbound(libp2p_upgrader_t *u,
+                                                   libp2p_conn_t     *raw);
+
+/**
+ * @brief Advance the upgrade as far as possible without blocking.
+ *
+ * @param op  Upgrade op.
+ * @param out On LIBP2P_UPGRADER_OK, receives the upgraded connection.
+ * @return LIBP2P_UPGRADER_OK when done, LIBP2P_UPGRADER_ERR_AGAIN when
+ *         waiting for I/O, or the error that ended the upgrade. Errors are
+ *         sticky.
+ */
+libp2p_upgrader_err_t libp2p_upgrade_op_step(libp2p_upgrade_op_t *op,
+                                             libp2p_uconn_t     **out);
+
+/**
+ * @brief Readiness the op waits for after a step returned AGAIN.
+ *
+ * @return Mask of LIBP2P_UPGRADE_WANT_READ / LIBP2P_UPGRADE_WANT_WRITE.
+ */
+int libp2p_upgrade_op_wants(const libp2p_upgrade_op_t *op);
+
+/**
+ * @brief Monotonic time (ms, CLOCK_MONOTONIC) at which the op times out.
+ *
+ * @return Deadline or 0 if the upgrader has no handshake timeout.
+ */
+uint64_t libp2p_upgrade_op_deadline(const libp2p_upgrade_op_t *op);
+
+/**
+ * @brief Free an op, closing its connection unless it was handed out.
+ *
+ * @param op Upgrade op (may be NULL).
+ */
+void libp2p_upgrade_op_free(libp2p_upgrade_op_t *op);
+
+/** @} */
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
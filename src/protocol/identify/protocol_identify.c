@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,8 +6,8 @@
 
 #include "multiformats/unsigned_varint/unsigned_varint.h"
 #include "protocol/identify/protocol_identify.h"
-#include "protocol/mplex/protocol_mplex.h"
 #include "protocol/protocol_handler.h"
+#include "transport/buf_pool.h"
 
 #define IDENTIFY_PUBLIC_KEY_TAG 0x0A
 #define IDENTIFY_LISTEN_ADDRS_TAG 0x12
@@ -24,6 +25,35 @@ static inline int varint_is_minimal(uint64_t v, size_t len)
     return min_len == len;
 }
 
+/**
+ * @brief Read the next length-delimited field of an encoded message.
+ *
+ * @param buf Encoded message
+ * @param len Length of @p buf
+ * @param off Offset of the field; advanced past it
+ * @param tag Field tag
+ * @param field First byte of the field's value
+ * @param flen Length of the value
+ * @return 1 if a field was read, 0 at the end, negative if malformed
+ */
+static int next_field(const uint8_t *buf, size_t len, size_t *off, uint64_t *tag, const uint8_t **field, size_t *flen)
+{
+    if (*off >= len)
+        return 0;
+    size_t pos = *off, sz = 0;
+    uint64_t n = 0;
+    if (unsigned_varint_decode(buf + pos, len - pos, tag, &sz) != UNSIGNED_VARINT_OK || !varint_is_minimal(*tag, sz))
+        return -1;
+    pos += sz;
+    if (unsigned_varint_decode(buf + pos, len - pos, &n, &sz) != UNSIGNED_VARINT_OK || n > len - pos - sz || !varint_is_minimal(n, sz))
+        return -1;
+    pos += sz;
+    *field = buf + pos;
+    *flen = (size_t)n;
+    *off = pos + (size_t)n;
+    return 1;
+}
+
 int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identify_t **out_msg)
 {
     if (!buf || !out_msg)
@@ -31,21 +61,17 @@ int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identi
     libp2p_identify_t *msg = calloc(1, sizeof(*msg));
     if (!msg)
         return -1;
-    size_t off = 0, sz = 0;
-    while (off < len)
-    {
-        uint64_t tag = 0, flen = 0;
-        if (unsigned_varint_decode(buf + off, len - off, &tag, &sz) != UNSIGNED_VARINT_OK || !varint_is_minimal(tag, sz))
-            goto fail;
-        off += sz;
-        if (unsigned_varint_decode(buf + off, len - off, &flen, &sz) != UNSIGNED_VARINT_OK || flen > len - off - sz || !varint_is_minimal(flen, sz))
-            goto fail;
-        off += sz;
-        const uint8_t *field = buf + off;
-        off += (size_t)flen;
+    size_t off = 0;
+    uint64_t tag = 0;
+    const uint8_t *field = NULL;
+    size_t flen = 0;
+    int rc;
+    while ((rc = next_field(buf, len, &off, &tag, &field, &flen)) > 0)
+    {
         switch (tag)
         {
             case IDENTIFY_PUBLIC_KEY_TAG:
+                free(msg->public_key); /* a repeated field replaces the earlier one */
                 msg->public_key = malloc(flen);
                 if (!msg->public_key)
                     goto fail;
@@ -55,14 +81,12 @@ int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identi
             case IDENTIFY_LISTEN_ADDRS_TAG:
             {
                 uint8_t **addrs = realloc(msg->listen_addrs, (msg->num_listen_addrs + 1) * sizeof(uint8_t *));
-                size_t *lens = realloc(msg->listen_addrs_lens, (msg->num_listen_addrs + 1) * sizeof(size_t));
-                if (!addrs || !lens)
-                {
-                    free(addrs);
-                    free(lens);
+                if (!addrs)
                     goto fail;
-                }
                 msg->listen_addrs = addrs;
+                size_t *lens = realloc(msg->listen_addrs_lens, (msg->num_listen_addrs + 1) * sizeof(size_t));
+                if (!lens)
+                    goto fail;
                 msg->listen_addrs_lens = lens;
                 uint8_t *copy = malloc(flen);
                 if (!copy)
@@ -89,6 +113,7 @@ int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identi
                 break;
             }
             case IDENTIFY_OBSERVED_ADDR_TAG:
+                free(msg->observed_addr);
                 msg->observed_addr = malloc(flen);
                 if (!msg->observed_addr)
                     goto fail;
@@ -96,6 +121,7 @@ int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identi
                 msg->observed_addr_len = (size_t)flen;
                 break;
             case IDENTIFY_PROTOCOL_VERSION_TAG:
+                free(msg->protocol_version);
                 msg->protocol_version = malloc(flen + 1);
                 if (!msg->protocol_version)
                     goto fail;
@@ -103,6 +129,7 @@ int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identi
                 msg->protocol_version[flen] = '\0';
                 break;
             case IDENTIFY_AGENT_VERSION_TAG:
+                free(msg->agent_version);
                 msg->agent_version = malloc(flen + 1);
                 if (!msg->agent_version)
                     goto fail;
@@ -114,6 +141,8 @@ int libp2p_identify_message_decode(const uint8_t *buf, size_t len, libp2p_identi
                 break;
         }
     }
+    if (rc < 0)
+        goto fail;
     *out_msg = msg;
     return 0;
 fail:
@@ -121,6 +150,155 @@ fail:
     return -1;
 }
 
+int libp2p_identify_view_decode(const uint8_t *buf, size_t len, libp2p_identify_view_t *out)
+{
+    if (!buf || !out)
+        return -1;
+    memset(out, 0, sizeof(*out));
+    out->buf = buf;
+    out->len = len;
+    size_t off = 0;
+    uint64_t tag = 0;
+    const uint8_t *field = NULL;
+    size_t flen = 0;
+    int rc;
+    while ((rc = next_field(buf, len, &off, &tag, &field, &flen)) > 0)
+    {
+        libp2p_identify_field_t value = {field, flen};
+        switch (tag)
+        {
+            case IDENTIFY_PUBLIC_KEY_TAG:
+                out->public_key = value;
+                break;
+            case IDENTIFY_LISTEN_ADDRS_TAG:
+                out->num_listen_addrs++;
+                break;
+            case IDENTIFY_PROTOCOLS_TAG:
+                out->num_protocols++;
+                break;
+            case IDENTIFY_OBSERVED_ADDR_TAG:
+                out->observed_addr = value;
+                break;
+            case IDENTIFY_PROTOCOL_VERSION_TAG:
+                out->protocol_version = value;
+                break;
+            case IDENTIFY_AGENT_VERSION_TAG:
+                out->agent_version = value;
+                break;
+            default:
+                /* unknown field - ignore */
+                break;
+        }
+    }
+    return rc < 0 ? -1 : 0;
+}
+
+/**
+ * @brief Advance @p it to the next field of a view with the given tag.
+ */
+static int view_next(const libp2p_identify_view_t *view, uint64_t want, size_t *it, libp2p_identify_field_t *out)
+{
+    if (!view || !it || !out)
+        return 0;
+    uint64_t tag = 0;
+    const uint8_t *field = NULL;
+    size_t flen = 0;
+    while (next_field(view->buf, view->len, it, &tag, &field, &flen) > 0)
+    {
+        if (tag == want)
+        {
+            out->data = field;
+            out->len = flen;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int libp2p_identify_view_next_listen_addr(const libp2p_identify_view_t *view, size_t *it, libp2p_identify_field_t *out)
+{
+    return view_next(view, IDENTIFY_LISTEN_ADDRS_TAG, it, out);
+}
+
+int libp2p_identify_view_next_protocol(const libp2p_identify_view_t *view, size_t *it, libp2p_identify_field_t *out)
+{
+    return view_next(view, IDENTIFY_PROTOCOLS_TAG, it, out);
+}
+
+/**
+ * @brief Copy a view field to @p *cursor, NUL-terminated if @p terminate.
+ */
+static uint8_t *arena_copy(uint8_t **cursor, libp2p_identify_field_t f, int terminate)
+{
+    uint8_t *dst = *cursor;
+    if (f.len)
+        memcpy(dst, f.data, f.len);
+    if (terminate)
+        dst[f.len] = '\0';
+    *cursor += f.len + (terminate ? 1 : 0);
+    return dst;
+}
+
+int libp2p_identify_message_decode_arena(const uint8_t *buf, size_t len, libp2p_identify_t **out_msg)
+{
+    if (!buf || !out_msg)
+        return -1;
+    libp2p_identify_view_t view;
+    if (libp2p_identify_view_decode(buf, len, &view) != 0)
+        return -1;
+
+    // Struct, pointer and length arrays first so they stay aligned; the
+    // copied bytes never exceed the encoded message
+    size_t head = sizeof(libp2p_identify_t) + view.num_listen_addrs * (sizeof(uint8_t *) + sizeof(size_t)) + view.num_protocols * sizeof(char *);
+    uint8_t *block = malloc(head + len + view.num_protocols + 2);
+    if (!block)
+        return -1;
+    libp2p_identify_t *msg = (libp2p_identify_t *)(void *)block;
+    memset(msg, 0, sizeof(*msg));
+    msg->arena = block;
+    uint8_t *cursor = block + sizeof(*msg);
+    if (view.num_listen_addrs)
+    {
+        msg->listen_addrs = (uint8_t **)(void *)cursor;
+        cursor += view.num_listen_addrs * sizeof(uint8_t *);
+        msg->listen_addrs_lens = (size_t *)(void *)cursor;
+        cursor += view.num_listen_addrs * sizeof(size_t);
+    }
+    if (view.num_protocols)
+    {
+        msg->protocols = (char **)(void *)cursor;
+        cursor += view.num_protocols * sizeof(char *);
+    }
+
+    libp2p_identify_field_t f;
+    size_t it = 0;
+    while (libp2p_identify_view_next_listen_addr(&view, &it, &f))
+    {
+        msg->listen_addrs_lens[msg->num_listen_addrs] = f.len;
+        msg->listen_addrs[msg->num_listen_addrs++] = arena_copy(&cursor, f, 0);
+    }
+    it = 0;
+    while (libp2p_identify_view_next_protocol(&view, &it, &f))
+        msg->protocols[msg->num_protocols++] = (char *)arena_copy(&cursor, f, 1);
+    if (view.public_key.data)
+    {
+        msg->public_key = arena_copy(&cursor, view.public_key, 0);
+        msg->public_key_len = view.public_key.len;
+    }
+    if (view.observed_addr.data)
+    {
+        msg->observed_addr = arena_copy(&cursor, view.observed_addr, 0);
+        msg->observed_addr_len = view.observed_addr.len;
+    }
+    if (view.protocol_version.data)
+        msg->protocol_version = (char *)arena_copy(&cursor, view.protocol_version, 1);
+    if (view.agent_version.data)
+        msg->agent_version = (char *)arena_copy(&cursor, view.agent_version, 1);
+
+    *out_msg = msg;
+    return 0;
+}
+
 int libp2p_identify_message_encode(const libp2p_identify_t *msg, uint8_t **out_buf, size_t *out_len)
 {
     if (!msg || !out_buf || !out_len)
@@ -332,9 +510,19 @@ void libp2p_identify_free(libp2p_identify_t *msg)
 {
     if (msg)
     {
+        if (msg->arena)
+        {
+            free(msg->arena);
+            return;
+        }
         free(msg->public_key);
+        for (size_t i = 0; i < msg->num_listen_addrs; i++)
+            free(msg->listen_addrs[i]);
         free(msg->listen_addrs);
+        free(msg->listen_addrs_lens);
         free(msg->observed_addr);
+        for (size_t i = 0; i < msg->num_protocols; i++)
+            free(msg->protocols[i]);
         free(msg->protocols);
         free(msg->protocol_version);
         free(msg->agent_version);
@@ -448,8 +636,7 @@ static int identify_protocol_handler(libp2p_stream_t *stream, void *user_data)
     }
 
     // Send length prefix
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)stream->ctx;
-    if (libp2p_mplex_stream_send(mx, stream->stream_id, stream->initiator, varint_buf, varint_len) != LIBP2P_MPLEX_OK)
+    if (libp2p_stream_write(stream, varint_buf, varint_len) != (ssize_t)varint_len)
     {
         // Cleanup allocated data
         free(encoded_data);
@@ -470,7 +657,7 @@ static int identify_protocol_handler(libp2p_stream_t *stream, void *user_data)
     }
 
     // Send the actual data
-    if (libp2p_mplex_stream_send(mx, stream->stream_id, stream->initiator, encoded_data, encoded_len) != LIBP2P_MPLEX_OK)
+    if (libp2p_stream_write(stream, encoded_data, encoded_len) != (ssize_t)encoded_len)
     {
         // Cleanup allocated data
         free(encoded_data);
@@ -549,13 +736,9 @@ int libp2p_identify_send_request_with_context(libp2p_protocol_handler_ctx_t *han
         return -1;
     }
 
-    // Pause protocol handler to avoid mplex frame contention during dial
-    libp2p_protocol_handler_stop(handler_ctx);
-
-    // Open stream for identify protocol using the existing mplex context
+    // Open stream for identify protocol on the connection's muxer session
     libp2p_stream_t *stream = NULL;
-    int result =
-        libp2p_protocol_open_stream_with_context((libp2p_mplex_ctx_t *)handler_ctx->muxer_ctx, handler_ctx->uconn, LIBP2P_IDENTIFY_PROTO_ID, &stream);
+    int result = libp2p_protocol_handler_open_stream(handler_ctx, LIBP2P_IDENTIFY_PROTO_ID, &stream);
     if (result != 0)
     {
         return result;
@@ -563,35 +746,32 @@ int libp2p_identify_send_request_with_context(libp2p_protocol_handler_ctx_t *han
 
     // For identify protocol, we don't send a request body - the protocol negotiation is the request
     // Just wait for the response
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)stream->ctx;
-
     uint8_t response_buf[4096]; // Buffer for identify response
     // Read length-prefixed identify response
-    int msg_len = recv_length_prefixed_message(mx, stream->stream_id, stream->initiator, (char *)response_buf, sizeof(response_buf));
-    if (msg_len <= 0)
+    ssize_t bytes_read = libp2p_stream_read_lp(stream, response_buf, sizeof(response_buf));
+    if (bytes_read <= 0)
     {
         libp2p_stream_free(stream);
-        // Resume protocol handler before returning
-        libp2p_protocol_handler_start(handler_ctx);
         return -1;
     }
-    ssize_t bytes_read = msg_len;
 
     // Decode the response
     libp2p_identify_t *response = NULL;
-    if (libp2p_identify_message_decode(response_buf, (size_t)bytes_read, &response) != 0)
+    if (libp2p_identify_message_decode_arena(response_buf, (size_t)bytes_read, &response) != 0)
     {
         libp2p_stream_free(stream);
-        // Resume protocol handler before returning
-        libp2p_protocol_handler_start(handler_ctx);
         return -1;
     }
 
+    // The advertised list answers later protocol proposals to this peer
+    const peer_id_t *remote_peer = libp2p_stream_remote_peer(stream);
+    libp2p_protocol_support_set_protocols(libp2p_protocol_handler_support_cache(handler_ctx->registry), remote_peer,
+                                          (const char *const *)response->protocols, response->num_protocols);
+
     // Call the response handler
     int handler_result = 0;
     if (response_handler)
     {
-        const peer_id_t *remote_peer = libp2p_stream_remote_peer(stream);
         handler_result = response_handler(remote_peer, response, user_data);
     }
 
@@ -600,7 +780,201 @@ int libp2p_identify_send_request_with_context(libp2p_protocol_handler_ctx_t *han
     libp2p_stream_close(stream);
     libp2p_stream_free(stream);
 
-    // Resume protocol handler thread
-    libp2p_protocol_handler_start(handler_ctx);
     return handler_result;
 }
+
+/* ===== Identify Service ===== */
+
+/** @brief Longest observed address spliced into a response */
+#define IDENTIFY_OBSERVED_ADDR_MAX 256
+
+struct libp2p_identify_service
+{
+    pthread_mutex_t mutex;
+    uint8_t *record;   /**< Encoded local record (pooled buffer, one ref held) */
+    size_t record_len; /**< Length of @p record */
+};
+
+/**
+ * @brief Encode a local record without its observed address into a pooled
+ * buffer.
+ */
+static uint8_t *encode_record(const libp2p_identify_t *local, size_t *out_len)
+{
+    libp2p_identify_t msg = *local;
+    msg.observed_addr = NULL;
+    msg.observed_addr_len = 0;
+
+    uint8_t *encoded = NULL;
+    size_t len = 0;
+    if (libp2p_identify_message_encode(&msg, &encoded, &len) != 0)
+        return NULL;
+    uint8_t *record = libp2p_buf_alloc(len);
+    if (record && len)
+        memcpy(record, encoded, len);
+    free(encoded);
+    *out_len = len;
+    return record;
+}
+
+/**
+ * @brief Take a reference to the current record.
+ */
+static uint8_t *acquire_record(libp2p_identify_service_t *svc, size_t *len)
+{
+    pthread_mutex_lock(&svc->mutex);
+    uint8_t *record = libp2p_buf_retain(svc->record);
+    *len = svc->record_len;
+    pthread_mutex_unlock(&svc->mutex);
+    return record;
+}
+
+/**
+ * @brief Length of a response body: the record plus the observed address
+ * field, if any.
+ */
+static size_t response_len(size_t record_len, size_t observed_len)
+{
+    if (!observed_len)
+        return record_len;
+    return record_len + 1 + unsigned_varint_size(observed_len) + observed_len;
+}
+
+/**
+ * @brief Write a response body; @p out holds ::response_len bytes.
+ */
+static void write_response(uint8_t *out, const uint8_t *record, size_t record_len, const uint8_t *observed, size_t observed_len)
+{
+    memcpy(out, record, record_len);
+    if (!observed_len)
+        return;
+    size_t off = record_len;
+    size_t sz = 0;
+    out[off++] = IDENTIFY_OBSERVED_ADDR_TAG;
+    unsigned_varint_encode(observed_len, out + off, 10, &sz);
+    off += sz;
+    memcpy(out + off, observed, observed_len);
+}
+
+libp2p_identify_service_t *libp2p_identify_service_new(const libp2p_identify_t *local)
+{
+    if (!local)
+        return NULL;
+    libp2p_identify_service_t *svc = calloc(1, sizeof(*svc));
+    if (!svc)
+        return NULL;
+    svc->record = encode_record(local, &svc->record_len);
+    if (!svc->record || pthread_mutex_init(&svc->mutex, NULL) != 0)
+    {
+        libp2p_buf_release(svc->record);
+        free(svc);
+        return NULL;
+    }
+    return svc;
+}
+
+int libp2p_identify_service_update(libp2p_identify_service_t *svc, const libp2p_identify_t *local)
+{
+    if (!svc || !local)
+        return -1;
+    size_t len = 0;
+    uint8_t *record = encode_record(local, &len);
+    if (!record)
+        return -1;
+
+    pthread_mutex_lock(&svc->mutex);
+    uint8_t *old = svc->record;
+    svc->record = record;
+    svc->record_len = len;
+    pthread_mutex_unlock(&svc->mutex);
+
+    // Senders still holding the old record keep it alive until they finish
+    libp2p_buf_release(old);
+    return 0;
+}
+
+int libp2p_identify_service_encode(libp2p_identify_service_t *svc, const uint8_t *observed_addr, size_t observed_addr_len, uint8_t **out_buf,
+                                   size_t *out_len)
+{
+    if (!svc || !out_buf || !out_len || (!observed_addr && observed_addr_len))
+        return -1;
+
+    size_t record_len = 0;
+    uint8_t *record = acquire_record(svc, &record_len);
+    size_t len = response_len(record_len, observed_addr_len);
+    uint8_t *buf = malloc(len ? len : 1);
+    if (!buf)
+    {
+        libp2p_buf_release(record);
+        return -1;
+    }
+    write_response(buf, record, record_len, observed_addr, observed_addr_len);
+    libp2p_buf_release(record);
+
+    *out_buf = buf;
+    *out_len = len;
+    return 0;
+}
+
+/**
+ * @brief Protocol handler answering identify streams from a service.
+ *
+ * The length prefix, the shared record and the connection's observed
+ * address go out in one write.
+ *
+ * @param stream Protocol stream
+ * @param user_data Identify service
+ * @return 0 on success, negative on error
+ */
+static int identify_service_handler(libp2p_stream_t *stream, void *user_data)
+{
+    libp2p_identify_service_t *svc = (libp2p_identify_service_t *)user_data;
+
+    // The address this side sees the remote at, as raw multiaddr bytes
+    uint8_t observed[IDENTIFY_OBSERVED_ADDR_MAX];
+    size_t observed_len = 0;
+    const multiaddr_t *remote = stream->uconn ? libp2p_conn_remote_addr(stream->uconn->conn) : NULL;
+    if (remote)
+    {
+        int n = multiaddr_get_bytes(remote, observed, sizeof(observed));
+        observed_len = n > 0 ? (size_t)n : 0; // omitted if it does not fit
+    }
+
+    size_t record_len = 0;
+    uint8_t *record = acquire_record(svc, &record_len);
+    size_t body_len = response_len(record_len, observed_len);
+    uint8_t *frame = libp2p_buf_alloc(10 + body_len);
+    if (!frame)
+    {
+        libp2p_buf_release(record);
+        return -1;
+    }
+
+    size_t varint_len = 0;
+    unsigned_varint_encode(body_len, frame, 10, &varint_len);
+    write_response(frame + varint_len, record, record_len, observed, observed_len);
+    libp2p_buf_release(record);
+
+    ssize_t sent = libp2p_stream_write(stream, frame, varint_len + body_len);
+    libp2p_buf_release(frame);
+    return sent != (ssize_t)(varint_len + body_len) ? -1 : 0;
+}
+
+int libp2p_identify_service_register(libp2p_protocol_handler_registry_t *registry, libp2p_identify_service_t *svc)
+{
+    if (!registry || !svc)
+    {
+        return -1;
+    }
+
+    return libp2p_register_protocol_handler(registry, LIBP2P_IDENTIFY_PROTO_ID, identify_service_handler, svc);
+}
+
+void libp2p_identify_service_free(libp2p_identify_service_t *svc)
+{
+    if (!svc)
+        return;
+    libp2p_buf_release(svc->record);
+    pthread_mutex_destroy(&svc->mutex);
+    free(svc);
+}
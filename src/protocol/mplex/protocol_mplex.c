@@ -10,8 +10,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+/** @brief Bytes requested from the connection per read. */
+#define MPLEX_READ_CHUNK (16 * 1024)
+
+/** @brief Frames dispatched per ::libp2p_mplex_process_ready call at most. */
+#define MPLEX_READY_BATCH 64
+
+/** @brief Longest single wait for connection data before re-checking stop. */
+#define MPLEX_READ_WAIT_MS 100
+
 /**
  * @brief Map a connection layer error to an mplex specific error code.
  *
@@ -37,7 +47,7 @@ static inline libp2p_mplex_err_t map_conn_err(ssize_t v)
  * Remove a stream from the context if both sides are done with it or it was
  * reset. This keeps the stream list from growing unbounded.
  */
-static void maybe_cleanup_stream(libp2p_mplex_ctx_t *ctx, size_t idx);
+static void maybe_cleanup_stream(libp2p_mplex_ctx_t *ctx, libp2p_mplex_stream_t *st);
 
 /**
  * @brief Write the entire buffer with a soft timeout.
@@ -157,22 +167,23 @@ static int mplex_open_stream(libp2p_muxer_t *mx, const uint8_t *name, size_t nam
 static ssize_t mplex_stream_read(libp2p_stream_t *s, void *buf, size_t len)
 {
     if (!s || !buf)
-        return -1;
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    int timeout_ms = s->read_timeout_ms ? s->read_timeout_ms : LIBP2P_STREAM_READ_TIMEOUT_MS;
     size_t out_len = 0;
-    libp2p_mplex_err_t rc = libp2p_mplex_stream_recv(s->ctx, s->stream_id, s->initiator, buf, len, &out_len);
+    libp2p_mplex_err_t rc = libp2p_mplex_stream_recv_timeout(s->ctx, s->stream_id, s->initiator, buf, len, &out_len, timeout_ms);
     if (rc == LIBP2P_MPLEX_OK)
         return (ssize_t)out_len;
     if (rc == LIBP2P_MPLEX_ERR_EOF)
         return 0;
-    return -1;
+    return rc == LIBP2P_MPLEX_ERR_TIMEOUT ? LIBP2P_MUXER_ERR_TIMEOUT : LIBP2P_MUXER_ERR_INTERNAL;
 }
 
 static ssize_t mplex_stream_write(libp2p_stream_t *s, const void *buf, size_t len)
 {
     if (!s || !buf)
-        return -1;
+        return LIBP2P_MUXER_ERR_NULL_PTR;
     libp2p_mplex_err_t rc = libp2p_mplex_stream_send(s->ctx, s->stream_id, s->initiator, buf, len);
-    return rc == LIBP2P_MPLEX_OK ? (ssize_t)len : -1;
+    return rc == LIBP2P_MPLEX_OK ? (ssize_t)len : LIBP2P_MUXER_ERR_INTERNAL;
 }
 
 static void mplex_stream_close(libp2p_stream_t *s)
@@ -182,15 +193,95 @@ static void mplex_stream_close(libp2p_stream_t *s)
     libp2p_mplex_stream_close(s->ctx, s->stream_id, s->initiator);
 }
 
+static void mplex_stream_reset(libp2p_stream_t *s)
+{
+    if (!s)
+        return;
+    libp2p_mplex_stream_reset(s->ctx, s->stream_id, s->initiator);
+}
+
+static int mplex_session_new(libp2p_muxer_t *mx, libp2p_conn_t *c, bool dialer)
+{
+    (void)dialer;
+    if (!mx || !c)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    mx->ctx = libp2p_mplex_ctx_new(c);
+    return mx->ctx ? LIBP2P_MUXER_OK : LIBP2P_MUXER_ERR_INTERNAL;
+}
+
+/**
+ * @brief Wait for an inbound stream, reading frames while none is queued.
+ *
+ * mplex has no reader thread of its own, so the accepting thread drives
+ * the connection; streams blocked in reads share that work through the
+ * reader lock.
+ */
+static int mplex_accept(libp2p_muxer_t *mx, libp2p_stream_t **out)
+{
+    if (!mx || !mx->ctx || !out)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    libp2p_mplex_ctx_t *ctx = mx->ctx;
+    libp2p_mplex_stream_t *st = NULL;
+    while (libp2p_mplex_accept_stream(ctx, &st) != LIBP2P_MPLEX_OK || !st)
+    {
+        if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+            return LIBP2P_MUXER_ERR_EOF;
+        libp2p_mplex_err_t rc = libp2p_mplex_process_ready(ctx, NULL);
+        if (rc == LIBP2P_MPLEX_ERR_AGAIN)
+            libp2p_mplex_wait_resume(ctx, -1); /* paused or stopped */
+        else if (rc != LIBP2P_MPLEX_OK)
+            return LIBP2P_MUXER_ERR_EOF;
+    }
+
+    libp2p_stream_t *s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        libp2p_mplex_stream_reset(ctx, st->id, 0);
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    }
+    s->stream_id = st->id;
+    s->initiator = 0;
+    s->ctx = ctx;
+    *out = s;
+    return LIBP2P_MUXER_OK;
+}
+
+static void mplex_session_stop(libp2p_muxer_t *mx)
+{
+    if (mx)
+        libp2p_mplex_stop(mx->ctx);
+}
+
+static void mplex_session_free(libp2p_muxer_t *mx)
+{
+    if (!mx)
+        return;
+    libp2p_mplex_ctx_free(mx->ctx);
+    mx->ctx = NULL;
+}
+
 static const libp2p_muxer_vtbl_t MPLEX_VTBL = {
+    .protocol_id = LIBP2P_MPLEX_PROTO_ID,
     .negotiate = mplex_negotiate,
     .open_stream = mplex_open_stream,
     .stream_read = mplex_stream_read,
     .stream_write = mplex_stream_write,
     .stream_close = mplex_stream_close,
     .free = mplex_free,
+    .session_new = mplex_session_new,
+    .accept_stream = mplex_accept,
+    .session_stop = mplex_session_stop,
+    .session_free = mplex_session_free,
+    .stream_reset = mplex_stream_reset,
 };
 
+/**
+ * @brief Muxer operations for streams that carry a bare mplex context.
+ *
+ * @return The mplex dispatch table.
+ */
+const libp2p_muxer_vtbl_t *libp2p_mplex_vtbl(void) { return &MPLEX_VTBL; }
+
 /**
  * @brief Allocate and initialize a new mplex muxer object.
  *
@@ -209,26 +300,102 @@ libp2p_muxer_t *libp2p_mplex_new(void)
 /**
  * @brief Locate a stream by identifier and initiator flag.
  *
- * @param ctx       Mplex context containing the stream array.
+ * @param ctx       Mplex context containing the stream map.
  * @param id        Stream identifier to search for.
  * @param initiator Initiator flag of the stream.
- * @param idx       Optional index output for the found stream.
  * @return Pointer to the stream or NULL if not found.
  */
-static libp2p_mplex_stream_t *find_stream(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, size_t *idx)
+static libp2p_mplex_stream_t *find_stream(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator)
 {
-    if (!ctx)
-        return NULL;
-    for (size_t i = 0; i < ctx->streams.len; i++)
+    return ctx ? mplex_stream_map_find(&ctx->streams, id, initiator) : NULL;
+}
+
+/**
+ * @brief Check whether backpressure currently stops frame reads.
+ *
+ * Caller holds ctx->mtx.
+ */
+static int recv_paused_locked(const libp2p_mplex_ctx_t *ctx)
+{
+    if (!ctx->recv_high)
+        return 0;
+    return ctx->num_over_high > 0 || (ctx->recv_cap && ctx->buffered >= ctx->recv_cap);
+}
+
+/**
+ * @brief Re-evaluate a stream's watermark state after its unread count changed.
+ *
+ * Wakes a paused reader once the session may read again. Caller holds
+ * ctx->mtx.
+ */
+static void stream_watermark(libp2p_mplex_ctx_t *ctx, libp2p_mplex_stream_t *st)
+{
+    size_t unread = st->buf_len - st->buf_pos;
+    if (!st->over_high && ctx->recv_high && unread > ctx->recv_high)
+    {
+        st->over_high = 1;
+        ctx->num_over_high++;
+    }
+    else if (st->over_high && unread <= ctx->recv_low)
+    {
+        st->over_high = 0;
+        ctx->num_over_high--;
+    }
+    if (!recv_paused_locked(ctx))
+        pthread_cond_broadcast(&ctx->drained);
+    pthread_cond_broadcast(&ctx->readable);
+}
+
+/**
+ * @brief Append received payload to a stream's buffer.
+ *
+ * The buffer grows geometrically and is only compacted when consumed bytes
+ * are in the way. Caller holds ctx->mtx.
+ *
+ * @return LIBP2P_MPLEX_OK or LIBP2P_MPLEX_ERR_INTERNAL on allocation failure.
+ */
+static libp2p_mplex_err_t stream_append(libp2p_mplex_ctx_t *ctx, libp2p_mplex_stream_t *st, const uint8_t *data, size_t len)
+{
+    size_t unread = st->buf_len - st->buf_pos;
+    if (st->buf_cap - st->buf_len < len)
     {
-        if (ctx->streams.items[i]->id == id && ctx->streams.items[i]->initiator == initiator)
+        if (st->buf_pos)
         {
-            if (idx)
-                *idx = i;
-            return ctx->streams.items[i];
+            memmove(st->buf, st->buf + st->buf_pos, unread);
+            st->buf_len = unread;
+            st->buf_pos = 0;
+        }
+        if (st->buf_cap - st->buf_len < len)
+        {
+            size_t cap = st->buf_cap ? st->buf_cap : 256;
+            while (cap < unread + len)
+                cap *= 2;
+            uint8_t *tmp = realloc(st->buf, cap);
+            if (!tmp)
+                return LIBP2P_MPLEX_ERR_INTERNAL;
+            st->buf = tmp;
+            st->buf_cap = cap;
         }
     }
-    return NULL;
+    memcpy(st->buf + st->buf_len, data, len);
+    st->buf_len += len;
+    ctx->buffered += len;
+    stream_watermark(ctx, st);
+    return LIBP2P_MPLEX_OK;
+}
+
+/**
+ * @brief Discard a stream's buffered data and release its accounting.
+ *
+ * Caller holds ctx->mtx.
+ */
+static void stream_drop_buf(libp2p_mplex_ctx_t *ctx, libp2p_mplex_stream_t *st)
+{
+    ctx->buffered -= st->buf_len - st->buf_pos;
+    free(st->buf);
+    st->buf = NULL;
+    st->buf_len = st->buf_pos = st->buf_cap = 0;
+    stream_watermark(ctx, st);
 }
 
 /**
@@ -244,12 +411,22 @@ libp2p_mplex_ctx_t *libp2p_mplex_ctx_new(libp2p_conn_t *conn)
     libp2p_mplex_ctx_t *ctx = calloc(1, sizeof(*ctx));
     if (!ctx)
         return NULL;
+    ctx->parser = malloc(sizeof(*ctx->parser));
+    if (!ctx->parser)
+    {
+        free(ctx);
+        return NULL;
+    }
+    libp2p_mplex_parser_init(ctx->parser);
     ctx->conn = conn;
     ctx->next_stream_id = 1;
     libp2p_mplex_queue_init(&ctx->incoming);
-    mplex_stream_array_init(&ctx->streams);
+    mplex_stream_map_init(&ctx->streams);
     atomic_init(&ctx->stop, false);
     pthread_mutex_init(&ctx->mtx, NULL);
+    pthread_mutex_init(&ctx->rd_mtx, NULL);
+    pthread_cond_init(&ctx->drained, NULL);
+    pthread_cond_init(&ctx->readable, NULL);
     return ctx;
 }
 
@@ -262,18 +439,26 @@ void libp2p_mplex_ctx_free(libp2p_mplex_ctx_t *ctx)
 {
     if (!ctx)
         return;
-    for (size_t i = 0; i < ctx->streams.len; i++)
+    size_t it = 0;
+    libp2p_mplex_stream_t *st;
+    while ((st = mplex_stream_map_next(&ctx->streams, &it)) != NULL)
     {
-        free(ctx->streams.items[i]->buf);
-        free(ctx->streams.items[i]->name);
-        free(ctx->streams.items[i]);
+        free(st->buf);
+        free(st->name);
+        free(st);
     }
-    mplex_stream_array_free(&ctx->streams);
+    mplex_stream_map_free(&ctx->streams);
     while (libp2p_mplex_queue_pop(&ctx->incoming))
         ;
     pthread_mutex_destroy(&ctx->incoming.mtx);
     pthread_cond_destroy(&ctx->incoming.cond);
     pthread_mutex_destroy(&ctx->mtx);
+    pthread_mutex_destroy(&ctx->rd_mtx);
+    pthread_cond_destroy(&ctx->drained);
+    pthread_cond_destroy(&ctx->readable);
+    libp2p_mplex_parser_free(ctx->parser);
+    free(ctx->parser);
+    free(ctx->rbuf);
     free(ctx);
 }
 
@@ -305,7 +490,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_open(libp2p_mplex_ctx_t *ctx, const uint8
         pthread_mutex_unlock(&ctx->mtx);
         return rc;
     }
-    libp2p_mplex_stream_t *st = calloc(1, sizeof(*st));
+    libp2p_mplex_stream_t *st = mplex_stream_map_alloc(&ctx->streams);
     if (!st)
     {
         pthread_mutex_unlock(&ctx->mtx);
@@ -318,7 +503,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_open(libp2p_mplex_ctx_t *ctx, const uint8
         st->name = malloc(name_len);
         if (!st->name)
         {
-            free(st);
+            mplex_stream_map_release(&ctx->streams, st);
             pthread_mutex_unlock(&ctx->mtx);
             return LIBP2P_MPLEX_ERR_INTERNAL;
         }
@@ -330,10 +515,10 @@ libp2p_mplex_err_t libp2p_mplex_stream_open(libp2p_mplex_ctx_t *ctx, const uint8
         st->name = NULL;
         st->name_len = 0;
     }
-    if (!mplex_stream_array_push(&ctx->streams, st))
+    if (!mplex_stream_map_insert(&ctx->streams, st))
     {
         free(st->name);
-        free(st);
+        mplex_stream_map_release(&ctx->streams, st);
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_MPLEX_ERR_INTERNAL;
     }
@@ -354,8 +539,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_open(libp2p_mplex_ctx_t *ctx, const uint8
 libp2p_mplex_err_t libp2p_mplex_stream_send(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, const uint8_t *data, size_t data_len)
 {
     pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
-    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator, &idx);
+    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator);
     if (!st)
     {
         pthread_mutex_unlock(&ctx->mtx);
@@ -363,7 +547,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_send(libp2p_mplex_ctx_t *ctx, uint64_t id
     }
     if (st->reset)
     {
-        maybe_cleanup_stream(ctx, idx);
+        maybe_cleanup_stream(ctx, st);
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_MPLEX_ERR_RESET;
     }
@@ -401,8 +585,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_recv(libp2p_mplex_ctx_t *ctx, uint64_t id
     if (!ctx || !buf || !out_len)
         return LIBP2P_MPLEX_ERR_NULL_PTR;
     pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
-    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator, &idx);
+    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator);
     if (!st)
     {
         pthread_mutex_unlock(&ctx->mtx);
@@ -410,7 +593,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_recv(libp2p_mplex_ctx_t *ctx, uint64_t id
     }
     if (st->reset)
     {
-        maybe_cleanup_stream(ctx, idx);
+        maybe_cleanup_stream(ctx, st);
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_MPLEX_ERR_RESET;
     }
@@ -429,12 +612,16 @@ libp2p_mplex_err_t libp2p_mplex_stream_recv(libp2p_mplex_ctx_t *ctx, uint64_t id
     size_t n = max_len < avail ? max_len : avail;
     memcpy(buf, st->buf + st->buf_pos, n);
     st->buf_pos += n;
+    ctx->buffered -= n;
     if (st->buf_pos == st->buf_len)
     {
-        free(st->buf);
-        st->buf = NULL;
-        st->buf_len = st->buf_pos = 0;
+        /* keep small buffers around for the next message */
+        if (st->buf_cap > 64 * 1024)
+            stream_drop_buf(ctx, st);
+        else
+            st->buf_len = st->buf_pos = 0;
     }
+    stream_watermark(ctx, st);
     *out_len = n;
     pthread_mutex_unlock(&ctx->mtx);
     return LIBP2P_MPLEX_OK;
@@ -446,21 +633,46 @@ libp2p_mplex_err_t libp2p_mplex_stream_recv(libp2p_mplex_ctx_t *ctx, uint64_t id
  * Called whenever a stream might be removable. Resources are freed once both
  * directions are closed or a reset has occurred.
  *
- * @param ctx Context owning the stream list.
- * @param idx Index of the stream within the array.
+ * @param ctx Context owning the stream map.
+ * @param st  Stream to check.
  */
-static void maybe_cleanup_stream(libp2p_mplex_ctx_t *ctx, size_t idx)
+static void maybe_cleanup_stream(libp2p_mplex_ctx_t *ctx, libp2p_mplex_stream_t *st)
 {
-    libp2p_mplex_stream_t *st = ctx->streams.items[idx];
     if ((st->local_closed && st->remote_closed) || st->reset)
     {
-        mplex_stream_array_remove(&ctx->streams, idx);
-        free(st->buf);
+        mplex_stream_map_remove(&ctx->streams, st->id, st->initiator);
+        stream_drop_buf(ctx, st);
         free(st->name);
-        free(st);
+        mplex_stream_map_release(&ctx->streams, st);
     }
 }
 
+/**
+ * @brief Set the stop flag and wake everything waiting on the session.
+ *
+ * Caller holds ctx->mtx, so a waiter cannot miss the broadcast between
+ * checking the flag and going to sleep.
+ */
+static void stop_locked(libp2p_mplex_ctx_t *ctx)
+{
+    atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+    pthread_cond_broadcast(&ctx->drained);
+    pthread_cond_broadcast(&ctx->readable);
+}
+
+/**
+ * @brief Tear down the session after a protocol violation.
+ *
+ * Caller holds ctx->mtx.
+ */
+static libp2p_mplex_err_t proto_violation_locked(libp2p_mplex_ctx_t *ctx)
+{
+    if (ctx->conn)
+        libp2p_conn_close(ctx->conn);
+    stop_locked(ctx);
+    return LIBP2P_MPLEX_ERR_PROTO_MAL;
+}
+
 /**
  * @brief Handle a protocol violation by closing the connection and stopping.
  *
@@ -486,8 +698,7 @@ static libp2p_mplex_err_t proto_violation(libp2p_mplex_ctx_t *ctx)
 libp2p_mplex_err_t libp2p_mplex_stream_close(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator)
 {
     pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
-    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator, &idx);
+    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator);
     if (!st)
     {
         pthread_mutex_unlock(&ctx->mtx);
@@ -495,7 +706,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_close(libp2p_mplex_ctx_t *ctx, uint64_t i
     }
     if (st->reset)
     {
-        maybe_cleanup_stream(ctx, idx);
+        maybe_cleanup_stream(ctx, st);
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_MPLEX_ERR_RESET;
     }
@@ -510,11 +721,11 @@ libp2p_mplex_err_t libp2p_mplex_stream_close(libp2p_mplex_ctx_t *ctx, uint64_t i
     if (rc)
         return rc;
     pthread_mutex_lock(&ctx->mtx);
-    st = find_stream(ctx, id, initiator, &idx);
+    st = find_stream(ctx, id, initiator);
     if (st)
     {
         st->local_closed = 1;
-        maybe_cleanup_stream(ctx, idx);
+        maybe_cleanup_stream(ctx, st);
     }
     pthread_mutex_unlock(&ctx->mtx);
     return LIBP2P_MPLEX_OK;
@@ -530,8 +741,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_close(libp2p_mplex_ctx_t *ctx, uint64_t i
 libp2p_mplex_err_t libp2p_mplex_stream_reset(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator)
 {
     pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
-    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator, &idx);
+    libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator);
     if (!st)
     {
         pthread_mutex_unlock(&ctx->mtx);
@@ -539,7 +749,7 @@ libp2p_mplex_err_t libp2p_mplex_stream_reset(libp2p_mplex_ctx_t *ctx, uint64_t i
     }
     if (st->reset)
     {
-        maybe_cleanup_stream(ctx, idx);
+        maybe_cleanup_stream(ctx, st);
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_MPLEX_ERR_RESET;
     }
@@ -549,13 +759,13 @@ libp2p_mplex_err_t libp2p_mplex_stream_reset(libp2p_mplex_ctx_t *ctx, uint64_t i
     if (rc && rc != LIBP2P_MPLEX_ERR_TIMEOUT)
         return rc;
     pthread_mutex_lock(&ctx->mtx);
-    st = find_stream(ctx, id, initiator, &idx);
+    st = find_stream(ctx, id, initiator);
     if (st)
     {
         st->reset = 1;
         st->local_closed = 1;
         st->remote_closed = 1;
-        maybe_cleanup_stream(ctx, idx);
+        maybe_cleanup_stream(ctx, st);
     }
     pthread_mutex_unlock(&ctx->mtx);
     return rc;
@@ -605,19 +815,18 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
     int reset_init = 0;
 
     pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
     libp2p_mplex_stream_t *st = NULL;
     switch (fr->flag)
     {
         case LIBP2P_MPLEX_NEW_STREAM:
             /* Remote side opened a new stream. Create local state for it. */
-            st = find_stream(ctx, fr->id, 0, &idx);
+            st = find_stream(ctx, fr->id, 0);
             if (st)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
-            st = calloc(1, sizeof(*st));
+            st = mplex_stream_map_alloc(&ctx->streams);
             if (!st)
             {
                 rc = LIBP2P_MPLEX_ERR_INTERNAL;
@@ -630,7 +839,7 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
                 st->name = malloc(fr->data_len);
                 if (!st->name)
                 {
-                    free(st);
+                    mplex_stream_map_release(&ctx->streams, st);
                     rc = LIBP2P_MPLEX_ERR_INTERNAL;
                     break;
                 }
@@ -643,10 +852,10 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
                 st->name_len = 0;
             }
             /* Track the new stream so it can be serviced later. */
-            if (!mplex_stream_array_push(&ctx->streams, st))
+            if (!mplex_stream_map_insert(&ctx->streams, st))
             {
                 free(st->name);
-                free(st);
+                mplex_stream_map_release(&ctx->streams, st);
                 pthread_mutex_unlock(&ctx->mtx);
                 return LIBP2P_MPLEX_ERR_INTERNAL;
             }
@@ -657,115 +866,85 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
             /* Remote closed its sending side (we are receiver). */
             if (fr->data_len)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
-            st = find_stream(ctx, fr->id, 0, &idx);
+            st = find_stream(ctx, fr->id, 0);
             if (!st)
-                st = find_stream(ctx, fr->id, 1, &idx);
+                st = find_stream(ctx, fr->id, 1);
             if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                break; /* late frame for a stream that was reset or closed */
             st->remote_closed = 1;
-            maybe_cleanup_stream(ctx, idx);
+            maybe_cleanup_stream(ctx, st);
             break;
         case LIBP2P_MPLEX_CLOSE_RECEIVER:
             /* Remote closed the receiving side (we are initiator). */
             if (fr->data_len)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
-            st = find_stream(ctx, fr->id, 1, &idx);
+            st = find_stream(ctx, fr->id, 1);
             if (!st)
-                st = find_stream(ctx, fr->id, 0, &idx);
+                st = find_stream(ctx, fr->id, 0);
             if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                break; /* late frame for a stream that was reset or closed */
             st->remote_closed = 1;
-            maybe_cleanup_stream(ctx, idx);
+            maybe_cleanup_stream(ctx, st);
             break;
         case LIBP2P_MPLEX_RESET_INITIATOR:
             /* Immediate reset from the remote initiator side. */
             if (fr->data_len)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
-            st = find_stream(ctx, fr->id, 0, &idx);
+            st = find_stream(ctx, fr->id, 0);
             if (!st)
-                st = find_stream(ctx, fr->id, 1, &idx);
+                st = find_stream(ctx, fr->id, 1);
             if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                break; /* late frame for a stream that was reset or closed */
             st->reset = 1;
             st->local_closed = 1;
             st->remote_closed = 1;
-            free(st->buf);
-            st->buf = NULL;
-            st->buf_len = st->buf_pos = 0;
+            stream_drop_buf(ctx, st);
             break;
         case LIBP2P_MPLEX_RESET_RECEIVER:
             /* Immediate reset from the remote receiver side. */
             if (fr->data_len)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
-            st = find_stream(ctx, fr->id, 1, &idx);
+            st = find_stream(ctx, fr->id, 1);
             if (!st)
-                st = find_stream(ctx, fr->id, 0, &idx);
+                st = find_stream(ctx, fr->id, 0);
             if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                break; /* late frame for a stream that was reset or closed */
             st->reset = 1;
             st->local_closed = 1;
             st->remote_closed = 1;
-            free(st->buf);
-            st->buf = NULL;
-            st->buf_len = st->buf_pos = 0;
+            stream_drop_buf(ctx, st);
             break;
         case LIBP2P_MPLEX_MSG_INITIATOR:
             /* Data from the stream initiator side. Append to buffer. */
-            st = find_stream(ctx, fr->id, 0, &idx);
+            st = find_stream(ctx, fr->id, 0);
             if (!st)
-                st = find_stream(ctx, fr->id, 1, &idx);
+                st = find_stream(ctx, fr->id, 1);
             if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                break; /* late frame for a stream that was reset or closed */
             if (st->remote_closed)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
             if (fr->data_len)
             {
-                /* Grow the receive buffer with any unread data preserved. */
-                size_t unread = st->buf_len > st->buf_pos ? st->buf_len - st->buf_pos : 0;
-                if (unread && st->buf_pos > 0)
-                    memmove(st->buf, st->buf + st->buf_pos, unread);
-                uint8_t *tmp = realloc(st->buf, unread + fr->data_len);
-                if (!tmp)
-                {
-                    rc = LIBP2P_MPLEX_ERR_INTERNAL;
+                rc = stream_append(ctx, st, fr->data, fr->data_len);
+                if (rc)
                     break;
-                }
-                memcpy(tmp + unread, fr->data, fr->data_len);
-                st->buf = tmp;
-                st->buf_len = unread + fr->data_len;
-                st->buf_pos = 0;
-                /* Avoid unbounded memory usage (see spec implementation notes). */
-                if (st->buf_len > MPLEX_MAX_RECV_BUF)
+                /* Without backpressure, avoid unbounded memory usage (see spec implementation notes). */
+                if (!ctx->recv_high && st->buf_len - st->buf_pos > MPLEX_MAX_RECV_BUF)
                 {
                     reset = 1;
                     reset_id = st->id;
@@ -775,36 +954,23 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
             break;
         case LIBP2P_MPLEX_MSG_RECEIVER:
             /* Data from the receiving side. Append to buffer. */
-            st = find_stream(ctx, fr->id, 1, &idx);
+            st = find_stream(ctx, fr->id, 1);
             if (!st)
-                st = find_stream(ctx, fr->id, 0, &idx);
+                st = find_stream(ctx, fr->id, 0);
             if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                break; /* late frame for a stream that was reset or closed */
             if (st->remote_closed)
             {
-                rc = proto_violation(ctx);
+                rc = proto_violation_locked(ctx);
                 break;
             }
             if (fr->data_len)
             {
-                size_t unread = st->buf_len > st->buf_pos ? st->buf_len - st->buf_pos : 0;
-                if (unread && st->buf_pos > 0)
-                    memmove(st->buf, st->buf + st->buf_pos, unread);
-                uint8_t *tmp = realloc(st->buf, unread + fr->data_len);
-                if (!tmp)
-                {
-                    rc = LIBP2P_MPLEX_ERR_INTERNAL;
+                rc = stream_append(ctx, st, fr->data, fr->data_len);
+                if (rc)
                     break;
-                }
-                memcpy(tmp + unread, fr->data, fr->data_len);
-                st->buf = tmp;
-                st->buf_len = unread + fr->data_len;
-                st->buf_pos = 0;
-                /* Avoid unbounded memory usage (see spec implementation notes). */
-                if (st->buf_len > MPLEX_MAX_RECV_BUF)
+                /* Without backpressure, avoid unbounded memory usage (see spec implementation notes). */
+                if (!ctx->recv_high && st->buf_len - st->buf_pos > MPLEX_MAX_RECV_BUF)
                 {
                     reset = 1;
                     reset_id = st->id;
@@ -814,9 +980,12 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
             break;
         default:
             /* Unknown flag => protocol violation. */
-            rc = proto_violation(ctx);
+            rc = proto_violation_locked(ctx);
             break;
     }
+    /* data, close or reset: let blocked readers re-check their stream */
+    if (ctx->recv_waiters)
+        pthread_cond_broadcast(&ctx->readable);
     pthread_mutex_unlock(&ctx->mtx);
     if (reset && rc == LIBP2P_MPLEX_OK)
         rc = libp2p_mplex_stream_reset(ctx, reset_id, reset_init);
@@ -826,7 +995,7 @@ libp2p_mplex_err_t libp2p_mplex_dispatch_frame(libp2p_mplex_ctx_t *ctx, const li
 /**
  * @brief Processing loop that runs until ::libp2p_mplex_stop is invoked.
  *
- * Frames are read from the connection and dispatched one by one.
+ * Frames are read from the connection and dispatched in batches.
  *
  * @param ctx Context to operate on.
  */
@@ -837,17 +1006,119 @@ libp2p_mplex_err_t libp2p_mplex_process_loop(libp2p_mplex_ctx_t *ctx)
 
     while (!atomic_load_explicit(&ctx->stop, memory_order_relaxed))
     {
-        libp2p_mplex_err_t rc = libp2p_mplex_process_one(ctx);
-        if (rc)
+        libp2p_mplex_err_t rc = libp2p_mplex_process_ready(ctx, NULL);
+        if (rc == LIBP2P_MPLEX_ERR_AGAIN)
+            libp2p_mplex_wait_resume(ctx, -1); /* paused or stopped */
+        else if (rc)
             return rc;
     }
     return LIBP2P_MPLEX_OK;
 }
 
+/**
+ * @brief Parser callback dispatching one frame and pausing the parser.
+ */
+static libp2p_mplex_err_t dispatch_one_cb(void *arg, const libp2p_mplex_frame_t *fr)
+{
+    libp2p_mplex_err_t rc = libp2p_mplex_dispatch_frame((libp2p_mplex_ctx_t *)arg, fr);
+    return rc ? rc : LIBP2P_MPLEX_ERR_AGAIN;
+}
+
+/**
+ * @brief Parser callback dispatching every frame.
+ */
+static libp2p_mplex_err_t dispatch_all_cb(void *arg, const libp2p_mplex_frame_t *fr)
+{
+    return libp2p_mplex_dispatch_frame((libp2p_mplex_ctx_t *)arg, fr);
+}
+
+/** @brief Deadline for ::read_one_locked meaning "wait as long as needed". */
+#define MPLEX_NO_DEADLINE UINT64_MAX
+
+/**
+ * @brief Give up the reader role and wake streams waiting to take it.
+ *
+ * Waiters only go to sleep after seeing the role taken while holding
+ * ctx->mtx, so this broadcast cannot be missed.
+ */
+static void reader_release(libp2p_mplex_ctx_t *ctx)
+{
+    pthread_mutex_unlock(&ctx->rd_mtx);
+    pthread_mutex_lock(&ctx->mtx);
+    if (ctx->recv_waiters)
+        pthread_cond_broadcast(&ctx->readable);
+    pthread_mutex_unlock(&ctx->mtx);
+}
+
+/**
+ * @brief Dispatch the next frame, reading from the connection if needed.
+ *
+ * Buffered bytes from an earlier read are parsed first; the connection is
+ * only read when they do not complete a frame. Caller holds ctx->rd_mtx.
+ *
+ * @param ctx      Context to operate on.
+ * @param deadline Monotonic ms after which to stop waiting for data; 0
+ *                 never waits, MPLEX_NO_DEADLINE waits indefinitely.
+ * @return LIBP2P_MPLEX_OK once a frame was dispatched,
+ *         LIBP2P_MPLEX_ERR_AGAIN when paused, stopped or out of data by the
+ *         deadline, or an error code.
+ */
+static libp2p_mplex_err_t read_one_locked(libp2p_mplex_ctx_t *ctx, uint64_t deadline)
+{
+    if (!ctx->rbuf)
+    {
+        ctx->rbuf = malloc(MPLEX_READ_CHUNK);
+        if (!ctx->rbuf)
+            return LIBP2P_MPLEX_ERR_INTERNAL;
+    }
+
+    for (;;)
+    {
+        if (libp2p_mplex_recv_paused(ctx))
+            return LIBP2P_MPLEX_ERR_AGAIN;
+        if (ctx->rbuf_pos < ctx->rbuf_len)
+        {
+            size_t used = 0;
+            libp2p_mplex_err_t rc =
+                libp2p_mplex_parser_feed(ctx->parser, ctx->rbuf + ctx->rbuf_pos, ctx->rbuf_len - ctx->rbuf_pos, dispatch_one_cb, ctx, &used);
+            ctx->rbuf_pos += used;
+            if (rc || ctx->rbuf_pos < ctx->rbuf_len)
+                return rc; /* error, or paused after one frame */
+            if (libp2p_mplex_parser_idle(ctx->parser))
+                return LIBP2P_MPLEX_OK; /* the frame ended exactly at the buffer end */
+        }
+        ctx->rbuf_pos = ctx->rbuf_len = 0;
+
+        /* block in the connection for at most one slice, so the stop flag
+         * and the caller's deadline are re-checked between waits */
+        uint64_t wait = MPLEX_READ_WAIT_MS;
+        if (deadline != MPLEX_NO_DEADLINE)
+        {
+            uint64_t now = now_mono_ms();
+            wait = deadline > now ? deadline - now : 0;
+            if (wait > MPLEX_READ_WAIT_MS)
+                wait = MPLEX_READ_WAIT_MS;
+        }
+        ssize_t n = wait ? libp2p_conn_read_wait(ctx->conn, ctx->rbuf, MPLEX_READ_CHUNK, wait)
+                         : libp2p_conn_read(ctx->conn, ctx->rbuf, MPLEX_READ_CHUNK);
+        if (n > 0)
+        {
+            ctx->rbuf_len = (size_t)n;
+            continue;
+        }
+        if (n != LIBP2P_CONN_ERR_AGAIN)
+            return map_conn_err(n);
+        if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+            return LIBP2P_MPLEX_ERR_AGAIN;
+        if (deadline != MPLEX_NO_DEADLINE && (deadline == 0 || now_mono_ms() >= deadline))
+            return LIBP2P_MPLEX_ERR_AGAIN;
+    }
+}
+
 /**
  * @brief Perform a single iteration of the processing loop.
  *
- * Reads one frame from the connection and dispatches it.
+ * Waits for and dispatches exactly one frame.
  *
  * @param ctx Context to operate on.
  */
@@ -856,18 +1127,241 @@ libp2p_mplex_err_t libp2p_mplex_process_one(libp2p_mplex_ctx_t *ctx)
     if (!ctx)
         return LIBP2P_MPLEX_ERR_NULL_PTR;
 
-    libp2p_mplex_frame_t fr = {0};
-    libp2p_mplex_err_t rc = libp2p_mplex_read_frame(ctx->conn, &fr);
-    if (rc)
+    pthread_mutex_lock(&ctx->rd_mtx);
+    libp2p_mplex_err_t rc = read_one_locked(ctx, MPLEX_NO_DEADLINE);
+    reader_release(ctx);
+
+    if (rc == LIBP2P_MPLEX_ERR_PROTO_MAL)
+        rc = proto_violation(ctx);
+    return rc;
+}
+
+/**
+ * @brief Wait for a frame, then dispatch every frame available without blocking.
+ *
+ * @param ctx        Context to operate on.
+ * @param out_frames Optional count of frames dispatched.
+ * @return LIBP2P_MPLEX_OK, LIBP2P_MPLEX_ERR_AGAIN if no frame could be
+ *         dispatched, or an error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_process_ready(libp2p_mplex_ctx_t *ctx, size_t *out_frames)
+{
+    if (out_frames)
+        *out_frames = 0;
+    if (!ctx)
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+
+    size_t frames = 0;
+    pthread_mutex_lock(&ctx->rd_mtx);
+    libp2p_mplex_err_t rc = read_one_locked(ctx, MPLEX_NO_DEADLINE);
+    if (rc == LIBP2P_MPLEX_OK)
     {
-        if (rc == LIBP2P_MPLEX_ERR_PROTO_MAL)
-            rc = proto_violation(ctx);
-        return rc;
+        frames = 1;
+        while (frames < MPLEX_READY_BATCH)
+        {
+            libp2p_mplex_err_t more = read_one_locked(ctx, 0);
+            if (more == LIBP2P_MPLEX_ERR_AGAIN)
+                break;
+            if (more)
+            {
+                rc = more;
+                break;
+            }
+            frames++;
+        }
     }
-    rc = libp2p_mplex_dispatch_frame(ctx, &fr);
+    reader_release(ctx);
+
+    if (out_frames)
+        *out_frames = frames;
+    if (rc == LIBP2P_MPLEX_ERR_PROTO_MAL)
+        rc = proto_violation(ctx);
+    return rc;
+}
+
+/**
+ * @brief Convert a monotonic deadline into an absolute CLOCK_REALTIME time.
+ */
+static void deadline_to_ts(uint64_t deadline, struct timespec *ts)
+{
+    uint64_t now = now_mono_ms();
+    uint64_t wait = deadline > now ? deadline - now : 0;
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += (time_t)(wait / 1000);
+    ts->tv_nsec += (long)(wait % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/**
+ * @brief Receive data from a stream, waiting up to a deadline for it to arrive.
+ *
+ * @param ctx        Mplex context.
+ * @param id         Stream identifier.
+ * @param initiator  Initiator flag.
+ * @param buf        Destination buffer.
+ * @param max_len    Capacity of @p buf.
+ * @param out_len    Receives the number of bytes written.
+ * @param timeout_ms Maximum wait in milliseconds, negative to wait forever.
+ * @return LIBP2P_MPLEX_OK with data, LIBP2P_MPLEX_ERR_TIMEOUT when nothing
+ *         arrived in time, LIBP2P_MPLEX_ERR_EOF once the remote closed or
+ *         the context was stopped, or another error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_stream_recv_timeout(libp2p_mplex_ctx_t *ctx, uint64_t id, int initiator, uint8_t *buf, size_t max_len,
+                                                    size_t *out_len, int timeout_ms)
+{
+    if (!ctx || !buf || !out_len)
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+    uint64_t deadline = timeout_ms < 0 ? MPLEX_NO_DEADLINE : now_mono_ms() + (uint64_t)timeout_ms;
+
+    for (;;)
+    {
+        libp2p_mplex_err_t rc = libp2p_mplex_stream_recv(ctx, id, initiator, buf, max_len, out_len);
+        if (rc || *out_len || max_len == 0)
+            return rc;
+        if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+            return LIBP2P_MPLEX_ERR_EOF;
+        if (deadline != MPLEX_NO_DEADLINE && now_mono_ms() >= deadline)
+            return LIBP2P_MPLEX_ERR_TIMEOUT;
+
+        if (pthread_mutex_trylock(&ctx->rd_mtx) == 0)
+        {
+            /* nobody is reading the connection: drive it ourselves */
+            rc = read_one_locked(ctx, deadline);
+            /* hand the reader role to anyone waiting on another stream */
+            reader_release(ctx);
+            if (rc == LIBP2P_MPLEX_ERR_PROTO_MAL)
+                return proto_violation(ctx);
+            if (rc && rc != LIBP2P_MPLEX_ERR_AGAIN)
+                return rc;
+            if (rc == LIBP2P_MPLEX_ERR_AGAIN && libp2p_mplex_recv_paused(ctx))
+                libp2p_mplex_wait_resume(ctx, 10);
+            continue;
+        }
+
+        /* another thread reads frames; sleep until it dispatches something
+         * or gives up the reader role */
+        pthread_mutex_lock(&ctx->mtx);
+        libp2p_mplex_stream_t *st = find_stream(ctx, id, initiator);
+        int wait = st && !st->reset && !st->remote_closed && st->buf_len == st->buf_pos &&
+                   !atomic_load_explicit(&ctx->stop, memory_order_relaxed);
+        if (wait && pthread_mutex_trylock(&ctx->rd_mtx) == 0)
+        {
+            /* the reader already left; take over on the next pass */
+            pthread_mutex_unlock(&ctx->rd_mtx);
+            wait = 0;
+        }
+        if (wait)
+        {
+            ctx->recv_waiters++;
+            if (deadline == MPLEX_NO_DEADLINE)
+            {
+                pthread_cond_wait(&ctx->readable, &ctx->mtx);
+            }
+            else
+            {
+                struct timespec ts;
+                deadline_to_ts(deadline, &ts);
+                pthread_cond_timedwait(&ctx->readable, &ctx->mtx, &ts);
+            }
+            ctx->recv_waiters--;
+        }
+        pthread_mutex_unlock(&ctx->mtx);
+    }
+}
+
+/**
+ * @brief Enable receive-side backpressure instead of reset-on-overflow.
+ *
+ * @param ctx         Context to configure.
+ * @param high        Per-stream high watermark in bytes, 0 to disable.
+ * @param low         Per-stream low watermark.
+ * @param session_cap Limit for all streams together, 0 for none.
+ * @return LIBP2P_MPLEX_OK or LIBP2P_MPLEX_ERR_NULL_PTR.
+ */
+libp2p_mplex_err_t libp2p_mplex_set_backpressure(libp2p_mplex_ctx_t *ctx, size_t high, size_t low, size_t session_cap)
+{
+    if (!ctx)
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    ctx->recv_high = high;
+    ctx->recv_low = (high && low >= high) ? high / 2 : low;
+    ctx->recv_cap = session_cap;
+    ctx->num_over_high = 0;
+    size_t it = 0;
+    libp2p_mplex_stream_t *st;
+    while ((st = mplex_stream_map_next(&ctx->streams, &it)) != NULL)
+    {
+        st->over_high = 0;
+        stream_watermark(ctx, st);
+    }
+    pthread_cond_broadcast(&ctx->drained);
+    pthread_mutex_unlock(&ctx->mtx);
+    return LIBP2P_MPLEX_OK;
+}
+
+/**
+ * @brief Check whether reading is paused by backpressure.
+ *
+ * @param ctx Context to query.
+ * @return Non-zero if frames should not be read right now.
+ */
+int libp2p_mplex_recv_paused(libp2p_mplex_ctx_t *ctx)
+{
+    if (!ctx)
+        return 0;
+    pthread_mutex_lock(&ctx->mtx);
+    int paused = recv_paused_locked(ctx);
+    pthread_mutex_unlock(&ctx->mtx);
+    return paused;
+}
+
+/**
+ * @brief Block while backpressure pauses reading.
+ *
+ * @param ctx        Context to wait on.
+ * @param timeout_ms Upper bound on the wait in milliseconds, negative to
+ *                   wait until resumed or stopped.
+ */
+void libp2p_mplex_wait_resume(libp2p_mplex_ctx_t *ctx, int timeout_ms)
+{
+    if (!ctx || timeout_ms == 0)
+        return;
+    struct timespec ts;
+    if (timeout_ms > 0)
+        deadline_to_ts(now_mono_ms() + (uint64_t)timeout_ms, &ts);
+    pthread_mutex_lock(&ctx->mtx);
+    while (recv_paused_locked(ctx) && !atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+    {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&ctx->drained, &ctx->mtx);
+        else if (pthread_cond_timedwait(&ctx->drained, &ctx->mtx, &ts) != 0)
+            break;
+    }
+    pthread_mutex_unlock(&ctx->mtx);
+}
+
+/**
+ * @brief Dispatch every frame contained in bytes read by the caller.
+ *
+ * @param ctx  Context to operate on.
+ * @param data Received bytes.
+ * @param len  Number of bytes in @p data.
+ * @return LIBP2P_MPLEX_OK or an error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_ctx_feed(libp2p_mplex_ctx_t *ctx, const uint8_t *data, size_t len)
+{
+    if (!ctx || (!data && len))
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+
+    pthread_mutex_lock(&ctx->rd_mtx);
+    libp2p_mplex_err_t rc = libp2p_mplex_parser_feed(ctx->parser, data, len, dispatch_all_cb, ctx, NULL);
+    reader_release(ctx);
     if (rc == LIBP2P_MPLEX_ERR_PROTO_MAL)
         rc = proto_violation(ctx);
-    libp2p_mplex_frame_free(&fr);
     return rc;
 }
 
@@ -878,8 +1372,11 @@ libp2p_mplex_err_t libp2p_mplex_process_one(libp2p_mplex_ctx_t *ctx)
  */
 void libp2p_mplex_stop(libp2p_mplex_ctx_t *ctx)
 {
-    if (ctx)
-        atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+    if (!ctx)
+        return;
+    pthread_mutex_lock(&ctx->mtx);
+    stop_locked(ctx);
+    pthread_mutex_unlock(&ctx->mtx);
 }
 
 int send_length_prefixed_message(libp2p_mplex_ctx_t *mx, uint64_t stream_id, const char *message, int initiator)
@@ -912,18 +1409,9 @@ int recv_length_prefixed_message(libp2p_mplex_ctx_t *mx, uint64_t stream_id, int
     size_t varint_bytes = 0;
     for (int i = 0; i < 10; i++)
     {
-        libp2p_mplex_err_t rc = libp2p_mplex_stream_recv(mx, stream_id, initiator, &varint_buf[varint_bytes], 1, &bytes_read);
+        libp2p_mplex_err_t rc = libp2p_mplex_stream_recv_timeout(mx, stream_id, initiator, &varint_buf[varint_bytes], 1, &bytes_read, -1);
         if (rc != LIBP2P_MPLEX_OK)
             return -1;
-        if (bytes_read == 0)
-        {
-            if (libp2p_mplex_process_one(mx) != LIBP2P_MPLEX_OK)
-                usleep(1000);
-            else
-                usleep(1000);
-            i--; /* retry same byte */
-            continue;
-        }
         varint_bytes++;
         size_t consumed;
         if (unsigned_varint_decode(varint_buf, varint_bytes, &msg_len, &consumed) == UNSIGNED_VARINT_OK)
@@ -935,17 +1423,9 @@ int recv_length_prefixed_message(libp2p_mplex_ctx_t *mx, uint64_t stream_id, int
     while (total < msg_len)
     {
         size_t got = 0;
-        libp2p_mplex_err_t rc = libp2p_mplex_stream_recv(mx, stream_id, initiator, (uint8_t *)buffer + total, msg_len - total, &got);
+        libp2p_mplex_err_t rc = libp2p_mplex_stream_recv_timeout(mx, stream_id, initiator, (uint8_t *)buffer + total, msg_len - total, &got, -1);
         if (rc != LIBP2P_MPLEX_OK)
             return -1;
-        if (got == 0)
-        {
-            if (libp2p_mplex_process_one(mx) != LIBP2P_MPLEX_OK)
-                usleep(1000);
-            else
-                usleep(1000);
-            continue;
-        }
         total += got;
     }
     buffer[msg_len] = '\0';
@@ -1,10 +1,17 @@
 #include "protocol/mplex/protocol_mplex_codec.h"
 #include "multiformats/unsigned_varint/unsigned_varint.h"
 #include "protocol/tcp/protocol_tcp_util.h"
+#include "transport/buf_pool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+/** @brief Frames up to this size are assembled on the stack. */
+#define MPLEX_INLINE_FRAME 4096
+
+/** @brief Frames up to this size are coalesced into a single write. */
+#define MPLEX_COALESCE_MAX (64 * 1024)
+
 /**
  * @brief Convert a generic connection error into an mplex error code.
  *
@@ -95,45 +102,154 @@ static libp2p_mplex_err_t conn_read_exact(libp2p_conn_t *c, uint8_t *buf, size_t
 }
 
 /**
- * @brief Encode and send a single mplex frame over the connection.
+ * @brief Encode the header and length varints of a frame.
  *
- * @param conn Connection to send on.
- * @param fr   Frame to encode and transmit.
+ * @param fr      Frame to encode.
+ * @param out     Destination buffer of at least MPLEX_MAX_HDR_LEN bytes.
+ * @param out_len Receives the number of bytes written.
  * @return LIBP2P_MPLEX_OK on success or an error code on failure.
  */
-libp2p_mplex_err_t libp2p_mplex_send_frame(libp2p_conn_t *conn, const libp2p_mplex_frame_t *fr)
+libp2p_mplex_err_t libp2p_mplex_encode_header(const libp2p_mplex_frame_t *fr, uint8_t out[MPLEX_MAX_HDR_LEN], size_t *out_len)
 {
-    if (!conn || !fr)
+    if (!fr || !out || !out_len)
         return LIBP2P_MPLEX_ERR_NULL_PTR;
     if (fr->data_len > MPLEX_MAX_MSG_SIZE)
         return LIBP2P_MPLEX_ERR_PROTO_MAL;
 
-    uint8_t hdr_buf[10];
     size_t hdr_len;
     uint64_t hdr_val = (fr->id << 3) | (uint8_t)fr->flag;
-    if (unsigned_varint_encode(hdr_val, hdr_buf, sizeof(hdr_buf), &hdr_len))
+    if (unsigned_varint_encode(hdr_val, out, MPLEX_MAX_HDR_LEN, &hdr_len))
         return LIBP2P_MPLEX_ERR_INTERNAL;
 
-    uint8_t len_buf[10];
     size_t len_len;
-    if (unsigned_varint_encode(fr->data_len, len_buf, sizeof(len_buf), &len_len))
+    if (unsigned_varint_encode(fr->data_len, out + hdr_len, MPLEX_MAX_HDR_LEN - hdr_len, &len_len))
         return LIBP2P_MPLEX_ERR_INTERNAL;
 
-    libp2p_mplex_err_t rc;
-    rc = conn_write_all(conn, hdr_buf, hdr_len);
-    if (rc)
-        return rc;
-    rc = conn_write_all(conn, len_buf, len_len);
+    *out_len = hdr_len + len_len;
+    return LIBP2P_MPLEX_OK;
+}
+
+/**
+ * @brief Encode and send a single mplex frame over the connection.
+ *
+ * Header and payload are gathered into one buffer so that the frame leaves
+ * in a single write (and, over a secure channel, a single record). Only
+ * payloads larger than MPLEX_COALESCE_MAX are written separately, where
+ * the extra write is negligible next to the copy it avoids.
+ *
+ * @param conn Connection to send on.
+ * @param fr   Frame to encode and transmit.
+ * @return LIBP2P_MPLEX_OK on success or an error code on failure.
+ */
+libp2p_mplex_err_t libp2p_mplex_send_frame(libp2p_conn_t *conn, const libp2p_mplex_frame_t *fr)
+{
+    if (!conn || !fr)
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+
+    uint8_t hdr[MPLEX_MAX_HDR_LEN];
+    size_t hdr_len;
+    libp2p_mplex_err_t rc = libp2p_mplex_encode_header(fr, hdr, &hdr_len);
     if (rc)
         return rc;
-    return conn_write_all(conn, fr->data, fr->data_len);
+
+    size_t total = hdr_len + fr->data_len;
+    if (total <= MPLEX_INLINE_FRAME)
+    {
+        uint8_t buf[MPLEX_INLINE_FRAME];
+        memcpy(buf, hdr, hdr_len);
+        if (fr->data_len)
+            memcpy(buf + hdr_len, fr->data, fr->data_len);
+        return conn_write_all(conn, buf, total);
+    }
+
+    uint8_t *buf = total <= MPLEX_COALESCE_MAX ? libp2p_buf_alloc(total) : NULL;
+    if (!buf)
+    {
+        rc = conn_write_all(conn, hdr, hdr_len);
+        if (rc)
+            return rc;
+        return conn_write_all(conn, fr->data, fr->data_len);
+    }
+    memcpy(buf, hdr, hdr_len);
+    memcpy(buf + hdr_len, fr->data, fr->data_len);
+    rc = conn_write_all(conn, buf, total);
+    libp2p_buf_release(buf);
+    return rc;
+}
+
+/**
+ * @brief Encode several frames and send them with as few writes as possible.
+ *
+ * Frames are validated up front so that nothing is written when any of them
+ * is malformed. They are then packed back to back into a buffer that is
+ * flushed whenever it would exceed MPLEX_COALESCE_MAX; oversized frames are
+ * sent on their own via ::libp2p_mplex_send_frame.
+ *
+ * @param conn   Connection to send on.
+ * @param frames Array of frames, possibly for different streams.
+ * @param count  Number of frames in @p frames.
+ * @return LIBP2P_MPLEX_OK on success or an error code on failure.
+ */
+libp2p_mplex_err_t libp2p_mplex_send_frames(libp2p_conn_t *conn, const libp2p_mplex_frame_t *frames, size_t count)
+{
+    if (!conn || (!frames && count))
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (frames[i].data_len > MPLEX_MAX_MSG_SIZE)
+            return LIBP2P_MPLEX_ERR_PROTO_MAL;
+        if (frames[i].data_len && !frames[i].data)
+            return LIBP2P_MPLEX_ERR_NULL_PTR;
+        total += MPLEX_MAX_HDR_LEN + frames[i].data_len;
+    }
+    if (count == 1)
+        return libp2p_mplex_send_frame(conn, &frames[0]);
+
+    size_t cap = total < MPLEX_COALESCE_MAX ? total : MPLEX_COALESCE_MAX;
+    uint8_t *buf = libp2p_buf_alloc(cap);
+    if (!buf)
+        return LIBP2P_MPLEX_ERR_INTERNAL;
+
+    libp2p_mplex_err_t rc = LIBP2P_MPLEX_OK;
+    size_t off = 0;
+    for (size_t i = 0; i < count && rc == LIBP2P_MPLEX_OK; i++)
+    {
+        const libp2p_mplex_frame_t *fr = &frames[i];
+        size_t need = MPLEX_MAX_HDR_LEN + fr->data_len;
+        if (off && off + need > cap)
+        {
+            rc = conn_write_all(conn, buf, off);
+            off = 0;
+            if (rc)
+                break;
+        }
+        if (need > cap)
+        {
+            rc = libp2p_mplex_send_frame(conn, fr);
+            continue;
+        }
+        size_t hdr_len;
+        rc = libp2p_mplex_encode_header(fr, buf + off, &hdr_len);
+        if (rc)
+            break;
+        off += hdr_len;
+        if (fr->data_len)
+            memcpy(buf + off, fr->data, fr->data_len);
+        off += fr->data_len;
+    }
+    if (rc == LIBP2P_MPLEX_OK && off)
+        rc = conn_write_all(conn, buf, off);
+    libp2p_buf_release(buf);
+    return rc;
 }
 
 /**
  * @brief Read and decode a single mplex frame from the connection.
  *
- * Allocates memory for the payload if the frame carries data. The caller is
- * responsible for freeing it using ::libp2p_mplex_frame_free.
+ * The payload, if any, is taken from the shared buffer pool. The caller
+ * owns that reference and drops it with ::libp2p_mplex_frame_free.
  *
  * @param conn Connection to read from.
  * @param out  Destination for the decoded frame.
@@ -196,13 +312,13 @@ libp2p_mplex_err_t libp2p_mplex_read_frame(libp2p_conn_t *conn, libp2p_mplex_fra
     out->data = NULL;
     if (out->data_len)
     {
-        out->data = malloc(out->data_len);
+        out->data = libp2p_buf_alloc(out->data_len);
         if (!out->data)
             return LIBP2P_MPLEX_ERR_INTERNAL;
         libp2p_mplex_err_t rc = conn_read_exact(conn, out->data, out->data_len);
         if (rc)
         {
-            free(out->data);
+            libp2p_buf_release(out->data);
             out->data = NULL;
             out->data_len = 0;
             return rc;
@@ -211,10 +327,197 @@ libp2p_mplex_err_t libp2p_mplex_read_frame(libp2p_conn_t *conn, libp2p_mplex_fra
     return LIBP2P_MPLEX_OK;
 }
 
+enum
+{
+    MPLEX_PARSE_HEADER = 0,
+    MPLEX_PARSE_LENGTH,
+    MPLEX_PARSE_PAYLOAD
+};
+
+/**
+ * @brief Initialise a parser waiting for the start of a frame.
+ *
+ * @param p Parser to initialise.
+ */
+void libp2p_mplex_parser_init(libp2p_mplex_parser_t *p)
+{
+    if (p)
+        memset(p, 0, sizeof(*p));
+}
+
+/**
+ * @brief Release buffers held by a parser.
+ *
+ * @param p Parser to clean up.
+ */
+void libp2p_mplex_parser_free(libp2p_mplex_parser_t *p)
+{
+    if (!p)
+        return;
+    free(p->payload);
+    libp2p_mplex_parser_init(p);
+}
+
+/**
+ * @brief Check whether the parser sits on a frame boundary.
+ *
+ * @param p Parser to query.
+ * @return Non-zero if no partial frame is buffered.
+ */
+int libp2p_mplex_parser_idle(const libp2p_mplex_parser_t *p) { return p && p->state == MPLEX_PARSE_HEADER && p->varint_len == 0; }
+
+/**
+ * @brief Append one byte to the varint in progress.
+ *
+ * Mirrors the checks of ::libp2p_mplex_read_frame: at most nine bytes and a
+ * minimal encoding.
+ *
+ * @param p   Parser state.
+ * @param b   Next input byte.
+ * @param out Receives the value once the varint is complete.
+ * @return LIBP2P_MPLEX_OK when complete, LIBP2P_MPLEX_ERR_AGAIN when more
+ *         bytes are needed, LIBP2P_MPLEX_ERR_PROTO_MAL when malformed.
+ */
+static libp2p_mplex_err_t parser_varint_byte(libp2p_mplex_parser_t *p, uint8_t b, uint64_t *out)
+{
+    p->varint[p->varint_len++] = b;
+    if (b & 0x80)
+        return p->varint_len < 9 ? LIBP2P_MPLEX_ERR_AGAIN : LIBP2P_MPLEX_ERR_PROTO_MAL;
+    size_t used = 0;
+    unsigned_varint_err_t vrc = unsigned_varint_decode(p->varint, p->varint_len, out, &used);
+    p->varint_len = 0;
+    return vrc == UNSIGNED_VARINT_OK ? LIBP2P_MPLEX_OK : LIBP2P_MPLEX_ERR_PROTO_MAL;
+}
+
+/**
+ * @brief Deliver the current frame and rearm the parser for the next one.
+ */
+static libp2p_mplex_err_t parser_emit(libp2p_mplex_parser_t *p, const uint8_t *payload, libp2p_mplex_frame_cb cb, void *arg)
+{
+    libp2p_mplex_frame_t fr = {
+        .id = p->id,
+        .flag = p->flag,
+        .data = p->payload_len ? (uint8_t *)payload : NULL,
+        .data_len = p->payload_len,
+    };
+    p->state = MPLEX_PARSE_HEADER;
+    p->payload_have = 0;
+    return cb ? cb(arg, &fr) : LIBP2P_MPLEX_OK;
+}
+
+/**
+ * @brief Feed bytes to the parser.
+ *
+ * @param p            Parser state.
+ * @param data         Received bytes.
+ * @param len          Number of bytes in @p data.
+ * @param cb           Frame callback.
+ * @param arg          Opaque argument for @p cb.
+ * @param out_consumed Optional count of bytes consumed from @p data.
+ * @return LIBP2P_MPLEX_OK or an error code.
+ */
+libp2p_mplex_err_t libp2p_mplex_parser_feed(libp2p_mplex_parser_t *p, const uint8_t *data, size_t len, libp2p_mplex_frame_cb cb, void *arg,
+                                            size_t *out_consumed)
+{
+    size_t off = 0;
+    libp2p_mplex_err_t rc = LIBP2P_MPLEX_OK;
+    if (out_consumed)
+        *out_consumed = 0;
+    if (!p || (!data && len))
+        return LIBP2P_MPLEX_ERR_NULL_PTR;
+
+    while (off < len && rc == LIBP2P_MPLEX_OK)
+    {
+        uint64_t val = 0;
+        switch (p->state)
+        {
+            case MPLEX_PARSE_HEADER:
+                rc = parser_varint_byte(p, data[off++], &val);
+                if (rc == LIBP2P_MPLEX_ERR_AGAIN)
+                {
+                    rc = LIBP2P_MPLEX_OK;
+                    break;
+                }
+                if (rc)
+                    break;
+                p->flag = (libp2p_mplex_flag_t)(val & 0x07);
+                p->id = val >> 3;
+                if (p->id >= MPLEX_MAX_STREAM_ID)
+                    rc = LIBP2P_MPLEX_ERR_PROTO_MAL;
+                else
+                    p->state = MPLEX_PARSE_LENGTH;
+                break;
+
+            case MPLEX_PARSE_LENGTH:
+                rc = parser_varint_byte(p, data[off++], &val);
+                if (rc == LIBP2P_MPLEX_ERR_AGAIN)
+                {
+                    rc = LIBP2P_MPLEX_OK;
+                    break;
+                }
+                if (rc)
+                    break;
+                if (val > MPLEX_MAX_MSG_SIZE)
+                {
+                    rc = LIBP2P_MPLEX_ERR_PROTO_MAL;
+                    break;
+                }
+                p->payload_len = (size_t)val;
+                p->payload_have = 0;
+                if (p->payload_len)
+                    p->state = MPLEX_PARSE_PAYLOAD;
+                else
+                    rc = parser_emit(p, NULL, cb, arg);
+                break;
+
+            case MPLEX_PARSE_PAYLOAD:
+            {
+                size_t avail = len - off;
+                if (p->payload_have == 0 && avail >= p->payload_len)
+                {
+                    /* whole payload inside this chunk: hand out a slice */
+                    const uint8_t *slice = data + off;
+                    off += p->payload_len;
+                    rc = parser_emit(p, slice, cb, arg);
+                    break;
+                }
+                if (p->payload_cap < p->payload_len)
+                {
+                    uint8_t *tmp = realloc(p->payload, p->payload_len);
+                    if (!tmp)
+                    {
+                        rc = LIBP2P_MPLEX_ERR_INTERNAL;
+                        break;
+                    }
+                    p->payload = tmp;
+                    p->payload_cap = p->payload_len;
+                }
+                size_t n = p->payload_len - p->payload_have;
+                if (n > avail)
+                    n = avail;
+                memcpy(p->payload + p->payload_have, data + off, n);
+                p->payload_have += n;
+                off += n;
+                if (p->payload_have == p->payload_len)
+                    rc = parser_emit(p, p->payload, cb, arg);
+                break;
+            }
+
+            default:
+                rc = LIBP2P_MPLEX_ERR_INTERNAL;
+                break;
+        }
+    }
+    if (out_consumed)
+        *out_consumed = off;
+    return rc == LIBP2P_MPLEX_ERR_AGAIN ? LIBP2P_MPLEX_OK : rc;
+}
+
 /**
  * @brief Release resources associated with a frame structure.
  *
- * Frees any dynamically allocated payload and resets the structure fields.
+ * Releases the pooled payload of a frame filled by ::libp2p_mplex_read_frame
+ * and resets the structure fields.
  *
  * @param fr Frame to free.
  */
@@ -222,7 +525,7 @@ void libp2p_mplex_frame_free(libp2p_mplex_frame_t *fr)
 {
     if (!fr)
         return;
-    free(fr->data);
+    libp2p_buf_release(fr->data);
     fr->data = NULL;
     fr->data_len = 0;
 }
@@ -0,0 +1,217 @@
+#include "protocol/mplex/protocol_mplex_stream_map.h"
+#include "protocol/mplex/protocol_mplex.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Hash a (id, initiator) key into a slot index.
+ *
+ * Stream ids are mostly sequential, so they are mixed before masking to
+ * keep probe sequences short.
+ */
+static size_t slot_of(const mplex_stream_map_t *m, uint64_t id, int initiator)
+{
+    uint64_t h = (id << 1) | (initiator ? 1u : 0u);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & (m->cap - 1);
+}
+
+static int key_eq(const struct libp2p_mplex_stream *s, uint64_t id, int initiator)
+{
+    return s->id == id && (s->initiator != 0) == (initiator != 0);
+}
+
+/**
+ * @brief Initialize an empty stream map.
+ *
+ * @param m Map to initialize.
+ */
+void mplex_stream_map_init(mplex_stream_map_t *m)
+{
+    if (!m)
+        return;
+    memset(m, 0, sizeof(*m));
+}
+
+/**
+ * @brief Release the slot table and pooled streams.
+ *
+ * Streams still stored in the map are not freed; the owner walks them with
+ * ::mplex_stream_map_next first.
+ *
+ * @param m Map to clean up.
+ */
+void mplex_stream_map_free(mplex_stream_map_t *m)
+{
+    if (!m)
+        return;
+    for (size_t i = 0; i < m->spare_len; i++)
+        free(m->spare[i]);
+    free(m->slots);
+    mplex_stream_map_init(m);
+}
+
+/**
+ * @brief Look up a stream by identifier and initiator flag.
+ *
+ * @param m         Map to search.
+ * @param id        Stream identifier.
+ * @param initiator Initiator flag of the stream.
+ * @return Matching stream or NULL.
+ */
+struct libp2p_mplex_stream *mplex_stream_map_find(const mplex_stream_map_t *m, uint64_t id, int initiator)
+{
+    if (!m || !m->len)
+        return NULL;
+    for (size_t i = slot_of(m, id, initiator);; i = (i + 1) & (m->cap - 1))
+    {
+        struct libp2p_mplex_stream *s = m->slots[i];
+        if (!s)
+            return NULL;
+        if (key_eq(s, id, initiator))
+            return s;
+    }
+}
+
+static void place(mplex_stream_map_t *m, struct libp2p_mplex_stream *s)
+{
+    size_t i = slot_of(m, s->id, s->initiator);
+    while (m->slots[i])
+        i = (i + 1) & (m->cap - 1);
+    m->slots[i] = s;
+}
+
+static int grow(mplex_stream_map_t *m)
+{
+    size_t old_cap = m->cap;
+    struct libp2p_mplex_stream **old = m->slots;
+    size_t cap = old_cap ? old_cap * 2 : 16;
+    struct libp2p_mplex_stream **slots = calloc(cap, sizeof(*slots));
+    if (!slots)
+        return 0;
+    m->slots = slots;
+    m->cap = cap;
+    for (size_t i = 0; i < old_cap; i++)
+        if (old[i])
+            place(m, old[i]);
+    free(old);
+    return 1;
+}
+
+/**
+ * @brief Store a stream, keyed by its id and initiator flag.
+ *
+ * The caller guarantees that no stream with the same key is present.
+ *
+ * @param m Map to modify.
+ * @param s Stream to insert.
+ * @return 1 on success, 0 on allocation failure or NULL arguments.
+ */
+int mplex_stream_map_insert(mplex_stream_map_t *m, struct libp2p_mplex_stream *s)
+{
+    if (!m || !s)
+        return 0;
+    /* keep the load factor at or below 1/2 */
+    if ((m->len + 1) * 2 > m->cap && !grow(m))
+        return 0;
+    place(m, s);
+    m->len++;
+    return 1;
+}
+
+/**
+ * @brief Remove a stream from the map.
+ *
+ * Uses backward-shift deletion, so lookups never need tombstones.
+ *
+ * @param m         Map to modify.
+ * @param id        Stream identifier.
+ * @param initiator Initiator flag of the stream.
+ * @return The removed stream or NULL if it was not present.
+ */
+struct libp2p_mplex_stream *mplex_stream_map_remove(mplex_stream_map_t *m, uint64_t id, int initiator)
+{
+    if (!m || !m->len)
+        return NULL;
+    size_t mask = m->cap - 1;
+    size_t i = slot_of(m, id, initiator);
+    while (m->slots[i] && !key_eq(m->slots[i], id, initiator))
+        i = (i + 1) & mask;
+    struct libp2p_mplex_stream *s = m->slots[i];
+    if (!s)
+        return NULL;
+
+    for (size_t j = (i + 1) & mask; m->slots[j]; j = (j + 1) & mask)
+    {
+        size_t home = slot_of(m, m->slots[j]->id, m->slots[j]->initiator);
+        /* move slots[j] into the hole unless its home lies in (i, j] */
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            m->slots[i] = m->slots[j];
+            i = j;
+        }
+    }
+    m->slots[i] = NULL;
+    m->len--;
+    return s;
+}
+
+/**
+ * @brief Iterate over the stored streams.
+ *
+ * Start with @p it set to zero. The map must not be modified while
+ * iterating.
+ *
+ * @param m  Map to walk.
+ * @param it Iterator state.
+ * @return Next stream or NULL when all have been visited.
+ */
+struct libp2p_mplex_stream *mplex_stream_map_next(const mplex_stream_map_t *m, size_t *it)
+{
+    if (!m || !it)
+        return NULL;
+    while (*it < m->cap)
+    {
+        struct libp2p_mplex_stream *s = m->slots[(*it)++];
+        if (s)
+            return s;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Get a zeroed stream object, reusing a pooled one if available.
+ *
+ * @param m Map owning the pool.
+ * @return New stream or NULL on allocation failure.
+ */
+struct libp2p_mplex_stream *mplex_stream_map_alloc(mplex_stream_map_t *m)
+{
+    if (m && m->spare_len)
+    {
+        struct libp2p_mplex_stream *s = m->spare[--m->spare_len];
+        memset(s, 0, sizeof(*s));
+        return s;
+    }
+    return calloc(1, sizeof(struct libp2p_mplex_stream));
+}
+
+/**
+ * @brief Return a stream object to the pool.
+ *
+ * Only the object itself is recycled; the caller frees its buffers.
+ *
+ * @param m Map owning the pool.
+ * @param s Stream no longer stored in the map.
+ */
+void mplex_stream_map_release(mplex_stream_map_t *m, struct libp2p_mplex_stream *s)
+{
+    if (!s)
+        return;
+    if (m && m->spare_len < MPLEX_STREAM_POOL)
+        m->spare[m->spare_len++] = s;
+    else
+        free(s);
+}
@@ -221,11 +221,15 @@ static libp2p_multiselect_err_t recv_msg(libp2p_conn_t *c, char **out)
     return LIBP2P_MULTISELECT_OK;
 }
 
-static bool str_in_list(const char *needle, const char *const list[])
+static bool proposal_supported(const libp2p_multiselect_config_t *cfg, const char *proposal, const char *const list[])
 {
+    if (cfg->supports)
+    {
+        return cfg->supports(proposal, cfg->supports_arg);
+    }
     for (size_t i = 0; list && list[i]; ++i)
     {
-        if (strcmp(needle, list[i]) == 0)
+        if (strcmp(proposal, list[i]) == 0)
         {
             return true;
         }
@@ -404,6 +408,69 @@ done:
     return rc;
 }
 
+libp2p_multiselect_err_t libp2p_multiselect_dial_lazy(libp2p_conn_t *conn, const char *protocol_id)
+{
+    if (!conn || !protocol_id)
+    {
+        return LIBP2P_MULTISELECT_ERR_NULL_PTR;
+    }
+
+    const char *batch[2] = {LIBP2P_MULTISELECT_PROTO_ID, protocol_id};
+    return send_msg_batch(conn, batch, 2);
+}
+
+libp2p_multiselect_err_t libp2p_multiselect_dial_lazy_confirm(libp2p_conn_t *conn, const char *protocol_id, uint64_t timeout_ms)
+{
+    if (!conn || !protocol_id)
+    {
+        return LIBP2P_MULTISELECT_ERR_NULL_PTR;
+    }
+    if (timeout_ms)
+    {
+        libp2p_conn_set_deadline(conn, timeout_ms);
+    }
+
+    char *msg = NULL;
+    libp2p_multiselect_err_t rc = recv_msg(conn, &msg);
+    if (rc)
+    {
+        goto done;
+    }
+    if (strcmp(msg, LIBP2P_MULTISELECT_PROTO_ID) != 0)
+    {
+        free(msg);
+        rc = LIBP2P_MULTISELECT_ERR_PROTO_MAL;
+        goto done;
+    }
+    free(msg);
+
+    rc = recv_msg(conn, &msg);
+    if (rc)
+    {
+        goto done;
+    }
+    if (!strcmp(msg, protocol_id))
+    {
+        rc = LIBP2P_MULTISELECT_OK;
+    }
+    else if (!strcmp(msg, LIBP2P_MULTISELECT_NA))
+    {
+        rc = LIBP2P_MULTISELECT_ERR_UNAVAIL;
+    }
+    else
+    {
+        rc = LIBP2P_MULTISELECT_ERR_PROTO_MAL;
+    }
+    free(msg);
+
+done:
+    if (timeout_ms)
+    {
+        libp2p_conn_set_deadline(conn, 0); /* clear */
+    }
+    return rc;
+}
+
 libp2p_multiselect_err_t libp2p_multiselect_listen(libp2p_conn_t *conn, const char *const supported[], const libp2p_multiselect_config_t *cfg_opt,
                                                    const char **accepted_out)
 {
@@ -483,7 +550,7 @@ libp2p_multiselect_err_t libp2p_multiselect_listen(libp2p_conn_t *conn, const ch
         }
 
         /* protocol proposal */
-        if (str_in_list(msg, supported))
+        if (proposal_supported(&cfg, msg, supported))
         {
             rc = send_msg(conn, msg); /* echo */
             if (rc)
@@ -3,6 +3,8 @@
 #include "peer_id/peer_id_proto.h"
 #include "protocol/noise/protocol_noise_conn.h"
 #include "protocol/noise/protocol_noise_extensions.h"
+#include "protocol/tcp/protocol_tcp_util.h" /* now_mono_ms(), now_mono_us() */
+#include "transport/buf_pool.h"
 #include <inttypes.h>
 #include <noise/protocol.h>
 #include <pthread.h>
@@ -31,21 +33,6 @@
 peer_id_error_t peer_id_create_from_private_key_rsa(const uint8_t *key_data, size_t key_data_len, uint8_t **pubkey_buf, size_t *pubkey_len);
 peer_id_error_t peer_id_create_from_private_key_ecdsa(const uint8_t *key_data, size_t key_data_len, uint8_t **pubkey_buf, size_t *pubkey_len);
 
-/* If the TCP utility header isn't available in this compilation unit, fall back to
-   a local definition of now_mono_ms() so we don't introduce a new link-time dep. */
-#ifndef NOW_MONO_MS_DECLARED
-static inline uint64_t now_mono_ms(void)
-{
-    struct timespec ts;
-#ifdef _WIN32
-    /* On Windows CLOCK_MONOTONIC is supported by mingw-w64 runtime. */
-#endif
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)(ts.tv_nsec / 1000000ULL);
-}
-#define NOW_MONO_MS_DECLARED 1
-#endif
-
 static inline int varint_is_minimal(uint64_t v, size_t len)
 {
     uint8_t tmp[10];
@@ -312,7 +299,7 @@ static int build_handshake_payload(struct libp2p_noise_ctx *ctx, uint8_t **out,
 }
 
 static int verify_handshake_payload(NoiseHandshakeState *hs, const uint8_t *payload, size_t payload_len, peer_id_t **out_peer, uint8_t **out_ed,
-                                    size_t *out_ed_len, uint8_t **out_ext, size_t *out_ext_len)
+                                    size_t *out_ed_len, uint8_t **out_ext, size_t *out_ext_len, int *out_key_type)
 {
     if (!hs || !payload || payload_len == 0)
     {
@@ -362,6 +349,8 @@ static int verify_handshake_payload(NoiseHandshakeState *hs, const uint8_t *payl
     {
         return -1;
     }
+    if (out_key_type)
+        *out_key_type = (int)key_type;
 
     uint8_t static_pub[32];
     NoiseDHState *dh = noise_handshakestate_get_remote_public_key_dh(hs);
@@ -546,380 +535,282 @@ static int read_exact(libp2p_conn_t *c, uint8_t *buf, size_t len)
     return 0;
 }
 
-static libp2p_security_err_t noise_secure_outbound(libp2p_security_t *self, libp2p_conn_t *raw, const peer_id_t *remote_hint, libp2p_conn_t **out,
-                                                   peer_id_t **remote_peer)
+/* ───────────────────────── Message-level handshake ── */
+
+/* One in-progress XX handshake. The identity payload is sent in the
+ * initiator's second message and the responder's first, and is built (and
+ * signed) just before that message so its cost shows up in that message's
+ * timing. Whatever the peer proves about itself is collected here until
+ * finish() hands it to the secured connection. */
+struct libp2p_noise_handshake
 {
-    (void)remote_hint;
-    if (!self || !raw || !out)
-        return LIBP2P_SECURITY_ERR_NULL_PTR;
+    struct libp2p_noise_ctx *ctx;
+    NoiseHandshakeState *hs;
+    int initiator;
+    const peer_id_t *remote_hint;
+    uint8_t *payload;
+    size_t payload_len;
+    unsigned writes;
+    unsigned reads;
+    uint64_t mark_us; /* end of the previous message */
+    libp2p_noise_hs_stats_t stats;
+    int failed;
+    int hint_mismatch;
+    peer_id_t *remote_peer;
+    uint8_t *remote_ed;
+    size_t remote_ed_len;
+    uint8_t *remote_ext;
+    size_t remote_ext_len;
+    noise_extensions_t *parsed_ext;
+};
 
-    struct libp2p_noise_ctx *ctx = self->ctx;
-    NoiseHandshakeState *hs = NULL;
-    uint8_t buf[65535];
-    uint8_t lenbuf[2];
-    NoiseBuffer mbuf;
-    uint8_t *payload = NULL;
-    size_t payload_len = 0;
-    unsigned msg_idx = 0;
-    unsigned read_idx = 0;
-    int err;
-    uint8_t *remote_ed = NULL, *remote_ext = NULL;
-    size_t remote_ed_len = 0, remote_ext_len = 0;
-    noise_extensions_t *parsed_ext = NULL;
-    int hint_mismatch = 0;
+libp2p_noise_handshake_t *libp2p_noise_handshake_new(libp2p_security_t *sec, int initiator, const peer_id_t *remote_hint)
+{
+    if (!sec || !sec->ctx)
+        return NULL;
+    struct libp2p_noise_ctx *ctx = sec->ctx;
+    if (!ctx->have_identity || noise_init() != NOISE_ERROR_NONE)
+        return NULL;
 
-    if (noise_init() != NOISE_ERROR_NONE)
-    {
-        return LIBP2P_SECURITY_ERR_INTERNAL;
-    }
+    libp2p_noise_handshake_t *h = calloc(1, sizeof(*h));
+    if (!h)
+        return NULL;
+    h->ctx = ctx;
+    h->initiator = initiator ? 1 : 0;
+    h->remote_hint = initiator ? remote_hint : NULL;
 
-    err = noise_handshakestate_new_by_name(&hs, "Noise_XX_25519_ChaChaPoly_SHA256", NOISE_ROLE_INITIATOR);
-    if (err != NOISE_ERROR_NONE)
+    if (noise_handshakestate_new_by_name(&h->hs, "Noise_XX_25519_ChaChaPoly_SHA256", initiator ? NOISE_ROLE_INITIATOR : NOISE_ROLE_RESPONDER) !=
+        NOISE_ERROR_NONE)
     {
-        return LIBP2P_SECURITY_ERR_INTERNAL;
+        free(h);
+        return NULL;
     }
-
-    if (noise_handshakestate_needs_local_keypair(hs) && ctx)
+    if (noise_handshakestate_needs_local_keypair(h->hs))
     {
-        NoiseDHState *dh = noise_handshakestate_get_local_keypair_dh(hs);
+        NoiseDHState *dh = noise_handshakestate_get_local_keypair_dh(h->hs);
         noise_dhstate_set_keypair_private(dh, ctx->static_key, sizeof(ctx->static_key));
     }
-
-    err = noise_handshakestate_start(hs);
-    if (err != NOISE_ERROR_NONE)
+    if (noise_handshakestate_start(h->hs) != NOISE_ERROR_NONE)
     {
-        noise_handshakestate_free(hs);
-        free(payload);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
+        libp2p_noise_handshake_free(h);
+        return NULL;
     }
+    h->stats.remote_key_type = -1;
+    h->mark_us = now_mono_us();
+    return h;
+}
 
-    if (!ctx->have_identity)
-    {
-        noise_handshakestate_free(hs);
-        free(payload);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
+/* Close the timing of the message just written or read. */
+static void hs_lap(libp2p_noise_handshake_t *h)
+{
+    unsigned idx = h->writes + h->reads - 1;
+    uint64_t now = now_mono_us();
+    if (idx < LIBP2P_NOISE_HS_MESSAGES)
+        h->stats.msg_us[idx] = now - h->mark_us;
+    h->mark_us = now;
+}
+
+libp2p_noise_hs_action_t libp2p_noise_handshake_action(const libp2p_noise_handshake_t *h)
+{
+    if (!h || h->failed)
+        return LIBP2P_NOISE_HS_FAILED;
+    switch (noise_handshakestate_get_action(h->hs))
+    {
+        case NOISE_ACTION_WRITE_MESSAGE:
+            return LIBP2P_NOISE_HS_WRITE;
+        case NOISE_ACTION_READ_MESSAGE:
+            return LIBP2P_NOISE_HS_READ;
+        case NOISE_ACTION_SPLIT:
+            return LIBP2P_NOISE_HS_DONE;
+        default:
+            return LIBP2P_NOISE_HS_FAILED;
     }
+}
+
+libp2p_noise_err_t libp2p_noise_handshake_write(libp2p_noise_handshake_t *h, uint8_t *out, size_t cap, size_t *out_len)
+{
+    if (!h || !out || !out_len)
+        return LIBP2P_NOISE_ERR_NULL_PTR;
+    if (cap < 2 || libp2p_noise_handshake_action(h) != LIBP2P_NOISE_HS_WRITE)
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
 
-    if (build_handshake_payload(ctx, &payload, &payload_len) != 0)
+    size_t room = cap - 2 < NOISE_MAX_PAYLOAD_LEN ? cap - 2 : NOISE_MAX_PAYLOAD_LEN;
+    NoiseBuffer mbuf, pbuf;
+    noise_buffer_set_output(mbuf, out + 2, room);
+    int with_payload = h->initiator ? h->writes == 1 : h->writes == 0;
+    if (with_payload && !h->payload && build_handshake_payload(h->ctx, &h->payload, &h->payload_len) != 0)
     {
-        noise_handshakestate_free(hs);
-        free(payload);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
+        h->failed = 1;
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
     }
-
-    for (;;)
+    int err;
+    if (with_payload)
     {
-        int action = noise_handshakestate_get_action(hs);
-        if (action == NOISE_ACTION_WRITE_MESSAGE)
-        {
-            noise_buffer_set_output(mbuf, buf, sizeof(buf));
-            NoiseBuffer pbuf;
-            if (payload && msg_idx == 1) /* second write */
-            {
-                noise_buffer_set_input(pbuf, payload, payload_len);
-                err = noise_handshakestate_write_message(hs, &mbuf, &pbuf);
-            }
-            else
-            {
-                err = noise_handshakestate_write_message(hs, &mbuf, NULL);
-            }
-            msg_idx++;
-            if (err != NOISE_ERROR_NONE)
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            uint16_t l = (uint16_t)mbuf.size;
-            lenbuf[0] = (uint8_t)(l >> 8);
-            lenbuf[1] = (uint8_t)l;
-            if (libp2p_conn_write(raw, lenbuf, 2) != 2 || libp2p_conn_write(raw, buf, mbuf.size) != (ssize_t)mbuf.size)
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-        }
-        else if (action == NOISE_ACTION_READ_MESSAGE)
-        {
-            if (read_exact(raw, lenbuf, 2) != 0)
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            uint16_t l = ((uint16_t)lenbuf[0] << 8) | lenbuf[1];
-            if (l > sizeof(buf))
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            if (read_exact(raw, buf, l) != 0)
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            noise_buffer_set_input(mbuf, buf, l);
-            uint8_t *pbuf_data = malloc(NOISE_MAX_PAYLOAD_LEN);
-            if (!pbuf_data)
-            {
-                noise_handshakestate_free(hs);
-                free(remote_ed);
-                free(remote_ext);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_INTERNAL;
-            }
-            NoiseBuffer pbuf;
-            noise_buffer_set_output(pbuf, pbuf_data, NOISE_MAX_PAYLOAD_LEN);
-            err = noise_handshakestate_read_message(hs, &mbuf, &pbuf);
-            if (err == NOISE_ERROR_NONE && pbuf.size > 0)
-            {
-                err = verify_handshake_payload(hs, pbuf.data, pbuf.size, remote_peer, &remote_ed, &remote_ed_len, &remote_ext, &remote_ext_len);
-                if (err == 0 && remote_ext_len > 0)
-                {
-                    if (parse_noise_extensions(remote_ext, remote_ext_len, &parsed_ext) != 0)
-                        err = -1;
-                }
-                if (err == 0 && remote_hint && remote_peer && *remote_peer && peer_id_equals(remote_hint, *remote_peer) != 1)
-                {
-                    hint_mismatch = 1;
-                }
-            }
-            free(pbuf_data);
-            if (err != NOISE_ERROR_NONE)
-            {
-                noise_handshakestate_free(hs);
-                free(remote_ed);
-                free(remote_ext);
-                if (remote_peer && *remote_peer)
-                {
-                    peer_id_destroy(*remote_peer);
-                    free(*remote_peer);
-                    *remote_peer = NULL;
-                }
-                noise_extensions_free(parsed_ext);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-        }
-        else
-        {
-            break;
-        }
+        noise_buffer_set_input(pbuf, h->payload, h->payload_len);
+        err = noise_handshakestate_write_message(h->hs, &mbuf, &pbuf);
     }
-
-    NoiseCipherState *send_cs = NULL, *recv_cs = NULL;
-    err = noise_handshakestate_split(hs, &send_cs, &recv_cs);
-    if (err != NOISE_ERROR_NONE)
+    else
     {
-        noise_handshakestate_free(hs);
-        free(payload);
-        if (remote_peer && *remote_peer)
-        {
-            peer_id_destroy(*remote_peer);
-            free(*remote_peer);
-            *remote_peer = NULL;
-        }
-        free(remote_ed);
-        free(remote_ext);
-        noise_extensions_free(parsed_ext);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
+        err = noise_handshakestate_write_message(h->hs, &mbuf, NULL);
     }
-    noise_handshakestate_free(hs);
-    free(payload);
-    if (hint_mismatch || (remote_hint && remote_peer && *remote_peer && peer_id_equals(remote_hint, *remote_peer) != 1))
+    h->writes++;
+    if (err != NOISE_ERROR_NONE)
     {
-        noise_cipherstate_free(send_cs);
-        noise_cipherstate_free(recv_cs);
-        free(remote_ed);
-        free(remote_ext);
-        peer_id_destroy(*remote_peer);
-        free(*remote_peer);
-        *remote_peer = NULL;
-        noise_extensions_free(parsed_ext);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
+        h->failed = 1;
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
     }
+    hs_lap(h);
+    out[0] = (uint8_t)(mbuf.size >> 8);
+    out[1] = (uint8_t)mbuf.size;
+    *out_len = mbuf.size + 2;
+    return LIBP2P_NOISE_OK;
+}
 
-    libp2p_conn_t *secure =
-        make_noise_conn(raw, send_cs, recv_cs, ctx->max_plaintext, remote_ed, remote_ed_len, remote_ext, remote_ext_len, parsed_ext);
-    if (!secure)
-    {
-        noise_cipherstate_free(send_cs);
-        noise_cipherstate_free(recv_cs);
-        free(remote_ed);
-        free(remote_ext);
-        if (remote_peer && *remote_peer)
+libp2p_noise_err_t libp2p_noise_handshake_read(libp2p_noise_handshake_t *h, uint8_t *msg, size_t len)
+{
+    if (!h || (!msg && len))
+        return LIBP2P_NOISE_ERR_NULL_PTR;
+    if (len > NOISE_MAX_PAYLOAD_LEN || libp2p_noise_handshake_action(h) != LIBP2P_NOISE_HS_READ)
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
+
+    uint8_t *pdata = libp2p_buf_alloc(NOISE_MAX_PAYLOAD_LEN);
+    if (!pdata)
+        return LIBP2P_NOISE_ERR_INTERNAL;
+    NoiseBuffer mbuf, pbuf;
+    noise_buffer_set_input(mbuf, msg, len);
+    noise_buffer_set_output(pbuf, pdata, NOISE_MAX_PAYLOAD_LEN);
+    int err = noise_handshakestate_read_message(h->hs, &mbuf, &pbuf);
+    if (err == NOISE_ERROR_NONE && pbuf.size > 0)
+    {
+        /* the responder's first message must not carry a payload */
+        if (!h->initiator && h->reads == 0)
+            err = -1;
+        else
         {
-            peer_id_destroy(*remote_peer);
-            free(*remote_peer);
-            *remote_peer = NULL;
+            uint64_t t0 = now_mono_us();
+            err = verify_handshake_payload(h->hs, pbuf.data, pbuf.size, &h->remote_peer, &h->remote_ed, &h->remote_ed_len, &h->remote_ext,
+                                           &h->remote_ext_len, &h->stats.remote_key_type);
+            h->stats.verify_us = now_mono_us() - t0;
         }
-        noise_extensions_free(parsed_ext);
-        return LIBP2P_SECURITY_ERR_INTERNAL;
+        if (err == 0 && h->remote_ext_len > 0 && parse_noise_extensions(h->remote_ext, h->remote_ext_len, &h->parsed_ext) != 0)
+            err = -1;
+        if (err == 0 && h->remote_hint && h->remote_peer && peer_id_equals(h->remote_hint, h->remote_peer) != 1)
+            h->hint_mismatch = 1;
     }
-    *out = secure;
-    return LIBP2P_SECURITY_OK;
+    h->reads++;
+    libp2p_buf_release(pdata);
+    if (err != NOISE_ERROR_NONE)
+    {
+        h->failed = 1;
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
+    }
+    hs_lap(h);
+    return LIBP2P_NOISE_OK;
 }
 
-static libp2p_security_err_t noise_secure_inbound(libp2p_security_t *self, libp2p_conn_t *raw, libp2p_conn_t **out, peer_id_t **remote_peer)
+libp2p_noise_err_t libp2p_noise_handshake_finish(libp2p_noise_handshake_t *h, libp2p_conn_t *raw, libp2p_conn_t **out, peer_id_t **remote_peer)
 {
-    if (!self || !raw || !out)
-        return LIBP2P_SECURITY_ERR_NULL_PTR;
-
-    struct libp2p_noise_ctx *ctx = self->ctx;
-    NoiseHandshakeState *hs = NULL;
-    uint8_t buf[65535];
-    uint8_t lenbuf[2];
-    NoiseBuffer mbuf;
-    uint8_t *payload = NULL;
-    size_t payload_len = 0;
-    unsigned msg_idx = 0;
-    unsigned read_idx = 0;
-    int err;
-    uint8_t *remote_ed = NULL, *remote_ext = NULL;
-    size_t remote_ed_len = 0, remote_ext_len = 0;
-    noise_extensions_t *parsed_ext = NULL;
+    if (!h || !raw || !out)
+        return LIBP2P_NOISE_ERR_NULL_PTR;
+    if (libp2p_noise_handshake_action(h) != LIBP2P_NOISE_HS_DONE || h->hint_mismatch)
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
 
-    if (noise_init() != NOISE_ERROR_NONE)
+    NoiseCipherState *send_cs = NULL, *recv_cs = NULL;
+    if (noise_handshakestate_split(h->hs, &send_cs, &recv_cs) != NOISE_ERROR_NONE)
     {
-        return LIBP2P_SECURITY_ERR_INTERNAL;
+        h->failed = 1;
+        return LIBP2P_NOISE_ERR_HANDSHAKE;
     }
-
-    err = noise_handshakestate_new_by_name(&hs, "Noise_XX_25519_ChaChaPoly_SHA256", NOISE_ROLE_RESPONDER);
-    if (err != NOISE_ERROR_NONE)
+    libp2p_conn_t *secure = make_noise_conn(raw, send_cs, recv_cs, h->ctx->max_plaintext, h->remote_ed, h->remote_ed_len, h->remote_ext,
+                                            h->remote_ext_len, h->parsed_ext);
+    if (!secure)
     {
-        return LIBP2P_SECURITY_ERR_INTERNAL;
+        noise_cipherstate_free(send_cs);
+        noise_cipherstate_free(recv_cs);
+        h->failed = 1;
+        return LIBP2P_NOISE_ERR_INTERNAL;
     }
+    /* the secured connection owns these now */
+    h->remote_ed = h->remote_ext = NULL;
+    h->remote_ed_len = h->remote_ext_len = 0;
+    h->parsed_ext = NULL;
 
-    if (noise_handshakestate_needs_local_keypair(hs) && ctx)
+    *out = secure;
+    if (remote_peer)
     {
-        NoiseDHState *dh = noise_handshakestate_get_local_keypair_dh(hs);
-        noise_dhstate_set_keypair_private(dh, ctx->static_key, sizeof(ctx->static_key));
+        *remote_peer = h->remote_peer;
+        h->remote_peer = NULL;
     }
+    return LIBP2P_NOISE_OK;
+}
 
-    err = noise_handshakestate_start(hs);
-    if (err != NOISE_ERROR_NONE)
-    {
-        noise_handshakestate_free(hs);
-        free(payload);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
-    }
+void libp2p_noise_handshake_get_stats(const libp2p_noise_handshake_t *h, libp2p_noise_hs_stats_t *out)
+{
+    if (!h || !out)
+        return;
+    *out = h->stats;
+}
 
-    if (!ctx->have_identity)
-    {
-        noise_handshakestate_free(hs);
-        free(payload);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
-    }
+void libp2p_noise_handshake_free(libp2p_noise_handshake_t *h)
+{
+    if (!h)
+        return;
+    if (h->hs)
+        noise_handshakestate_free(h->hs);
+    free(h->payload);
+    free(h->remote_ed);
+    free(h->remote_ext);
+    noise_extensions_free(h->parsed_ext);
+    if (h->remote_peer)
+    {
+        peer_id_destroy(h->remote_peer);
+        free(h->remote_peer);
+    }
+    free(h);
+}
 
-    if (build_handshake_payload(ctx, &payload, &payload_len) != 0)
-    {
-        noise_handshakestate_free(hs);
-        free(payload);
+libp2p_security_err_t libp2p_noise_handshake_run(libp2p_security_t *self, libp2p_conn_t *raw, int initiator, const peer_id_t *remote_hint,
+                                                 libp2p_conn_t **out, peer_id_t **remote_peer, libp2p_noise_hs_stats_t *stats)
+{
+    if (!self || !raw || !out)
+        return LIBP2P_SECURITY_ERR_NULL_PTR;
+
+    libp2p_noise_handshake_t *h = libp2p_noise_handshake_new(self, initiator, remote_hint);
+    if (!h)
         return LIBP2P_SECURITY_ERR_HANDSHAKE;
-    }
 
+    uint8_t buf[2 + NOISE_MAX_PAYLOAD_LEN];
+    libp2p_security_err_t rc = LIBP2P_SECURITY_OK;
     for (;;)
     {
-        int action = noise_handshakestate_get_action(hs);
-        if (action == NOISE_ACTION_WRITE_MESSAGE)
+        libp2p_noise_hs_action_t action = libp2p_noise_handshake_action(h);
+        if (action == LIBP2P_NOISE_HS_WRITE)
         {
-            noise_buffer_set_output(mbuf, buf, sizeof(buf));
-            NoiseBuffer pbuf;
-            if (payload && msg_idx == 0)
-            {
-                noise_buffer_set_input(pbuf, payload, payload_len);
-                err = noise_handshakestate_write_message(hs, &mbuf, &pbuf);
-            }
-            else
-            {
-                err = noise_handshakestate_write_message(hs, &mbuf, NULL);
-            }
-            msg_idx++;
-            if (err != NOISE_ERROR_NONE)
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            uint16_t l = (uint16_t)mbuf.size;
-            lenbuf[0] = (uint8_t)(l >> 8);
-            lenbuf[1] = (uint8_t)l;
-            if (libp2p_conn_write(raw, lenbuf, 2) != 2 || libp2p_conn_write(raw, buf, mbuf.size) != (ssize_t)mbuf.size)
+            size_t n = 0;
+            if (libp2p_noise_handshake_write(h, buf, sizeof(buf), &n) != LIBP2P_NOISE_OK || libp2p_conn_write(raw, buf, n) != (ssize_t)n)
             {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
+                rc = LIBP2P_SECURITY_ERR_HANDSHAKE;
+                break;
             }
         }
-        else if (action == NOISE_ACTION_READ_MESSAGE)
+        else if (action == LIBP2P_NOISE_HS_READ)
         {
-            if (read_exact(raw, lenbuf, 2) != 0)
-            {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            uint16_t l = ((uint16_t)lenbuf[0] << 8) | lenbuf[1];
-            if (l > sizeof(buf))
+            if (read_exact(raw, buf, 2) != 0)
             {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
+                rc = LIBP2P_SECURITY_ERR_HANDSHAKE;
+                break;
             }
+            size_t l = ((size_t)buf[0] << 8) | buf[1];
             if (read_exact(raw, buf, l) != 0)
             {
-                noise_handshakestate_free(hs);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
-            }
-            noise_buffer_set_input(mbuf, buf, l);
-            uint8_t *pbuf_data = malloc(NOISE_MAX_PAYLOAD_LEN);
-            if (!pbuf_data)
-            {
-                noise_handshakestate_free(hs);
-                free(remote_ed);
-                free(remote_ext);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_INTERNAL;
+                rc = LIBP2P_SECURITY_ERR_HANDSHAKE;
+                break;
             }
-            NoiseBuffer pbuf;
-            noise_buffer_set_output(pbuf, pbuf_data, NOISE_MAX_PAYLOAD_LEN);
-            err = noise_handshakestate_read_message(hs, &mbuf, &pbuf);
-            if (err == NOISE_ERROR_NONE)
+            libp2p_noise_err_t nrc = libp2p_noise_handshake_read(h, buf, l);
+            if (nrc != LIBP2P_NOISE_OK)
             {
-                if (read_idx == 0 && pbuf.size > 0)
-                {
-                    err = -1;
-                }
-                else if (pbuf.size > 0)
-                {
-                    err = verify_handshake_payload(hs, pbuf.data, pbuf.size, remote_peer, &remote_ed, &remote_ed_len, &remote_ext, &remote_ext_len);
-                    if (err == 0 && remote_ext_len > 0)
-                    {
-                        if (parse_noise_extensions(remote_ext, remote_ext_len, &parsed_ext) != 0)
-                            err = -1;
-                    }
-                }
-            }
-            read_idx++;
-            free(pbuf_data);
-            if (err != NOISE_ERROR_NONE)
-            {
-                noise_handshakestate_free(hs);
-                free(remote_ed);
-                free(remote_ext);
-                if (remote_peer && *remote_peer)
-                {
-                    peer_id_destroy(*remote_peer);
-                    free(*remote_peer);
-                    *remote_peer = NULL;
-                }
-                noise_extensions_free(parsed_ext);
-                free(payload);
-                return LIBP2P_SECURITY_ERR_HANDSHAKE;
+                rc = nrc == LIBP2P_NOISE_ERR_INTERNAL ? LIBP2P_SECURITY_ERR_INTERNAL : LIBP2P_SECURITY_ERR_HANDSHAKE;
+                break;
             }
         }
         else
@@ -928,45 +819,26 @@ static libp2p_security_err_t noise_secure_inbound(libp2p_security_t *self, libp2
         }
     }
 
-    NoiseCipherState *send_cs = NULL, *recv_cs = NULL;
-    err = noise_handshakestate_split(hs, &send_cs, &recv_cs);
-    if (err != NOISE_ERROR_NONE)
+    if (rc == LIBP2P_SECURITY_OK)
     {
-        noise_handshakestate_free(hs);
-        free(payload);
-        if (remote_peer && *remote_peer)
-        {
-            peer_id_destroy(*remote_peer);
-            free(*remote_peer);
-            *remote_peer = NULL;
-        }
-        free(remote_ed);
-        free(remote_ext);
-        noise_extensions_free(parsed_ext);
-        return LIBP2P_SECURITY_ERR_HANDSHAKE;
+        libp2p_noise_err_t nrc = libp2p_noise_handshake_finish(h, raw, out, remote_peer);
+        if (nrc != LIBP2P_NOISE_OK)
+            rc = nrc == LIBP2P_NOISE_ERR_INTERNAL ? LIBP2P_SECURITY_ERR_INTERNAL : LIBP2P_SECURITY_ERR_HANDSHAKE;
     }
-    noise_handshakestate_free(hs);
-    free(payload);
-    libp2p_conn_t *secure =
-        make_noise_conn(raw, send_cs, recv_cs, ctx->max_plaintext, remote_ed, remote_ed_len, remote_ext, remote_ext_len, parsed_ext);
+    libp2p_noise_handshake_get_stats(h, stats);
+    libp2p_noise_handshake_free(h);
+    return rc;
+}
 
-    if (!secure)
-    {
-        noise_cipherstate_free(send_cs);
-        noise_cipherstate_free(recv_cs);
-        free(remote_ed);
-        free(remote_ext);
-        if (remote_peer && *remote_peer)
-        {
-            peer_id_destroy(*remote_peer);
-            free(*remote_peer);
-            *remote_peer = NULL;
-        }
-        noise_extensions_free(parsed_ext);
-        return LIBP2P_SECURITY_ERR_INTERNAL;
-    }
-    *out = secure;
-    return LIBP2P_SECURITY_OK;
+static libp2p_security_err_t noise_secure_outbound(libp2p_security_t *self, libp2p_conn_t *raw, const peer_id_t *remote_hint, libp2p_conn_t **out,
+                                                   peer_id_t **remote_peer)
+{
+    return libp2p_noise_handshake_run(self, raw, 1, remote_hint, out, remote_peer, NULL);
+}
+
+static libp2p_security_err_t noise_secure_inbound(libp2p_security_t *self, libp2p_conn_t *raw, libp2p_conn_t **out, peer_id_t **remote_peer)
+{
+    return libp2p_noise_handshake_run(self, raw, 0, NULL, out, remote_peer, NULL);
 }
 
 static libp2p_security_err_t noise_close(libp2p_security_t *self)
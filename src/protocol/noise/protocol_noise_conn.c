@@ -5,6 +5,15 @@
 #include <string.h>
 
 #include "protocol/noise/protocol_noise_extensions.h"
+#include "transport/buf_pool.h"
+
+/* Decrypted records are kept in place in their pooled ciphertext buffer;
+ * buf_pos/buf_len delimit the plaintext not yet handed to the reader.
+ * A record still arriving is assembled in rx, so a nonblocking raw
+ * connection can return AGAIN at any byte without losing the stream.
+ * Likewise an encrypted record the raw connection did not take in full
+ * stays in tx until it is sent; its nonce is already spent, so it must go
+ * out before anything else is encrypted. */
 typedef struct noise_conn_ctx
 {
     libp2p_conn_t *raw;
@@ -13,6 +22,14 @@ typedef struct noise_conn_ctx
     uint8_t *buf;
     size_t buf_len;
     size_t buf_pos;
+    uint8_t rx_hdr[2];
+    size_t rx_hdr_len;
+    uint8_t *rx;
+    size_t rx_have;
+    uint8_t *tx;
+    size_t tx_len;
+    size_t tx_off;
+    size_t tx_plain; /* plaintext bytes carried by tx */
     uint8_t *early_data;
     size_t early_data_len;
     uint8_t *extensions;
@@ -39,73 +56,105 @@ static ssize_t noise_conn_read(libp2p_conn_t *c, void *buf, size_t len)
         ctx->buf_pos += n;
         if (ctx->buf_pos == ctx->buf_len)
         {
-            free(ctx->buf);
+            libp2p_buf_release(ctx->buf);
             ctx->buf = NULL;
             ctx->buf_len = ctx->buf_pos = 0;
         }
         return (ssize_t)n;
     }
 
-    uint8_t hdr[2];
-    ssize_t r = libp2p_conn_read(ctx->raw, hdr, 2);
-    if (r != 2)
-        return r < 0 ? r : LIBP2P_CONN_ERR_EOF;
-    uint16_t mlen = ((uint16_t)hdr[0] << 8) | hdr[1];
-    uint8_t *cipher = malloc(mlen);
-    if (!cipher)
-        return LIBP2P_CONN_ERR_INTERNAL;
-    r = libp2p_conn_read(ctx->raw, cipher, mlen);
-    if (r != mlen)
+    /* a record may arrive in pieces; keep what we have and report AGAIN */
+    while (ctx->rx_hdr_len < 2)
+    {
+        ssize_t r = libp2p_conn_read(ctx->raw, ctx->rx_hdr + ctx->rx_hdr_len, 2 - ctx->rx_hdr_len);
+        if (r <= 0)
+            return r < 0 ? r : LIBP2P_CONN_ERR_EOF;
+        ctx->rx_hdr_len += (size_t)r;
+    }
+    size_t mlen = ((size_t)ctx->rx_hdr[0] << 8) | ctx->rx_hdr[1];
+    if (!ctx->rx)
+    {
+        ctx->rx = libp2p_buf_alloc(mlen);
+        if (!ctx->rx)
+            return LIBP2P_CONN_ERR_INTERNAL;
+        ctx->rx_have = 0;
+    }
+    while (ctx->rx_have < mlen)
     {
-        free(cipher);
-        return r < 0 ? r : LIBP2P_CONN_ERR_EOF;
+        ssize_t r = libp2p_conn_read(ctx->raw, ctx->rx + ctx->rx_have, mlen - ctx->rx_have);
+        if (r <= 0)
+            return r < 0 ? r : LIBP2P_CONN_ERR_EOF;
+        ctx->rx_have += (size_t)r;
     }
+    uint8_t *cipher = ctx->rx;
+    ctx->rx = NULL;
+    ctx->rx_have = 0;
+    ctx->rx_hdr_len = 0;
+
     NoiseBuffer nb;
     noise_buffer_set_input(nb, cipher, mlen);
     int err = noise_cipherstate_decrypt(ctx->recv, &nb);
     if (err == NOISE_ERROR_INVALID_NONCE)
     {
-        free(cipher);
+        libp2p_buf_release(cipher);
         libp2p_conn_close(ctx->raw);
         return LIBP2P_CONN_ERR_CLOSED;
     }
     if (err != NOISE_ERROR_NONE)
     {
-        free(cipher);
+        libp2p_buf_release(cipher);
         return LIBP2P_CONN_ERR_INTERNAL;
     }
     ctx->recv_count++;
     size_t max_plain = ctx->max_plaintext ? ctx->max_plaintext : NOISE_MAX_PAYLOAD_LEN;
     if (nb.size > max_plain)
     {
-        free(cipher);
+        libp2p_buf_release(cipher);
         return LIBP2P_CONN_ERR_INTERNAL;
     }
-    ctx->buf = malloc(nb.size);
-    if (!ctx->buf)
+    /* decryption is in place, so the plaintext sits at the start of cipher */
+    size_t n = len < nb.size ? len : nb.size;
+    memcpy(buf, nb.data, n);
+    if (n == nb.size)
     {
-        free(cipher);
-        return LIBP2P_CONN_ERR_INTERNAL;
+        libp2p_buf_release(cipher);
+        return (ssize_t)n;
     }
-    memcpy(ctx->buf, nb.data, nb.size);
-    free(cipher);
+    ctx->buf = cipher;
     ctx->buf_len = nb.size;
-    ctx->buf_pos = 0;
-    size_t n = len < nb.size ? len : nb.size;
-    memcpy(buf, ctx->buf, n);
     ctx->buf_pos = n;
-    if (ctx->buf_pos == ctx->buf_len)
+    return (ssize_t)n;
+}
+
+/* Send what is left of the pending record. 0 once it is out, otherwise a
+ * negative libp2p_conn_err_t (AGAIN included) with tx kept. */
+static ssize_t tx_flush(noise_conn_ctx_t *ctx)
+{
+    while (ctx->tx_off < ctx->tx_len)
     {
-        free(ctx->buf);
-        ctx->buf = NULL;
-        ctx->buf_len = ctx->buf_pos = 0;
+        ssize_t r = libp2p_conn_write(ctx->raw, ctx->tx + ctx->tx_off, ctx->tx_len - ctx->tx_off);
+        if (r <= 0)
+            return r < 0 ? r : LIBP2P_CONN_ERR_INTERNAL;
+        ctx->tx_off += (size_t)r;
     }
-    return (ssize_t)n;
+    libp2p_buf_release(ctx->tx);
+    ctx->tx = NULL;
+    ctx->tx_len = ctx->tx_off = 0;
+    return 0;
 }
 
+/* A write that returns AGAIN has encrypted its bytes already; the caller
+ * must retry it with the same data, and the retry completes the pending
+ * record instead of encrypting them again. */
 static ssize_t noise_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
 {
     noise_conn_ctx_t *ctx = c->ctx;
+    if (ctx->tx)
+    {
+        size_t plain = ctx->tx_plain;
+        ssize_t rc = tx_flush(ctx);
+        return rc < 0 ? rc : (ssize_t)plain;
+    }
     if (ctx->send_count == UINT64_MAX)
     {
         libp2p_conn_close(ctx->raw);
@@ -117,7 +166,7 @@ static ssize_t noise_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
     if (len > limit)
         return LIBP2P_CONN_ERR_INTERNAL;
     uint16_t mlen = (uint16_t)(len + mac_len);
-    uint8_t *out = malloc(mlen + 2);
+    uint8_t *out = libp2p_buf_alloc((size_t)mlen + 2);
     if (!out)
         return LIBP2P_CONN_ERR_INTERNAL;
     memcpy(out + 2, buf, len);
@@ -126,23 +175,24 @@ static ssize_t noise_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
     int err = noise_cipherstate_encrypt(ctx->send, &nb);
     if (err == NOISE_ERROR_INVALID_NONCE)
     {
-        free(out);
+        libp2p_buf_release(out);
         libp2p_conn_close(ctx->raw);
         return LIBP2P_CONN_ERR_CLOSED;
     }
     if (err != NOISE_ERROR_NONE)
     {
-        free(out);
+        libp2p_buf_release(out);
         return LIBP2P_CONN_ERR_INTERNAL;
     }
+    ctx->send_count++;
     out[0] = (uint8_t)(nb.size >> 8);
     out[1] = (uint8_t)nb.size;
-    ssize_t rc = libp2p_conn_write(ctx->raw, out, nb.size + 2);
-    free(out);
-    if (rc != nb.size + 2)
-        return rc < 0 ? rc : LIBP2P_CONN_ERR_INTERNAL;
-    ctx->send_count++;
-    return (ssize_t)len;
+    ctx->tx = out;
+    ctx->tx_len = nb.size + 2;
+    ctx->tx_off = 0;
+    ctx->tx_plain = len;
+    ssize_t rc = tx_flush(ctx);
+    return rc < 0 ? rc : (ssize_t)len;
 }
 
 static libp2p_conn_err_t noise_conn_set_deadline(libp2p_conn_t *c, uint64_t ms)
@@ -151,6 +201,14 @@ static libp2p_conn_err_t noise_conn_set_deadline(libp2p_conn_t *c, uint64_t ms)
     return libp2p_conn_set_deadline(ctx->raw, ms);
 }
 
+static libp2p_conn_err_t noise_conn_wait_readable(libp2p_conn_t *c, uint64_t timeout_ms)
+{
+    noise_conn_ctx_t *ctx = c->ctx;
+    if (ctx->buf_len > ctx->buf_pos || !ctx->raw->vt->wait_readable)
+        return LIBP2P_CONN_OK; /* the read finds out */
+    return ctx->raw->vt->wait_readable(ctx->raw, timeout_ms);
+}
+
 static const multiaddr_t *noise_conn_local(libp2p_conn_t *c)
 {
     noise_conn_ctx_t *ctx = c->ctx;
@@ -207,7 +265,9 @@ static void noise_conn_free(libp2p_conn_t *c)
         noise_cipherstate_free(ctx->send);
         noise_cipherstate_free(ctx->recv);
         libp2p_conn_free(ctx->raw);
-        free(ctx->buf);
+        libp2p_buf_release(ctx->buf);
+        libp2p_buf_release(ctx->rx);
+        libp2p_buf_release(ctx->tx);
         free(ctx->early_data);
         free(ctx->extensions);
         noise_extensions_free(ctx->parsed_ext);
@@ -220,6 +280,7 @@ static const libp2p_conn_vtbl_t NOISE_CONN_VTBL = {
     .read = noise_conn_read,
     .write = noise_conn_write,
     .set_deadline = noise_conn_set_deadline,
+    .wait_readable = noise_conn_wait_readable,
     .local_addr = noise_conn_local,
     .remote_addr = noise_conn_remote,
     .close = noise_conn_close,
@@ -3,7 +3,9 @@
 #include "protocol/mplex/protocol_mplex.h"
 #include "transport/upgrader.h"
 #include "protocol/multiselect/protocol_multiselect.h"
+#include "protocol/tcp/protocol_tcp_util.h"
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,125 +14,587 @@
 /* ===== Internal Helper Functions ===== */
 
 /**
- * @brief Perform multiselect negotiation for a protocol.
+ * @brief Muxer operations for a stream.
  *
- * @param ctx Muxer context
- * @param stream_id Stream identifier
+ * Streams created from a bare mplex context carry no dispatch table.
+ */
+static const libp2p_muxer_vtbl_t *stream_ops(const libp2p_stream_t *stream)
+{
+    return stream->muxer ? stream->muxer : libp2p_mplex_vtbl();
+}
+
+/**
+ * @brief Read from a stream, giving up at a deadline.
+ *
+ * @param stream Protocol stream
+ * @param buf Buffer for received data
+ * @param len Maximum bytes to receive
+ * @param deadline Monotonic ms after which to give up, 0 to use the
+ *        stream's own read timeout
+ * @return As libp2p_stream_read()
+ */
+static ssize_t read_until(libp2p_stream_t *stream, void *buf, size_t len, uint64_t deadline)
+{
+    if (!deadline)
+    {
+        return libp2p_stream_read(stream, buf, len);
+    }
+    uint64_t now = now_mono_ms();
+    if (now >= deadline)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_TIMEOUT;
+    }
+    int saved = stream->read_timeout_ms;
+    stream->read_timeout_ms = (int)(deadline - now);
+    ssize_t n = libp2p_stream_read(stream, buf, len);
+    stream->read_timeout_ms = saved;
+    return n;
+}
+
+/**
+ * @brief Receive one length-prefixed message before a deadline.
+ *
+ * @param stream Protocol stream
+ * @param buf Buffer for the message body
+ * @param max_len Size of @p buf
+ * @param deadline Monotonic ms by which the whole message must arrive, 0
+ *        to use the stream's own read timeout for each read
+ * @return As libp2p_stream_read_lp()
+ */
+static ssize_t read_lp_until(libp2p_stream_t *stream, void *buf, size_t max_len, uint64_t deadline)
+{
+    // The prefix is read a byte at a time so no body bytes are consumed
+    uint8_t varint_buf[10];
+    size_t varint_bytes = 0;
+    uint64_t msg_len = 0;
+    for (;;)
+    {
+        if (varint_bytes == sizeof(varint_buf))
+        {
+            return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+        }
+        ssize_t n = read_until(stream, &varint_buf[varint_bytes], 1, deadline);
+        if (n <= 0)
+        {
+            return n < 0 ? n : LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+        }
+        varint_bytes++;
+        size_t consumed;
+        if (unsigned_varint_decode(varint_buf, varint_bytes, &msg_len, &consumed) == UNSIGNED_VARINT_OK)
+        {
+            break;
+        }
+    }
+    if (msg_len >= max_len)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+    }
+
+    uint8_t *out = (uint8_t *)buf;
+    size_t total = 0;
+    while (total < msg_len)
+    {
+        ssize_t n = read_until(stream, out + total, (size_t)msg_len - total, deadline);
+        if (n <= 0)
+        {
+            return n < 0 ? n : LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+        }
+        total += (size_t)n;
+    }
+    out[msg_len] = '\0';
+    return (ssize_t)msg_len;
+}
+
+/* ===== Multistream over a Stream ===== */
+
+static ssize_t stream_conn_read(libp2p_conn_t *c, void *buf, size_t len)
+{
+    libp2p_stream_t *stream = c->ctx;
+    ssize_t n = stream_ops(stream)->stream_read(stream, buf, len);
+    if (n > 0)
+    {
+        return n;
+    }
+    if (n == 0)
+    {
+        return LIBP2P_CONN_ERR_EOF;
+    }
+    return n == LIBP2P_MUXER_ERR_TIMEOUT ? LIBP2P_CONN_ERR_TIMEOUT : LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static ssize_t stream_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    libp2p_stream_t *stream = c->ctx;
+    ssize_t n = stream_ops(stream)->stream_write(stream, buf, len);
+    if (n >= 0)
+    {
+        return n;
+    }
+    return n == LIBP2P_MUXER_ERR_TIMEOUT ? LIBP2P_CONN_ERR_TIMEOUT : LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static libp2p_conn_err_t stream_conn_set_deadline(libp2p_conn_t *c, uint64_t ms)
+{
+    // Reads already honour the stream's own read timeout
+    (void)c;
+    (void)ms;
+    return LIBP2P_CONN_OK;
+}
+
+static const multiaddr_t *stream_conn_addr(libp2p_conn_t *c)
+{
+    (void)c;
+    return NULL;
+}
+
+static libp2p_conn_err_t stream_conn_close(libp2p_conn_t *c)
+{
+    (void)c;
+    return LIBP2P_CONN_OK;
+}
+
+static void stream_conn_free(libp2p_conn_t *c) { (void)c; }
+
+/**
+ * @brief Connection view of a stream for the multiselect dialer.
+ *
+ * Reads and writes go straight to the muxer; the view owns nothing.
+ */
+static const libp2p_conn_vtbl_t STREAM_CONN_VTBL = {
+    .read = stream_conn_read,
+    .write = stream_conn_write,
+    .set_deadline = stream_conn_set_deadline,
+    .local_addr = stream_conn_addr,
+    .remote_addr = stream_conn_addr,
+    .close = stream_conn_close,
+    .free = stream_conn_free,
+};
+
+/**
+ * @brief Propose a protocol on a fresh outbound stream.
+ *
+ * The multistream header and the proposal are sent as one write and the
+ * reply is left for ::confirm_protocol.
+ *
+ * @param stream Freshly opened stream
  * @param protocol_id Target protocol ID
- * @param is_initiator True if we're the initiator of the stream
  * @return 0 on success, negative on error
  */
-static int negotiate_protocol(void *mux_ctx, uint64_t stream_id, const char *protocol_id, int is_initiator)
+static int negotiate_protocol(libp2p_stream_t *stream, const char *protocol_id)
+{
+    if (strlen(protocol_id) > LIBP2P_PROTOCOL_ID_MAX_LEN)
+    {
+        return -1;
+    }
+    libp2p_conn_t conn = {.vt = &STREAM_CONN_VTBL, .ctx = stream};
+    if (libp2p_multiselect_dial_lazy(&conn, protocol_id) != LIBP2P_MULTISELECT_OK)
+    {
+        return -1;
+    }
+    stream->negotiation = 1;
+    return 0;
+}
+
+/**
+ * @brief Read the remote's answer to the protocol proposed on a stream.
+ *
+ * The outcome is recorded in the stream's support cache, if any.
+ *
+ * @param stream Stream whose @c protocol_id was proposed
+ * @return 0 if the remote echoed it, 1 if it answered `na`, negative on error
+ */
+static int read_proposal_reply(libp2p_stream_t *stream)
 {
     char buffer[512];
+    ssize_t len = libp2p_stream_read_lp(stream, buffer, sizeof(buffer));
+    if (len <= 0 || buffer[len - 1] != '\n' || !stream->protocol_id)
+    {
+        return -1;
+    }
+    buffer[len - 1] = '\0';
 
-    if (is_initiator)
+    int rc;
+    if (strcmp(buffer, stream->protocol_id) == 0)
     {
-        // Send multistream header
-        if (send_length_prefixed_message(mux_ctx, stream_id, LIBP2P_MULTISELECT_PROTO_ID "\n", 1) != 0)
-        {
-            return -1;
-        }
+        rc = 0;
+    }
+    else if (strcmp(buffer, "na") == 0)
+    {
+        rc = 1;
+    }
+    else
+    {
+        return -1;
+    }
+    if (stream->support)
+    {
+        libp2p_protocol_support_record(stream->support, libp2p_stream_remote_peer(stream), stream->protocol_id, rc == 0);
+    }
+    return rc;
+}
+
+/**
+ * @brief Read and check the reply to ::negotiate_protocol.
+ *
+ * The outcome is recorded in the stream's support cache, if any.
+ *
+ * @param stream Stream with a pending negotiation
+ * @return 0 if the remote echoed the header and the protocol, negative otherwise
+ */
+static int confirm_protocol(libp2p_stream_t *stream)
+{
+    libp2p_conn_t conn = {.vt = &STREAM_CONN_VTBL, .ctx = stream};
+    stream->negotiation = 0;
+    libp2p_multiselect_err_t rc = libp2p_multiselect_dial_lazy_confirm(&conn, stream->protocol_id, 0);
+    if ((rc == LIBP2P_MULTISELECT_OK || rc == LIBP2P_MULTISELECT_ERR_UNAVAIL) && stream->support)
+    {
+        libp2p_protocol_support_record(stream->support, libp2p_stream_remote_peer(stream), stream->protocol_id, rc == LIBP2P_MULTISELECT_OK);
+    }
+    if (rc != LIBP2P_MULTISELECT_OK)
+    {
+        // The remote keeps listening for proposals after an "na"; what it
+        // still sends on the reset stream is dropped by the muxer
+        stream_ops(stream)->stream_reset(stream);
+        stream->negotiation = -1;
+        return -1;
+    }
+    return 0;
+}
+
+/* ===== Registry Lookup ===== */
+
+/** @brief How a registered string is matched against requested IDs */
+typedef enum
+{
+    MATCH_EXACT = 0,
+    MATCH_PREFIX,
+    MATCH_VERSION
+} match_kind_t;
 
-        // Wait for acknowledgment
-        int recv_result = recv_length_prefixed_message(mux_ctx, stream_id, is_initiator, buffer, sizeof(buffer));
+/** @brief Protocol handler registry entry */
+struct libp2p_protocol_handler_entry
+{
+    char *protocol_id;    /**< Registered ID, prefix or version base */
+    size_t id_len;        /**< Length of @p protocol_id */
+    uint64_t hash;        /**< Hash of @p protocol_id */
+    match_kind_t match;   /**< How @p protocol_id is matched */
+    uint32_t min_version[3]; /**< First accepted version (MATCH_VERSION) */
+    uint32_t max_version[3]; /**< First rejected version (MATCH_VERSION) */
+    int has_max;          /**< Non-zero if @p max_version applies */
+    libp2p_protocol_handler_t handler;
+    void *user_data;
+    atomic_size_t max_concurrent;  /**< Handler invocations allowed at once (0 = unlimited) */
+    atomic_size_t active;          /**< Handler invocations currently running */
+    atomic_uint_fast64_t rejected; /**< Streams reset because @p max_concurrent was reached */
+    atomic_size_t refs;            /**< Registration plus running handlers */
+    struct libp2p_protocol_handler_entry *next;
+};
 
-        if (recv_result < 0)
+/**
+ * @brief Lookup snapshot: exact IDs in an open-addressed table, prefix and
+ * version entries in a list ordered by decreasing string length.
+ */
+struct libp2p_protocol_table
+{
+    size_t cap;                                  /**< Slot count (power of two) */
+    libp2p_protocol_handler_entry_t **slots;     /**< Linear-probed exact entries */
+    libp2p_protocol_handler_entry_t **matchers;  /**< Prefix and version entries */
+    size_t n_matchers;
+};
+
+/** @brief FNV-1a over a protocol ID. */
+static uint64_t id_hash(const char *id, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)id[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/**
+ * @brief Parse "MAJOR[.MINOR[.PATCH]]" that ends the string.
+ *
+ * @return 0 on success, -1 if @p s is not such a version
+ */
+static int parse_version(const char *s, uint32_t out[3])
+{
+    out[0] = out[1] = out[2] = 0;
+    for (int part = 0; part < 3; part++)
+    {
+        if (*s < '0' || *s > '9')
         {
             return -1;
         }
-
-        if (strcmp(buffer, LIBP2P_MULTISELECT_PROTO_ID "\n") != 0)
+        uint64_t v = 0;
+        while (*s >= '0' && *s <= '9')
         {
-            return -1;
+            v = v * 10 + (uint64_t)(*s++ - '0');
+            if (v > UINT32_MAX)
+            {
+                return -1;
+            }
         }
-
-        // Send protocol request
-        char protocol_request[LIBP2P_PROTOCOL_ID_MAX_LEN + 2];
-        snprintf(protocol_request, sizeof(protocol_request), "%s\n", protocol_id);
-        if (send_length_prefixed_message(mux_ctx, stream_id, protocol_request, 1) != 0)
+        out[part] = (uint32_t)v;
+        if (*s == '\0')
+        {
+            return 0;
+        }
+        if (*s++ != '.')
         {
             return -1;
         }
+    }
+    return -1;
+}
 
-        // Wait for protocol acknowledgment
-        if (recv_length_prefixed_message(mux_ctx, stream_id, is_initiator, buffer, sizeof(buffer)) < 0)
+static int version_cmp(const uint32_t a[3], const uint32_t b[3])
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (a[i] != b[i])
         {
-            return -1;
+            return a[i] < b[i] ? -1 : 1;
         }
+    }
+    return 0;
+}
 
-        char expected[LIBP2P_PROTOCOL_ID_MAX_LEN + 2];
-        snprintf(expected, sizeof(expected), "%s\n", protocol_id);
-        if (strcmp(buffer, expected) != 0)
+static int matcher_accepts(const libp2p_protocol_handler_entry_t *e, const char *id, size_t len)
+{
+    if (len < e->id_len || memcmp(id, e->protocol_id, e->id_len) != 0)
+    {
+        return 0;
+    }
+    if (e->match == MATCH_PREFIX)
+    {
+        return 1;
+    }
+    uint32_t v[3];
+    return parse_version(id + e->id_len, v) == 0 && version_cmp(v, e->min_version) >= 0 &&
+           (!e->has_max || version_cmp(v, e->max_version) < 0);
+}
+
+/**
+ * @brief Find the entry handling a requested protocol ID in a snapshot.
+ *
+ * @return Matching entry or NULL
+ */
+static libp2p_protocol_handler_entry_t *table_find(const struct libp2p_protocol_table *t, const char *id, size_t len)
+{
+    if (!t)
+    {
+        return NULL;
+    }
+    if (t->cap)
+    {
+        uint64_t h = id_hash(id, len);
+        for (size_t i = (size_t)h & (t->cap - 1);; i = (i + 1) & (t->cap - 1))
         {
-            return -1;
+            libp2p_protocol_handler_entry_t *e = t->slots[i];
+            if (!e)
+            {
+                break;
+            }
+            if (e->hash == h && e->id_len == len && memcmp(e->protocol_id, id, len) == 0)
+            {
+                return e;
+            }
         }
     }
-    else
+    for (size_t i = 0; i < t->n_matchers; i++)
     {
-        if (recv_length_prefixed_message(mux_ctx, stream_id, 0, buffer, sizeof(buffer)) < 0)
+        if (matcher_accepts(t->matchers[i], id, len))
         {
-            return -1;
+            return t->matchers[i];
         }
+    }
+    return NULL;
+}
 
-        if (strcmp(buffer, LIBP2P_MULTISELECT_PROTO_ID "\n") != 0)
+/**
+ * @brief Build a snapshot of the registered entries.
+ *
+ * @param registry Protocol handler registry (mutex held by the caller)
+ * @return New snapshot or NULL on allocation failure
+ */
+static struct libp2p_protocol_table *table_build(libp2p_protocol_handler_registry_t *registry)
+{
+    size_t n_exact = 0, n_matchers = 0;
+    for (libp2p_protocol_handler_entry_t *e = registry->handlers; e; e = e->next)
+    {
+        if (e->match == MATCH_EXACT)
         {
-            return -1;
+            n_exact++;
         }
-
-        // Send acknowledgment
-        if (send_length_prefixed_message(mux_ctx, stream_id, LIBP2P_MULTISELECT_PROTO_ID "\n", 0) != 0)
+        else
         {
-            return -1;
+            n_matchers++;
         }
-
-        // Receive protocol request
-        if (recv_length_prefixed_message(mux_ctx, stream_id, 0, buffer, sizeof(buffer)) < 0)
+    }
+    // keep the load factor at or below 1/2
+    size_t cap = 0;
+    if (n_exact)
+    {
+        cap = 8;
+        while (cap < n_exact * 2)
         {
-            return -1;
+            cap *= 2;
         }
+    }
+
+    struct libp2p_protocol_table *t = calloc(1, sizeof(*t) + (cap + n_matchers) * sizeof(libp2p_protocol_handler_entry_t *));
+    if (!t)
+    {
+        return NULL;
+    }
+    t->cap = cap;
+    t->slots = (libp2p_protocol_handler_entry_t **)(t + 1);
+    t->matchers = t->slots + cap;
 
-        // Verify it matches expected protocol
-        char expected[LIBP2P_PROTOCOL_ID_MAX_LEN + 2];
-        snprintf(expected, sizeof(expected), "%s\n", protocol_id);
-        if (strcmp(buffer, expected) != 0)
+    for (libp2p_protocol_handler_entry_t *e = registry->handlers; e; e = e->next)
+    {
+        if (e->match == MATCH_EXACT)
         {
-            return -1;
+            size_t i = (size_t)e->hash & (cap - 1);
+            while (t->slots[i])
+            {
+                i = (i + 1) & (cap - 1);
+            }
+            t->slots[i] = e;
+            continue;
+        }
+        // insertion sort: longest string first, earlier registration first on ties
+        size_t i = t->n_matchers++;
+        while (i > 0 && t->matchers[i - 1]->id_len < e->id_len)
+        {
+            t->matchers[i] = t->matchers[i - 1];
+            i--;
         }
+        t->matchers[i] = e;
+    }
+    return t;
+}
 
-        // Send protocol acknowledgment
-        if (send_length_prefixed_message(mux_ctx, stream_id, expected, 0) != 0)
+/**
+ * @brief Enter a lookup section.
+ *
+ * The snapshot loaded inside the section stays valid until ::read_exit.
+ *
+ * @return Token for ::read_exit
+ */
+static unsigned read_enter(libp2p_protocol_handler_registry_t *registry)
+{
+    for (;;)
+    {
+        unsigned e = atomic_load(&registry->epoch);
+        atomic_fetch_add(&registry->readers[e & 1u], 1);
+        // a writer that retired a snapshot since the load waits on the other counter
+        if (atomic_load(&registry->epoch) == e)
         {
-            return -1;
+            return e & 1u;
         }
+        atomic_fetch_sub(&registry->readers[e & 1u], 1);
     }
+}
 
-    return 0;
+static void read_exit(libp2p_protocol_handler_registry_t *registry, unsigned token)
+{
+    atomic_fetch_sub(&registry->readers[token], 1);
+}
+
+/**
+ * @brief Publish a new snapshot and free the old one once unused.
+ *
+ * @param registry Protocol handler registry (mutex held by the caller)
+ * @param t New snapshot
+ */
+static void table_publish(libp2p_protocol_handler_registry_t *registry, struct libp2p_protocol_table *t)
+{
+    struct libp2p_protocol_table *old = atomic_exchange(&registry->table, t);
+    unsigned parity = atomic_fetch_add(&registry->epoch, 1) & 1u;
+    while (atomic_load(&registry->readers[parity]) != 0)
+    {
+        sched_yield();
+    }
+    free(old);
+}
+
+static void entry_unref(libp2p_protocol_handler_entry_t *e)
+{
+    if (atomic_fetch_sub(&e->refs, 1) == 1)
+    {
+        free(e->protocol_id);
+        free(e);
+    }
 }
 
 /**
- * @brief Find a protocol handler in the registry.
+ * @brief Find the handler for a requested protocol and claim a slot.
  *
  * @param registry Protocol handler registry
- * @param protocol_id Protocol ID to find
- * @return Handler entry or NULL if not found
+ * @param id Requested protocol ID
+ * @param len Length of @p id
+ * @param over_limit Set to 1 if the entry is at its concurrency limit
+ * @return Entry to pass to ::release_entry, or NULL if none was claimed
  */
-static libp2p_protocol_handler_entry_t *find_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id)
+static libp2p_protocol_handler_entry_t *claim_entry(libp2p_protocol_handler_registry_t *registry, const char *id, size_t len, int *over_limit)
 {
-    pthread_mutex_lock(&registry->mutex);
+    unsigned token = read_enter(registry);
+    libp2p_protocol_handler_entry_t *e = table_find(atomic_load(&registry->table), id, len);
+    if (e)
+    {
+        size_t max = atomic_load(&e->max_concurrent);
+        size_t cur = atomic_load(&e->active);
+        do
+        {
+            if (max && cur >= max)
+            {
+                atomic_fetch_add(&e->rejected, 1);
+                *over_limit = 1;
+                e = NULL;
+                break;
+            }
+        } while (!atomic_compare_exchange_weak(&e->active, &cur, cur + 1));
+        if (e)
+        {
+            // keeps the entry alive if it is unregistered while the handler runs
+            atomic_fetch_add(&e->refs, 1);
+        }
+    }
+    read_exit(registry, token);
+    return e;
+}
 
-    libp2p_protocol_handler_entry_t *entry = registry->handlers;
-    while (entry)
+/**
+ * @brief Give back the concurrency slot taken by ::claim_entry.
+ *
+ * @param e Claimed entry
+ */
+static void release_entry(libp2p_protocol_handler_entry_t *e)
+{
+    atomic_fetch_sub(&e->active, 1);
+    entry_unref(e);
+}
+
+/**
+ * @brief Find a registration by its registered string.
+ *
+ * @param registry Protocol handler registry (mutex held by the caller)
+ * @param protocol_id Registered ID, prefix or version base
+ * @return Entry or NULL if not registered
+ */
+static libp2p_protocol_handler_entry_t *find_entry_locked(libp2p_protocol_handler_registry_t *registry, const char *protocol_id)
+{
+    for (libp2p_protocol_handler_entry_t *entry = registry->handlers; entry; entry = entry->next)
     {
         if (strcmp(entry->protocol_id, protocol_id) == 0)
         {
-            pthread_mutex_unlock(&registry->mutex);
             return entry;
         }
-        entry = entry->next;
     }
-
-    pthread_mutex_unlock(&registry->mutex);
     return NULL;
 }
 
@@ -138,81 +602,240 @@ static libp2p_protocol_handler_entry_t *find_protocol_handler(libp2p_protocol_ha
  * @brief Handle an incoming stream with protocol negotiation.
  *
  * @param ctx Protocol handler context
- * @param stream_id Stream identifier
+ * @param stream Accepted stream; freed before returning
  * @return 0 on success, negative on error
  */
-static int handle_incoming_stream(libp2p_protocol_handler_ctx_t *ctx, uint64_t stream_id)
+static int handle_incoming_stream(libp2p_protocol_handler_ctx_t *ctx, libp2p_stream_t *stream)
 {
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)ctx->muxer_ctx;
+    static const char header[] = LIBP2P_MULTISELECT_PROTO_ID "\n";
+    static const char na[] = LIBP2P_MULTISELECT_NA "\n";
     char buffer[512];
+    int result = -1;
 
-    // Receive multistream header
-    if (recv_length_prefixed_message(mx, stream_id, 0, buffer, sizeof(buffer)) < 0)
-    {
-        return -1;
-    }
+    // A silent or slow dialer may hold this pool worker for the
+    // negotiation deadline at most, not for the stream read timeout
+    uint64_t deadline = now_mono_ms() + LIBP2P_PROTOCOL_NEGOTIATION_TIMEOUT_MS;
 
-    if (strcmp(buffer, LIBP2P_MULTISELECT_PROTO_ID "\n") != 0)
+    // Receive multistream header and acknowledge it
+    if (read_lp_until(stream, buffer, sizeof(buffer), deadline) < 0 || strcmp(buffer, header) != 0 ||
+        libp2p_stream_write_lp(stream, header, sizeof(header) - 1) != 0)
     {
-        return -1;
+        goto out;
     }
 
-    // Send acknowledgment
-    if (send_length_prefixed_message(mx, stream_id, LIBP2P_MULTISELECT_PROTO_ID "\n", 0) != 0)
+    // Answer proposals until one names a registered protocol; the dialer
+    // may fall back to older versions on the same stream after an "na",
+    // but only a few times so one stream cannot probe the whole registry
+    libp2p_protocol_handler_entry_t *entry = NULL;
+    ssize_t len;
+    for (int proposals = 0;; proposals++)
     {
-        return -1;
+        if (proposals == LIBP2P_PROTOCOL_MAX_PROPOSALS)
+        {
+            stream_ops(stream)->stream_reset(stream);
+            goto out;
+        }
+        len = read_lp_until(stream, buffer, sizeof(buffer), deadline);
+        if (len < 0)
+        {
+            goto out;
+        }
+
+        // Remove trailing newline for lookup
+        if (len > 0 && buffer[len - 1] == '\n')
+        {
+            buffer[--len] = '\0';
+        }
+
+        // Find handler for this protocol and claim a concurrency slot
+        if ((size_t)len < LIBP2P_PROTOCOL_ID_MAX_LEN)
+        {
+            int over_limit = 0;
+            entry = claim_entry(ctx->registry, buffer, (size_t)len, &over_limit);
+            if (over_limit)
+            {
+                stream_ops(stream)->stream_reset(stream);
+                result = LIBP2P_PROTOCOL_HANDLER_ERR_BUSY;
+                goto out;
+            }
+        }
+        if (entry)
+        {
+            break;
+        }
+
+        // Send "na" (not available) response
+        if (libp2p_stream_write_lp(stream, na, sizeof(na) - 1) != 0)
+        {
+            goto out;
+        }
     }
 
-    // Receive protocol request
-    if (recv_length_prefixed_message(mx, stream_id, 0, buffer, sizeof(buffer)) < 0)
+    // Send protocol acknowledgment
+    char ack[LIBP2P_PROTOCOL_ID_MAX_LEN + 1];
+    memcpy(ack, buffer, (size_t)len);
+    ack[len] = '\n';
+    stream->protocol_id = strdup(buffer);
+    if (!stream->protocol_id || libp2p_stream_write_lp(stream, ack, (size_t)len + 1) != 0)
     {
-        return -1;
+        release_entry(entry);
+        goto out;
     }
 
-    // Remove trailing newline for lookup
-    size_t len = strlen(buffer);
-    if (len > 0 && buffer[len - 1] == '\n')
+    // Call the protocol handler
+    result = entry->handler(stream, entry->user_data);
+    release_entry(entry);
+
+out:
+    libp2p_stream_free(stream);
+    return result;
+}
+
+/** @brief Inbound stream waiting for a pool worker */
+struct libp2p_protocol_handler_job
+{
+    libp2p_protocol_handler_ctx_t *ctx;
+    libp2p_stream_t *stream;
+    struct libp2p_protocol_handler_job *next;
+};
+
+/**
+ * @brief Worker loop: negotiate and run handlers for queued streams.
+ *
+ * @param arg Protocol handler registry
+ * @return NULL
+ */
+static void *pool_worker(void *arg)
+{
+    libp2p_protocol_handler_registry_t *registry = (libp2p_protocol_handler_registry_t *)arg;
+    libp2p_protocol_handler_pool_t *pool = &registry->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;)
     {
-        buffer[len - 1] = '\0';
+        while (!pool->head && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        }
+        if (!pool->head)
+        {
+            break;
+        }
+
+        struct libp2p_protocol_handler_job *job = pool->head;
+        pool->head = job->next;
+        if (!pool->head)
+        {
+            pool->tail = NULL;
+        }
+        pool->queued--;
+        pool->running++;
+        libp2p_protocol_handler_ctx_t *ctx = job->ctx;
+        int skip = ctx->stop_flag || pool->shutdown;
+        pthread_mutex_unlock(&pool->mutex);
+
+        // Connections being torn down drop their queued streams
+        if (skip)
+        {
+            stream_ops(job->stream)->stream_reset(job->stream);
+            libp2p_stream_free(job->stream);
+        }
+        else
+        {
+            handle_incoming_stream(ctx, job->stream);
+        }
+        free(job);
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        if (!skip)
+        {
+            pool->completed++;
+        }
+        if (--ctx->pending == 0)
+        {
+            pthread_cond_broadcast(&ctx->idle);
+        }
     }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
 
-    // Find handler for this protocol
-    libp2p_protocol_handler_entry_t *entry = find_protocol_handler(ctx->registry, buffer);
-    if (!entry)
+/**
+ * @brief Start the pool workers if they are not running yet (pool mutex held).
+ *
+ * @param pool Worker pool
+ * @param registry Registry passed to the workers
+ * @return 0 if at least one worker is running, -1 otherwise
+ */
+static int pool_start_locked(libp2p_protocol_handler_pool_t *pool, libp2p_protocol_handler_registry_t *registry)
+{
+    if (pool->started)
     {
-        // Send "na" (not available) response
-        send_length_prefixed_message(mx, stream_id, LIBP2P_MULTISELECT_NA "\n", 0);
-        return -1;
+        return 0;
     }
 
-    // Send protocol acknowledgment
-    char ack[LIBP2P_PROTOCOL_ID_MAX_LEN + 2];
-    snprintf(ack, sizeof(ack), "%s\n", buffer);
-    if (send_length_prefixed_message(mx, stream_id, ack, 0) != 0)
+    pool->threads = calloc(pool->num_threads, sizeof(pthread_t));
+    if (!pool->threads)
     {
         return -1;
     }
-
-    // Create stream object
-    libp2p_stream_t *stream = calloc(1, sizeof(libp2p_stream_t));
-    if (!stream)
+    while (pool->started < pool->num_threads)
     {
-        return -1;
+        if (pthread_create(&pool->threads[pool->started], NULL, pool_worker, registry) != 0)
+        {
+            break;
+        }
+        pool->started++;
     }
+    return pool->started ? 0 : -1;
+}
 
-    stream->uconn = ctx->uconn;
-    stream->stream_id = stream_id;
-    stream->initiator = 0; // Incoming stream
-    stream->protocol_id = strdup(buffer);
-    stream->ctx = ctx->muxer_ctx;
-
-    // Call the protocol handler
-    int result = entry->handler(stream, entry->user_data);
+/**
+ * @brief Queue an inbound stream for a pool worker.
+ *
+ * The stream is reset when the queue is full so the remote sees the
+ * overload instead of a silent stall.
+ *
+ * @param ctx Protocol handler context owning the stream
+ * @param stream Accepted stream; owned by the pool afterwards
+ * @return 0 if queued, negative on error
+ */
+static int submit_incoming_stream(libp2p_protocol_handler_ctx_t *ctx, libp2p_stream_t *stream)
+{
+    libp2p_protocol_handler_pool_t *pool = &ctx->registry->pool;
+    struct libp2p_protocol_handler_job *job = calloc(1, sizeof(*job));
 
-    // Cleanup
-    libp2p_stream_free(stream);
+    pthread_mutex_lock(&pool->mutex);
+    if (!job || pool->shutdown || pool->queued >= pool->queue_cap || pool_start_locked(pool, ctx->registry) != 0)
+    {
+        pool->rejected++;
+        pthread_mutex_unlock(&pool->mutex);
+        free(job);
+        stream_ops(stream)->stream_reset(stream);
+        libp2p_stream_free(stream);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_BUSY;
+    }
 
-    return result;
+    job->ctx = ctx;
+    job->stream = stream;
+    if (pool->tail)
+    {
+        pool->tail->next = job;
+    }
+    else
+    {
+        pool->head = job;
+    }
+    pool->tail = job;
+    if (++pool->queued > pool->peak_queued)
+    {
+        pool->peak_queued = pool->queued;
+    }
+    ctx->pending++;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
 }
 
 /**
@@ -224,126 +847,311 @@ static int handle_incoming_stream(libp2p_protocol_handler_ctx_t *ctx, uint64_t s
 static void *protocol_handler_thread(void *arg)
 {
     libp2p_protocol_handler_ctx_t *ctx = (libp2p_protocol_handler_ctx_t *)arg;
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)ctx->muxer_ctx;
-
-    int frame_count = 0;
-    int stream_count = 0;
 
     while (!ctx->stop_flag)
     {
-        // Process one mplex frame
-        libp2p_mplex_err_t err = libp2p_mplex_process_one(mx);
-        if (err == LIBP2P_MPLEX_OK)
-        {
-            frame_count++;
-        }
-        else if (err != LIBP2P_MPLEX_ERR_AGAIN)
+        // Sleeps in the muxer until the peer opens a stream or the session ends
+        libp2p_stream_t *stream = NULL;
+        if (ctx->muxer.vt->accept_stream(&ctx->muxer, &stream) != LIBP2P_MUXER_OK)
         {
             break;
         }
+        stream->uconn = ctx->uconn;
+        stream->muxer = ctx->muxer.vt;
+        submit_incoming_stream(ctx, stream);
+    }
+
+    return NULL;
+}
+
+/* ===== Registry Management Implementation ===== */
+libp2p_protocol_handler_registry_t *libp2p_protocol_handler_registry_new(void)
+{
+    libp2p_protocol_handler_registry_t *registry = calloc(1, sizeof(libp2p_protocol_handler_registry_t));
+    if (!registry)
+    {
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&registry->mutex, NULL) != 0)
+    {
+        free(registry);
+        return NULL;
+    }
+
+    libp2p_protocol_handler_pool_t *pool = &registry->pool;
+    pool->num_threads = LIBP2P_PROTOCOL_HANDLER_WORKERS;
+    pool->queue_cap = LIBP2P_PROTOCOL_HANDLER_QUEUE;
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0)
+    {
+        pthread_mutex_destroy(&registry->mutex);
+        free(registry);
+        return NULL;
+    }
+    if (pthread_cond_init(&pool->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&pool->mutex);
+        pthread_mutex_destroy(&registry->mutex);
+        free(registry);
+        return NULL;
+    }
+
+    // Optional: without it outbound opens simply negotiate every time
+    registry->support = libp2p_protocol_support_cache_new(0);
+
+    return registry;
+}
+
+void libp2p_protocol_handler_registry_free(libp2p_protocol_handler_registry_t *registry)
+{
+    if (!registry)
+    {
+        return;
+    }
+
+    // Workers finish their current stream; streams still queued are reset
+    // and freed without being handled
+    libp2p_protocol_handler_pool_t *pool = &registry->pool;
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->mutex);
+    for (size_t i = 0; i < pool->started; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+
+    pthread_mutex_lock(&registry->mutex);
+
+    libp2p_protocol_handler_entry_t *entry = registry->handlers;
+    while (entry)
+    {
+        libp2p_protocol_handler_entry_t *next = entry->next;
+        entry_unref(entry);
+        entry = next;
+    }
+    free(atomic_load(&registry->table));
+
+    pthread_mutex_unlock(&registry->mutex);
+    pthread_mutex_destroy(&registry->mutex);
+    libp2p_protocol_support_cache_free(registry->support);
+    free(registry);
+}
+
+/**
+ * @brief Add a registration and publish it.
+ *
+ * @param registry Protocol handler registry
+ * @param entry New entry with its string and match set; freed on error
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+static int add_entry(libp2p_protocol_handler_registry_t *registry, libp2p_protocol_handler_entry_t *entry)
+{
+    pthread_mutex_lock(&registry->mutex);
+
+    if (find_entry_locked(registry, entry->protocol_id))
+    {
+        pthread_mutex_unlock(&registry->mutex);
+        free(entry->protocol_id);
+        free(entry);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_EXISTS;
+    }
+
+    entry->next = registry->handlers;
+    registry->handlers = entry;
+    struct libp2p_protocol_table *t = table_build(registry);
+    if (!t)
+    {
+        registry->handlers = entry->next;
+        pthread_mutex_unlock(&registry->mutex);
+        free(entry->protocol_id);
+        free(entry);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+    table_publish(registry, t);
+
+    pthread_mutex_unlock(&registry->mutex);
+    return LIBP2P_PROTOCOL_HANDLER_OK;
+}
+
+/**
+ * @brief Allocate an entry for a registered string.
+ *
+ * @return New entry or NULL on allocation failure
+ */
+static libp2p_protocol_handler_entry_t *entry_new(const char *protocol_id, match_kind_t match, libp2p_protocol_handler_t handler, void *user_data)
+{
+    libp2p_protocol_handler_entry_t *entry = calloc(1, sizeof(libp2p_protocol_handler_entry_t));
+    if (!entry)
+    {
+        return NULL;
+    }
+    entry->protocol_id = strdup(protocol_id);
+    if (!entry->protocol_id)
+    {
+        free(entry);
+        return NULL;
+    }
+    entry->id_len = strlen(protocol_id);
+    entry->hash = id_hash(protocol_id, entry->id_len);
+    entry->match = match;
+    entry->handler = handler;
+    entry->user_data = user_data;
+    atomic_init(&entry->max_concurrent, 0);
+    atomic_init(&entry->active, 0);
+    atomic_init(&entry->rejected, 0);
+    atomic_init(&entry->refs, 1);
+    return entry;
+}
+
+int libp2p_register_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id, libp2p_protocol_handler_t handler,
+                                     void *user_data)
+{
+    if (!registry || !protocol_id || !handler)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
+    }
+
+    if (strlen(protocol_id) >= LIBP2P_PROTOCOL_ID_MAX_LEN)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+
+    libp2p_protocol_handler_entry_t *entry = entry_new(protocol_id, MATCH_EXACT, handler, user_data);
+    if (!entry)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+    return add_entry(registry, entry);
+}
 
-        // Check for new incoming streams
-        libp2p_mplex_stream_t *new_stream = NULL;
-        if (libp2p_mplex_accept_stream(mx, &new_stream) == LIBP2P_MPLEX_OK && new_stream)
-        {
-            stream_count++;
-            // Handle the new stream
-            int result = handle_incoming_stream(ctx, new_stream->id);
-        }
+int libp2p_register_protocol_prefix_handler(libp2p_protocol_handler_registry_t *registry, const char *prefix, libp2p_protocol_handler_t handler,
+                                            void *user_data)
+{
+    if (!registry || !prefix || !handler)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
+    }
 
-        // Small delay to avoid busy waiting
-        usleep(1000); // 1ms
+    if (strlen(prefix) >= LIBP2P_PROTOCOL_ID_MAX_LEN)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
     }
 
-    return NULL;
+    libp2p_protocol_handler_entry_t *entry = entry_new(prefix, MATCH_PREFIX, handler, user_data);
+    if (!entry)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+    return add_entry(registry, entry);
 }
 
-/* ===== Registry Management Implementation ===== */
-libp2p_protocol_handler_registry_t *libp2p_protocol_handler_registry_new(void)
+int libp2p_register_protocol_version_handler(libp2p_protocol_handler_registry_t *registry, const char *base, const char *min_version,
+                                             const char *max_version, libp2p_protocol_handler_t handler, void *user_data)
 {
-    libp2p_protocol_handler_registry_t *registry = calloc(1, sizeof(libp2p_protocol_handler_registry_t));
-    if (!registry)
+    if (!registry || !base || !min_version || !handler)
     {
-        return NULL;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    if (pthread_mutex_init(&registry->mutex, NULL) != 0)
+    uint32_t min[3], max[3] = {0, 0, 0};
+    if (strlen(base) >= LIBP2P_PROTOCOL_ID_MAX_LEN || parse_version(min_version, min) != 0 ||
+        (max_version && (parse_version(max_version, max) != 0 || version_cmp(min, max) >= 0)))
     {
-        free(registry);
-        return NULL;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
     }
 
-    return registry;
+    libp2p_protocol_handler_entry_t *entry = entry_new(base, MATCH_VERSION, handler, user_data);
+    if (!entry)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+    memcpy(entry->min_version, min, sizeof(min));
+    memcpy(entry->max_version, max, sizeof(max));
+    entry->has_max = max_version != NULL;
+    return add_entry(registry, entry);
 }
 
-void libp2p_protocol_handler_registry_free(libp2p_protocol_handler_registry_t *registry)
+int libp2p_unregister_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id)
 {
-    if (!registry)
+    if (!registry || !protocol_id)
     {
-        return;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
     pthread_mutex_lock(&registry->mutex);
 
-    libp2p_protocol_handler_entry_t *entry = registry->handlers;
-    while (entry)
+    libp2p_protocol_handler_entry_t **link = &registry->handlers;
+    while (*link && strcmp((*link)->protocol_id, protocol_id) != 0)
     {
-        libp2p_protocol_handler_entry_t *next = entry->next;
-        free(entry);
-        entry = next;
+        link = &(*link)->next;
+    }
+    libp2p_protocol_handler_entry_t *entry = *link;
+    if (!entry)
+    {
+        pthread_mutex_unlock(&registry->mutex);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+    }
+
+    *link = entry->next;
+    struct libp2p_protocol_table *t = table_build(registry);
+    if (!t)
+    {
+        entry->next = *link;
+        *link = entry;
+        pthread_mutex_unlock(&registry->mutex);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
     }
+    // no lookup can reach the entry once the old snapshot is retired
+    table_publish(registry, t);
+    entry_unref(entry);
 
     pthread_mutex_unlock(&registry->mutex);
-    pthread_mutex_destroy(&registry->mutex);
-    free(registry);
+    return LIBP2P_PROTOCOL_HANDLER_OK;
 }
 
-int libp2p_register_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id, libp2p_protocol_handler_t handler,
-                                     void *user_data)
+libp2p_protocol_support_cache_t *libp2p_protocol_handler_support_cache(libp2p_protocol_handler_registry_t *registry)
 {
-    if (!registry || !protocol_id || !handler)
-    {
-        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
-    }
+    return registry ? registry->support : NULL;
+}
 
-    if (strlen(protocol_id) >= LIBP2P_PROTOCOL_ID_MAX_LEN)
+bool libp2p_protocol_handler_supports(const char *protocol_id, void *registry)
+{
+    libp2p_protocol_handler_registry_t *reg = (libp2p_protocol_handler_registry_t *)registry;
+    if (!reg || !protocol_id)
     {
-        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+        return false;
     }
+    unsigned token = read_enter(reg);
+    bool found = table_find(atomic_load(&reg->table), protocol_id, strlen(protocol_id)) != NULL;
+    read_exit(reg, token);
+    return found;
+}
 
-    pthread_mutex_lock(&registry->mutex);
-
-    // Check if protocol already exists
-    libp2p_protocol_handler_entry_t *existing = registry->handlers;
-    while (existing)
+int libp2p_protocol_handler_set_workers(libp2p_protocol_handler_registry_t *registry, size_t workers, size_t queue_cap)
+{
+    if (!registry)
     {
-        if (strcmp(existing->protocol_id, protocol_id) == 0)
-        {
-            pthread_mutex_unlock(&registry->mutex);
-            return LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_EXISTS;
-        }
-        existing = existing->next;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    // Create new entry
-    libp2p_protocol_handler_entry_t *entry = calloc(1, sizeof(libp2p_protocol_handler_entry_t));
-    if (!entry)
+    libp2p_protocol_handler_pool_t *pool = &registry->pool;
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->started)
     {
-        pthread_mutex_unlock(&registry->mutex);
+        pthread_mutex_unlock(&pool->mutex);
         return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
     }
-
-    strncpy(entry->protocol_id, protocol_id, LIBP2P_PROTOCOL_ID_MAX_LEN - 1);
-    entry->handler = handler;
-    entry->user_data = user_data;
-    entry->next = registry->handlers;
-    registry->handlers = entry;
-
-    pthread_mutex_unlock(&registry->mutex);
+    pool->num_threads = workers ? workers : LIBP2P_PROTOCOL_HANDLER_WORKERS;
+    pool->queue_cap = queue_cap ? queue_cap : LIBP2P_PROTOCOL_HANDLER_QUEUE;
+    pthread_mutex_unlock(&pool->mutex);
     return LIBP2P_PROTOCOL_HANDLER_OK;
 }
 
-int libp2p_unregister_protocol_handler(libp2p_protocol_handler_registry_t *registry, const char *protocol_id)
+int libp2p_protocol_handler_set_concurrency(libp2p_protocol_handler_registry_t *registry, const char *protocol_id, size_t max_concurrent)
 {
     if (!registry || !protocol_id)
     {
@@ -351,32 +1159,41 @@ int libp2p_unregister_protocol_handler(libp2p_protocol_handler_registry_t *regis
     }
 
     pthread_mutex_lock(&registry->mutex);
+    libp2p_protocol_handler_entry_t *entry = find_entry_locked(registry, protocol_id);
+    if (entry)
+    {
+        atomic_store(&entry->max_concurrent, max_concurrent);
+    }
+    pthread_mutex_unlock(&registry->mutex);
 
-    libp2p_protocol_handler_entry_t *entry = registry->handlers;
-    libp2p_protocol_handler_entry_t *prev = NULL;
+    return entry ? LIBP2P_PROTOCOL_HANDLER_OK : LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+}
 
-    while (entry)
+int libp2p_protocol_handler_get_stats(libp2p_protocol_handler_registry_t *registry, libp2p_protocol_handler_stats_t *out)
+{
+    if (!registry || !out)
     {
-        if (strcmp(entry->protocol_id, protocol_id) == 0)
-        {
-            if (prev)
-            {
-                prev->next = entry->next;
-            }
-            else
-            {
-                registry->handlers = entry->next;
-            }
-            free(entry);
-            pthread_mutex_unlock(&registry->mutex);
-            return LIBP2P_PROTOCOL_HANDLER_OK;
-        }
-        prev = entry;
-        entry = entry->next;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
+    uint64_t limited = 0;
+    pthread_mutex_lock(&registry->mutex);
+    for (libp2p_protocol_handler_entry_t *entry = registry->handlers; entry; entry = entry->next)
+    {
+        limited += atomic_load(&entry->rejected);
+    }
     pthread_mutex_unlock(&registry->mutex);
-    return LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+
+    libp2p_protocol_handler_pool_t *pool = &registry->pool;
+    pthread_mutex_lock(&pool->mutex);
+    out->workers = pool->started;
+    out->queued = pool->queued;
+    out->peak_queued = pool->peak_queued;
+    out->running = pool->running;
+    out->completed = pool->completed;
+    out->rejected = pool->rejected + limited;
+    pthread_mutex_unlock(&pool->mutex);
+    return LIBP2P_PROTOCOL_HANDLER_OK;
 }
 
 /* ===== Stream Management Implementation ===== */
@@ -396,16 +1213,25 @@ libp2p_protocol_handler_ctx_t *libp2p_protocol_handler_ctx_new(libp2p_protocol_h
 
     ctx->registry = registry;
     ctx->uconn = uconn;
-    ctx->muxer_ctx = libp2p_mplex_ctx_new(uconn->conn);
-    if (!ctx->muxer_ctx)
+    ctx->muxer.vt = (uconn->muxer && uconn->muxer->vt) ? uconn->muxer->vt : libp2p_mplex_vtbl();
+    if (!ctx->muxer.vt->session_new || ctx->muxer.vt->session_new(&ctx->muxer, uconn->conn, uconn->dialer) != LIBP2P_MUXER_OK)
     {
         free(ctx);
         return NULL;
     }
+    ctx->muxer_ctx = ctx->muxer.ctx;
 
     if (pthread_mutex_init(&ctx->mutex, NULL) != 0)
     {
-        libp2p_mplex_ctx_free((libp2p_mplex_ctx_t *)ctx->muxer_ctx);
+        ctx->muxer.vt->session_free(&ctx->muxer);
+        free(ctx);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&ctx->idle, NULL) != 0)
+    {
+        pthread_mutex_destroy(&ctx->mutex);
+        ctx->muxer.vt->session_free(&ctx->muxer);
         free(ctx);
         return NULL;
     }
@@ -421,7 +1247,6 @@ int libp2p_protocol_handler_start(libp2p_protocol_handler_ctx_t *ctx)
     }
 
     ctx->stop_flag = 0;
-
     if (pthread_create(&ctx->handler_thread, NULL, protocol_handler_thread, ctx) != 0)
     {
         return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
@@ -438,6 +1263,8 @@ void libp2p_protocol_handler_stop(libp2p_protocol_handler_ctx_t *ctx)
     }
 
     ctx->stop_flag = 1;
+    // Wake the handler thread if it is blocked waiting for a stream
+    ctx->muxer.vt->session_stop(&ctx->muxer);
     pthread_join(ctx->handler_thread, NULL);
 }
 
@@ -453,13 +1280,71 @@ void libp2p_protocol_handler_ctx_free(libp2p_protocol_handler_ctx_t *ctx)
         libp2p_protocol_handler_stop(ctx);
     }
 
-    libp2p_mplex_ctx_free((libp2p_mplex_ctx_t *)ctx->muxer_ctx);
+    // Pool workers may still hold streams of this connection
+    libp2p_protocol_handler_pool_t *pool = &ctx->registry->pool;
+    pthread_mutex_lock(&pool->mutex);
+    while (ctx->pending > 0)
+    {
+        pthread_cond_wait(&ctx->idle, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    ctx->muxer.vt->session_free(&ctx->muxer);
+    pthread_cond_destroy(&ctx->idle);
     pthread_mutex_destroy(&ctx->mutex);
     free(ctx);
 }
 
 /* ===== Stream Operations Implementation ===== */
 
+/**
+ * @brief Open a stream on a muxer session and negotiate a protocol.
+ *
+ * @param mx Muxer session
+ * @param uconn Upgraded connection carrying the session
+ * @param protocol_id Protocol to negotiate
+ * @param support Cache to record the outcome in (may be NULL)
+ * @param lazy Non-zero to return before the reply arrives; it is then
+ *        checked on the first read
+ * @param stream Output stream on success
+ * @return LIBP2P_PROTOCOL_HANDLER_OK or error code
+ */
+static int open_negotiated_stream(libp2p_muxer_t *mx, libp2p_uconn_t *uconn, const char *protocol_id, libp2p_protocol_support_cache_t *support,
+                                  int lazy, libp2p_stream_t **stream)
+{
+    libp2p_stream_t *new_stream = NULL;
+    if (mx->vt->open_stream(mx, NULL, 0, &new_stream) != LIBP2P_MUXER_OK)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+    }
+    new_stream->uconn = uconn;
+    new_stream->muxer = mx->vt;
+    new_stream->support = support;
+
+    new_stream->protocol_id = strdup(protocol_id);
+    if (!new_stream->protocol_id)
+    {
+        mx->vt->stream_reset(new_stream);
+        libp2p_stream_free(new_stream);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+
+    if (negotiate_protocol(new_stream, protocol_id) != 0)
+    {
+        mx->vt->stream_reset(new_stream);
+        libp2p_stream_free(new_stream);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+    }
+    if (!lazy && confirm_protocol(new_stream) != 0)
+    {
+        libp2p_stream_free(new_stream);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+    }
+
+    *stream = new_stream;
+    return LIBP2P_PROTOCOL_HANDLER_OK;
+}
+
 int libp2p_protocol_open_stream(libp2p_uconn_t *uconn, const char *protocol_id, libp2p_stream_t **stream)
 {
     if (!uconn || !protocol_id || !stream)
@@ -467,115 +1352,147 @@ int libp2p_protocol_open_stream(libp2p_uconn_t *uconn, const char *protocol_id,
         return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    // Create mplex context for this connection
-    libp2p_mplex_ctx_t *mx = libp2p_mplex_ctx_new(uconn->conn);
+    // Create a muxer session for this connection; the stream owns it
+    libp2p_muxer_t *mx = calloc(1, sizeof(*mx));
     if (!mx)
     {
         return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
     }
-
-    // Open a new stream
-    uint64_t stream_id;
-    if (libp2p_mplex_stream_open(mx, NULL, 0, &stream_id) != LIBP2P_MPLEX_OK)
+    mx->vt = (uconn->muxer && uconn->muxer->vt) ? uconn->muxer->vt : libp2p_mplex_vtbl();
+    if (!mx->vt->session_new || mx->vt->session_new(mx, uconn->conn, uconn->dialer) != LIBP2P_MUXER_OK)
     {
-        libp2p_mplex_ctx_free(mx);
-        return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+        free(mx);
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
     }
 
-    // Perform protocol negotiation
-    if (negotiate_protocol(mx, stream_id, protocol_id, 1) != 0)
+    int rc = open_negotiated_stream(mx, uconn, protocol_id, NULL, 0, stream);
+    if (rc != LIBP2P_PROTOCOL_HANDLER_OK)
     {
-        libp2p_mplex_ctx_free(mx);
-        return LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+        mx->vt->session_free(mx);
+        free(mx);
+        return rc;
     }
+    (*stream)->session = mx;
+    return rc;
+}
 
-    // Create stream object
-    libp2p_stream_t *new_stream = calloc(1, sizeof(libp2p_stream_t));
-    if (!new_stream)
+int libp2p_protocol_handler_open_stream(libp2p_protocol_handler_ctx_t *ctx, const char *protocol_id, libp2p_stream_t **stream)
+{
+    if (!ctx || !protocol_id || !stream)
     {
-        libp2p_mplex_ctx_free(mx);
-        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    new_stream->uconn = uconn;
-    new_stream->stream_id = stream_id;
-    new_stream->initiator = 1;
-    new_stream->protocol_id = strdup(protocol_id);
-    new_stream->ctx = mx;
-
-    *stream = new_stream;
-    return LIBP2P_PROTOCOL_HANDLER_OK;
+    // Only a protocol the peer is known to speak is confirmed lazily: if it
+    // were refused, the caller's first write would be read as a proposal
+    libp2p_protocol_support_cache_t *support = ctx->registry->support;
+    const peer_id_t *peer = ctx->uconn ? ctx->uconn->remote_peer : NULL;
+    int lazy = libp2p_protocol_support_lookup(support, peer, protocol_id) == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+    return open_negotiated_stream(&ctx->muxer, ctx->uconn, protocol_id, support, lazy, stream);
 }
 
-int libp2p_protocol_open_stream_with_context(libp2p_mplex_ctx_t *mx, libp2p_uconn_t *uconn, const char *protocol_id, libp2p_stream_t **stream)
+int libp2p_protocol_handler_open_stream_any(libp2p_protocol_handler_ctx_t *ctx, const char *const *protocol_ids, size_t num_protocols,
+                                            libp2p_stream_t **stream)
 {
-    if (!mx || !uconn || !protocol_id || !stream)
+    if (!ctx || !protocol_ids || !stream)
     {
         return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    // Open a new stream using the existing mplex context
-    uint64_t stream_id;
-    libp2p_mplex_err_t open_result = libp2p_mplex_stream_open(mx, NULL, 0, &stream_id);
+    libp2p_protocol_support_cache_t *support = ctx->registry->support;
+    const peer_id_t *peer = ctx->uconn ? ctx->uconn->remote_peer : NULL;
+
+    // A protocol the peer is known to speak needs no round trip up front
+    size_t first = num_protocols;
+    for (size_t i = 0; i < num_protocols; i++)
+    {
+        libp2p_protocol_support_t known = libp2p_protocol_support_lookup(support, peer, protocol_ids[i]);
+        if (known == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED)
+        {
+            return open_negotiated_stream(&ctx->muxer, ctx->uconn, protocol_ids[i], support, 1, stream);
+        }
+        if (known != LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED && first == num_protocols)
+        {
+            first = i;
+        }
+    }
+    if (first == num_protocols)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+    }
 
-    if (open_result != LIBP2P_MPLEX_OK)
+    libp2p_stream_t *s = NULL;
+    int rc = open_negotiated_stream(&ctx->muxer, ctx->uconn, protocol_ids[first], support, 1, &s);
+    if (rc != LIBP2P_PROTOCOL_HANDLER_OK)
     {
+        return rc;
+    }
 
-        // Add more details about the error
-        const char *err_str = "UNKNOWN";
-        switch (open_result)
+    // Walk the remaining candidates on the same stream until one is accepted
+    static const char header[] = LIBP2P_MULTISELECT_PROTO_ID "\n";
+    char buffer[512];
+    s->negotiation = 0;
+    rc = LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+    if (libp2p_stream_read_lp(s, buffer, sizeof(buffer)) >= 0 && strcmp(buffer, header) == 0)
+    {
+        size_t i = first;
+        for (;;)
         {
-            case LIBP2P_MPLEX_ERR_NULL_PTR:
-                err_str = "NULL_PTR";
-                break;
-            case LIBP2P_MPLEX_ERR_HANDSHAKE:
-                err_str = "HANDSHAKE";
-                break;
-            case LIBP2P_MPLEX_ERR_INTERNAL:
-                err_str = "INTERNAL";
-                break;
-            case LIBP2P_MPLEX_ERR_PROTO_MAL:
-                err_str = "PROTO_MAL";
-                break;
-            case LIBP2P_MPLEX_ERR_TIMEOUT:
-                err_str = "TIMEOUT";
-                break;
-            case LIBP2P_MPLEX_ERR_EOF:
-                err_str = "EOF";
+            int reply = read_proposal_reply(s);
+            if (reply == 0)
+            {
+                *stream = s;
+                return LIBP2P_PROTOCOL_HANDLER_OK;
+            }
+            if (reply < 0)
+            {
                 break;
-            case LIBP2P_MPLEX_ERR_AGAIN:
-                err_str = "AGAIN";
+            }
+            do
+            {
+                i++;
+            } while (i < num_protocols && libp2p_protocol_support_lookup(support, peer, protocol_ids[i]) == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED);
+            if (i == num_protocols)
+            {
+                rc = LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
                 break;
-            case LIBP2P_MPLEX_ERR_RESET:
-                err_str = "RESET";
+            }
+
+            size_t len = strlen(protocol_ids[i]);
+            char *next = len <= LIBP2P_PROTOCOL_ID_MAX_LEN ? malloc(len + 2) : NULL;
+            if (!next)
+            {
                 break;
-            default:
+            }
+            memcpy(next, protocol_ids[i], len);
+            next[len] = '\n';
+            next[len + 1] = '\0';
+            int wrc = libp2p_stream_write_lp(s, next, len + 1);
+            next[len] = '\0';
+            free(s->protocol_id);
+            s->protocol_id = next;
+            if (wrc != LIBP2P_PROTOCOL_HANDLER_OK)
+            {
                 break;
+            }
         }
-        return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
     }
 
-    // Perform protocol negotiation
-    if (negotiate_protocol(mx, stream_id, protocol_id, 1) != 0)
-    {
-        return LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
-    }
+    ctx->muxer.vt->stream_reset(s);
+    libp2p_stream_free(s);
+    return rc;
+}
 
-    // Create stream object
-    libp2p_stream_t *new_stream = calloc(1, sizeof(libp2p_stream_t));
-    if (!new_stream)
+int libp2p_protocol_open_stream_with_context(libp2p_mplex_ctx_t *mx, libp2p_uconn_t *uconn, const char *protocol_id, libp2p_stream_t **stream)
+{
+    if (!mx || !uconn || !protocol_id || !stream)
     {
-        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    new_stream->uconn = uconn;
-    new_stream->stream_id = stream_id;
-    new_stream->initiator = 1;
-    new_stream->protocol_id = strdup(protocol_id);
-    new_stream->ctx = mx; // Reuse the existing context
-
-    *stream = new_stream;
-    return LIBP2P_PROTOCOL_HANDLER_OK;
+    // Open a new stream using the existing mplex context
+    libp2p_muxer_t muxer = {.vt = libp2p_mplex_vtbl(), .ctx = mx};
+    return open_negotiated_stream(&muxer, uconn, protocol_id, NULL, 0, stream);
 }
 
 ssize_t libp2p_stream_read(libp2p_stream_t *stream, void *buf, size_t len)
@@ -585,49 +1502,43 @@ ssize_t libp2p_stream_read(libp2p_stream_t *stream, void *buf, size_t len)
         return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)stream->ctx;
+    // Sleeps in the muxer until data for this stream is dispatched
+    if (stream->negotiation != 0 && libp2p_stream_await_protocol(stream) != LIBP2P_PROTOCOL_HANDLER_OK)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+    }
 
-    // Retry logic with mplex frame processing (similar to recv_length_prefixed_message)
-    const int max_retries = 10; // Reduced from 100 to 10 retries
-    for (int retry = 1; retry <= max_retries; retry++)
+    ssize_t n = stream_ops(stream)->stream_read(stream, buf, len);
+    if (n >= 0)
     {
-        size_t bytes_read = 0;
-        libp2p_mplex_err_t recv_result = libp2p_mplex_stream_recv(mx, stream->stream_id, stream->initiator, (uint8_t *)buf, len, &bytes_read);
+        return n; // 0 at end of stream
+    }
+    return n == LIBP2P_MUXER_ERR_TIMEOUT ? LIBP2P_PROTOCOL_HANDLER_ERR_TIMEOUT : LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+}
 
-        if (recv_result != LIBP2P_MPLEX_OK)
-        {
-            if (recv_result == LIBP2P_MPLEX_ERR_EOF)
-            {
-                return 0; // End of stream
-            }
-            return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
-        }
+int libp2p_stream_await_protocol(libp2p_stream_t *stream)
+{
+    if (!stream)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
+    }
 
-        if (bytes_read > 0)
-        {
-            return (ssize_t)bytes_read;
-        }
+    if (stream->negotiation > 0 && confirm_protocol(stream) != 0)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+    }
+    return stream->negotiation < 0 ? LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT : LIBP2P_PROTOCOL_HANDLER_OK;
+}
 
-        // No data available, process incoming frames
-        libp2p_mplex_err_t process_result = libp2p_mplex_process_one(mx);
-        if (process_result == LIBP2P_MPLEX_OK)
-        {
-            // Successfully processed a frame, try reading again immediately
-            continue;
-        }
-        else if (process_result == LIBP2P_MPLEX_ERR_AGAIN)
-        {
-            // No data to process, add small delay
-            usleep(1000); // 1ms
-        }
-        else
-        {
-            // Error in processing
-            return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
-        }
+int libp2p_stream_set_read_timeout(libp2p_stream_t *stream, int timeout_ms)
+{
+    if (!stream)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    return 0; // Timeout - no data received
+    stream->read_timeout_ms = timeout_ms;
+    return LIBP2P_PROTOCOL_HANDLER_OK;
 }
 
 ssize_t libp2p_stream_write(libp2p_stream_t *stream, const void *data, size_t len)
@@ -637,13 +1548,52 @@ ssize_t libp2p_stream_write(libp2p_stream_t *stream, const void *data, size_t le
         return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
     }
 
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)stream->ctx;
-    if (libp2p_mplex_stream_send(mx, stream->stream_id, stream->initiator, (const uint8_t *)data, len) != LIBP2P_MPLEX_OK)
+    ssize_t n = stream_ops(stream)->stream_write(stream, data, len);
+    if (n < 0)
+    {
+        return n == LIBP2P_MUXER_ERR_TIMEOUT ? LIBP2P_PROTOCOL_HANDLER_ERR_TIMEOUT : LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
+    }
+    return n;
+}
+
+int libp2p_stream_write_lp(libp2p_stream_t *stream, const void *data, size_t len)
+{
+    if (!stream || (!data && len))
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
+    }
+
+    // Short messages (all of multistream-select) go out as a single write
+    uint8_t small[10 + LIBP2P_PROTOCOL_ID_MAX_LEN + 2];
+    size_t varint_len = 0;
+    if (unsigned_varint_encode(len, small, 10, &varint_len) != UNSIGNED_VARINT_OK)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    }
+    if (varint_len + len <= sizeof(small))
+    {
+        if (len)
+        {
+            memcpy(small + varint_len, data, len);
+        }
+        return libp2p_stream_write(stream, small, varint_len + len) != (ssize_t)(varint_len + len) ? LIBP2P_PROTOCOL_HANDLER_ERR_STREAM
+                                                                                                   : LIBP2P_PROTOCOL_HANDLER_OK;
+    }
+
+    if (libp2p_stream_write(stream, small, varint_len) != (ssize_t)varint_len || libp2p_stream_write(stream, data, len) != (ssize_t)len)
     {
         return LIBP2P_PROTOCOL_HANDLER_ERR_STREAM;
     }
+    return LIBP2P_PROTOCOL_HANDLER_OK;
+}
 
-    return (ssize_t)len;
+ssize_t libp2p_stream_read_lp(libp2p_stream_t *stream, void *buf, size_t max_len)
+{
+    if (!stream || !buf)
+    {
+        return LIBP2P_PROTOCOL_HANDLER_ERR_NULL_PTR;
+    }
+    return read_lp_until(stream, buf, max_len, 0);
 }
 
 void libp2p_stream_close(libp2p_stream_t *stream)
@@ -653,8 +1603,7 @@ void libp2p_stream_close(libp2p_stream_t *stream)
         return;
     }
 
-    libp2p_mplex_ctx_t *mx = (libp2p_mplex_ctx_t *)stream->ctx;
-    libp2p_mplex_stream_close(mx, stream->stream_id, stream->initiator);
+    stream_ops(stream)->stream_close(stream);
 }
 
 void libp2p_stream_free(libp2p_stream_t *stream)
@@ -665,6 +1614,13 @@ void libp2p_stream_free(libp2p_stream_t *stream)
     }
 
     free(stream->protocol_id);
+    if (stream->session)
+    {
+        // Ends the session libp2p_protocol_open_stream() created, including
+        // any reader thread it runs
+        stream->session->vt->session_free(stream->session);
+        free(stream->session);
+    }
     free(stream);
 }
 
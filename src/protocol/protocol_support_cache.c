@@ -0,0 +1,401 @@
+#include "protocol/protocol_support_cache.h"
+#include "protocol/tcp/protocol_tcp_util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One protocol ID a peer accepted or rejected.
+typedef struct
+{
+    char *id;
+    uint32_t hash;
+    uint8_t supported;
+    uint64_t expires_ms; // rejections seen in negotiation only; 0 = never
+} support_id_t;
+
+typedef struct support_peer
+{
+    uint8_t *key;
+    size_t key_len;
+    uint32_t hash;
+    struct support_peer *chain;    // next peer in the same bucket
+    struct support_peer *lru_prev; // towards the most recently used peer
+    struct support_peer *lru_next; // towards the least recently used peer
+    uint64_t listed_until;         // ids hold the peer's full advertised list until then; 0 = never
+    support_id_t *ids;
+    size_t num_ids;
+    size_t cap_ids;
+} support_peer_t;
+
+struct libp2p_protocol_support_cache
+{
+    pthread_mutex_t mutex;
+    support_peer_t **buckets;
+    size_t num_buckets; // power of two
+    size_t num_peers;
+    size_t max_peers;
+    support_peer_t *lru_head;
+    support_peer_t *lru_tail;
+    uint64_t reject_ttl_ms;
+};
+
+static uint32_t fnv1a(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void peer_free(support_peer_t *p)
+{
+    if (!p)
+    {
+        return;
+    }
+    for (size_t i = 0; i < p->num_ids; i++)
+    {
+        free(p->ids[i].id);
+    }
+    free(p->ids);
+    free(p->key);
+    free(p);
+}
+
+static void lru_unlink(libp2p_protocol_support_cache_t *c, support_peer_t *p)
+{
+    if (p->lru_prev)
+        p->lru_prev->lru_next = p->lru_next;
+    else
+        c->lru_head = p->lru_next;
+    if (p->lru_next)
+        p->lru_next->lru_prev = p->lru_prev;
+    else
+        c->lru_tail = p->lru_prev;
+    p->lru_prev = p->lru_next = NULL;
+}
+
+static void lru_push_front(libp2p_protocol_support_cache_t *c, support_peer_t *p)
+{
+    p->lru_prev = NULL;
+    p->lru_next = c->lru_head;
+    if (c->lru_head)
+        c->lru_head->lru_prev = p;
+    c->lru_head = p;
+    if (!c->lru_tail)
+        c->lru_tail = p;
+}
+
+static support_peer_t **bucket_of(libp2p_protocol_support_cache_t *c, uint32_t hash) { return &c->buckets[hash & (c->num_buckets - 1)]; }
+
+// Unlink a peer from its bucket and the LRU list and free it.
+static void peer_remove(libp2p_protocol_support_cache_t *c, support_peer_t *p)
+{
+    for (support_peer_t **pp = bucket_of(c, p->hash); *pp; pp = &(*pp)->chain)
+    {
+        if (*pp == p)
+        {
+            *pp = p->chain;
+            break;
+        }
+    }
+    lru_unlink(c, p);
+    c->num_peers--;
+    peer_free(p);
+}
+
+// Find a peer and mark it most recently used; optionally create it.
+static support_peer_t *peer_get(libp2p_protocol_support_cache_t *c, const peer_id_t *peer, int create)
+{
+    uint32_t hash = fnv1a(peer->bytes, peer->size);
+    for (support_peer_t *p = *bucket_of(c, hash); p; p = p->chain)
+    {
+        if (p->hash == hash && p->key_len == peer->size && memcmp(p->key, peer->bytes, peer->size) == 0)
+        {
+            if (c->lru_head != p)
+            {
+                lru_unlink(c, p);
+                lru_push_front(c, p);
+            }
+            return p;
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+
+    support_peer_t *p = calloc(1, sizeof(*p));
+    if (!p)
+    {
+        return NULL;
+    }
+    p->key = malloc(peer->size ? peer->size : 1);
+    if (!p->key)
+    {
+        free(p);
+        return NULL;
+    }
+    memcpy(p->key, peer->bytes, peer->size);
+    p->key_len = peer->size;
+    p->hash = hash;
+
+    if (c->num_peers >= c->max_peers && c->lru_tail)
+    {
+        peer_remove(c, c->lru_tail);
+    }
+    support_peer_t **b = bucket_of(c, hash);
+    p->chain = *b;
+    *b = p;
+    lru_push_front(c, p);
+    c->num_peers++;
+    return p;
+}
+
+static support_id_t *id_find(support_peer_t *p, const char *id, uint32_t hash)
+{
+    for (size_t i = 0; i < p->num_ids; i++)
+    {
+        if (p->ids[i].hash == hash && strcmp(p->ids[i].id, id) == 0)
+        {
+            return &p->ids[i];
+        }
+    }
+    return NULL;
+}
+
+static void id_drop(support_peer_t *p, size_t i)
+{
+    free(p->ids[i].id);
+    p->ids[i] = p->ids[--p->num_ids];
+}
+
+// Append an id; when the peer is full the oldest entry is replaced.
+// The caller sets its state.
+static support_id_t *id_add(support_peer_t *p, const char *id, uint32_t hash)
+{
+    char *copy = strdup(id);
+    if (!copy)
+    {
+        return NULL;
+    }
+    if (p->num_ids >= LIBP2P_PROTOCOL_SUPPORT_MAX_IDS)
+    {
+        free(p->ids[0].id);
+        memmove(&p->ids[0], &p->ids[1], (p->num_ids - 1) * sizeof(p->ids[0]));
+        p->num_ids--;
+        p->listed_until = 0; // the advertised list is no longer whole
+    }
+    else if (p->num_ids == p->cap_ids)
+    {
+        size_t cap = p->cap_ids ? p->cap_ids * 2 : 4;
+        if (cap > LIBP2P_PROTOCOL_SUPPORT_MAX_IDS)
+            cap = LIBP2P_PROTOCOL_SUPPORT_MAX_IDS;
+        support_id_t *ids = realloc(p->ids, cap * sizeof(*ids));
+        if (!ids)
+        {
+            free(copy);
+            return NULL;
+        }
+        p->ids = ids;
+        p->cap_ids = cap;
+    }
+    support_id_t *e = &p->ids[p->num_ids++];
+    e->id = copy;
+    e->hash = hash;
+    e->supported = 0;
+    e->expires_ms = 0;
+    return e;
+}
+
+libp2p_protocol_support_cache_t *libp2p_protocol_support_cache_new(size_t max_peers)
+{
+    libp2p_protocol_support_cache_t *c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        return NULL;
+    }
+    c->max_peers = max_peers ? max_peers : LIBP2P_PROTOCOL_SUPPORT_PEERS;
+    c->reject_ttl_ms = LIBP2P_PROTOCOL_SUPPORT_REJECT_TTL_MS;
+    c->num_buckets = 16;
+    while (c->num_buckets < c->max_peers)
+    {
+        c->num_buckets <<= 1;
+    }
+    c->buckets = calloc(c->num_buckets, sizeof(*c->buckets));
+    if (!c->buckets || pthread_mutex_init(&c->mutex, NULL) != 0)
+    {
+        free(c->buckets);
+        free(c);
+        return NULL;
+    }
+    return c;
+}
+
+void libp2p_protocol_support_cache_free(libp2p_protocol_support_cache_t *cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    support_peer_t *p = cache->lru_head;
+    while (p)
+    {
+        support_peer_t *next = p->lru_next;
+        peer_free(p);
+        p = next;
+    }
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->buckets);
+    free(cache);
+}
+
+void libp2p_protocol_support_set_reject_ttl(libp2p_protocol_support_cache_t *cache, uint64_t ttl_ms)
+{
+    if (!cache)
+    {
+        return;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    cache->reject_ttl_ms = ttl_ms ? ttl_ms : LIBP2P_PROTOCOL_SUPPORT_REJECT_TTL_MS;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void libp2p_protocol_support_record(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer, const char *protocol_id, int supported)
+{
+    if (!cache || !peer || !peer->bytes || !protocol_id)
+    {
+        return;
+    }
+    uint32_t hash = fnv1a(protocol_id, strlen(protocol_id));
+    pthread_mutex_lock(&cache->mutex);
+    support_peer_t *p = peer_get(cache, peer, 1);
+    if (p)
+    {
+        support_id_t *e = id_find(p, protocol_id, hash);
+        if (!e || !e->supported)
+        {
+            // The peer accepted something it did not advertise; stop
+            // inferring rejections from its advertised list.
+            if (supported)
+            {
+                p->listed_until = 0;
+            }
+            if (!e)
+            {
+                e = id_add(p, protocol_id, hash);
+            }
+        }
+        if (e)
+        {
+            e->supported = supported ? 1 : 0;
+            e->expires_ms = supported ? 0 : now_mono_ms() + cache->reject_ttl_ms;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void libp2p_protocol_support_set_protocols(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer, const char *const *protocols,
+                                           size_t num_protocols)
+{
+    if (!cache || !peer || !peer->bytes || (!protocols && num_protocols))
+    {
+        return;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    support_peer_t *p = peer_get(cache, peer, 1);
+    if (p)
+    {
+        while (p->num_ids)
+        {
+            id_drop(p, p->num_ids - 1);
+        }
+        size_t added = 0;
+        for (size_t i = 0; i < num_protocols; i++)
+        {
+            if (!protocols[i])
+            {
+                continue;
+            }
+            uint32_t hash = fnv1a(protocols[i], strlen(protocols[i]));
+            support_id_t *e = id_find(p, protocols[i], hash);
+            if (!e)
+            {
+                e = id_add(p, protocols[i], hash);
+            }
+            if (!e)
+            {
+                break;
+            }
+            e->supported = 1;
+            added++;
+        }
+        // An oversized or partially stored list cannot prove absence, and
+        // a complete one only for as long as a rejection would: the peer
+        // may add protocols without a fresh identify reaching us.
+        int complete = added == num_protocols && num_protocols <= LIBP2P_PROTOCOL_SUPPORT_MAX_IDS;
+        p->listed_until = complete ? now_mono_ms() + cache->reject_ttl_ms : 0;
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+libp2p_protocol_support_t libp2p_protocol_support_lookup(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer, const char *protocol_id)
+{
+    if (!cache || !peer || !peer->bytes || !protocol_id)
+    {
+        return LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    }
+    uint32_t hash = fnv1a(protocol_id, strlen(protocol_id));
+    libp2p_protocol_support_t res = LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    pthread_mutex_lock(&cache->mutex);
+    support_peer_t *p = peer_get(cache, peer, 0);
+    if (p)
+    {
+        uint64_t now = now_mono_ms();
+        if (p->listed_until && now >= p->listed_until)
+        {
+            // the advertised list is too old to rule anything out
+            p->listed_until = 0;
+        }
+        support_id_t *e = id_find(p, protocol_id, hash);
+        if (e && e->supported)
+        {
+            res = LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+        }
+        else if (e && e->expires_ms && now >= e->expires_ms)
+        {
+            // stale rejection: let the next open try again unless the
+            // advertised list still rules it out
+            id_drop(p, (size_t)(e - p->ids));
+            if (p->listed_until)
+            {
+                res = LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+            }
+        }
+        else if (e || p->listed_until)
+        {
+            res = LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+        }
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return res;
+}
+
+void libp2p_protocol_support_forget(libp2p_protocol_support_cache_t *cache, const peer_id_t *peer)
+{
+    if (!cache || !peer || !peer->bytes)
+    {
+        return;
+    }
+    pthread_mutex_lock(&cache->mutex);
+    support_peer_t *p = peer_get(cache, peer, 0);
+    if (p)
+    {
+        peer_remove(cache, p);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
@@ -1,6 +1,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,7 @@
 #include <ws2tcpip.h>
 #endif
 
+#include "protocol/tcp/protocol_tcp.h"
 #include "protocol/tcp/protocol_tcp_conn.h"
 #include "protocol/tcp/protocol_tcp_util.h"
 
@@ -22,13 +24,15 @@ ssize_t tcp_conn_read(libp2p_conn_t *c, void *buf, size_t len)
         return LIBP2P_CONN_ERR_CLOSED;
     }
 
-    /* deadline handling */
-    if (ctx->deadline_at > 0)
+    /* deadline handling: wait for readiness until the deadline; once it
+     * has passed only the non-blocking attempt below is made */
+    uint64_t deadline_at = atomic_load_explicit(&ctx->deadline_at, memory_order_relaxed);
+    if (deadline_at > 0)
     {
         uint64_t now = now_mono_ms();
-        if (now < ctx->deadline_at)
+        if (now < deadline_at)
         {
-            int timeout = (int)(ctx->deadline_at - now);
+            int timeout = (int)(deadline_at - now);
             struct pollfd pfd = {.fd = ctx->fd, .events = POLLIN};
             int r = poll(&pfd, 1, timeout);
             if (r <= 0)
@@ -38,10 +42,6 @@ ssize_t tcp_conn_read(libp2p_conn_t *c, void *buf, size_t len)
                 return LIBP2P_CONN_ERR_INTERNAL;
             }
         }
-        else
-        {
-            return LIBP2P_CONN_ERR_AGAIN; /* past deadline */
-        }
     }
 
     /* actual read */
@@ -79,13 +79,15 @@ ssize_t tcp_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
         return LIBP2P_CONN_ERR_CLOSED;
     }
 
-    /* deadline handling */
-    if (ctx->deadline_at > 0)
+    /* deadline handling: wait for readiness until the deadline; once it
+     * has passed only the non-blocking attempt below is made */
+    uint64_t deadline_at = atomic_load_explicit(&ctx->deadline_at, memory_order_relaxed);
+    if (deadline_at > 0)
     {
         uint64_t now = now_mono_ms();
-        if (now < ctx->deadline_at)
+        if (now < deadline_at)
         {
-            int timeout = (int)(ctx->deadline_at - now);
+            int timeout = (int)(deadline_at - now);
             struct pollfd pfd = {.fd = ctx->fd, .events = POLLOUT};
             int r = poll(&pfd, 1, timeout);
             if (r <= 0)
@@ -95,10 +97,6 @@ ssize_t tcp_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
                 return LIBP2P_CONN_ERR_INTERNAL;
             }
         }
-        else
-        {
-            return LIBP2P_CONN_ERR_AGAIN; /* past deadline */
-        }
     }
 
     /* actual write */
@@ -126,10 +124,33 @@ ssize_t tcp_conn_write(libp2p_conn_t *c, const void *buf, size_t len)
 libp2p_conn_err_t tcp_conn_set_deadline(libp2p_conn_t *c, uint64_t ms)
 {
     tcp_conn_ctx_t *ctx = c->ctx;
-    ctx->deadline_at = (ms == 0) ? 0 : now_mono_ms() + ms;
+    atomic_store_explicit(&ctx->deadline_at, (ms == 0) ? 0 : now_mono_ms() + ms, memory_order_relaxed);
     return LIBP2P_CONN_OK;
 }
 
+libp2p_conn_err_t tcp_conn_wait_readable(libp2p_conn_t *c, uint64_t timeout_ms)
+{
+    tcp_conn_ctx_t *ctx = c->ctx;
+    if (atomic_load(&ctx->closed))
+    {
+        return LIBP2P_CONN_ERR_CLOSED;
+    }
+
+    /* hang-ups and errors count as readable: the read reports them */
+    struct pollfd pfd = {.fd = ctx->fd, .events = POLLIN};
+    int timeout = timeout_ms > INT_MAX ? INT_MAX : (int)timeout_ms;
+    int r = poll(&pfd, 1, timeout);
+    if (r > 0)
+    {
+        return LIBP2P_CONN_OK;
+    }
+    if (r == 0 || errno == EINTR)
+    {
+        return LIBP2P_CONN_ERR_AGAIN;
+    }
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
 const multiaddr_t *tcp_conn_local(libp2p_conn_t *c)
 {
     if (!c)
@@ -206,6 +227,7 @@ const libp2p_conn_vtbl_t TCP_CONN_VTBL = {
     .read = tcp_conn_read,
     .write = tcp_conn_write,
     .set_deadline = tcp_conn_set_deadline,
+    .wait_readable = tcp_conn_wait_readable,
     .local_addr = tcp_conn_local,
     .remote_addr = tcp_conn_remote,
     .close = tcp_conn_close,
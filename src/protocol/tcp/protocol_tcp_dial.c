@@ -249,6 +249,7 @@ libp2p_transport_err_t tcp_dial(libp2p_transport_t *self, const multiaddr_t *add
         return rc;
     }
 
+    uint64_t start_us = now_mono_us();
     int c = connect(fd, (struct sockaddr *)&ss, ss_len);
 #ifdef _WIN32
     int errsv = (c == 0) ? 0 : WSAGetLastError();
@@ -274,8 +275,16 @@ libp2p_transport_err_t tcp_dial(libp2p_transport_t *self, const multiaddr_t *add
             close(fd);
             return LIBP2P_TRANSPORT_ERR_INTERNAL;
         }
-        return LIBP2P_TRANSPORT_OK;
+    }
+    else
+    {
+        rc = wait_for_connect(fd, transport_ctx, out);
+        if (rc != LIBP2P_TRANSPORT_OK)
+            return rc;
     }
 
-    return wait_for_connect(fd, transport_ctx, out);
+    /* recorded for the upgrader's setup timings */
+    uint64_t took = now_mono_us() - start_us;
+    (*out)->connect_us = took ? took : 1;
+    return LIBP2P_TRANSPORT_OK;
 }
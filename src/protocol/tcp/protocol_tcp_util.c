@@ -139,6 +139,18 @@ uint64_t now_mono_ms(void)
     return (uint64_t)ts.tv_sec * 1000 + (uint64_t)(ts.tv_nsec / 1000000);
 }
 
+/**
+ * @brief Get the current monotonic time in microseconds.
+ *
+ * @return The current monotonic time in microseconds.
+ */
+uint64_t now_mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000);
+}
+
 /**
  * @brief Safely add seconds and nanoseconds to a struct timespec without
  *        overflowing time_t on 32‑bit systems (Y2038 problem).
@@ -1,8 +1,11 @@
 #include "protocol/yamux/protocol_yamux.h"
 #include "protocol/multiselect/protocol_multiselect.h"
+#include "protocol/protocol_handler.h"
 #include "protocol/tcp/protocol_tcp_util.h"
 #include <stdio.h>
+#include "transport/buf_pool.h"
 #include "transport/conn_util.h"
+#include "protocol/yamux/protocol_yamux_timer.h"
 
 #ifdef _WIN32
 #include <winsock2.h>
@@ -11,15 +14,31 @@
 #include <arpa/inet.h>
 #endif
 
+#include <errno.h>
 #include <limits.h>
 #include <pthread.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #define YAMUX_INITIAL_WINDOW (256 * 1024)
 #define YAMUX_MAX_BACKLOG 256
+#define YAMUX_READAHEAD (64 * 1024)
+#define YAMUX_DISPATCH_BATCH 64
+#define YAMUX_BUDGET_RETRY_MS 20
+#define YAMUX_READ_WAIT_MS 100
+#define YAMUX_KEEP_BUF (64 * 1024) /* drained receive buffers above this are freed */
+
+/* Timer work handed to the session reader (ctx->deferred). */
+#define YAMUX_DEFER_PING 1u /* send keepalive ctx->deferred_seq */
+#define YAMUX_DEFER_STOP 2u /* idle: stop with a GoAway         */
+#define YAMUX_DEFER_FAIL 4u /* ping timeout: close the conn     */
+
+/* Bytes buffered in yamux receive buffers across all sessions. */
+static atomic_size_t g_mem_used;
+static atomic_size_t g_mem_limit;
 
 static inline libp2p_yamux_err_t map_conn_err(ssize_t v)
 {
@@ -115,32 +134,120 @@ static libp2p_muxer_err_t yamux_negotiate(libp2p_muxer_t *mx, libp2p_conn_t *c,
 static int yamux_open_stream(libp2p_muxer_t *mx, const uint8_t *name,
                              size_t name_len, libp2p_stream_t **out)
 {
-    (void)mx;
     (void)name;
     (void)name_len;
-    (void)out;
-    return LIBP2P_MUXER_ERR_INTERNAL;
+    if (!mx || !mx->ctx || !out)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    uint32_t id;
+    if (libp2p_yamux_stream_open(mx->ctx, &id) != LIBP2P_YAMUX_OK)
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    libp2p_stream_t *s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        libp2p_yamux_stream_reset(mx->ctx, id);
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    }
+    s->stream_id = id;
+    s->initiator = 1;
+    s->ctx = mx->ctx;
+    *out = s;
+    return LIBP2P_MUXER_OK;
 }
 
 static ssize_t yamux_stream_read(libp2p_stream_t *s, void *buf, size_t len)
 {
-    (void)s;
-    (void)buf;
-    (void)len;
-    return -1;
+    if (!s || !buf)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    /* yamux treats a zero timeout as "wait forever" */
+    int t = s->read_timeout_ms ? s->read_timeout_ms : LIBP2P_STREAM_READ_TIMEOUT_MS;
+    uint64_t timeout_ms = t < 0 ? 0 : (uint64_t)t;
+    size_t out_len = 0;
+    libp2p_yamux_err_t rc = libp2p_yamux_stream_recv_timeout(s->ctx, (uint32_t)s->stream_id, buf, len, &out_len, timeout_ms);
+    if (rc == LIBP2P_YAMUX_OK)
+        return (ssize_t)out_len;
+    if (rc == LIBP2P_YAMUX_ERR_EOF)
+        return 0;
+    return rc == LIBP2P_YAMUX_ERR_TIMEOUT ? LIBP2P_MUXER_ERR_TIMEOUT : LIBP2P_MUXER_ERR_INTERNAL;
 }
 
 static ssize_t yamux_stream_write(libp2p_stream_t *s, const void *buf, size_t len)
 {
-    (void)s;
-    (void)buf;
-    (void)len;
-    return -1;
+    if (!s || !buf)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    /* a closed send window waits as long as a read would */
+    int t = s->read_timeout_ms ? s->read_timeout_ms : LIBP2P_STREAM_READ_TIMEOUT_MS;
+    uint64_t timeout_ms = t < 0 ? 0 : (uint64_t)t;
+    size_t sent = 0;
+    libp2p_yamux_err_t rc = libp2p_yamux_stream_send_timeout(s->ctx, (uint32_t)s->stream_id, buf, len, &sent, timeout_ms);
+    if (rc == LIBP2P_YAMUX_OK || sent)
+        return (ssize_t)sent;
+    return rc == LIBP2P_YAMUX_ERR_TIMEOUT ? LIBP2P_MUXER_ERR_TIMEOUT : LIBP2P_MUXER_ERR_INTERNAL;
 }
 
 static void yamux_stream_close(libp2p_stream_t *s)
 {
-    (void)s;
+    if (s)
+        libp2p_yamux_stream_close(s->ctx, (uint32_t)s->stream_id);
+}
+
+static void yamux_stream_reset(libp2p_stream_t *s)
+{
+    if (s)
+        libp2p_yamux_stream_reset(s->ctx, (uint32_t)s->stream_id);
+}
+
+static int yamux_session_new(libp2p_muxer_t *mx, libp2p_conn_t *c, bool dialer)
+{
+    if (!mx || !c)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(c, dialer, 0);
+    if (!ctx)
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    /* the reader thread wakes blocked readers and acceptors */
+    if (libp2p_yamux_start_reader(ctx) != LIBP2P_YAMUX_OK)
+    {
+        libp2p_yamux_ctx_free(ctx);
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    }
+    mx->ctx = ctx;
+    return LIBP2P_MUXER_OK;
+}
+
+static int yamux_accept(libp2p_muxer_t *mx, libp2p_stream_t **out)
+{
+    if (!mx || !mx->ctx || !out)
+        return LIBP2P_MUXER_ERR_NULL_PTR;
+    libp2p_yamux_stream_t *st = NULL;
+    libp2p_yamux_err_t rc = libp2p_yamux_accept_stream_timeout(mx->ctx, &st, 0);
+    if (rc == LIBP2P_YAMUX_ERR_EOF)
+        return LIBP2P_MUXER_ERR_EOF;
+    if (rc != LIBP2P_YAMUX_OK)
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    libp2p_stream_t *s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        libp2p_yamux_stream_reset(mx->ctx, st->id);
+        return LIBP2P_MUXER_ERR_INTERNAL;
+    }
+    s->stream_id = st->id;
+    s->initiator = 0;
+    s->ctx = mx->ctx;
+    *out = s;
+    return LIBP2P_MUXER_OK;
+}
+
+static void yamux_session_stop(libp2p_muxer_t *mx)
+{
+    if (mx)
+        libp2p_yamux_stop(mx->ctx);
+}
+
+static void yamux_session_free(libp2p_muxer_t *mx)
+{
+    if (!mx)
+        return;
+    libp2p_yamux_ctx_free(mx->ctx);
+    mx->ctx = NULL;
 }
 
 static libp2p_muxer_err_t yamux_close(libp2p_muxer_t *self)
@@ -152,12 +259,18 @@ static libp2p_muxer_err_t yamux_close(libp2p_muxer_t *self)
 static void yamux_free_muxer(libp2p_muxer_t *self) { free(self); }
 
 static const libp2p_muxer_vtbl_t YAMUX_VTBL = {
+    .protocol_id = LIBP2P_YAMUX_PROTO_ID,
     .negotiate = yamux_negotiate,
     .open_stream = yamux_open_stream,
     .stream_read = yamux_stream_read,
     .stream_write = yamux_stream_write,
     .stream_close = yamux_stream_close,
     .free = yamux_free_muxer,
+    .session_new = yamux_session_new,
+    .accept_stream = yamux_accept,
+    .session_stop = yamux_session_stop,
+    .session_free = yamux_session_free,
+    .stream_reset = yamux_stream_reset,
 };
 
 libp2p_muxer_t *libp2p_yamux_new(void)
@@ -170,21 +283,26 @@ libp2p_muxer_t *libp2p_yamux_new(void)
     return m;
 }
 
-libp2p_yamux_err_t libp2p_yamux_send_frame(libp2p_conn_t *conn, const libp2p_yamux_frame_t *fr)
+static void encode_header(const libp2p_yamux_frame_t *fr, uint16_t flags, uint32_t length, uint8_t hdr[12])
 {
-    if (!conn || !fr)
-        return LIBP2P_YAMUX_ERR_NULL_PTR;
-    if (fr->data_len > UINT32_MAX)
-        return LIBP2P_YAMUX_ERR_PROTO_MAL;
-    uint8_t hdr[12];
     hdr[0] = fr->version;
     hdr[1] = (uint8_t)fr->type;
-    uint16_t f = htons(fr->flags);
+    uint16_t f = htons(flags);
     memcpy(hdr + 2, &f, 2);
     uint32_t sid = htonl(fr->stream_id);
     memcpy(hdr + 4, &sid, 4);
-    uint32_t len = htonl(fr->length);
+    uint32_t len = htonl(length);
     memcpy(hdr + 8, &len, 4);
+}
+
+libp2p_yamux_err_t libp2p_yamux_send_frame(libp2p_conn_t *conn, const libp2p_yamux_frame_t *fr)
+{
+    if (!conn || !fr)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    if (fr->data_len > UINT32_MAX)
+        return LIBP2P_YAMUX_ERR_PROTO_MAL;
+    uint8_t hdr[12];
+    encode_header(fr, fr->flags, fr->length, hdr);
     libp2p_yamux_err_t rc = conn_write_all(conn, hdr, sizeof(hdr));
     if (rc)
         return rc;
@@ -193,14 +311,9 @@ libp2p_yamux_err_t libp2p_yamux_send_frame(libp2p_conn_t *conn, const libp2p_yam
     return rc;
 }
 
-libp2p_yamux_err_t libp2p_yamux_read_frame(libp2p_conn_t *conn, libp2p_yamux_frame_t *out)
+/* Parse a 12-byte header; the payload pointer is left for the caller. */
+static libp2p_yamux_err_t decode_header(const uint8_t hdr[12], libp2p_yamux_frame_t *out)
 {
-    if (!conn || !out)
-        return LIBP2P_YAMUX_ERR_NULL_PTR;
-    uint8_t hdr[12];
-    libp2p_yamux_err_t rc = conn_read_exact(conn, hdr, sizeof(hdr));
-    if (rc)
-        return rc;
     out->version = hdr[0];
     if (out->version != 0)
         return LIBP2P_YAMUX_ERR_PROTO_MAL;
@@ -219,15 +332,29 @@ libp2p_yamux_err_t libp2p_yamux_read_frame(libp2p_conn_t *conn, libp2p_yamux_fra
     else
         out->data_len = 0;
     out->data = NULL;
+    return LIBP2P_YAMUX_OK;
+}
+
+libp2p_yamux_err_t libp2p_yamux_read_frame(libp2p_conn_t *conn, libp2p_yamux_frame_t *out)
+{
+    if (!conn || !out)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    uint8_t hdr[12];
+    libp2p_yamux_err_t rc = conn_read_exact(conn, hdr, sizeof(hdr));
+    if (rc)
+        return rc;
+    rc = decode_header(hdr, out);
+    if (rc)
+        return rc;
     if (out->data_len)
     {
-        out->data = malloc(out->data_len);
+        out->data = libp2p_buf_alloc(out->data_len);
         if (!out->data)
             return LIBP2P_YAMUX_ERR_INTERNAL;
         rc = conn_read_exact(conn, out->data, out->data_len);
         if (rc)
         {
-            free(out->data);
+            libp2p_buf_release(out->data);
             out->data = NULL;
             out->data_len = 0;
             return rc;
@@ -240,7 +367,7 @@ void libp2p_yamux_frame_free(libp2p_yamux_frame_t *fr)
 {
     if (!fr)
         return;
-    free(fr->data);
+    libp2p_buf_release(fr->data);
     fr->data = NULL;
     fr->data_len = 0;
 }
@@ -307,23 +434,250 @@ libp2p_yamux_err_t libp2p_yamux_ping(libp2p_conn_t *conn, uint32_t value, uint16
     return libp2p_yamux_send_frame(conn, &fr);
 }
 
-static void *keepalive_loop(void *arg)
+/* Split a frame into scheduler entries. DATA payloads larger than the
+ * scheduling quantum are cut into several frames so the round-robin can
+ * interleave other streams; SYN/ACK stay on the first piece and FIN moves
+ * to the last. */
+static yamux_send_entry_t *frame_to_chain(const libp2p_yamux_frame_t *fr)
 {
-    libp2p_yamux_ctx_t *ctx = arg;
-    uint32_t counter = 0;
-    while (!atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+    if (fr->type != LIBP2P_YAMUX_DATA || fr->data_len <= YAMUX_SCHED_QUANTUM)
+    {
+        uint8_t hdr[12];
+        encode_header(fr, fr->flags, fr->length, hdr);
+        return ys_entry_new(hdr, fr->data, fr->data_len);
+    }
+
+    yamux_send_entry_t *head = NULL, *tail = NULL;
+    size_t off = 0;
+    while (off < fr->data_len)
     {
-        libp2p_yamux_ctx_ping(ctx, counter++);
-        uint64_t remain = ctx->keepalive_ms;
-        while (remain && !atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+        size_t n = fr->data_len - off;
+        if (n > YAMUX_SCHED_QUANTUM)
+            n = YAMUX_SCHED_QUANTUM;
+        uint16_t flags = off == 0 ? (uint16_t)(fr->flags & ~LIBP2P_YAMUX_FIN) : 0;
+        if (off + n == fr->data_len)
+            flags |= (uint16_t)(fr->flags & LIBP2P_YAMUX_FIN);
+        uint8_t hdr[12];
+        encode_header(fr, flags, (uint32_t)n, hdr);
+        yamux_send_entry_t *e = ys_entry_new(hdr, fr->data + off, n);
+        if (!e)
         {
-            uint64_t chunk = remain > 100 ? 100 : remain;
-            struct timespec ts = {.tv_sec = 0, .tv_nsec = chunk * 1000000L};
-            nanosleep(&ts, NULL);
-            remain -= chunk;
+            ys_chain_free(head);
+            return NULL;
         }
+        if (tail)
+            tail->next = e;
+        else
+            head = e;
+        tail = e;
+        off += n;
     }
-    return NULL;
+    return head;
+}
+
+/* Queue a frame on the session scheduler without writing it. Pings,
+ * go-away and plain window updates are control frames and jump ahead of
+ * stream data; everything else keeps its order within its stream. */
+static libp2p_yamux_err_t ctx_queue_frame(libp2p_yamux_ctx_t *ctx, const libp2p_yamux_frame_t *fr, uint32_t weight)
+{
+    if (fr->data_len > UINT32_MAX)
+        return LIBP2P_YAMUX_ERR_PROTO_MAL;
+    uint32_t flow = fr->stream_id;
+    if (fr->type == LIBP2P_YAMUX_PING || fr->type == LIBP2P_YAMUX_GO_AWAY ||
+        (fr->type == LIBP2P_YAMUX_WINDOW_UPDATE && !(fr->flags & LIBP2P_YAMUX_SYN)))
+        flow = YAMUX_SCHED_CONTROL;
+    yamux_send_entry_t *chain = frame_to_chain(fr);
+    if (!chain)
+        return LIBP2P_YAMUX_ERR_INTERNAL;
+    libp2p_conn_err_t rc = ys_push(&ctx->sched, chain, flow, weight);
+    return rc == LIBP2P_CONN_OK ? LIBP2P_YAMUX_OK : map_conn_err(rc);
+}
+
+static libp2p_yamux_err_t ctx_flush(libp2p_yamux_ctx_t *ctx)
+{
+    libp2p_conn_err_t rc = ys_flush(&ctx->sched, ctx->conn);
+    return rc == LIBP2P_CONN_OK ? LIBP2P_YAMUX_OK : map_conn_err(rc);
+}
+
+/* Write queued frames without payload without waiting on a full
+ * connection; readers and the timer use this so they never block behind
+ * stream data. */
+static libp2p_yamux_err_t ctx_flush_control(libp2p_yamux_ctx_t *ctx)
+{
+    libp2p_conn_err_t rc = ys_flush_control(&ctx->sched, ctx->conn);
+    return rc == LIBP2P_CONN_OK ? LIBP2P_YAMUX_OK : map_conn_err(rc);
+}
+
+static libp2p_yamux_err_t ctx_send_frame(libp2p_yamux_ctx_t *ctx, const libp2p_yamux_frame_t *fr, uint32_t weight)
+{
+    libp2p_yamux_err_t rc = ctx_queue_frame(ctx, fr, weight);
+    if (rc)
+        return rc;
+    int control = fr->type == LIBP2P_YAMUX_PING || fr->type == LIBP2P_YAMUX_GO_AWAY ||
+                  (fr->type == LIBP2P_YAMUX_WINDOW_UPDATE && !(fr->flags & LIBP2P_YAMUX_SYN));
+    return control ? ctx_flush_control(ctx) : ctx_flush(ctx);
+}
+
+static libp2p_yamux_err_t ctx_send_msg(libp2p_yamux_ctx_t *ctx, uint32_t id, const uint8_t *data, size_t data_len, uint16_t flags,
+                                       uint32_t weight)
+{
+    libp2p_yamux_frame_t fr = {
+        .version = 0,
+        .type = LIBP2P_YAMUX_DATA,
+        .flags = flags,
+        .stream_id = id,
+        .length = (uint32_t)data_len,
+        .data = (uint8_t *)data,
+        .data_len = data_len,
+    };
+    return ctx_send_frame(ctx, &fr, weight);
+}
+
+static libp2p_yamux_err_t ctx_window_update(libp2p_yamux_ctx_t *ctx, uint32_t id, uint32_t delta, uint16_t flags)
+{
+    libp2p_yamux_frame_t fr = {
+        .version = 0,
+        .type = LIBP2P_YAMUX_WINDOW_UPDATE,
+        .flags = flags,
+        .stream_id = id,
+        .length = delta,
+        .data = NULL,
+        .data_len = 0,
+    };
+    return ctx_send_frame(ctx, &fr, 0);
+}
+
+static libp2p_yamux_err_t ctx_ping_frame(libp2p_yamux_ctx_t *ctx, uint32_t value, uint16_t flags)
+{
+    libp2p_yamux_frame_t fr = {
+        .version = 0,
+        .type = LIBP2P_YAMUX_PING,
+        .flags = flags,
+        .stream_id = 0,
+        .length = value,
+        .data = NULL,
+        .data_len = 0,
+    };
+    return ctx_send_frame(ctx, &fr, 0);
+}
+
+static void wake_all(libp2p_yamux_ctx_t *ctx);
+static uint64_t oldest_ping_ms(libp2p_yamux_ctx_t *ctx);
+static int release_withheld(libp2p_yamux_ctx_t *ctx);
+
+static uint64_t earliest(uint64_t a, uint64_t b)
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    return a < b ? a : b;
+}
+
+/* Send what session_tick() left for the session's own thread. Returns
+ * non-zero once the session is being torn down. */
+static libp2p_yamux_err_t run_deferred(libp2p_yamux_ctx_t *ctx)
+{
+    unsigned work = atomic_exchange_explicit(&ctx->deferred, 0, memory_order_acq_rel);
+    if (!work)
+        return LIBP2P_YAMUX_OK;
+    if (work & YAMUX_DEFER_FAIL)
+    {
+        libp2p_conn_close(ctx->conn);
+        return LIBP2P_YAMUX_ERR_EOF;
+    }
+    if (work & YAMUX_DEFER_STOP)
+    {
+        libp2p_yamux_stop(ctx);
+        return LIBP2P_YAMUX_ERR_EOF;
+    }
+    if (work & YAMUX_DEFER_PING)
+    {
+        pthread_mutex_lock(&ctx->mtx);
+        uint32_t seq = ctx->deferred_seq;
+        pthread_mutex_unlock(&ctx->mtx);
+        libp2p_yamux_ctx_ping(ctx, seq);
+    }
+    return LIBP2P_YAMUX_OK;
+}
+
+/* Shared timer callback: sends keepalive pings, tears the session down
+ * when a ping goes unanswered for too long, closes idle sessions and
+ * retries window updates withheld by the memory budget. With a session
+ * reader running, frames and the close are left to that thread so one
+ * stalled connection cannot hold up the timer for every session.
+ * Returns the next time the session needs attention. */
+static uint64_t session_tick(void *arg, uint64_t now)
+{
+    libp2p_yamux_ctx_t *ctx = arg;
+    if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+        return 0;
+
+    pthread_mutex_lock(&ctx->mtx);
+    uint64_t keepalive_ms = ctx->keepalive_ms;
+    uint64_t ping_timeout_ms = ctx->ping_timeout_ms;
+    uint64_t idle_timeout_ms = ctx->idle_timeout_ms;
+    uint64_t oldest_ping = oldest_ping_ms(ctx);
+    size_t num_streams = ctx->num_streams;
+    int send_ping = keepalive_ms && now >= ctx->next_keepalive_ms;
+    uint32_t seq = ctx->keepalive_seq;
+    if (send_ping)
+    {
+        ctx->keepalive_seq++;
+        ctx->next_keepalive_ms = now + keepalive_ms;
+    }
+    if (send_ping)
+        ctx->deferred_seq = seq;
+    uint64_t next_keepalive = keepalive_ms ? ctx->next_keepalive_ms : 0;
+    int withheld = ctx->num_withheld > 0;
+    pthread_mutex_unlock(&ctx->mtx);
+    uint64_t last = atomic_load_explicit(&ctx->last_activity_ms, memory_order_relaxed);
+    int defer = atomic_load(&ctx->reader_active);
+
+    /* both stamps can be taken after @p now was read */
+    if (ping_timeout_ms && oldest_ping && now > oldest_ping && now - oldest_ping >= ping_timeout_ms)
+    {
+        /* the peer stopped answering; fail the session without a GoAway */
+        atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+        if (defer)
+            atomic_fetch_or_explicit(&ctx->deferred, YAMUX_DEFER_FAIL, memory_order_release);
+        else
+            libp2p_conn_close(ctx->conn);
+        wake_all(ctx);
+        return 0;
+    }
+    if (idle_timeout_ms && num_streams == 0 && now > last && now - last >= idle_timeout_ms)
+    {
+        if (defer)
+            atomic_fetch_or_explicit(&ctx->deferred, YAMUX_DEFER_STOP, memory_order_release);
+        else
+            libp2p_yamux_stop(ctx);
+        return 0;
+    }
+    if (send_ping)
+    {
+        if (defer)
+            atomic_fetch_or_explicit(&ctx->deferred, YAMUX_DEFER_PING, memory_order_release);
+        else
+            libp2p_yamux_ctx_ping(ctx, seq);
+        if (!oldest_ping)
+            oldest_ping = now;
+    }
+
+    uint64_t next = next_keepalive;
+    /* other sessions may free process budget without touching this one */
+    if (withheld && release_withheld(ctx))
+        next = earliest(next, now + YAMUX_BUDGET_RETRY_MS);
+    if (ping_timeout_ms && oldest_ping)
+        next = earliest(next, oldest_ping + ping_timeout_ms);
+    if (idle_timeout_ms)
+        next = earliest(next, (num_streams ? now : last) + idle_timeout_ms);
+    return next;
+}
+
+static libp2p_yamux_err_t arm_timer(libp2p_yamux_ctx_t *ctx, uint64_t due_ms)
+{
+    return ytimer_arm(&ctx->timer, due_ms) == 0 ? LIBP2P_YAMUX_OK : LIBP2P_YAMUX_ERR_INTERNAL;
 }
 
 libp2p_yamux_err_t libp2p_yamux_enable_keepalive(libp2p_yamux_ctx_t *ctx, uint64_t interval_ms)
@@ -332,15 +686,62 @@ libp2p_yamux_err_t libp2p_yamux_enable_keepalive(libp2p_yamux_ctx_t *ctx, uint64
         return LIBP2P_YAMUX_ERR_NULL_PTR;
     if (interval_ms == 0)
         return LIBP2P_YAMUX_OK;
+    pthread_mutex_lock(&ctx->mtx);
     ctx->keepalive_ms = interval_ms;
-    if (ctx->keepalive_active)
-        return LIBP2P_YAMUX_OK;
-    if (pthread_create(&ctx->keepalive_th, NULL, keepalive_loop, ctx) != 0)
-        return LIBP2P_YAMUX_ERR_INTERNAL;
-    ctx->keepalive_active = 1;
+    ctx->next_keepalive_ms = now_mono_ms() + interval_ms;
+    uint64_t due = ctx->next_keepalive_ms;
+    pthread_mutex_unlock(&ctx->mtx);
+    return arm_timer(ctx, due);
+}
+
+libp2p_yamux_err_t libp2p_yamux_set_ping_timeout(libp2p_yamux_ctx_t *ctx, uint64_t timeout_ms)
+{
+    if (!ctx)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    ctx->ping_timeout_ms = timeout_ms;
+    pthread_mutex_unlock(&ctx->mtx);
+    /* an immediate tick computes the real deadline from pending pings */
+    return timeout_ms ? arm_timer(ctx, now_mono_ms()) : LIBP2P_YAMUX_OK;
+}
+
+libp2p_yamux_err_t libp2p_yamux_set_idle_timeout(libp2p_yamux_ctx_t *ctx, uint64_t timeout_ms)
+{
+    if (!ctx)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    ctx->idle_timeout_ms = timeout_ms;
+    pthread_mutex_unlock(&ctx->mtx);
+    return timeout_ms ? arm_timer(ctx, now_mono_ms() + timeout_ms) : LIBP2P_YAMUX_OK;
+}
+
+libp2p_yamux_err_t libp2p_yamux_set_memory_limit(libp2p_yamux_ctx_t *ctx, size_t bytes)
+{
+    if (!ctx)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    ctx->mem_limit = bytes;
+    int withheld = ctx->num_withheld > 0;
+    pthread_mutex_unlock(&ctx->mtx);
+    if (withheld)
+        release_withheld(ctx);
+    return LIBP2P_YAMUX_OK;
+}
+
+libp2p_yamux_err_t libp2p_yamux_get_memory_usage(libp2p_yamux_ctx_t *ctx, size_t *out)
+{
+    if (!ctx || !out)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    *out = ctx->mem_used;
+    pthread_mutex_unlock(&ctx->mtx);
     return LIBP2P_YAMUX_OK;
 }
 
+void libp2p_yamux_set_process_memory_limit(size_t bytes) { atomic_store_explicit(&g_mem_limit, bytes, memory_order_relaxed); }
+
+size_t libp2p_yamux_process_memory_usage(void) { return atomic_load_explicit(&g_mem_used, memory_order_relaxed); }
+
 libp2p_yamux_err_t libp2p_yamux_go_away(libp2p_conn_t *conn, libp2p_yamux_goaway_t code)
 {
     libp2p_yamux_frame_t fr = {
@@ -365,69 +766,242 @@ void libp2p_yamux_set_ping_cb(libp2p_yamux_ctx_t *ctx, libp2p_yamux_ping_cb cb,
     pthread_mutex_unlock(&ctx->mtx);
 }
 
+/* Send time of the oldest outstanding ping in ms, or 0; caller holds ctx->mtx. */
+static uint64_t oldest_ping_ms(libp2p_yamux_ctx_t *ctx)
+{
+    uint64_t oldest = 0;
+    if (!ctx->num_pings)
+        return 0;
+    for (size_t i = 0; i < LIBP2P_YAMUX_PING_SLOTS; i++)
+        if (ctx->pings[i].in_use && (!oldest || ctx->pings[i].sent_us < oldest))
+            oldest = ctx->pings[i].sent_us;
+    return oldest / 1000;
+}
+
+/* Fold one RTT sample into the session estimate; caller holds ctx->mtx. */
+static void rtt_update(libp2p_yamux_rtt_t *r, uint64_t sample)
+{
+    if (r->samples == 0)
+    {
+        r->srtt_us = sample;
+        r->rttvar_us = sample / 2;
+        r->min_rtt_us = sample;
+    }
+    else
+    {
+        uint64_t err = sample > r->srtt_us ? sample - r->srtt_us : r->srtt_us - sample;
+        r->rttvar_us = (3 * r->rttvar_us + err) / 4;
+        r->srtt_us = (7 * r->srtt_us + sample) / 8;
+        if (sample < r->min_rtt_us)
+            r->min_rtt_us = sample;
+    }
+    r->last_rtt_us = sample;
+    r->samples++;
+}
+
 libp2p_yamux_err_t libp2p_yamux_ctx_ping(libp2p_yamux_ctx_t *ctx, uint32_t value)
 {
     if (!ctx)
         return LIBP2P_YAMUX_ERR_NULL_PTR;
     pthread_mutex_lock(&ctx->mtx);
-    size_t n = ctx->num_pings;
-    struct yamux_ping_pending *tmp = realloc(ctx->pings, (n + 1) * sizeof(*tmp));
-    if (!tmp)
+    struct yamux_ping_pending *p = &ctx->pings[value % LIBP2P_YAMUX_PING_SLOTS];
+    if (p->in_use && p->value != value)
     {
+        /* the slot still tracks an unanswered ping; overwriting it would
+         * restart the clock the ping timeout runs on */
         pthread_mutex_unlock(&ctx->mtx);
-        return LIBP2P_YAMUX_ERR_INTERNAL;
+        return LIBP2P_YAMUX_ERR_AGAIN;
+    }
+    if (!p->in_use)
+    {
+        /* a repeated value keeps the time of its first send */
+        ctx->num_pings++;
+        p->value = value;
+        p->sent_us = now_mono_us();
+        p->in_use = 1;
     }
-    ctx->pings = tmp;
-    ctx->pings[n].value = value;
-    ctx->pings[n].sent_ms = now_mono_ms();
-    ctx->num_pings = n + 1;
+    uint64_t ping_deadline = ctx->ping_timeout_ms ? p->sent_us / 1000 + ctx->ping_timeout_ms : 0;
     pthread_mutex_unlock(&ctx->mtx);
-    return libp2p_yamux_ping(ctx->conn, value, LIBP2P_YAMUX_SYN);
+    if (ping_deadline)
+        arm_timer(ctx, ping_deadline);
+    return ctx_ping_frame(ctx, value, LIBP2P_YAMUX_SYN);
 }
 
-static void *find_stream(libp2p_yamux_ctx_t *ctx, uint32_t id, size_t *idx)
+libp2p_yamux_err_t libp2p_yamux_get_rtt(libp2p_yamux_ctx_t *ctx, libp2p_yamux_rtt_t *out)
 {
-    for (size_t i = 0; i < ctx->num_streams; i++)
-    {
-        if (ctx->streams[i]->id == id)
-        {
-            if (idx)
-                *idx = i;
-            return ctx->streams[i];
-        }
-    }
-    return NULL;
+    if (!ctx || !out)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    *out = ctx->rtt;
+    pthread_mutex_unlock(&ctx->mtx);
+    return LIBP2P_YAMUX_OK;
 }
 
-static void maybe_cleanup_stream(libp2p_yamux_ctx_t *ctx, size_t idx)
+/* Condition variables use the monotonic clock where available so that
+ * deadlines are immune to wall-clock adjustments (mirrors yq_init). */
+static void init_wait_cond(pthread_cond_t *cond)
 {
-    libp2p_yamux_stream_t *st = ctx->streams[idx];
-    if ((st->local_closed && st->remote_closed) || st->reset)
-    {
-        free(st->buf);
-        free(st);
-        for (size_t i = idx + 1; i < ctx->num_streams; i++)
-            ctx->streams[i - 1] = ctx->streams[i];
-        ctx->num_streams--;
-    }
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#if defined(_POSIX_MONOTONIC_CLOCK) && !defined(__APPLE__)
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
 }
 
-static libp2p_yamux_err_t proto_violation(libp2p_yamux_ctx_t *ctx)
+static void deadline_after(uint64_t timeout_ms, struct timespec *ts)
 {
-    if (ctx && ctx->conn)
+#if defined(_POSIX_MONOTONIC_CLOCK) && !defined(__APPLE__)
+    clock_gettime(CLOCK_MONOTONIC, ts);
+#else
+    clock_gettime(CLOCK_REALTIME, ts);
+#endif
+    ts->tv_sec += (time_t)(timeout_ms / 1000);
+    ts->tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
     {
-        /* notify the peer about the error before closing */
-        libp2p_yamux_go_away(ctx->conn, LIBP2P_YAMUX_GOAWAY_PROTOCOL_ERROR);
-        libp2p_conn_close(ctx->conn);
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
     }
-    if (ctx)
-        atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
-    return LIBP2P_YAMUX_ERR_PROTO_MAL;
 }
 
-libp2p_yamux_ctx_t *libp2p_yamux_ctx_new(libp2p_conn_t *conn, int dialer, uint32_t max_window)
+static libp2p_yamux_stream_t *stream_new(uint32_t id, int initiator)
 {
-    if (!conn)
+    libp2p_yamux_stream_t *st = calloc(1, sizeof(*st));
+    if (!st)
+        return NULL;
+    st->id = id;
+    st->initiator = initiator;
+    st->weight = 1;
+    init_wait_cond(&st->cond);
+    return st;
+}
+
+/* Memory accounting; callers hold ctx->mtx. */
+static void mem_charge(libp2p_yamux_ctx_t *ctx, size_t n)
+{
+    ctx->mem_used += n;
+    atomic_fetch_add_explicit(&g_mem_used, n, memory_order_relaxed);
+}
+
+static void mem_release(libp2p_yamux_ctx_t *ctx, size_t n)
+{
+    ctx->mem_used -= n;
+    atomic_fetch_sub_explicit(&g_mem_used, n, memory_order_relaxed);
+}
+
+static int over_budget(const libp2p_yamux_ctx_t *ctx)
+{
+    if (ctx->mem_limit && ctx->mem_used >= ctx->mem_limit)
+        return 1;
+    size_t limit = atomic_load_explicit(&g_mem_limit, memory_order_relaxed);
+    return limit && atomic_load_explicit(&g_mem_used, memory_order_relaxed) >= limit;
+}
+
+/* Drop buffered bytes and any withheld credit of a stream. */
+static void stream_drop_buf(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t *st)
+{
+    mem_release(ctx, st->buf_len - st->buf_pos);
+    if (st->withheld)
+    {
+        st->withheld = 0;
+        ctx->num_withheld--;
+    }
+    free(st->buf);
+    st->buf = NULL;
+    st->buf_len = 0;
+    st->buf_pos = 0;
+    st->buf_cap = 0;
+}
+
+static void stream_free(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t *st)
+{
+    stream_drop_buf(ctx, st);
+    pthread_cond_destroy(&st->cond);
+    free(st);
+}
+
+/* Wake every blocked reader and acceptor; caller holds ctx->mtx. */
+static void wake_all_locked(libp2p_yamux_ctx_t *ctx)
+{
+    for (size_t i = 0; i < ctx->num_streams; i++)
+        pthread_cond_broadcast(&ctx->streams[i]->cond);
+    yq_wake_all(&ctx->incoming);
+}
+
+static void wake_all(libp2p_yamux_ctx_t *ctx)
+{
+    pthread_mutex_lock(&ctx->mtx);
+    wake_all_locked(ctx);
+    pthread_mutex_unlock(&ctx->mtx);
+}
+
+static void *find_stream(libp2p_yamux_ctx_t *ctx, uint32_t id, size_t *idx)
+{
+    for (size_t i = 0; i < ctx->num_streams; i++)
+    {
+        if (ctx->streams[i]->id == id)
+        {
+            if (idx)
+                *idx = i;
+            return ctx->streams[i];
+        }
+    }
+    return NULL;
+}
+
+static void maybe_cleanup_stream(libp2p_yamux_ctx_t *ctx, size_t idx)
+{
+    libp2p_yamux_stream_t *st = ctx->streams[idx];
+    /* a blocked reader still references the stream; it cleans up on wake */
+    if (st->waiters > 0)
+        return;
+    if ((st->local_closed && st->remote_closed) || st->reset)
+    {
+        stream_free(ctx, st);
+        for (size_t i = idx + 1; i < ctx->num_streams; i++)
+            ctx->streams[i - 1] = ctx->streams[i];
+        ctx->num_streams--;
+    }
+}
+
+/* Non-zero if @p id belongs to a stream that was opened at some point,
+ * by either side; caller holds ctx->mtx. */
+static int stream_id_used(libp2p_yamux_ctx_t *ctx, uint32_t id)
+{
+    uint32_t local_parity = ctx->dialer ? 1 : 0;
+    if ((id & 1) == local_parity)
+        return id < ctx->next_stream_id;
+    return id <= ctx->max_remote_id;
+}
+
+static libp2p_yamux_err_t proto_violation(libp2p_yamux_ctx_t *ctx)
+{
+    if (ctx && ctx->conn)
+    {
+        /* notify the peer about the error before closing; the frame goes
+         * through the scheduler so it cannot interleave with a writer */
+        libp2p_yamux_frame_t fr = {
+            .version = 0,
+            .type = LIBP2P_YAMUX_GO_AWAY,
+            .flags = 0,
+            .stream_id = 0,
+            .length = (uint32_t)LIBP2P_YAMUX_GOAWAY_PROTOCOL_ERROR,
+            .data = NULL,
+            .data_len = 0,
+        };
+        ctx_send_frame(ctx, &fr, 0);
+        libp2p_conn_close(ctx->conn);
+    }
+    if (ctx)
+        atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+    return LIBP2P_YAMUX_ERR_PROTO_MAL;
+}
+
+libp2p_yamux_ctx_t *libp2p_yamux_ctx_new(libp2p_conn_t *conn, int dialer, uint32_t max_window)
+{
+    if (!conn)
         return NULL;
 
     libp2p_yamux_ctx_t *ctx = calloc(1, sizeof(*ctx));
@@ -437,18 +1011,27 @@ libp2p_yamux_ctx_t *libp2p_yamux_ctx_new(libp2p_conn_t *conn, int dialer, uint32
     ctx->conn = conn;
     ctx->dialer = dialer;
     ctx->next_stream_id = dialer ? 1 : 2;
+    ctx->max_remote_id = 0;
     ctx->max_window = max_window >= YAMUX_INITIAL_WINDOW ? max_window : YAMUX_INITIAL_WINDOW;
     ctx->ack_backlog = 0;
     yq_init(&ctx->incoming);
+    ys_init(&ctx->sched);
     atomic_init(&ctx->stop, false);
     pthread_mutex_init(&ctx->mtx, NULL);
     ctx->keepalive_ms = 0;
-    ctx->keepalive_active = 0;
+    ctx->next_keepalive_ms = 0;
+    ctx->keepalive_seq = 0;
+    ctx->deferred_seq = 0;
+    atomic_init(&ctx->deferred, 0);
+    ctx->ping_timeout_ms = 0;
+    ctx->idle_timeout_ms = 0;
+    atomic_init(&ctx->last_activity_ms, now_mono_ms());
+    ytimer_init(&ctx->timer, session_tick, ctx);
+    ctx->reader_active = 0;
     ctx->goaway_code = LIBP2P_YAMUX_GOAWAY_OK;
     ctx->goaway_received = 0;
     ctx->ping_cb = NULL;
     ctx->ping_arg = NULL;
-    ctx->pings = NULL;
     ctx->num_pings = 0;
 
     return ctx;
@@ -462,23 +1045,28 @@ void libp2p_yamux_ctx_free(libp2p_yamux_ctx_t *ctx)
     if (!atomic_load_explicit(&ctx->stop, memory_order_relaxed) && ctx->conn)
         libp2p_yamux_stop(ctx);
 
-    if (ctx->keepalive_active)
+    /* waits for an in-flight tick so the session can be freed safely */
+    ytimer_disarm(&ctx->timer);
+
+    if (ctx->reader_active)
     {
-        pthread_join(ctx->keepalive_th, NULL);
-        ctx->keepalive_active = 0;
+        /* the reader sees stop within one read wait; only close the
+         * connection once it no longer touches it */
+        atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+        pthread_join(ctx->reader_th, NULL);
+        ctx->reader_active = 0;
+        libp2p_yamux_shutdown(ctx);
     }
 
     for (size_t i = 0; i < ctx->num_streams; i++)
-    {
-        free(ctx->streams[i]->buf);
-        free(ctx->streams[i]);
-    }
+        stream_free(ctx, ctx->streams[i]);
     free(ctx->streams);
-    free(ctx->pings);
     while (yq_pop(&ctx->incoming))
         ;
     pthread_mutex_destroy(&ctx->incoming.mtx);
     pthread_cond_destroy(&ctx->incoming.cond);
+    ys_free(&ctx->sched);
+    free(ctx->rbuf);
     pthread_mutex_destroy(&ctx->mtx);
     free(ctx);
 }
@@ -499,41 +1087,75 @@ libp2p_yamux_err_t libp2p_yamux_stream_open(libp2p_yamux_ctx_t *ctx, uint32_t *o
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_YAMUX_ERR_AGAIN;
     }
-    uint32_t id = ctx->next_stream_id;
-    ctx->next_stream_id += 2;
-
-    libp2p_yamux_err_t rc = libp2p_yamux_open_stream(ctx->conn, id, ctx->max_window);
-    if (rc)
+    libp2p_yamux_stream_t **tmp = realloc(ctx->streams, (ctx->num_streams + 1) * sizeof(*tmp));
+    if (!tmp)
     {
-        ctx->next_stream_id -= 2;
         pthread_mutex_unlock(&ctx->mtx);
-        return rc;
+        return LIBP2P_YAMUX_ERR_INTERNAL;
     }
-
-    libp2p_yamux_stream_t *st = calloc(1, sizeof(*st));
+    ctx->streams = tmp;
+    uint32_t id = ctx->next_stream_id;
+    libp2p_yamux_stream_t *st = stream_new(id, 1);
     if (!st)
     {
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_YAMUX_ERR_INTERNAL;
     }
-    st->id = id;
-    st->initiator = 1;
     st->acked = 0;
     st->send_window = YAMUX_INITIAL_WINDOW;
     st->recv_window = ctx->max_window;
+    /* register the stream before its SYN can reach the peer, so an early
+     * ACK or data frame finds it */
+    ctx->streams[ctx->num_streams++] = st;
+    ctx->next_stream_id += 2;
 
-    libp2p_yamux_stream_t **tmp = realloc(ctx->streams, (ctx->num_streams + 1) * sizeof(*tmp));
-    if (!tmp)
+    /* queue under the lock so SYNs leave in stream id order */
+    libp2p_yamux_frame_t syn = {
+        .version = 0,
+        .type = LIBP2P_YAMUX_DATA,
+        .flags = LIBP2P_YAMUX_SYN,
+        .stream_id = id,
+        .length = 0,
+        .data = NULL,
+        .data_len = 0,
+    };
+    if (ctx->max_window > YAMUX_INITIAL_WINDOW)
     {
-        free(st);
+        syn.type = LIBP2P_YAMUX_WINDOW_UPDATE;
+        syn.length = ctx->max_window - YAMUX_INITIAL_WINDOW;
+    }
+    libp2p_yamux_err_t rc = ctx_queue_frame(ctx, &syn, 1);
+    if (rc)
+    {
+        ctx->num_streams--;
+        ctx->next_stream_id -= 2;
+        stream_free(ctx, st);
         pthread_mutex_unlock(&ctx->mtx);
-        return LIBP2P_YAMUX_ERR_INTERNAL;
+        return rc;
     }
-    ctx->streams = tmp;
-    ctx->streams[ctx->num_streams++] = st;
     ctx->ack_backlog++;
-    *out_id = id;
+    atomic_store_explicit(&ctx->last_activity_ms, now_mono_ms(), memory_order_relaxed);
     pthread_mutex_unlock(&ctx->mtx);
+
+    rc = ctx_flush(ctx);
+    if (rc)
+    {
+        /* the SYN was dropped; retire the stream nobody was told about */
+        pthread_mutex_lock(&ctx->mtx);
+        size_t idx = 0;
+        st = find_stream(ctx, id, &idx);
+        if (st)
+        {
+            if (!st->acked && ctx->ack_backlog > 0)
+                ctx->ack_backlog--;
+            st->reset = 1;
+            st->local_closed = 1;
+            maybe_cleanup_stream(ctx, idx);
+        }
+        pthread_mutex_unlock(&ctx->mtx);
+        return rc;
+    }
+    *out_id = id;
     return LIBP2P_YAMUX_OK;
 }
 
@@ -559,21 +1181,72 @@ libp2p_yamux_err_t libp2p_yamux_stream_send(libp2p_yamux_ctx_t *ctx, uint32_t id
         return LIBP2P_YAMUX_ERR_PROTO_MAL;
     }
 
+    if (data_len > st->send_window)
+    {
+        pthread_mutex_unlock(&ctx->mtx);
+        return LIBP2P_YAMUX_ERR_AGAIN;
+    }
+
     if (!st->initiator && !st->acked)
     {
         flags |= LIBP2P_YAMUX_ACK;
         st->acked = 1;
     }
 
-    if (data_len > st->send_window)
+    st->send_window -= (uint32_t)data_len;
+    uint32_t weight = st->weight;
+    pthread_mutex_unlock(&ctx->mtx);
+    return ctx_send_msg(ctx, id, data, data_len, flags, weight);
+}
+
+libp2p_yamux_err_t libp2p_yamux_stream_send_timeout(libp2p_yamux_ctx_t *ctx, uint32_t id, const uint8_t *data, size_t data_len,
+                                                    size_t *out_sent, uint64_t timeout_ms)
+{
+    if (!ctx || (!data && data_len) || !out_sent)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+
+    *out_sent = 0;
+    if (!data_len)
+        return libp2p_yamux_stream_send(ctx, id, data, 0, 0);
+    struct timespec deadline;
+    if (timeout_ms)
+        deadline_after(timeout_ms, &deadline);
+    while (*out_sent < data_len)
     {
+        pthread_mutex_lock(&ctx->mtx);
+        size_t idx = 0;
+        libp2p_yamux_stream_t *st = find_stream(ctx, id, &idx);
+        if (st && st->send_window == 0 && !st->reset && !st->local_closed)
+        {
+            if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+            {
+                pthread_mutex_unlock(&ctx->mtx);
+                return LIBP2P_YAMUX_ERR_EOF;
+            }
+            /* window updates and resets wake the stream's waiters */
+            st->waiters++;
+            int wrc = timeout_ms ? pthread_cond_timedwait(&st->cond, &ctx->mtx, &deadline) : pthread_cond_wait(&st->cond, &ctx->mtx);
+            st->waiters--;
+            int expired = wrc == ETIMEDOUT && st->send_window == 0 && !st->reset;
+            pthread_mutex_unlock(&ctx->mtx);
+            if (expired)
+                return LIBP2P_YAMUX_ERR_TIMEOUT;
+            continue;
+        }
+        size_t n = data_len - *out_sent;
+        if (st && n > st->send_window)
+            n = st->send_window;
         pthread_mutex_unlock(&ctx->mtx);
-        return LIBP2P_YAMUX_ERR_AGAIN;
-    }
 
-    st->send_window -= (uint32_t)data_len;
-    pthread_mutex_unlock(&ctx->mtx);
-    return libp2p_yamux_send_msg(ctx->conn, id, data, data_len, flags);
+        /* a missing, reset or closed stream is reported by the send */
+        libp2p_yamux_err_t rc = libp2p_yamux_stream_send(ctx, id, data + *out_sent, n, 0);
+        if (rc == LIBP2P_YAMUX_ERR_AGAIN)
+            continue; /* another writer took the window first */
+        if (rc)
+            return rc;
+        *out_sent += n;
+    }
+    return LIBP2P_YAMUX_OK;
 }
 
 libp2p_yamux_err_t libp2p_yamux_stream_close(libp2p_yamux_ctx_t *ctx, uint32_t id)
@@ -586,9 +1259,10 @@ libp2p_yamux_err_t libp2p_yamux_stream_close(libp2p_yamux_ctx_t *ctx, uint32_t i
         pthread_mutex_unlock(&ctx->mtx);
         return LIBP2P_YAMUX_ERR_PROTO_MAL;
     }
+    uint32_t weight = st->weight;
     pthread_mutex_unlock(&ctx->mtx);
 
-    libp2p_yamux_err_t rc = libp2p_yamux_close_stream(ctx->conn, id);
+    libp2p_yamux_err_t rc = ctx_send_msg(ctx, id, NULL, 0, LIBP2P_YAMUX_FIN, weight);
     if (rc)
         return rc;
 
@@ -615,7 +1289,7 @@ libp2p_yamux_err_t libp2p_yamux_stream_reset(libp2p_yamux_ctx_t *ctx, uint32_t i
     }
     pthread_mutex_unlock(&ctx->mtx);
 
-    libp2p_yamux_err_t rc = libp2p_yamux_reset_stream(ctx->conn, id);
+    libp2p_yamux_err_t rc = ctx_send_msg(ctx, id, NULL, 0, LIBP2P_YAMUX_RST, 0);
 
     pthread_mutex_lock(&ctx->mtx);
     st = find_stream(ctx, id, &idx);
@@ -632,83 +1306,203 @@ libp2p_yamux_err_t libp2p_yamux_stream_reset(libp2p_yamux_ctx_t *ctx, uint32_t i
     return rc;
 }
 
-libp2p_yamux_err_t libp2p_yamux_dispatch_frame(libp2p_yamux_ctx_t *ctx, const libp2p_yamux_frame_t *fr)
+libp2p_yamux_err_t libp2p_yamux_stream_set_weight(libp2p_yamux_ctx_t *ctx, uint32_t id, uint32_t weight)
 {
-    if (!ctx || !fr)
+    if (!ctx)
         return LIBP2P_YAMUX_ERR_NULL_PTR;
+    pthread_mutex_lock(&ctx->mtx);
+    libp2p_yamux_stream_t *st = find_stream(ctx, id, NULL);
+    if (!st)
+    {
+        pthread_mutex_unlock(&ctx->mtx);
+        return LIBP2P_YAMUX_ERR_PROTO_MAL;
+    }
+    st->weight = weight ? weight : 1;
+    pthread_mutex_unlock(&ctx->mtx);
+    return LIBP2P_YAMUX_OK;
+}
+
+/* Work collected while frames are applied under ctx->mtx and finished once
+ * per batch: every touched stream is woken once, replies queued on the
+ * scheduler are flushed and ping callbacks run after the lock is dropped. */
+typedef struct
+{
+    libp2p_yamux_stream_t *touched[YAMUX_DISPATCH_BATCH]; /* streams to wake  */
+    size_t num_touched;
+    struct
+    {
+        uint32_t value;
+        uint64_t rtt_ms;
+    } acks[YAMUX_DISPATCH_BATCH]; /* ping ACKs to report */
+    size_t num_acks;
+    int queued; /* replies were queued on the scheduler */
+} dispatch_batch_t;
+
+/* Record that @p st needs a wake-up; @p cleanup says whether it may be
+ * released afterwards. The last frame for a stream decides. */
+static void batch_touch(dispatch_batch_t *b, libp2p_yamux_stream_t *st, int cleanup)
+{
+    if (!st->touched)
+        b->touched[b->num_touched++] = st;
+    st->touched = cleanup ? 2 : 1;
+}
+
+static void batch_reply(libp2p_yamux_ctx_t *ctx, dispatch_batch_t *b, libp2p_yamux_type_t type, uint32_t id, uint32_t length,
+                        uint16_t flags)
+{
+    libp2p_yamux_frame_t fr = {
+        .version = 0,
+        .type = type,
+        .flags = flags,
+        .stream_id = id,
+        .length = length,
+        .data = NULL,
+        .data_len = 0,
+    };
+    if (ctx_queue_frame(ctx, &fr, 0) == LIBP2P_YAMUX_OK)
+        b->queued = 1;
+}
 
+/* Wake touched streams and release finished ones; caller holds ctx->mtx. */
+static void batch_wake_locked(libp2p_yamux_ctx_t *ctx, dispatch_batch_t *b)
+{
+    for (size_t i = 0; i < b->num_touched; i++)
+    {
+        libp2p_yamux_stream_t *st = b->touched[i];
+        int cleanup = st->touched == 2;
+        st->touched = 0;
+        pthread_cond_broadcast(&st->cond);
+        size_t idx = 0;
+        if (cleanup && find_stream(ctx, st->id, &idx))
+            maybe_cleanup_stream(ctx, idx);
+    }
+    b->num_touched = 0;
+}
+
+/* Flush replies and run ping callbacks; called without ctx->mtx. */
+static libp2p_yamux_err_t batch_finish(libp2p_yamux_ctx_t *ctx, dispatch_batch_t *b)
+{
+    libp2p_yamux_err_t rc = LIBP2P_YAMUX_OK;
+    if (b->queued)
+        rc = ctx_flush_control(ctx);
+    if (b->num_acks)
+    {
+        pthread_mutex_lock(&ctx->mtx);
+        libp2p_yamux_ping_cb cb = ctx->ping_cb;
+        void *cb_arg = ctx->ping_arg;
+        pthread_mutex_unlock(&ctx->mtx);
+        for (size_t i = 0; cb && i < b->num_acks; i++)
+            cb(ctx, b->acks[i].value, b->acks[i].rtt_ms, cb_arg);
+    }
+    return rc;
+}
+
+/* Register a stream opened by the peer (SYN); caller holds ctx->mtx.
+ * Returns NULL when the stream was refused with RST or on failure. */
+static libp2p_yamux_stream_t *accept_remote_stream(libp2p_yamux_ctx_t *ctx, const libp2p_yamux_frame_t *fr, dispatch_batch_t *b,
+                                                   libp2p_yamux_err_t *rc)
+{
+    if (yq_length(&ctx->incoming) >= YAMUX_MAX_BACKLOG)
+    {
+        batch_reply(ctx, b, LIBP2P_YAMUX_DATA, fr->stream_id, 0, LIBP2P_YAMUX_RST);
+        return NULL;
+    }
+    libp2p_yamux_stream_t *st = stream_new(fr->stream_id, 0);
+    if (!st)
+    {
+        batch_reply(ctx, b, LIBP2P_YAMUX_DATA, fr->stream_id, 0, LIBP2P_YAMUX_RST);
+        *rc = LIBP2P_YAMUX_ERR_INTERNAL;
+        return NULL;
+    }
+    st->acked = 0;
+    st->send_window = YAMUX_INITIAL_WINDOW;
+    if (fr->type == LIBP2P_YAMUX_WINDOW_UPDATE)
+    {
+        st->send_window += fr->length;
+        if (st->send_window > ctx->max_window)
+            st->send_window = ctx->max_window;
+    }
+    st->recv_window = ctx->max_window;
+    libp2p_yamux_stream_t **tmp = realloc(ctx->streams, (ctx->num_streams + 1) * sizeof(*tmp));
+    if (!tmp)
+    {
+        stream_free(ctx, st);
+        batch_reply(ctx, b, LIBP2P_YAMUX_DATA, fr->stream_id, 0, LIBP2P_YAMUX_RST);
+        *rc = LIBP2P_YAMUX_ERR_INTERNAL;
+        return NULL;
+    }
+    ctx->streams = tmp;
+    ctx->streams[ctx->num_streams++] = st;
+    yq_push(&ctx->incoming, st);
+    if (ctx->max_window > YAMUX_INITIAL_WINDOW)
+    {
+        st->acked = 1;
+        batch_reply(ctx, b, LIBP2P_YAMUX_WINDOW_UPDATE, fr->stream_id, ctx->max_window - YAMUX_INITIAL_WINDOW, LIBP2P_YAMUX_ACK);
+    }
+    return st;
+}
+
+/* Append payload to the stream's receive buffer, growing it geometrically
+ * so runs of small frames for one stream do not realloc per frame. Read
+ * bytes are only compacted away when the tail has no room left. */
+static int stream_append(libp2p_yamux_stream_t *st, const uint8_t *data, size_t len)
+{
+    if (st->buf_cap - st->buf_len < len)
+    {
+        size_t unread = st->buf_len - st->buf_pos;
+        if (st->buf_pos)
+        {
+            if (unread)
+                memmove(st->buf, st->buf + st->buf_pos, unread);
+            st->buf_len = unread;
+            st->buf_pos = 0;
+        }
+        if (st->buf_cap - st->buf_len < len)
+        {
+            size_t cap = st->buf_cap ? st->buf_cap * 2 : 4096;
+            while (cap < st->buf_len + len)
+                cap *= 2;
+            uint8_t *tmp = realloc(st->buf, cap);
+            if (!tmp)
+                return -1;
+            st->buf = tmp;
+            st->buf_cap = cap;
+        }
+    }
+    memcpy(st->buf + st->buf_len, data, len);
+    st->buf_len += len;
+    return 0;
+}
+
+/* Apply a single frame; caller holds ctx->mtx for the whole batch. */
+static libp2p_yamux_err_t dispatch_locked(libp2p_yamux_ctx_t *ctx, const libp2p_yamux_frame_t *fr, dispatch_batch_t *b)
+{
     libp2p_yamux_err_t rc = LIBP2P_YAMUX_OK;
-    pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
     libp2p_yamux_stream_t *st = NULL;
 
     switch (fr->type)
     {
         case LIBP2P_YAMUX_DATA:
+        case LIBP2P_YAMUX_WINDOW_UPDATE:
             if (fr->stream_id == 0)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                return proto_violation(ctx);
             if (fr->flags & LIBP2P_YAMUX_SYN)
             {
                 uint32_t parity = ctx->dialer ? 0 : 1;
                 if ((fr->stream_id & 1) != parity)
-                {
-                    rc = proto_violation(ctx);
-                    break;
-                }
-                st = find_stream(ctx, fr->stream_id, &idx);
-                if (!st)
-                {
-                    if (yq_length(&ctx->incoming) >= YAMUX_MAX_BACKLOG)
-                    {
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_reset_stream(ctx->conn, fr->stream_id);
-                        pthread_mutex_lock(&ctx->mtx);
-                        break;
-                    }
-                    st = calloc(1, sizeof(*st));
-                    if (!st)
-                    {
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_reset_stream(ctx->conn, fr->stream_id);
-                        pthread_mutex_lock(&ctx->mtx);
-                        rc = LIBP2P_YAMUX_ERR_INTERNAL;
-                        break;
-                    }
-                    st->id = fr->stream_id;
-                    st->initiator = 0;
-                    st->acked = 0;
-                    st->send_window = YAMUX_INITIAL_WINDOW;
-                    st->recv_window = ctx->max_window;
-                    libp2p_yamux_stream_t **tmp = realloc(ctx->streams, (ctx->num_streams + 1) * sizeof(*tmp));
-                    if (!tmp)
-                    {
-                        free(st);
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_reset_stream(ctx->conn, fr->stream_id);
-                        pthread_mutex_lock(&ctx->mtx);
-                        rc = LIBP2P_YAMUX_ERR_INTERNAL;
-                        break;
-                    }
-                    ctx->streams = tmp;
-                    ctx->streams[ctx->num_streams++] = st;
-                    yq_push(&ctx->incoming, st);
-                    if (ctx->max_window > YAMUX_INITIAL_WINDOW)
-                    {
-                        st->acked = 1;
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_window_update(ctx->conn, fr->stream_id, ctx->max_window - YAMUX_INITIAL_WINDOW, LIBP2P_YAMUX_ACK);
-                        pthread_mutex_lock(&ctx->mtx);
-                    }
-                }
+                    return proto_violation(ctx);
+                if (fr->stream_id > ctx->max_remote_id)
+                    ctx->max_remote_id = fr->stream_id;
+                if (!find_stream(ctx, fr->stream_id, NULL) && !accept_remote_stream(ctx, fr, b, &rc))
+                    return rc;
             }
 
-            st = find_stream(ctx, fr->stream_id, &idx);
+            st = find_stream(ctx, fr->stream_id, NULL);
             if (!st)
             {
-                rc = proto_violation(ctx);
+                /* late frames for reset/closed streams are dropped */
+                if (!stream_id_used(ctx, fr->stream_id))
+                    rc = proto_violation(ctx);
                 break;
             }
 
@@ -726,200 +1520,75 @@ libp2p_yamux_err_t libp2p_yamux_dispatch_frame(libp2p_yamux_ctx_t *ctx, const li
                 st->reset = 1;
                 st->local_closed = 1;
                 st->remote_closed = 1;
-                free(st->buf);
-                st->buf = NULL;
-                st->buf_len = 0;
-                st->buf_pos = 0;
+                stream_drop_buf(ctx, st);
+                /* kept until the owner observes the reset */
+                batch_touch(b, st, 0);
                 break;
             }
 
             if (fr->flags & LIBP2P_YAMUX_FIN)
                 st->remote_closed = 1;
 
-            if (fr->data_len)
+            if (fr->type == LIBP2P_YAMUX_WINDOW_UPDATE)
+            {
+                st->send_window += fr->length;
+            }
+            else if (fr->data_len)
             {
                 if (fr->data_len > st->recv_window)
-                {
-                    rc = proto_violation(ctx);
-                    break;
-                }
-                size_t unread = st->buf_len > st->buf_pos ? st->buf_len - st->buf_pos : 0;
-                if (unread && st->buf_pos > 0)
-                    memmove(st->buf, st->buf + st->buf_pos, unread);
-                uint8_t *tmp = realloc(st->buf, unread + fr->data_len);
-                if (!tmp)
-                {
-                    rc = LIBP2P_YAMUX_ERR_INTERNAL;
-                    break;
-                }
-                memcpy(tmp + unread, fr->data, fr->data_len);
-                st->buf = tmp;
-                st->buf_len = unread + fr->data_len;
-                st->buf_pos = 0;
-                st->recv_window -= fr->data_len;
+                    return proto_violation(ctx);
+                if (stream_append(st, fr->data, fr->data_len) != 0)
+                    return LIBP2P_YAMUX_ERR_INTERNAL;
+                mem_charge(ctx, fr->data_len);
+                st->recv_window -= (uint32_t)fr->data_len;
                 if (!st->initiator && !st->acked)
                 {
                     st->acked = 1;
-                    pthread_mutex_unlock(&ctx->mtx);
-                    libp2p_yamux_send_msg(ctx->conn, fr->stream_id, NULL, 0, LIBP2P_YAMUX_ACK);
-                    pthread_mutex_lock(&ctx->mtx);
+                    batch_reply(ctx, b, LIBP2P_YAMUX_DATA, fr->stream_id, 0, LIBP2P_YAMUX_ACK);
                 }
             }
 
-            maybe_cleanup_stream(ctx, idx);
-            break;
-
-        case LIBP2P_YAMUX_WINDOW_UPDATE:
-            if (fr->stream_id == 0)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
-            if (fr->flags & LIBP2P_YAMUX_SYN)
-            {
-                uint32_t parity = ctx->dialer ? 0 : 1;
-                if ((fr->stream_id & 1) != parity)
-                {
-                    rc = proto_violation(ctx);
-                    break;
-                }
-                st = find_stream(ctx, fr->stream_id, &idx);
-                if (!st)
-                {
-                    if (yq_length(&ctx->incoming) >= YAMUX_MAX_BACKLOG)
-                    {
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_reset_stream(ctx->conn, fr->stream_id);
-                        pthread_mutex_lock(&ctx->mtx);
-                        break;
-                    }
-                    st = calloc(1, sizeof(*st));
-                    if (!st)
-                    {
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_reset_stream(ctx->conn, fr->stream_id);
-                        pthread_mutex_lock(&ctx->mtx);
-                        rc = LIBP2P_YAMUX_ERR_INTERNAL;
-                        break;
-                    }
-                    st->id = fr->stream_id;
-                    st->initiator = 0;
-                    st->acked = 0;
-                    st->send_window = YAMUX_INITIAL_WINDOW + fr->length;
-                    if (st->send_window > ctx->max_window)
-                        st->send_window = ctx->max_window;
-                    st->recv_window = ctx->max_window;
-                    libp2p_yamux_stream_t **tmp = realloc(ctx->streams, (ctx->num_streams + 1) * sizeof(*tmp));
-                    if (!tmp)
-                    {
-                        free(st);
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_reset_stream(ctx->conn, fr->stream_id);
-                        pthread_mutex_lock(&ctx->mtx);
-                        rc = LIBP2P_YAMUX_ERR_INTERNAL;
-                        break;
-                    }
-                    ctx->streams = tmp;
-                    ctx->streams[ctx->num_streams++] = st;
-                    yq_push(&ctx->incoming, st);
-                    if (ctx->max_window > YAMUX_INITIAL_WINDOW)
-                    {
-                        st->acked = 1;
-                        pthread_mutex_unlock(&ctx->mtx);
-                        libp2p_yamux_window_update(ctx->conn, fr->stream_id, ctx->max_window - YAMUX_INITIAL_WINDOW, LIBP2P_YAMUX_ACK);
-                        pthread_mutex_lock(&ctx->mtx);
-                    }
-                }
-            }
-
-            st = find_stream(ctx, fr->stream_id, &idx);
-            if (!st)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
-
-            if ((fr->flags & LIBP2P_YAMUX_ACK) && st->initiator && !st->acked)
-            {
-                st->acked = 1;
-                if (ctx->ack_backlog > 0)
-                    ctx->ack_backlog--;
-            }
-
-            if (fr->flags & LIBP2P_YAMUX_RST)
-            {
-                if (st->initiator && !st->acked && ctx->ack_backlog > 0)
-                    ctx->ack_backlog--;
-                st->reset = 1;
-                st->local_closed = 1;
-                st->remote_closed = 1;
-                free(st->buf);
-                st->buf = NULL;
-                st->buf_len = 0;
-                st->buf_pos = 0;
-                break;
-            }
-
-            if (fr->flags & LIBP2P_YAMUX_FIN)
-                st->remote_closed = 1;
-
-            st->send_window += fr->length;
-
-            maybe_cleanup_stream(ctx, idx);
+            batch_touch(b, st, 1);
             break;
 
         case LIBP2P_YAMUX_PING:
             if (fr->stream_id != 0)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                return proto_violation(ctx);
             if (fr->flags != LIBP2P_YAMUX_SYN && fr->flags != LIBP2P_YAMUX_ACK)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                return proto_violation(ctx);
             if (fr->flags == LIBP2P_YAMUX_SYN)
             {
                 /* respond with ACK echoing the value */
-                pthread_mutex_unlock(&ctx->mtx);
-                rc = libp2p_yamux_ping(ctx->conn, fr->length, LIBP2P_YAMUX_ACK);
-                pthread_mutex_lock(&ctx->mtx);
+                batch_reply(ctx, b, LIBP2P_YAMUX_PING, 0, fr->length, LIBP2P_YAMUX_ACK);
             }
             else /* ACK */
             {
                 uint64_t rtt = 0;
-                for (size_t i = 0; i < ctx->num_pings; i++)
+                struct yamux_ping_pending *p = &ctx->pings[fr->length % LIBP2P_YAMUX_PING_SLOTS];
+                if (p->in_use && p->value == fr->length)
                 {
-                    if (ctx->pings[i].value == fr->length)
-                    {
-                        rtt = now_mono_ms() - ctx->pings[i].sent_ms;
-                        memmove(&ctx->pings[i], &ctx->pings[i + 1], (ctx->num_pings - i - 1) * sizeof(*ctx->pings));
-                        ctx->num_pings--;
-                        break;
-                    }
+                    uint64_t sample = now_mono_us() - p->sent_us;
+                    rtt_update(&ctx->rtt, sample);
+                    rtt = sample / 1000;
+                    p->in_use = 0;
+                    ctx->num_pings--;
                 }
-                libp2p_yamux_ping_cb cb = ctx->ping_cb;
-                void *cb_arg = ctx->ping_arg;
-                pthread_mutex_unlock(&ctx->mtx);
-                if (cb)
-                    cb(ctx, fr->length, rtt, cb_arg);
-                pthread_mutex_lock(&ctx->mtx);
+                b->acks[b->num_acks].value = fr->length;
+                b->acks[b->num_acks].rtt_ms = rtt;
+                b->num_acks++;
             }
             break;
 
         case LIBP2P_YAMUX_GO_AWAY:
             if (fr->stream_id != 0 || fr->flags != 0)
-            {
-                rc = proto_violation(ctx);
-                break;
-            }
+                return proto_violation(ctx);
             /* record the remote code and tear down the session */
             ctx->goaway_code = (libp2p_yamux_goaway_t)fr->length;
             ctx->goaway_received = 1;
             /* tear down the session without replying */
             libp2p_conn_close(ctx->conn);
             atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+            wake_all_locked(ctx);
             break;
 
         default:
@@ -927,56 +1596,187 @@ libp2p_yamux_err_t libp2p_yamux_dispatch_frame(libp2p_yamux_ctx_t *ctx, const li
             break;
     }
 
-    pthread_mutex_unlock(&ctx->mtx);
     return rc;
 }
 
-libp2p_yamux_err_t libp2p_yamux_stream_recv(libp2p_yamux_ctx_t *ctx, uint32_t id, uint8_t *buf, size_t max_len, size_t *out_len)
+libp2p_yamux_err_t libp2p_yamux_dispatch_frame(libp2p_yamux_ctx_t *ctx, const libp2p_yamux_frame_t *fr)
 {
-    if (!ctx || !out_len)
+    if (!ctx || !fr)
         return LIBP2P_YAMUX_ERR_NULL_PTR;
 
+    dispatch_batch_t b;
+    b.num_touched = 0;
+    b.num_acks = 0;
+    b.queued = 0;
     pthread_mutex_lock(&ctx->mtx);
-    size_t idx = 0;
-    libp2p_yamux_stream_t *st = find_stream(ctx, id, &idx);
-    if (!st)
+    libp2p_yamux_err_t rc = dispatch_locked(ctx, fr, &b);
+    batch_wake_locked(ctx, &b);
+    pthread_mutex_unlock(&ctx->mtx);
+    libp2p_yamux_err_t frc = batch_finish(ctx, &b);
+    return rc ? rc : frc;
+}
+
+/* Return @p n consumed bytes to the stream's receive window. While the
+ * session or process budget is exhausted the credit is withheld, so the
+ * peer stalls instead of growing our buffers further. Returns the window
+ * update to send now; caller holds ctx->mtx. */
+static uint32_t stream_credit(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t *st, uint32_t n)
+{
+    if (over_budget(ctx))
     {
-        pthread_mutex_unlock(&ctx->mtx);
-        return LIBP2P_YAMUX_ERR_PROTO_MAL;
+        if (!st->withheld && n)
+            ctx->num_withheld++;
+        st->withheld += n;
+        return 0;
     }
-    if (st->reset)
+    uint32_t grant = st->withheld + n;
+    if (st->withheld)
     {
-        maybe_cleanup_stream(ctx, idx);
-        pthread_mutex_unlock(&ctx->mtx);
-        *out_len = 0;
-        return LIBP2P_YAMUX_ERR_RESET;
+        st->withheld = 0;
+        ctx->num_withheld--;
+    }
+    st->recv_window += grant;
+    return grant;
+}
+
+/* Send withheld window updates once usage is back under budget. Returns
+ * non-zero if credit is still withheld. */
+static int release_withheld(libp2p_yamux_ctx_t *ctx)
+{
+    int queued = 0;
+    pthread_mutex_lock(&ctx->mtx);
+    if (!over_budget(ctx))
+    {
+        for (size_t i = 0; i < ctx->num_streams && ctx->num_withheld; i++)
+        {
+            libp2p_yamux_stream_t *st = ctx->streams[i];
+            if (!st->withheld)
+                continue;
+            libp2p_yamux_frame_t fr = {
+                .version = 0,
+                .type = LIBP2P_YAMUX_WINDOW_UPDATE,
+                .flags = 0,
+                .stream_id = st->id,
+                .length = st->withheld,
+                .data = NULL,
+                .data_len = 0,
+            };
+            if (ctx_queue_frame(ctx, &fr, 0) != LIBP2P_YAMUX_OK)
+                break;
+            st->recv_window += st->withheld;
+            st->withheld = 0;
+            ctx->num_withheld--;
+            queued = 1;
+        }
     }
-    if (st->buf_pos == st->buf_len)
+    int pending = ctx->num_withheld > 0;
+    pthread_mutex_unlock(&ctx->mtx);
+    if (queued)
+        ctx_flush_control(ctx);
+    return pending;
+}
+
+static libp2p_yamux_err_t stream_recv(libp2p_yamux_ctx_t *ctx, uint32_t id, uint8_t *buf, size_t max_len, size_t *out_len,
+                                      int block, const struct timespec *deadline)
+{
+    if (!ctx || !out_len)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+
+    *out_len = 0;
+    pthread_mutex_lock(&ctx->mtx);
+    for (;;)
     {
+        size_t idx = 0;
+        libp2p_yamux_stream_t *st = find_stream(ctx, id, &idx);
+        if (!st)
+        {
+            pthread_mutex_unlock(&ctx->mtx);
+            return LIBP2P_YAMUX_ERR_PROTO_MAL;
+        }
+        if (st->reset)
+        {
+            maybe_cleanup_stream(ctx, idx);
+            pthread_mutex_unlock(&ctx->mtx);
+            return LIBP2P_YAMUX_ERR_RESET;
+        }
+        if (st->buf_pos < st->buf_len)
+        {
+            size_t n = st->buf_len - st->buf_pos;
+            if (n > max_len)
+                n = max_len;
+            memcpy(buf, st->buf + st->buf_pos, n);
+            st->buf_pos += n;
+            if (st->buf_pos == st->buf_len)
+            {
+                st->buf_pos = st->buf_len = 0;
+                /* the budget counts unread bytes; give back large drained
+                 * buffers so idle streams do not pin a full window each */
+                if (st->buf_cap > YAMUX_KEEP_BUF)
+                {
+                    free(st->buf);
+                    st->buf = NULL;
+                    st->buf_cap = 0;
+                }
+            }
+            mem_release(ctx, n);
+            int was_withheld = ctx->num_withheld > 0;
+            uint32_t grant = stream_credit(ctx, st, (uint32_t)n);
+            int release = grant && was_withheld;
+            int retry = !was_withheld && ctx->num_withheld > 0;
+            maybe_cleanup_stream(ctx, idx);
+            pthread_mutex_unlock(&ctx->mtx);
+            if (grant)
+                ctx_window_update(ctx, id, grant, 0);
+            if (release)
+                release_withheld(ctx);
+            else if (retry)
+                arm_timer(ctx, now_mono_ms() + YAMUX_BUDGET_RETRY_MS);
+            *out_len = n;
+            return LIBP2P_YAMUX_OK;
+        }
         if (st->remote_closed)
         {
             maybe_cleanup_stream(ctx, idx);
             pthread_mutex_unlock(&ctx->mtx);
-            *out_len = 0;
             return LIBP2P_YAMUX_ERR_EOF;
         }
-        pthread_mutex_unlock(&ctx->mtx);
-        *out_len = 0;
-        return LIBP2P_YAMUX_ERR_AGAIN;
+        if (!block)
+        {
+            pthread_mutex_unlock(&ctx->mtx);
+            return LIBP2P_YAMUX_ERR_AGAIN;
+        }
+        if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+        {
+            pthread_mutex_unlock(&ctx->mtx);
+            return LIBP2P_YAMUX_ERR_EOF;
+        }
+
+        st->waiters++;
+        int wrc = deadline ? pthread_cond_timedwait(&st->cond, &ctx->mtx, deadline) : pthread_cond_wait(&st->cond, &ctx->mtx);
+        st->waiters--;
+        if (wrc == ETIMEDOUT)
+        {
+            /* data may have raced the deadline; report it if present */
+            if (st->buf_pos < st->buf_len || st->reset || st->remote_closed)
+                continue;
+            pthread_mutex_unlock(&ctx->mtx);
+            return LIBP2P_YAMUX_ERR_TIMEOUT;
+        }
     }
+}
 
-    size_t n = st->buf_len - st->buf_pos;
-    if (n > max_len)
-        n = max_len;
-    memcpy(buf, st->buf + st->buf_pos, n);
-    st->buf_pos += n;
-    st->recv_window += (uint32_t)n;
-    maybe_cleanup_stream(ctx, idx);
-    pthread_mutex_unlock(&ctx->mtx);
-    if (n)
-        libp2p_yamux_window_update(ctx->conn, id, (uint32_t)n, 0);
-    *out_len = n;
-    return LIBP2P_YAMUX_OK;
+libp2p_yamux_err_t libp2p_yamux_stream_recv(libp2p_yamux_ctx_t *ctx, uint32_t id, uint8_t *buf, size_t max_len, size_t *out_len)
+{
+    return stream_recv(ctx, id, buf, max_len, out_len, 0, NULL);
+}
+
+libp2p_yamux_err_t libp2p_yamux_stream_recv_timeout(libp2p_yamux_ctx_t *ctx, uint32_t id, uint8_t *buf, size_t max_len, size_t *out_len,
+                                                    uint64_t timeout_ms)
+{
+    struct timespec deadline;
+    if (timeout_ms)
+        deadline_after(timeout_ms, &deadline);
+    return stream_recv(ctx, id, buf, max_len, out_len, 1, timeout_ms ? &deadline : NULL);
 }
 
 libp2p_yamux_err_t libp2p_yamux_accept_stream(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t **out)
@@ -990,23 +1790,179 @@ libp2p_yamux_err_t libp2p_yamux_accept_stream(libp2p_yamux_ctx_t *ctx, libp2p_ya
     return LIBP2P_YAMUX_OK;
 }
 
-libp2p_yamux_err_t libp2p_yamux_process_one(libp2p_yamux_ctx_t *ctx)
+libp2p_yamux_err_t libp2p_yamux_accept_stream_timeout(libp2p_yamux_ctx_t *ctx, libp2p_yamux_stream_t **out, uint64_t timeout_ms)
 {
-    if (!ctx)
+    if (!ctx || !out)
         return LIBP2P_YAMUX_ERR_NULL_PTR;
+    struct timespec deadline;
+    if (timeout_ms)
+        deadline_after(timeout_ms, &deadline);
+    libp2p_yamux_stream_t *st = yq_pop_wait(&ctx->incoming, timeout_ms ? &deadline : NULL, &ctx->stop);
+    if (!st)
+        return atomic_load_explicit(&ctx->stop, memory_order_relaxed) ? LIBP2P_YAMUX_ERR_EOF : LIBP2P_YAMUX_ERR_TIMEOUT;
+    *out = st;
+    return LIBP2P_YAMUX_OK;
+}
+
+/* Make at least @p need bytes available in the read-ahead buffer. With
+ * @p readahead set every read asks for all free space so one wakeup can
+ * pull in many frames; otherwise only the missing bytes are read. */
+static libp2p_yamux_err_t rbuf_fill(libp2p_yamux_ctx_t *ctx, size_t need, int readahead)
+{
+    size_t have = ctx->rbuf_len - ctx->rbuf_pos;
+    if (have >= need)
+        return LIBP2P_YAMUX_OK;
+    if (ctx->rbuf_pos + need > ctx->rbuf_cap)
+    {
+        if (have)
+            memmove(ctx->rbuf, ctx->rbuf + ctx->rbuf_pos, have);
+        ctx->rbuf_pos = 0;
+        ctx->rbuf_len = have;
+        if (need > ctx->rbuf_cap)
+        {
+            size_t cap = need > YAMUX_READAHEAD ? need : YAMUX_READAHEAD;
+            uint8_t *tmp = realloc(ctx->rbuf, cap);
+            if (!tmp)
+                return LIBP2P_YAMUX_ERR_INTERNAL;
+            ctx->rbuf = tmp;
+            ctx->rbuf_cap = cap;
+        }
+    }
+    while (ctx->rbuf_len - ctx->rbuf_pos < need)
+    {
+        libp2p_yamux_err_t rc = run_deferred(ctx);
+        if (rc)
+            return rc;
+        /* replies that did not fit into the connection earlier */
+        ctx_flush_control(ctx);
+        size_t want = readahead ? ctx->rbuf_cap - ctx->rbuf_len : need - (ctx->rbuf_len - ctx->rbuf_pos);
+        /* sleep in the connection until data arrives; the bounded wait
+         * lets a stopped session notice without closing the conn first */
+        ssize_t n = libp2p_conn_read_wait(ctx->conn, ctx->rbuf + ctx->rbuf_len, want, YAMUX_READ_WAIT_MS);
+        if (n > 0)
+        {
+            ctx->rbuf_len += (size_t)n;
+            continue;
+        }
+        if (n == LIBP2P_CONN_ERR_AGAIN)
+        {
+            if (atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+                return LIBP2P_YAMUX_ERR_EOF;
+            continue;
+        }
+        return map_conn_err(n);
+    }
+    return LIBP2P_YAMUX_OK;
+}
+
+/* Decode the frame at the head of the read-ahead buffer. Returns
+ * LIBP2P_YAMUX_ERR_AGAIN when it is not complete yet; on success the
+ * payload points into the buffer and stays valid until the next fill. */
+static libp2p_yamux_err_t rbuf_peek(libp2p_yamux_ctx_t *ctx, libp2p_yamux_frame_t *fr, size_t *frame_len)
+{
+    size_t have = ctx->rbuf_len - ctx->rbuf_pos;
+    if (have < 12)
+        return LIBP2P_YAMUX_ERR_AGAIN;
+    const uint8_t *p = ctx->rbuf + ctx->rbuf_pos;
+    if (decode_header(p, fr) != LIBP2P_YAMUX_OK)
+        return LIBP2P_YAMUX_ERR_PROTO_MAL;
+    /* no stream window ever exceeds max_window, so larger frames are bogus */
+    if (fr->data_len > ctx->max_window)
+        return LIBP2P_YAMUX_ERR_PROTO_MAL;
+    *frame_len = 12 + fr->data_len;
+    if (have < *frame_len)
+        return LIBP2P_YAMUX_ERR_AGAIN;
+    if (fr->data_len)
+        fr->data = (uint8_t *)p + 12;
+    return LIBP2P_YAMUX_OK;
+}
+
+/* Block until the next complete frame is buffered. */
+static libp2p_yamux_err_t rbuf_next(libp2p_yamux_ctx_t *ctx, libp2p_yamux_frame_t *fr, size_t *frame_len, int readahead)
+{
+    libp2p_yamux_err_t rc = rbuf_fill(ctx, 12, readahead);
+    if (rc)
+        return rc;
+    rc = rbuf_peek(ctx, fr, frame_len);
+    if (rc != LIBP2P_YAMUX_ERR_AGAIN)
+        return rc;
+    rc = rbuf_fill(ctx, *frame_len, readahead);
+    if (rc)
+        return rc;
+    return rbuf_peek(ctx, fr, frame_len);
+}
+
+static void rbuf_consume(libp2p_yamux_ctx_t *ctx, size_t len)
+{
+    ctx->rbuf_pos += len;
+    if (ctx->rbuf_pos == ctx->rbuf_len)
+        ctx->rbuf_pos = ctx->rbuf_len = 0;
+}
+
+static libp2p_yamux_err_t process_frames(libp2p_yamux_ctx_t *ctx, size_t max_frames, int readahead, size_t *out_frames)
+{
+    if (out_frames)
+        *out_frames = 0;
     libp2p_yamux_frame_t fr = {0};
-    libp2p_yamux_err_t rc = libp2p_yamux_read_frame(ctx->conn, &fr);
+    size_t frame_len = 0;
+    libp2p_yamux_err_t rc = rbuf_next(ctx, &fr, &frame_len, readahead);
     if (rc)
     {
         if (rc == LIBP2P_YAMUX_ERR_PROTO_MAL)
+        {
             rc = proto_violation(ctx);
+            wake_all(ctx);
+        }
         return rc;
     }
-    rc = libp2p_yamux_dispatch_frame(ctx, &fr);
+
+    dispatch_batch_t b;
+    b.num_touched = 0;
+    b.num_acks = 0;
+    b.queued = 0;
+    size_t n = 0;
+    int activity = 0;
+    pthread_mutex_lock(&ctx->mtx);
+    do
+    {
+        if (fr.type == LIBP2P_YAMUX_DATA || fr.type == LIBP2P_YAMUX_WINDOW_UPDATE)
+            activity = 1;
+        rc = dispatch_locked(ctx, &fr, &b);
+        rbuf_consume(ctx, frame_len);
+        n++;
+        if (rc || n == max_frames || atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+            break;
+        rc = rbuf_peek(ctx, &fr, &frame_len);
+        if (rc == LIBP2P_YAMUX_ERR_PROTO_MAL)
+            rc = proto_violation(ctx);
+    } while (rc == LIBP2P_YAMUX_OK);
+    if (rc == LIBP2P_YAMUX_ERR_AGAIN)
+        rc = LIBP2P_YAMUX_OK;
     if (rc == LIBP2P_YAMUX_ERR_PROTO_MAL)
-        rc = proto_violation(ctx);
-    libp2p_yamux_frame_free(&fr);
-    return rc;
+        wake_all_locked(ctx);
+    batch_wake_locked(ctx, &b);
+    pthread_mutex_unlock(&ctx->mtx);
+
+    if (activity)
+        atomic_store_explicit(&ctx->last_activity_ms, now_mono_ms(), memory_order_relaxed);
+    libp2p_yamux_err_t frc = batch_finish(ctx, &b);
+    if (out_frames)
+        *out_frames = n;
+    return rc ? rc : frc;
+}
+
+libp2p_yamux_err_t libp2p_yamux_process_one(libp2p_yamux_ctx_t *ctx)
+{
+    if (!ctx)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    return process_frames(ctx, 1, 0, NULL);
+}
+
+libp2p_yamux_err_t libp2p_yamux_process_batch(libp2p_yamux_ctx_t *ctx, size_t *out_frames)
+{
+    if (!ctx)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    return process_frames(ctx, YAMUX_DISPATCH_BATCH, 1, out_frames);
 }
 
 libp2p_yamux_err_t libp2p_yamux_process_loop(libp2p_yamux_ctx_t *ctx)
@@ -1015,22 +1971,60 @@ libp2p_yamux_err_t libp2p_yamux_process_loop(libp2p_yamux_ctx_t *ctx)
         return LIBP2P_YAMUX_ERR_NULL_PTR;
     while (!atomic_load_explicit(&ctx->stop, memory_order_relaxed))
     {
-        libp2p_yamux_err_t rc = libp2p_yamux_process_one(ctx);
+        libp2p_yamux_err_t rc = libp2p_yamux_process_batch(ctx, NULL);
         if (rc)
             return rc;
     }
     return LIBP2P_YAMUX_OK;
 }
 
+static void *reader_loop(void *arg)
+{
+    libp2p_yamux_ctx_t *ctx = arg;
+    libp2p_yamux_process_loop(ctx);
+    /* a close handed over by the timer may still be pending */
+    run_deferred(ctx);
+    /* the session is unusable once the reader exits; release all waiters */
+    atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+    wake_all(ctx);
+    return NULL;
+}
+
+libp2p_yamux_err_t libp2p_yamux_start_reader(libp2p_yamux_ctx_t *ctx)
+{
+    if (!ctx)
+        return LIBP2P_YAMUX_ERR_NULL_PTR;
+    if (ctx->reader_active)
+        return LIBP2P_YAMUX_OK;
+    if (pthread_create(&ctx->reader_th, NULL, reader_loop, ctx) != 0)
+        return LIBP2P_YAMUX_ERR_INTERNAL;
+    ctx->reader_active = 1;
+    return LIBP2P_YAMUX_OK;
+}
+
 void libp2p_yamux_stop(libp2p_yamux_ctx_t *ctx)
 {
     if (!ctx)
         return;
     if (!atomic_load_explicit(&ctx->stop, memory_order_relaxed))
     {
+        /* a sender stuck on a peer that stopped reading gives up now */
+        ys_close(&ctx->sched);
         if (ctx->conn)
-            libp2p_yamux_go_away(ctx->conn, LIBP2P_YAMUX_GOAWAY_OK);
+        {
+            libp2p_yamux_frame_t fr = {
+                .version = 0,
+                .type = LIBP2P_YAMUX_GO_AWAY,
+                .flags = 0,
+                .stream_id = 0,
+                .length = (uint32_t)LIBP2P_YAMUX_GOAWAY_OK,
+                .data = NULL,
+                .data_len = 0,
+            };
+            ctx_send_frame(ctx, &fr, 0);
+        }
         atomic_store_explicit(&ctx->stop, true, memory_order_relaxed);
+        wake_all(ctx);
     }
 }
 
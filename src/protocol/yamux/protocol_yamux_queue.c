@@ -1,6 +1,8 @@
 #include "protocol/yamux/protocol_yamux_queue.h"
 #include "protocol/yamux/protocol_yamux.h"
+#include <errno.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 void yq_init(yamux_stream_queue_t *q)
 {
@@ -57,6 +59,38 @@ struct libp2p_yamux_stream *yq_pop(yamux_stream_queue_t *q)
     return s;
 }
 
+struct libp2p_yamux_stream *yq_pop_wait(yamux_stream_queue_t *q, const struct timespec *deadline, const atomic_bool *cancel)
+{
+    pthread_mutex_lock(&q->mtx);
+    while (!q->head && !(cancel && atomic_load_explicit(cancel, memory_order_relaxed)))
+    {
+        int rc = deadline ? pthread_cond_timedwait(&q->cond, &q->mtx, deadline) : pthread_cond_wait(&q->cond, &q->mtx);
+        if (rc == ETIMEDOUT)
+            break;
+    }
+    yamux_stream_node_t *n = q->head;
+    if (!n)
+    {
+        pthread_mutex_unlock(&q->mtx);
+        return NULL;
+    }
+    q->head = n->next;
+    if (!q->head)
+        q->tail = NULL;
+    atomic_fetch_sub_explicit(&q->len, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&q->mtx);
+    struct libp2p_yamux_stream *s = n->s;
+    free(n);
+    return s;
+}
+
+void yq_wake_all(yamux_stream_queue_t *q)
+{
+    pthread_mutex_lock(&q->mtx);
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mtx);
+}
+
 size_t yq_length(yamux_stream_queue_t *q)
 {
     return atomic_load_explicit(&q->len, memory_order_relaxed);
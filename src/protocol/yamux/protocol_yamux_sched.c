@@ -0,0 +1,444 @@
+#include "protocol/yamux/protocol_yamux_sched.h"
+#include "transport/buf_pool.h"
+#include "transport/conn_util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum
+{
+    YS_IDLE = 0,            /* no writer                             */
+    YS_WRITING_CONTROL = 1, /* a reader sends frames without payload */
+    YS_WRITING_ALL = 2,     /* a sender drains every queue           */
+};
+
+void ys_chain_free(yamux_send_entry_t *e)
+{
+    while (e)
+    {
+        yamux_send_entry_t *next = e->next;
+        libp2p_buf_release((uint8_t *)e);
+        e = next;
+    }
+}
+
+void ys_init(yamux_send_sched_t *s)
+{
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_init(&s->mtx, NULL);
+    pthread_cond_init(&s->idle, NULL);
+    s->err = LIBP2P_CONN_OK;
+}
+
+static void drop_pending(yamux_send_sched_t *s)
+{
+    ys_chain_free(s->ctl_head);
+    s->ctl_head = s->ctl_tail = NULL;
+    yamux_send_flow_t *f = s->active;
+    while (f)
+    {
+        yamux_send_flow_t *next = f->next;
+        ys_chain_free(f->head);
+        free(f);
+        f = next;
+    }
+    s->active = s->active_tail = NULL;
+    s->pending_bytes = 0;
+}
+
+static void release_output(yamux_send_sched_t *s)
+{
+    ys_chain_free(s->out_chain);
+    s->out_chain = NULL;
+    s->out = NULL;
+    s->out_len = s->out_off = 0;
+}
+
+void ys_free(yamux_send_sched_t *s)
+{
+    drop_pending(s);
+    release_output(s);
+    yamux_send_flow_t *f = s->spare;
+    while (f)
+    {
+        yamux_send_flow_t *next = f->next;
+        free(f);
+        f = next;
+    }
+    s->spare = NULL;
+    free(s->batch);
+    s->batch = NULL;
+    s->batch_cap = 0;
+    pthread_cond_destroy(&s->idle);
+    pthread_mutex_destroy(&s->mtx);
+}
+
+yamux_send_entry_t *ys_entry_new(const uint8_t hdr[12], const uint8_t *payload, size_t payload_len)
+{
+    yamux_send_entry_t *e = (yamux_send_entry_t *)(void *)libp2p_buf_alloc(sizeof(*e) + 12 + payload_len);
+    if (!e)
+        return NULL;
+    e->next = NULL;
+    e->len = 12 + payload_len;
+    e->payload_len = payload_len;
+    memcpy(e->bytes, hdr, 12);
+    if (payload_len)
+        memcpy(e->bytes + 12, payload, payload_len);
+    return e;
+}
+
+static yamux_send_flow_t *find_active(yamux_send_sched_t *s, uint32_t id)
+{
+    for (yamux_send_flow_t *f = s->active; f; f = f->next)
+        if (f->id == id)
+            return f;
+    return NULL;
+}
+
+libp2p_conn_err_t ys_push(yamux_send_sched_t *s, yamux_send_entry_t *chain, uint32_t flow, uint32_t weight)
+{
+    if (!chain)
+        return LIBP2P_CONN_ERR_NULL_PTR;
+
+    yamux_send_entry_t *last = chain;
+    size_t bytes = chain->len;
+    while (last->next)
+    {
+        last = last->next;
+        bytes += last->len;
+    }
+
+    pthread_mutex_lock(&s->mtx);
+    if (s->err != LIBP2P_CONN_OK)
+    {
+        libp2p_conn_err_t err = s->err;
+        pthread_mutex_unlock(&s->mtx);
+        ys_chain_free(chain);
+        return err;
+    }
+
+    if (flow == YAMUX_SCHED_CONTROL)
+    {
+        if (s->ctl_tail)
+            s->ctl_tail->next = chain;
+        else
+            s->ctl_head = chain;
+        s->ctl_tail = last;
+    }
+    else
+    {
+        yamux_send_flow_t *f = find_active(s, flow);
+        if (!f)
+        {
+            f = s->spare;
+            if (f)
+                s->spare = f->next;
+            else
+                f = malloc(sizeof(*f));
+            if (!f)
+            {
+                pthread_mutex_unlock(&s->mtx);
+                ys_chain_free(chain);
+                return LIBP2P_CONN_ERR_INTERNAL;
+            }
+            f->id = flow;
+            f->deficit = 0;
+            f->head = f->tail = NULL;
+            f->next = NULL;
+            if (s->active_tail)
+                s->active_tail->next = f;
+            else
+                s->active = f;
+            s->active_tail = f;
+        }
+        f->weight = weight ? weight : 1;
+        if (f->tail)
+            f->tail->next = chain;
+        else
+            f->head = chain;
+        f->tail = last;
+    }
+    s->pending_bytes += bytes;
+    pthread_mutex_unlock(&s->mtx);
+    return LIBP2P_CONN_OK;
+}
+
+/* Move the flow at the head of the active ring to the tail, or retire it
+ * when it has nothing left to send. Caller holds s->mtx. */
+static void rotate_active(yamux_send_sched_t *s)
+{
+    yamux_send_flow_t *f = s->active;
+    s->active = f->next;
+    if (!s->active)
+        s->active_tail = NULL;
+    f->next = NULL;
+    if (f->head)
+    {
+        if (s->active_tail)
+            s->active_tail->next = f;
+        else
+            s->active = f;
+        s->active_tail = f;
+    }
+    else
+    {
+        f->next = s->spare;
+        s->spare = f;
+    }
+}
+
+/* Unlink @p f from the active ring and recycle it once its queue is empty;
+ * @p prev is the flow before it or NULL. Caller holds s->mtx. */
+static void retire_flow(yamux_send_sched_t *s, yamux_send_flow_t *prev, yamux_send_flow_t *f)
+{
+    if (prev)
+        prev->next = f->next;
+    else
+        s->active = f->next;
+    if (s->active_tail == f)
+        s->active_tail = prev;
+    f->next = s->spare;
+    s->spare = f;
+}
+
+static void chain_append(yamux_send_entry_t **head, yamux_send_entry_t **tail, yamux_send_entry_t *e)
+{
+    e->next = NULL;
+    if (*tail)
+        (*tail)->next = e;
+    else
+        *head = e;
+    *tail = e;
+}
+
+/* Detach the next batch of frames: all control frames first, then deficit
+ * round-robin across stream flows until YAMUX_SCHED_BATCH bytes are taken.
+ * With @p control_only only frames without payload are taken from the
+ * head of each flow, which keeps them behind earlier data on the same
+ * stream. Caller holds s->mtx. */
+static yamux_send_entry_t *take_batch(yamux_send_sched_t *s, int control_only, size_t *out_bytes)
+{
+    yamux_send_entry_t *head = s->ctl_head, *tail = s->ctl_tail;
+    size_t bytes = 0;
+    for (yamux_send_entry_t *e = head; e; e = e->next)
+        bytes += e->len;
+    s->ctl_head = s->ctl_tail = NULL;
+
+    if (control_only)
+    {
+        yamux_send_flow_t *prev = NULL, *f = s->active;
+        while (f)
+        {
+            yamux_send_flow_t *next = f->next;
+            while (f->head && f->head->payload_len == 0)
+            {
+                yamux_send_entry_t *e = f->head;
+                f->head = e->next;
+                if (!f->head)
+                    f->tail = NULL;
+                bytes += e->len;
+                chain_append(&head, &tail, e);
+            }
+            if (f->head)
+                prev = f;
+            else
+                retire_flow(s, prev, f);
+            f = next;
+        }
+    }
+
+    while (!control_only && s->active && bytes < YAMUX_SCHED_BATCH)
+    {
+        yamux_send_flow_t *f = s->active;
+        f->deficit += (size_t)f->weight * YAMUX_SCHED_QUANTUM;
+        while (f->head && f->head->payload_len <= f->deficit && bytes < YAMUX_SCHED_BATCH)
+        {
+            yamux_send_entry_t *e = f->head;
+            f->head = e->next;
+            if (!f->head)
+                f->tail = NULL;
+            f->deficit -= e->payload_len;
+            bytes += e->len;
+            chain_append(&head, &tail, e);
+        }
+        if (!f->head)
+            f->deficit = 0;
+        rotate_active(s);
+    }
+
+    s->pending_bytes -= bytes;
+    *out_bytes = bytes;
+    return head;
+}
+
+/* Stage a detached batch as the current output, coalescing several frames
+ * into the batch buffer. Only the active writer calls this. */
+static libp2p_conn_err_t stage_batch(yamux_send_sched_t *s, yamux_send_entry_t *batch, size_t bytes)
+{
+    s->out_chain = batch;
+    s->out_off = 0;
+    s->out_len = bytes;
+    if (!batch->next)
+    {
+        s->out = batch->bytes;
+        return LIBP2P_CONN_OK;
+    }
+
+    if (s->batch_cap < bytes)
+    {
+        uint8_t *tmp = realloc(s->batch, bytes);
+        if (!tmp)
+            return LIBP2P_CONN_ERR_INTERNAL;
+        s->batch = tmp;
+        s->batch_cap = bytes;
+    }
+    size_t off = 0;
+    for (yamux_send_entry_t *e = batch; e; e = e->next)
+    {
+        memcpy(s->batch + off, e->bytes, e->len);
+        off += e->len;
+    }
+    s->out = s->batch;
+    return LIBP2P_CONN_OK;
+}
+
+static int closing(yamux_send_sched_t *s)
+{
+    pthread_mutex_lock(&s->mtx);
+    int c = s->closing;
+    pthread_mutex_unlock(&s->mtx);
+    return c;
+}
+
+/* Write the rest of the staged output. A full connection is backpressure:
+ * a control-only writer gives up with LIBP2P_CONN_ERR_AGAIN and leaves the
+ * remainder for the next writer, any other writer waits for the peer to
+ * drain it. Once the session is closing a stall of YAMUX_SCHED_STALL_MS
+ * fails the write so teardown cannot hang on a peer that stopped reading. */
+static libp2p_conn_err_t write_output(yamux_send_sched_t *s, libp2p_conn_t *conn, int control_only)
+{
+    uint64_t progress = now_mono_ms();
+    while (s->out_off < s->out_len)
+    {
+        ssize_t n = libp2p_conn_write(conn, s->out + s->out_off, s->out_len - s->out_off);
+        if (n > 0)
+        {
+            s->out_off += (size_t)n;
+            progress = now_mono_ms();
+            continue;
+        }
+        if (n != 0 && n != LIBP2P_CONN_ERR_AGAIN && n != LIBP2P_CONN_ERR_TIMEOUT)
+            return (libp2p_conn_err_t)n;
+        if (control_only)
+            return LIBP2P_CONN_ERR_AGAIN;
+        if (closing(s) && now_mono_ms() - progress > YAMUX_SCHED_STALL_MS)
+            return LIBP2P_CONN_ERR_TIMEOUT;
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = 1000000L};
+        nanosleep(&ts, NULL);
+    }
+    return LIBP2P_CONN_OK;
+}
+
+/* Drain queued frames as the single active writer; caller holds s->mtx
+ * and has set s->writing. */
+static libp2p_conn_err_t drain_locked(yamux_send_sched_t *s, libp2p_conn_t *conn, int control_only)
+{
+    libp2p_conn_err_t rc = s->err;
+    while (rc == LIBP2P_CONN_OK)
+    {
+        if (s->out_off == s->out_len)
+        {
+            release_output(s);
+            size_t bytes = 0;
+            yamux_send_entry_t *batch = take_batch(s, control_only, &bytes);
+            if (!batch)
+                break;
+            rc = stage_batch(s, batch, bytes);
+            if (rc != LIBP2P_CONN_OK)
+            {
+                release_output(s);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&s->mtx);
+
+        /* the output is only touched by the single active writer */
+        rc = write_output(s, conn, control_only);
+
+        pthread_mutex_lock(&s->mtx);
+        if (rc == LIBP2P_CONN_ERR_AGAIN)
+            return LIBP2P_CONN_OK;
+    }
+    if (rc != LIBP2P_CONN_OK)
+    {
+        /* frames queued behind us learn about the loss through s->err */
+        s->err = rc;
+        release_output(s);
+        drop_pending(s);
+    }
+    return rc;
+}
+
+static void writer_done_locked(yamux_send_sched_t *s)
+{
+    s->writing = YS_IDLE;
+    s->rounds++;
+    pthread_cond_broadcast(&s->idle);
+}
+
+libp2p_conn_err_t ys_flush(yamux_send_sched_t *s, libp2p_conn_t *conn)
+{
+    pthread_mutex_lock(&s->mtx);
+    while (s->writing != YS_IDLE)
+    {
+        /* a full writer drains our frames before it goes idle; wait for it
+         * so a failure that drops them is reported here and not lost */
+        int full = s->writing == YS_WRITING_ALL;
+        unsigned long round = s->rounds;
+        while (s->rounds == round)
+            pthread_cond_wait(&s->idle, &s->mtx);
+        if (full)
+        {
+            libp2p_conn_err_t err = s->err;
+            pthread_mutex_unlock(&s->mtx);
+            return err;
+        }
+    }
+    s->writing = YS_WRITING_ALL;
+    libp2p_conn_err_t rc = drain_locked(s, conn, 0);
+    writer_done_locked(s);
+    pthread_mutex_unlock(&s->mtx);
+    return rc;
+}
+
+libp2p_conn_err_t ys_flush_control(yamux_send_sched_t *s, libp2p_conn_t *conn)
+{
+    pthread_mutex_lock(&s->mtx);
+    if (s->writing != YS_IDLE)
+    {
+        /* every writer sends control frames ahead of stream data */
+        libp2p_conn_err_t err = s->err;
+        pthread_mutex_unlock(&s->mtx);
+        return err;
+    }
+    s->writing = YS_WRITING_CONTROL;
+    libp2p_conn_err_t rc = drain_locked(s, conn, 1);
+    writer_done_locked(s);
+    pthread_mutex_unlock(&s->mtx);
+    return rc;
+}
+
+void ys_close(yamux_send_sched_t *s)
+{
+    pthread_mutex_lock(&s->mtx);
+    s->closing = 1;
+    pthread_mutex_unlock(&s->mtx);
+}
+
+size_t ys_pending(yamux_send_sched_t *s)
+{
+    pthread_mutex_lock(&s->mtx);
+    size_t n = s->pending_bytes + (s->out_len - s->out_off);
+    pthread_mutex_unlock(&s->mtx);
+    return n;
+}
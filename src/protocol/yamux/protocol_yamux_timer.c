@@ -0,0 +1,243 @@
+#include "protocol/yamux/protocol_yamux_timer.h"
+#include "protocol/tcp/protocol_tcp_util.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct
+{
+    pthread_mutex_t mtx;           /* protects everything below          */
+    pthread_cond_t cond;           /* heap changed / callback finished   */
+    pthread_once_t once;           /* lazy init of mtx/cond              */
+    yamux_timer_entry_t **heap;    /* min-heap ordered by due            */
+    size_t len;
+    size_t cap;
+    yamux_timer_entry_t *current;  /* entry whose callback is running    */
+    int running;                   /* non-zero while the thread is alive */
+} g_timer = {.once = PTHREAD_ONCE_INIT};
+
+static void timer_init_once(void)
+{
+    pthread_mutex_init(&g_timer.mtx, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#if defined(_POSIX_MONOTONIC_CLOCK) && !defined(__APPLE__)
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+    pthread_cond_init(&g_timer.cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void heap_swap(size_t a, size_t b)
+{
+    yamux_timer_entry_t *t = g_timer.heap[a];
+    g_timer.heap[a] = g_timer.heap[b];
+    g_timer.heap[b] = t;
+    g_timer.heap[a]->slot = a;
+    g_timer.heap[b]->slot = b;
+}
+
+static void heap_up(size_t i)
+{
+    while (i > 0)
+    {
+        size_t p = (i - 1) / 2;
+        if (g_timer.heap[p]->due <= g_timer.heap[i]->due)
+            break;
+        heap_swap(i, p);
+        i = p;
+    }
+}
+
+static void heap_down(size_t i)
+{
+    for (;;)
+    {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < g_timer.len && g_timer.heap[l]->due < g_timer.heap[m]->due)
+            m = l;
+        if (r < g_timer.len && g_timer.heap[r]->due < g_timer.heap[m]->due)
+            m = r;
+        if (m == i)
+            break;
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+static int heap_insert(yamux_timer_entry_t *e)
+{
+    if (g_timer.len == g_timer.cap)
+    {
+        size_t cap = g_timer.cap ? g_timer.cap * 2 : 16;
+        yamux_timer_entry_t **tmp = realloc(g_timer.heap, cap * sizeof(*tmp));
+        if (!tmp)
+            return -1;
+        g_timer.heap = tmp;
+        g_timer.cap = cap;
+    }
+    e->slot = g_timer.len;
+    g_timer.heap[g_timer.len++] = e;
+    heap_up(e->slot);
+    return 0;
+}
+
+static void heap_remove(yamux_timer_entry_t *e)
+{
+    size_t i = e->slot;
+    e->slot = SIZE_MAX;
+    g_timer.len--;
+    if (i == g_timer.len)
+        return;
+    g_timer.heap[i] = g_timer.heap[g_timer.len];
+    g_timer.heap[i]->slot = i;
+    heap_down(i);
+    heap_up(i);
+}
+
+static void deadline_ts(uint64_t due_ms, struct timespec *ts)
+{
+    /* convert a now_mono_ms() deadline to the condvar's clock */
+    uint64_t now = now_mono_ms();
+    uint64_t wait = due_ms > now ? due_ms - now : 0;
+#if defined(_POSIX_MONOTONIC_CLOCK) && !defined(__APPLE__)
+    clock_gettime(CLOCK_MONOTONIC, ts);
+#else
+    clock_gettime(CLOCK_REALTIME, ts);
+#endif
+    ts->tv_sec += (time_t)(wait / 1000);
+    ts->tv_nsec += (long)(wait % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+static void *timer_loop(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_timer.mtx);
+    while (g_timer.len > 0)
+    {
+        yamux_timer_entry_t *e = g_timer.heap[0];
+        uint64_t now = now_mono_ms();
+        if (e->due > now)
+        {
+            struct timespec ts;
+            deadline_ts(e->due, &ts);
+            pthread_cond_timedwait(&g_timer.cond, &g_timer.mtx, &ts);
+            continue;
+        }
+
+        heap_remove(e);
+        e->rearm_due = 0;
+        g_timer.current = e;
+        pthread_mutex_unlock(&g_timer.mtx);
+
+        uint64_t next = e->fn(e->arg, now);
+
+        pthread_mutex_lock(&g_timer.mtx);
+        g_timer.current = NULL;
+        if (e->rearm_due && (!next || e->rearm_due < next))
+            next = e->rearm_due;
+        if (e->armed && next)
+        {
+            e->due = next;
+            if (heap_insert(e) != 0)
+                e->armed = 0;
+        }
+        else
+        {
+            e->armed = 0;
+        }
+        pthread_cond_broadcast(&g_timer.cond);
+    }
+    g_timer.running = 0;
+    pthread_mutex_unlock(&g_timer.mtx);
+    return NULL;
+}
+
+void ytimer_init(yamux_timer_entry_t *e, yamux_timer_fn fn, void *arg)
+{
+    e->fn = fn;
+    e->arg = arg;
+    e->due = 0;
+    e->rearm_due = 0;
+    e->slot = SIZE_MAX;
+    e->armed = 0;
+}
+
+int ytimer_arm(yamux_timer_entry_t *e, uint64_t due_ms)
+{
+    pthread_once(&g_timer.once, timer_init_once);
+    pthread_mutex_lock(&g_timer.mtx);
+    e->armed = 1;
+    if (g_timer.current == e)
+    {
+        /* picked up by the timer thread once the callback returns */
+        if (!e->rearm_due || due_ms < e->rearm_due)
+            e->rearm_due = due_ms;
+        pthread_mutex_unlock(&g_timer.mtx);
+        return 0;
+    }
+    if (e->slot != SIZE_MAX)
+    {
+        if (due_ms < e->due)
+        {
+            e->due = due_ms;
+            heap_up(e->slot);
+        }
+    }
+    else
+    {
+        e->due = due_ms;
+        if (heap_insert(e) != 0)
+        {
+            e->armed = 0;
+            pthread_mutex_unlock(&g_timer.mtx);
+            return -1;
+        }
+    }
+    if (!g_timer.running)
+    {
+        pthread_t th;
+        if (pthread_create(&th, NULL, timer_loop, NULL) != 0)
+        {
+            heap_remove(e);
+            e->armed = 0;
+            pthread_mutex_unlock(&g_timer.mtx);
+            return -1;
+        }
+        pthread_detach(th);
+        g_timer.running = 1;
+    }
+    pthread_cond_broadcast(&g_timer.cond);
+    pthread_mutex_unlock(&g_timer.mtx);
+    return 0;
+}
+
+void ytimer_disarm(yamux_timer_entry_t *e)
+{
+    pthread_once(&g_timer.once, timer_init_once);
+    pthread_mutex_lock(&g_timer.mtx);
+    e->armed = 0;
+    e->rearm_due = 0;
+    if (e->slot != SIZE_MAX)
+        heap_remove(e);
+    while (g_timer.current == e)
+        pthread_cond_wait(&g_timer.cond, &g_timer.mtx);
+    pthread_cond_broadcast(&g_timer.cond);
+    pthread_mutex_unlock(&g_timer.mtx);
+}
+
+size_t ytimer_count(void)
+{
+    pthread_once(&g_timer.once, timer_init_once);
+    pthread_mutex_lock(&g_timer.mtx);
+    size_t n = g_timer.len;
+    pthread_mutex_unlock(&g_timer.mtx);
+    return n;
+}
@@ -0,0 +1,261 @@
+#include "transport/buf_pool.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define BUF_MIN_SHIFT 8  /* LIBP2P_BUF_MIN_SIZE */
+#define BUF_MAX_SHIFT 16 /* LIBP2P_BUF_MAX_SIZE */
+#define BUF_CLASSES (BUF_MAX_SHIFT - BUF_MIN_SHIFT + 1)
+#define BUF_OVERSIZED 0xffu
+
+/* Header placed in front of every buffer. While a block sits on a free list
+ * @p next links it; while it is handed out @p refs counts its owners. */
+typedef struct buf_hdr
+{
+    struct buf_hdr *next;
+    atomic_uint refs;
+    unsigned cls; /* size class index or BUF_OVERSIZED */
+    size_t cap;
+} buf_hdr_t;
+
+/* keep payloads 16-byte aligned */
+#define BUF_HDR_SIZE ((sizeof(buf_hdr_t) + 15u) & ~(size_t)15u)
+
+static inline buf_hdr_t *hdr_of(const uint8_t *buf) { return (buf_hdr_t *)(void *)(buf - BUF_HDR_SIZE); }
+static inline uint8_t *data_of(buf_hdr_t *h) { return (uint8_t *)h + BUF_HDR_SIZE; }
+
+typedef struct
+{
+    buf_hdr_t *blocks[LIBP2P_BUF_THREAD_CACHE];
+    size_t len;
+} buf_cache_class_t;
+
+/* Per-thread cache, created on first use and flushed at thread exit. */
+typedef struct
+{
+    buf_cache_class_t cls[BUF_CLASSES];
+} buf_cache_t;
+
+static struct
+{
+    pthread_mutex_t mtx;
+    buf_hdr_t *head[BUF_CLASSES]; /* shared free lists */
+    size_t len[BUF_CLASSES];
+    pthread_key_t key;
+    pthread_once_t once;
+    int key_ok;
+    atomic_uint_fast64_t misses;
+    atomic_uint_fast64_t oversized;
+} g_pool = {.mtx = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+static size_t shared_limit(unsigned cls)
+{
+    size_t n = (size_t)LIBP2P_BUF_SHARED_BYTES >> (cls + BUF_MIN_SHIFT);
+    return n ? n : 1;
+}
+
+/* Move @p n blocks from a thread cache to the shared list, freeing any that
+ * would push the list past its byte budget. */
+static void cache_spill(buf_cache_class_t *cc, unsigned cls, size_t n)
+{
+    size_t limit = shared_limit(cls);
+    pthread_mutex_lock(&g_pool.mtx);
+    while (n-- && cc->len)
+    {
+        buf_hdr_t *h = cc->blocks[--cc->len];
+        if (g_pool.len[cls] >= limit)
+        {
+            free(h);
+            continue;
+        }
+        h->next = g_pool.head[cls];
+        g_pool.head[cls] = h;
+        g_pool.len[cls]++;
+    }
+    pthread_mutex_unlock(&g_pool.mtx);
+}
+
+/* Refill an empty thread cache with up to half its capacity from the
+ * shared list. */
+static void cache_refill(buf_cache_class_t *cc, unsigned cls)
+{
+    pthread_mutex_lock(&g_pool.mtx);
+    while (cc->len < LIBP2P_BUF_THREAD_CACHE / 2 && g_pool.head[cls])
+    {
+        buf_hdr_t *h = g_pool.head[cls];
+        g_pool.head[cls] = h->next;
+        g_pool.len[cls]--;
+        cc->blocks[cc->len++] = h;
+    }
+    pthread_mutex_unlock(&g_pool.mtx);
+}
+
+static void cache_destroy(void *arg)
+{
+    buf_cache_t *c = arg;
+    if (!c)
+        return;
+    for (unsigned i = 0; i < BUF_CLASSES; i++)
+        cache_spill(&c->cls[i], i, LIBP2P_BUF_THREAD_CACHE);
+    free(c);
+}
+
+static void pool_init_once(void) { g_pool.key_ok = pthread_key_create(&g_pool.key, cache_destroy) == 0; }
+
+/* Calling thread's cache, or NULL if none can be created. In that case
+ * blocks go straight to and from the shared lists. */
+static buf_cache_t *thread_cache(int create)
+{
+    pthread_once(&g_pool.once, pool_init_once);
+    if (!g_pool.key_ok)
+        return NULL;
+    buf_cache_t *c = pthread_getspecific(g_pool.key);
+    if (!c && create)
+    {
+        c = calloc(1, sizeof(*c));
+        if (c && pthread_setspecific(g_pool.key, c) != 0)
+        {
+            free(c);
+            c = NULL;
+        }
+    }
+    return c;
+}
+
+static unsigned class_of(size_t size)
+{
+    unsigned cls = 0;
+    while (((size_t)LIBP2P_BUF_MIN_SIZE << cls) < size)
+        cls++;
+    return cls;
+}
+
+uint8_t *libp2p_buf_alloc(size_t size)
+{
+    if (size == 0)
+        size = 1;
+    buf_hdr_t *h = NULL;
+    if (size > LIBP2P_BUF_MAX_SIZE)
+    {
+        if (size > SIZE_MAX - BUF_HDR_SIZE)
+            return NULL;
+        h = malloc(BUF_HDR_SIZE + size);
+        if (!h)
+            return NULL;
+        atomic_fetch_add_explicit(&g_pool.oversized, 1, memory_order_relaxed);
+        h->cls = BUF_OVERSIZED;
+        h->cap = size;
+    }
+    else
+    {
+        unsigned cls = class_of(size);
+        buf_cache_t *c = thread_cache(1);
+        if (c)
+        {
+            buf_cache_class_t *cc = &c->cls[cls];
+            if (!cc->len)
+                cache_refill(cc, cls);
+            if (cc->len)
+                h = cc->blocks[--cc->len];
+        }
+        else
+        {
+            pthread_mutex_lock(&g_pool.mtx);
+            h = g_pool.head[cls];
+            if (h)
+            {
+                g_pool.head[cls] = h->next;
+                g_pool.len[cls]--;
+            }
+            pthread_mutex_unlock(&g_pool.mtx);
+        }
+        if (!h)
+        {
+            h = malloc(BUF_HDR_SIZE + ((size_t)LIBP2P_BUF_MIN_SIZE << cls));
+            if (!h)
+                return NULL;
+            atomic_fetch_add_explicit(&g_pool.misses, 1, memory_order_relaxed);
+            h->cls = cls;
+            h->cap = (size_t)LIBP2P_BUF_MIN_SIZE << cls;
+        }
+    }
+    h->next = NULL;
+    atomic_init(&h->refs, 1);
+    return data_of(h);
+}
+
+uint8_t *libp2p_buf_retain(uint8_t *buf)
+{
+    if (buf)
+        atomic_fetch_add_explicit(&hdr_of(buf)->refs, 1, memory_order_relaxed);
+    return buf;
+}
+
+void libp2p_buf_release(uint8_t *buf)
+{
+    if (!buf)
+        return;
+    buf_hdr_t *h = hdr_of(buf);
+    if (atomic_fetch_sub_explicit(&h->refs, 1, memory_order_acq_rel) != 1)
+        return;
+    if (h->cls == BUF_OVERSIZED)
+    {
+        free(h);
+        return;
+    }
+    buf_cache_t *c = thread_cache(1);
+    if (!c)
+    {
+        buf_cache_class_t one = {.blocks = {h}, .len = 1};
+        cache_spill(&one, h->cls, 1);
+        return;
+    }
+    buf_cache_class_t *cc = &c->cls[h->cls];
+    if (cc->len == LIBP2P_BUF_THREAD_CACHE)
+        cache_spill(cc, h->cls, LIBP2P_BUF_THREAD_CACHE / 2);
+    cc->blocks[cc->len++] = h;
+}
+
+size_t libp2p_buf_capacity(const uint8_t *buf) { return buf ? hdr_of(buf)->cap : 0; }
+
+void libp2p_buf_slice(libp2p_buf_slice_t *out, uint8_t *base, size_t off, size_t len)
+{
+    if (!out)
+        return;
+    out->base = libp2p_buf_retain(base);
+    out->data = base ? base + off : NULL;
+    out->len = base ? len : 0;
+}
+
+void libp2p_buf_slice_release(libp2p_buf_slice_t *s)
+{
+    if (!s)
+        return;
+    libp2p_buf_release(s->base);
+    s->base = NULL;
+    s->data = NULL;
+    s->len = 0;
+}
+
+void libp2p_buf_pool_flush_thread(void)
+{
+    buf_cache_t *c = thread_cache(0);
+    if (!c)
+        return;
+    for (unsigned i = 0; i < BUF_CLASSES; i++)
+        cache_spill(&c->cls[i], i, LIBP2P_BUF_THREAD_CACHE);
+}
+
+void libp2p_buf_pool_get_stats(libp2p_buf_pool_stats_t *out)
+{
+    if (!out)
+        return;
+    out->misses = atomic_load_explicit(&g_pool.misses, memory_order_relaxed);
+    out->oversized = atomic_load_explicit(&g_pool.oversized, memory_order_relaxed);
+    size_t n = 0;
+    pthread_mutex_lock(&g_pool.mtx);
+    for (unsigned i = 0; i < BUF_CLASSES; i++)
+        n += g_pool.len[i];
+    pthread_mutex_unlock(&g_pool.mtx);
+    out->shared_free = n;
+}
@@ -71,3 +71,21 @@ libp2p_conn_err_t libp2p_conn_read_exact(libp2p_conn_t *c,
     }
     return LIBP2P_CONN_OK;
 }
+
+ssize_t libp2p_conn_read_wait(libp2p_conn_t *c, void *buf, size_t len, uint64_t wait_ms)
+{
+    if (!c || !buf)
+        return LIBP2P_CONN_ERR_NULL_PTR;
+
+    if (c->vt && c->vt->wait_readable)
+    {
+        libp2p_conn_err_t rc = c->vt->wait_readable(c, wait_ms);
+        if (rc != LIBP2P_CONN_OK)
+            return rc;
+    }
+
+    ssize_t n = libp2p_conn_read(c, buf, len);
+    if (n == LIBP2P_CONN_ERR_AGAIN)
+        tiny_sleep(); /* no wait, or only part of a record arrived */
+    return n;
+}
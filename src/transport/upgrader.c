@@ -1,10 +1,16 @@
 #include "transport/upgrader.h"
+#include "protocol/multiselect/protocol_multiselect.h"
 #include "protocol/noise/protocol_noise.h" /* For negotiation helpers */
+#include "protocol/tcp/protocol_tcp_util.h" /* now_mono_ms(), now_mono_us() */
+#include "multiformats/unsigned_varint/unsigned_varint.h"
+#include "transport/buf_pool.h"
 #include "transport/muxer.h"
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
-/* Context for the upgrader.  Currently very small and only stores the
- * configuration pointers provided at construction time. */
+/* Context for the upgrader: the configuration pointers provided at
+ * construction time and the aggregate setup timings. */
 struct libp2p_upgrader_ctx {
     const peer_id_t *local_peer;
     const struct libp2p_security *const *security;
@@ -12,8 +18,87 @@ struct libp2p_upgrader_ctx {
     const struct libp2p_muxer *const *muxers;
     size_t n_muxers;
     uint64_t handshake_timeout_ms;
+    void (*on_timings)(const libp2p_uconn_t *uc, void *arg);
+    void *on_timings_arg;
+
+    pthread_mutex_t stats_mtx;
+    libp2p_upgrader_stats_t stats;
 };
 
+/* ------------------------------------------------------------------------- */
+/* Setup timings                                                             */
+/* ------------------------------------------------------------------------- */
+
+/* Start the timings of an upgrade of @p raw. The connect time is only known
+ * when the transport that dialed @p raw recorded it. */
+static void timings_init(libp2p_upgrade_timings_t *t, const libp2p_conn_t *raw)
+{
+    memset(t, 0, sizeof(*t));
+    t->remote_key_type = -1;
+    if (raw->connect_us) {
+        t->phase_us[LIBP2P_UPGRADE_PHASE_CONNECT] = raw->connect_us;
+        t->measured |= 1u << LIBP2P_UPGRADE_PHASE_CONNECT;
+    }
+}
+
+/* Record that phase @p p ran from @p since until now; returns now. */
+static uint64_t timings_lap(libp2p_upgrade_timings_t *t, libp2p_upgrade_phase_t p, uint64_t since)
+{
+    uint64_t now = now_mono_us();
+    t->phase_us[p] = now - since;
+    t->measured |= 1u << p;
+    return now;
+}
+
+/* Copy the per-message timings of a completed Noise handshake. */
+static void timings_noise(libp2p_upgrade_timings_t *t, const libp2p_noise_hs_stats_t *hs)
+{
+    for (int i = 0; i < LIBP2P_NOISE_HS_MESSAGES; i++) {
+        t->phase_us[LIBP2P_UPGRADE_PHASE_NOISE_MSG1 + i] = hs->msg_us[i];
+        t->measured |= 1u << (LIBP2P_UPGRADE_PHASE_NOISE_MSG1 + i);
+    }
+    if (hs->remote_key_type >= 0) {
+        t->phase_us[LIBP2P_UPGRADE_PHASE_VERIFY] = hs->verify_us;
+        t->measured |= 1u << LIBP2P_UPGRADE_PHASE_VERIFY;
+        t->remote_key_type = hs->remote_key_type;
+    }
+}
+
+static void hist_add(libp2p_upgrade_hist_t *h, uint64_t us)
+{
+    unsigned b = 0;
+    while (b + 1 < LIBP2P_UPGRADE_HIST_BUCKETS && (us >> b))
+        b++;
+    h->buckets[b]++;
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us)
+        h->max_us = us;
+}
+
+/* Fold a finished upgrade into the histograms and report it. */
+static void record_success(struct libp2p_upgrader_ctx *ctx, const libp2p_uconn_t *uc)
+{
+    const libp2p_upgrade_timings_t *t = &uc->timings;
+    pthread_mutex_lock(&ctx->stats_mtx);
+    for (int p = 0; p < LIBP2P_UPGRADE_PHASE_COUNT; p++)
+        if (t->measured & (1u << p))
+            hist_add(&ctx->stats.phase[p], t->phase_us[p]);
+    hist_add(&ctx->stats.total, t->total_us);
+    if ((t->measured & (1u << LIBP2P_UPGRADE_PHASE_VERIFY)) && t->remote_key_type < LIBP2P_UPGRADE_KEY_TYPES)
+        hist_add(&ctx->stats.verify_by_key[t->remote_key_type], t->phase_us[LIBP2P_UPGRADE_PHASE_VERIFY]);
+    pthread_mutex_unlock(&ctx->stats_mtx);
+    if (ctx->on_timings)
+        ctx->on_timings(uc, ctx->on_timings_arg);
+}
+
+static void record_failure(struct libp2p_upgrader_ctx *ctx)
+{
+    pthread_mutex_lock(&ctx->stats_mtx);
+    ctx->stats.failures++;
+    pthread_mutex_unlock(&ctx->stats_mtx);
+}
+
 static void uconn_free(libp2p_uconn_t *uc)
 {
     if (!uc)
@@ -24,68 +109,180 @@ static void uconn_free(libp2p_uconn_t *uc)
     free(uc);
 }
 
-/* ------------------------------------------------------------------------- */
-/* Upgrader methods                                                          */
-/* ------------------------------------------------------------------------- */
+/* Collect the protocol ids of the configured muxers, in configuration
+ * order, along with the muxer owning each. Returns the number found. */
+static size_t muxer_ids(const struct libp2p_upgrader_ctx *ctx, const char **ids, const libp2p_muxer_t **owners)
+{
+    size_t n_ids = 0;
+    for (size_t i = 0; i < ctx->n_muxers; i++) {
+        const libp2p_muxer_t *m = ctx->muxers[i];
+        if (m && m->vt && m->vt->protocol_id) {
+            owners[n_ids] = m;
+            ids[n_ids++] = m->vt->protocol_id;
+        }
+    }
+    return n_ids;
+}
 
-static libp2p_upgrader_err_t
-upgrader_upgrade_outbound(libp2p_upgrader_t *self,
-                          libp2p_conn_t *raw,
-                          const peer_id_t *remote_hint,
-                          libp2p_uconn_t **out)
+/* Negotiate a muxer on a secured connection.
+ *
+ * All configured muxers that advertise a protocol id are offered in a single
+ * multistream-select exchange, in configuration order, so falling back from
+ * the preferred muxer costs no extra header or round trip. Muxers without an
+ * id are tried afterwards through their own negotiate hook. */
+static libp2p_upgrader_err_t select_muxer(struct libp2p_upgrader_ctx *ctx,
+                                          libp2p_conn_t *secured,
+                                          bool inbound,
+                                          const libp2p_muxer_t **selected)
 {
-    if (!self || !raw || !out)
-        return LIBP2P_UPGRADER_ERR_NULL_PTR;
+    *selected = NULL;
+    if (!ctx->muxers || ctx->n_muxers == 0)
+        return LIBP2P_UPGRADER_OK;
 
-    struct libp2p_upgrader_ctx *ctx = self->ctx;
-    if (!ctx || !ctx->security || ctx->n_security == 0)
-        return LIBP2P_UPGRADER_ERR_SECURITY;
+    const char **ids = calloc(ctx->n_muxers + 1, sizeof(*ids));
+    const libp2p_muxer_t **owners = calloc(ctx->n_muxers, sizeof(*owners));
+    if (!ids || !owners) {
+        free(ids);
+        free(owners);
+        return LIBP2P_UPGRADER_ERR_INTERNAL;
+    }
+    size_t n_ids = muxer_ids(ctx, ids, owners);
 
-    /* Only Noise is implemented at the moment.  Use the first security entry
-     * and run the multistream negotiation helper provided by the Noise module. */
-    libp2p_conn_t *secured = NULL;
-    peer_id_t *remote_peer = NULL;
-    libp2p_security_err_t rc =
-        libp2p_noise_negotiate_outbound((libp2p_security_t *)ctx->security[0],
-                                        raw, remote_hint,
-                                        ctx->handshake_timeout_ms,
-                                        &secured, &remote_peer);
-    if (rc != LIBP2P_SECURITY_OK)
-        return LIBP2P_UPGRADER_ERR_HANDSHAKE;
+    libp2p_upgrader_err_t rc = LIBP2P_UPGRADER_ERR_MUXER;
+    if (n_ids > 0) {
+        const char *accepted = NULL;
+        libp2p_multiselect_err_t mrc;
+        if (inbound) {
+            libp2p_multiselect_config_t cfg = libp2p_multiselect_config_default();
+            cfg.handshake_timeout_ms = ctx->handshake_timeout_ms;
+            mrc = libp2p_multiselect_listen(secured, ids, &cfg, &accepted);
+        } else {
+            mrc = libp2p_multiselect_dial(secured, ids, ctx->handshake_timeout_ms, &accepted);
+        }
+        if (mrc == LIBP2P_MULTISELECT_OK && accepted) {
+            for (size_t i = 0; i < n_ids && !*selected; i++)
+                if (strcmp(accepted, ids[i]) == 0)
+                    *selected = owners[i];
+            rc = *selected ? LIBP2P_UPGRADER_OK : LIBP2P_UPGRADER_ERR_MUXER;
+        } else if (mrc == LIBP2P_MULTISELECT_ERR_TIMEOUT) {
+            rc = LIBP2P_UPGRADER_ERR_TIMEOUT;
+        }
+        /* the listener hands back a heap copy of the chosen id */
+        if (inbound)
+            free((char *)accepted);
+    }
 
-    const libp2p_muxer_t *selected = NULL;
-    if (ctx->muxers && ctx->n_muxers > 0) {
+    if (!*selected && n_ids < ctx->n_muxers && rc != LIBP2P_UPGRADER_ERR_TIMEOUT) {
         for (size_t i = 0; i < ctx->n_muxers; i++) {
+            libp2p_muxer_t *m = (libp2p_muxer_t *)ctx->muxers[i];
+            if (!m || !m->vt || m->vt->protocol_id)
+                continue;
             libp2p_muxer_err_t mrc =
-                libp2p_muxer_negotiate_outbound((libp2p_muxer_t *)ctx->muxers[i],
-                                                secured,
-                                                ctx->handshake_timeout_ms);
+                inbound ? libp2p_muxer_negotiate_inbound(m, secured, ctx->handshake_timeout_ms)
+                        : libp2p_muxer_negotiate_outbound(m, secured, ctx->handshake_timeout_ms);
             if (mrc == LIBP2P_MUXER_OK) {
-                selected = ctx->muxers[i];
+                *selected = m;
+                rc = LIBP2P_UPGRADER_OK;
                 break;
             }
         }
-        if (!selected) {
-            libp2p_conn_free(secured);
-            peer_id_destroy(remote_peer);
-            return LIBP2P_UPGRADER_ERR_MUXER;
-        }
+    }
+
+    free(ids);
+    free(owners);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Upgrader methods                                                          */
+/* ------------------------------------------------------------------------- */
+
+/* Blocking upgrade shared by both directions: security multistream-select,
+ * the Noise handshake, then muxer selection, timing each step. */
+static libp2p_upgrader_err_t upgrade_blocking(struct libp2p_upgrader_ctx *ctx,
+                                              libp2p_conn_t *raw,
+                                              const peer_id_t *remote_hint,
+                                              bool dialer,
+                                              libp2p_uconn_t **out)
+{
+    libp2p_upgrade_timings_t t;
+    timings_init(&t, raw);
+    uint64_t start = now_mono_us();
+
+    /* Only Noise is implemented at the moment, so the first security entry
+     * is negotiated and driven directly. */
+    const char *noise_ids[] = {LIBP2P_NOISE_PROTO_ID, NULL};
+    libp2p_multiselect_err_t mrc;
+    if (dialer) {
+        mrc = libp2p_multiselect_dial(raw, noise_ids, ctx->handshake_timeout_ms, NULL);
     } else {
+        libp2p_multiselect_config_t cfg = libp2p_multiselect_config_default();
+        cfg.handshake_timeout_ms = ctx->handshake_timeout_ms;
+        mrc = libp2p_multiselect_listen(raw, noise_ids, &cfg, NULL);
+    }
+    if (mrc != LIBP2P_MULTISELECT_OK) {
+        record_failure(ctx);
+        return LIBP2P_UPGRADER_ERR_HANDSHAKE;
     }
+    timings_lap(&t, LIBP2P_UPGRADE_PHASE_SECURITY, start);
+
+    libp2p_conn_t *secured = NULL;
+    peer_id_t *remote_peer = NULL;
+    libp2p_noise_hs_stats_t hs;
+    libp2p_security_err_t rc = libp2p_noise_handshake_run((libp2p_security_t *)ctx->security[0], raw, dialer,
+                                                          dialer ? remote_hint : NULL, &secured, &remote_peer, &hs);
+    if (rc != LIBP2P_SECURITY_OK) {
+        record_failure(ctx);
+        return LIBP2P_UPGRADER_ERR_HANDSHAKE;
+    }
+    timings_noise(&t, &hs);
+
+    uint64_t mark = now_mono_us();
+    const libp2p_muxer_t *selected = NULL;
+    libp2p_upgrader_err_t urc = select_muxer(ctx, secured, !dialer, &selected);
+    if (urc != LIBP2P_UPGRADER_OK) {
+        libp2p_conn_free(secured);
+        peer_id_destroy(remote_peer);
+        record_failure(ctx);
+        return urc;
+    }
+    if (ctx->muxers && ctx->n_muxers)
+        mark = timings_lap(&t, LIBP2P_UPGRADE_PHASE_MUXER, mark);
+    t.total_us = mark - start;
 
     libp2p_uconn_t *uc = calloc(1, sizeof(*uc));
     if (!uc) {
         libp2p_conn_free(secured);
         peer_id_destroy(remote_peer);
+        record_failure(ctx);
         return LIBP2P_UPGRADER_ERR_INTERNAL;
     }
     uc->conn = secured;
     uc->remote_peer = remote_peer;
     uc->muxer = selected;
+    uc->dialer = dialer;
+    uc->timings = t;
+    record_success(ctx, uc);
     *out = uc;
     return LIBP2P_UPGRADER_OK;
 }
 
+static libp2p_upgrader_err_t
+upgrader_upgrade_outbound(libp2p_upgrader_t *self,
+                          libp2p_conn_t *raw,
+                          const peer_id_t *remote_hint,
+                          libp2p_uconn_t **out)
+{
+    if (!self || !raw || !out)
+        return LIBP2P_UPGRADER_ERR_NULL_PTR;
+
+    struct libp2p_upgrader_ctx *ctx = self->ctx;
+    if (!ctx || !ctx->security || ctx->n_security == 0 || !ctx->security[0])
+        return LIBP2P_UPGRADER_ERR_SECURITY;
+
+    return upgrade_blocking(ctx, raw, remote_hint, true, out);
+}
+
 static libp2p_upgrader_err_t
 upgrader_upgrade_inbound(libp2p_upgrader_t *self,
                          libp2p_conn_t *raw,
@@ -95,49 +292,10 @@ upgrader_upgrade_inbound(libp2p_upgrader_t *self,
         return LIBP2P_UPGRADER_ERR_NULL_PTR;
 
     struct libp2p_upgrader_ctx *ctx = self->ctx;
-    if (!ctx || !ctx->security || ctx->n_security == 0)
+    if (!ctx || !ctx->security || ctx->n_security == 0 || !ctx->security[0])
         return LIBP2P_UPGRADER_ERR_SECURITY;
 
-    libp2p_conn_t *secured = NULL;
-    peer_id_t *remote_peer = NULL;
-    libp2p_security_err_t rc =
-        libp2p_noise_negotiate_inbound((libp2p_security_t *)ctx->security[0],
-                                       raw, ctx->handshake_timeout_ms,
-                                       &secured, &remote_peer);
-    if (rc != LIBP2P_SECURITY_OK)
-        return LIBP2P_UPGRADER_ERR_HANDSHAKE;
-
-    const libp2p_muxer_t *selected = NULL;
-    if (ctx->muxers && ctx->n_muxers > 0) {
-        for (size_t i = 0; i < ctx->n_muxers; i++) {
-            libp2p_muxer_err_t mrc =
-                libp2p_muxer_negotiate_inbound((libp2p_muxer_t *)ctx->muxers[i],
-                                               secured,
-                                               ctx->handshake_timeout_ms);
-            if (mrc == LIBP2P_MUXER_OK) {
-                selected = ctx->muxers[i];
-                break;
-            }
-        }
-        if (!selected) {
-            libp2p_conn_free(secured);
-            peer_id_destroy(remote_peer);
-            return LIBP2P_UPGRADER_ERR_MUXER;
-        }
-    } else {
-    }
-
-    libp2p_uconn_t *uc = calloc(1, sizeof(*uc));
-    if (!uc) {
-        libp2p_conn_free(secured);
-        peer_id_destroy(remote_peer);
-        return LIBP2P_UPGRADER_ERR_INTERNAL;
-    }
-    uc->conn = secured;
-    uc->remote_peer = remote_peer;
-    uc->muxer = selected;
-    *out = uc;
-    return LIBP2P_UPGRADER_OK;
+    return upgrade_blocking(ctx, raw, NULL, false, out);
 }
 
 static libp2p_upgrader_err_t upgrader_close(libp2p_upgrader_t *self)
@@ -150,11 +308,35 @@ static void upgrader_free(libp2p_upgrader_t *self)
 {
     if (!self)
         return;
-    if (self->ctx)
-        free(self->ctx);
+    if (self->ctx) {
+        struct libp2p_upgrader_ctx *ctx = self->ctx;
+        pthread_mutex_destroy(&ctx->stats_mtx);
+        free(ctx);
+    }
     free(self);
 }
 
+libp2p_upgrader_err_t libp2p_upgrader_get_stats(libp2p_upgrader_t *u, libp2p_upgrader_stats_t *out)
+{
+    if (!u || !u->ctx || !out)
+        return LIBP2P_UPGRADER_ERR_NULL_PTR;
+    struct libp2p_upgrader_ctx *ctx = u->ctx;
+    pthread_mutex_lock(&ctx->stats_mtx);
+    *out = ctx->stats;
+    pthread_mutex_unlock(&ctx->stats_mtx);
+    return LIBP2P_UPGRADER_OK;
+}
+
+void libp2p_upgrader_reset_stats(libp2p_upgrader_t *u)
+{
+    if (!u || !u->ctx)
+        return;
+    struct libp2p_upgrader_ctx *ctx = u->ctx;
+    pthread_mutex_lock(&ctx->stats_mtx);
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    pthread_mutex_unlock(&ctx->stats_mtx);
+}
+
 /* ------------------------------------------------------------------------- */
 /* Constructor                                                               */
 /* ------------------------------------------------------------------------- */
@@ -177,6 +359,13 @@ libp2p_upgrader_t *libp2p_upgrader_new(const libp2p_upgrader_config_t *cfg)
     ctx->muxers = cfg->muxers;
     ctx->n_muxers = cfg->n_muxers;
     ctx->handshake_timeout_ms = cfg->handshake_timeout_ms;
+    ctx->on_timings = cfg->on_timings;
+    ctx->on_timings_arg = cfg->on_timings_arg;
+    if (pthread_mutex_init(&ctx->stats_mtx, NULL) != 0) {
+        free(u);
+        free(ctx);
+        return NULL;
+    }
 
     static const libp2p_upgrader_vtbl_t VTBL = {
         .upgrade_outbound = upgrader_upgrade_outbound,
@@ -189,3 +378,456 @@ libp2p_upgrader_t *libp2p_upgrader_new(const libp2p_upgrader_config_t *cfg)
     u->ctx = ctx;
     return u;
 }
+
+/* ------------------------------------------------------------------------- */
+/* Nonblocking upgrade op                                                    */
+/* ------------------------------------------------------------------------- */
+
+/* Longest multistream-select message accepted during an upgrade. Protocol
+ * ids are short; anything bigger is a misbehaving peer. */
+#define OP_MS_MAX_MSG 1024
+
+typedef enum {
+    OP_SEC_SELECT,
+    OP_NOISE,
+    OP_MUX_SELECT,
+    OP_DONE,
+    OP_FINISHED,
+    OP_FAILED
+} op_phase_t;
+
+/* All I/O goes through one pending output buffer and one input buffer.
+ * Output is always flushed before a phase runs, so each phase starts with
+ * an empty tx. Input is read in exact amounts (a varint byte at a time, then
+ * the body) so nothing that belongs to the next layer is consumed. */
+struct libp2p_upgrade_op {
+    struct libp2p_upgrader_ctx *ctx;
+    bool dialer;
+    op_phase_t phase;
+    libp2p_upgrader_err_t err;
+    int wants;
+    uint64_t deadline;
+
+    libp2p_conn_t *raw;     /* owned until wrapped by @p secured     */
+    libp2p_conn_t *secured; /* owned until handed out               */
+    libp2p_conn_t *conn;    /* connection the current phase talks on */
+    const peer_id_t *remote_hint;
+    peer_id_t *remote_peer;
+    libp2p_noise_handshake_t *hs;
+
+    libp2p_upgrade_timings_t timings;
+    uint64_t start_us; /* op creation                 */
+    uint64_t mark_us;  /* start of the current phase */
+
+    /* multistream-select */
+    const char *sec_ids[1];
+    const char **mux_ids;
+    const libp2p_muxer_t **mux_owners;
+    size_t n_mux_ids;
+    const char **ms_ids;
+    size_t ms_n;
+    size_t ms_cur;
+    bool ms_started;
+    bool ms_hdr_seen;
+    int ms_chosen;
+    const libp2p_muxer_t *muxer;
+
+    uint8_t *tx;
+    size_t tx_len;
+    size_t tx_off;
+    uint8_t *rx;
+    size_t rx_have;
+    size_t rx_need; /* 0 while a multistream length prefix is incomplete */
+    size_t rx_body; /* offset of the message body                       */
+};
+
+static libp2p_upgrader_err_t op_fail(libp2p_upgrade_op_t *op, libp2p_upgrader_err_t err)
+{
+    op->phase = OP_FAILED;
+    op->err = err;
+    op->wants = 0;
+    record_failure(op->ctx);
+    return err;
+}
+
+/* Write pending output. 1 = flushed, 0 = would block, -1 = error. After
+ * AGAIN the same bytes are offered again, which the secured connection
+ * relies on to finish a record it already encrypted. */
+static int tx_flush(libp2p_upgrade_op_t *op)
+{
+    while (op->tx_off < op->tx_len) {
+        ssize_t n = libp2p_conn_write(op->conn, op->tx + op->tx_off, op->tx_len - op->tx_off);
+        if (n > 0)
+            op->tx_off += (size_t)n;
+        else if (n == LIBP2P_CONN_ERR_AGAIN)
+            return 0;
+        else
+            return -1;
+    }
+    libp2p_buf_release(op->tx);
+    op->tx = NULL;
+    op->tx_len = op->tx_off = 0;
+    return 1;
+}
+
+/* Queue multistream-select messages as one write. */
+static bool tx_ms(libp2p_upgrade_op_t *op, const char *const msgs[], size_t count)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+        total += 10 + strlen(msgs[i]) + 1;
+    op->tx = libp2p_buf_alloc(total);
+    if (!op->tx)
+        return false;
+    size_t off = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t mlen = strlen(msgs[i]);
+        size_t vlen = 0;
+        unsigned_varint_encode((uint64_t)mlen + 1, op->tx + off, total - off, &vlen);
+        off += vlen;
+        memcpy(op->tx + off, msgs[i], mlen);
+        off += mlen;
+        op->tx[off++] = '\n';
+    }
+    op->tx_len = off;
+    op->tx_off = 0;
+    return true;
+}
+
+/* Read until @p want input bytes are buffered. 1 = done, 0 = would block,
+ * -1 = error or EOF. */
+static int rx_fill(libp2p_upgrade_op_t *op, size_t want)
+{
+    if (!op->rx || libp2p_buf_capacity(op->rx) < want) {
+        uint8_t *nb = libp2p_buf_alloc(want < LIBP2P_BUF_MIN_SIZE ? LIBP2P_BUF_MIN_SIZE : want);
+        if (!nb)
+            return -1;
+        if (op->rx_have)
+            memcpy(nb, op->rx, op->rx_have);
+        libp2p_buf_release(op->rx);
+        op->rx = nb;
+    }
+    while (op->rx_have < want) {
+        ssize_t n = libp2p_conn_read(op->conn, op->rx + op->rx_have, want - op->rx_have);
+        if (n > 0)
+            op->rx_have += (size_t)n;
+        else if (n == LIBP2P_CONN_ERR_AGAIN)
+            return 0;
+        else
+            return -1;
+    }
+    return 1;
+}
+
+static void rx_done(libp2p_upgrade_op_t *op)
+{
+    op->rx_have = op->rx_need = op->rx_body = 0;
+}
+
+/* Receive one multistream-select message into @p msg (newline stripped,
+ * valid until rx_done). 1 = message, 0 = would block, -1 = error. */
+static int rx_ms_msg(libp2p_upgrade_op_t *op, char **msg)
+{
+    while (!op->rx_need) {
+        int r = rx_fill(op, op->rx_have + 1);
+        if (r <= 0)
+            return r;
+        uint64_t len = 0;
+        size_t vlen = 0;
+        if (unsigned_varint_decode(op->rx, op->rx_have, &len, &vlen) == UNSIGNED_VARINT_OK) {
+            if (len == 0 || len > OP_MS_MAX_MSG)
+                return -1;
+            op->rx_body = vlen;
+            op->rx_need = vlen + (size_t)len;
+        } else if (op->rx_have >= 9) {
+            return -1;
+        }
+    }
+    int r = rx_fill(op, op->rx_need);
+    if (r <= 0)
+        return r;
+    if (op->rx[op->rx_need - 1] != '\n')
+        return -1;
+    op->rx[op->rx_need - 1] = '\0';
+    *msg = (char *)op->rx + op->rx_body;
+    return 1;
+}
+
+static void ms_begin(libp2p_upgrade_op_t *op, const char **ids, size_t n)
+{
+    op->ms_ids = ids;
+    op->ms_n = n;
+    op->ms_cur = 0;
+    op->ms_started = false;
+    op->ms_hdr_seen = false;
+    op->ms_chosen = -1;
+}
+
+/* Move on once multistream-select settled on ms_ids[ms_chosen]. */
+static int ms_done(libp2p_upgrade_op_t *op)
+{
+    if (op->phase == OP_SEC_SELECT) {
+        op->hs = libp2p_noise_handshake_new((libp2p_security_t *)op->ctx->security[0], op->dialer, op->remote_hint);
+        if (!op->hs)
+            return LIBP2P_UPGRADER_ERR_HANDSHAKE;
+        op->mark_us = timings_lap(&op->timings, LIBP2P_UPGRADE_PHASE_SECURITY, op->mark_us);
+        op->phase = OP_NOISE;
+        return 1;
+    }
+    op->muxer = op->mux_owners[op->ms_chosen];
+    op->mark_us = timings_lap(&op->timings, LIBP2P_UPGRADE_PHASE_MUXER, op->mark_us);
+    op->phase = OP_DONE;
+    return 1;
+}
+
+/* One multistream-select exchange. The dialer proposes its ids in order,
+ * the listener accepts the first it supports. Returns 1 on progress, 0 when
+ * waiting for input, or a negative upgrader error. */
+static int ms_step(libp2p_upgrade_op_t *op)
+{
+    const int fail = op->phase == OP_SEC_SELECT ? LIBP2P_UPGRADER_ERR_HANDSHAKE : LIBP2P_UPGRADER_ERR_MUXER;
+
+    if (op->ms_chosen >= 0)
+        return ms_done(op); /* the listener's echo has been flushed */
+    if (op->dialer && !op->ms_started) {
+        const char *msgs[2] = {LIBP2P_MULTISELECT_PROTO_ID, op->ms_ids[0]};
+        op->ms_started = true;
+        return tx_ms(op, msgs, 2) ? 1 : LIBP2P_UPGRADER_ERR_INTERNAL;
+    }
+
+    char *msg = NULL;
+    int r = rx_ms_msg(op, &msg);
+    if (r <= 0)
+        return r == 0 ? 0 : fail;
+
+    const char *reply = NULL;
+    if (!op->ms_hdr_seen) {
+        if (strcmp(msg, LIBP2P_MULTISELECT_PROTO_ID) != 0) {
+            rx_done(op);
+            return fail;
+        }
+        op->ms_hdr_seen = true;
+        if (!op->dialer)
+            reply = LIBP2P_MULTISELECT_PROTO_ID;
+    } else if (op->dialer) {
+        if (strcmp(msg, op->ms_ids[op->ms_cur]) == 0) {
+            op->ms_chosen = (int)op->ms_cur;
+        } else if (strcmp(msg, LIBP2P_MULTISELECT_NA) == 0 && op->ms_cur + 1 < op->ms_n) {
+            reply = op->ms_ids[++op->ms_cur];
+        } else {
+            rx_done(op);
+            return fail;
+        }
+    } else if (strcmp(msg, LIBP2P_MULTISELECT_PROTO_ID) != 0) {
+        reply = LIBP2P_MULTISELECT_NA;
+        for (size_t i = 0; i < op->ms_n; i++) {
+            if (strcmp(msg, op->ms_ids[i]) == 0) {
+                op->ms_chosen = (int)i;
+                reply = op->ms_ids[i];
+                break;
+            }
+        }
+    }
+    rx_done(op);
+
+    if (reply && !tx_ms(op, &reply, 1))
+        return LIBP2P_UPGRADER_ERR_INTERNAL;
+    if (op->dialer && op->ms_chosen >= 0)
+        return ms_done(op);
+    return 1;
+}
+
+/* One Noise handshake message, or the switch to the secured connection. */
+static int noise_step(libp2p_upgrade_op_t *op)
+{
+    switch (libp2p_noise_handshake_action(op->hs)) {
+    case LIBP2P_NOISE_HS_WRITE: {
+        op->tx = libp2p_buf_alloc(LIBP2P_NOISE_HS_MAX_FRAME);
+        if (!op->tx)
+            return LIBP2P_UPGRADER_ERR_INTERNAL;
+        size_t n = 0;
+        if (libp2p_noise_handshake_write(op->hs, op->tx, LIBP2P_NOISE_HS_MAX_FRAME, &n) != LIBP2P_NOISE_OK)
+            return LIBP2P_UPGRADER_ERR_HANDSHAKE;
+        op->tx_len = n;
+        op->tx_off = 0;
+        return 1;
+    }
+    case LIBP2P_NOISE_HS_READ: {
+        int r = rx_fill(op, 2);
+        if (r > 0) {
+            op->rx_need = 2 + (((size_t)op->rx[0] << 8) | op->rx[1]);
+            r = rx_fill(op, op->rx_need);
+        }
+        if (r <= 0)
+            return r == 0 ? 0 : LIBP2P_UPGRADER_ERR_HANDSHAKE;
+        libp2p_noise_err_t nrc = libp2p_noise_handshake_read(op->hs, op->rx + 2, op->rx_need - 2);
+        rx_done(op);
+        if (nrc != LIBP2P_NOISE_OK)
+            return nrc == LIBP2P_NOISE_ERR_INTERNAL ? LIBP2P_UPGRADER_ERR_INTERNAL : LIBP2P_UPGRADER_ERR_HANDSHAKE;
+        return 1;
+    }
+    case LIBP2P_NOISE_HS_DONE: {
+        libp2p_noise_err_t nrc = libp2p_noise_handshake_finish(op->hs, op->raw, &op->secured, &op->remote_peer);
+        if (nrc != LIBP2P_NOISE_OK)
+            return nrc == LIBP2P_NOISE_ERR_INTERNAL ? LIBP2P_UPGRADER_ERR_INTERNAL : LIBP2P_UPGRADER_ERR_HANDSHAKE;
+        libp2p_noise_hs_stats_t hs;
+        libp2p_noise_handshake_get_stats(op->hs, &hs);
+        timings_noise(&op->timings, &hs);
+        op->mark_us = now_mono_us();
+        libp2p_noise_handshake_free(op->hs);
+        op->hs = NULL;
+        op->raw = NULL;
+        op->conn = op->secured;
+        if (op->ctx->n_muxers == 0 || !op->ctx->muxers) {
+            op->phase = OP_DONE;
+            return 1;
+        }
+        if (op->n_mux_ids == 0)
+            return LIBP2P_UPGRADER_ERR_MUXER;
+        op->phase = OP_MUX_SELECT;
+        ms_begin(op, op->mux_ids, op->n_mux_ids);
+        return 1;
+    }
+    default:
+        return LIBP2P_UPGRADER_ERR_HANDSHAKE;
+    }
+}
+
+static libp2p_upgrade_op_t *op_new(libp2p_upgrader_t *u, libp2p_conn_t *raw, const peer_id_t *remote_hint, bool dialer)
+{
+    if (!u || !u->ctx || !raw)
+        return NULL;
+    struct libp2p_upgrader_ctx *ctx = u->ctx;
+    if (!ctx->security || ctx->n_security == 0 || !ctx->security[0])
+        return NULL;
+
+    libp2p_upgrade_op_t *op = calloc(1, sizeof(*op));
+    if (!op)
+        return NULL;
+    if (ctx->muxers && ctx->n_muxers) {
+        op->mux_ids = calloc(ctx->n_muxers, sizeof(*op->mux_ids));
+        op->mux_owners = calloc(ctx->n_muxers, sizeof(*op->mux_owners));
+        if (!op->mux_ids || !op->mux_owners) {
+            free(op->mux_ids);
+            free(op->mux_owners);
+            free(op);
+            return NULL;
+        }
+        op->n_mux_ids = muxer_ids(ctx, op->mux_ids, op->mux_owners);
+    }
+
+    op->ctx = ctx;
+    op->dialer = dialer;
+    op->raw = raw;
+    op->conn = raw;
+    op->remote_hint = remote_hint;
+    op->phase = OP_SEC_SELECT;
+    op->sec_ids[0] = LIBP2P_NOISE_PROTO_ID;
+    ms_begin(op, op->sec_ids, 1);
+    timings_init(&op->timings, raw);
+    op->start_us = op->mark_us = now_mono_us();
+    if (ctx->handshake_timeout_ms)
+        op->deadline = now_mono_ms() + ctx->handshake_timeout_ms;
+    /* reads and writes must return AGAIN instead of waiting */
+    libp2p_conn_set_deadline(raw, 0);
+    return op;
+}
+
+libp2p_upgrade_op_t *libp2p_upgrade_op_new_outbound(libp2p_upgrader_t *u, libp2p_conn_t *raw, const peer_id_t *remote_hint)
+{
+    return op_new(u, raw, remote_hint, true);
+}
+
+libp2p_upgrade_op_t *libp2p_upgrade_op_new_inbound(libp2p_upgrader_t *u, libp2p_conn_t *raw)
+{
+    return op_new(u, raw, NULL, false);
+}
+
+libp2p_upgrader_err_t libp2p_upgrade_op_step(libp2p_upgrade_op_t *op, libp2p_uconn_t **out)
+{
+    if (!op || !out)
+        return LIBP2P_UPGRADER_ERR_NULL_PTR;
+    if (op->phase == OP_FAILED)
+        return op->err;
+    if (op->phase == OP_FINISHED)
+        return LIBP2P_UPGRADER_ERR_INTERNAL;
+    if (op->deadline && now_mono_ms() >= op->deadline)
+        return op_fail(op, LIBP2P_UPGRADER_ERR_TIMEOUT);
+
+    for (;;) {
+        int r = tx_flush(op);
+        if (r == 0) {
+            op->wants = LIBP2P_UPGRADE_WANT_WRITE;
+            return LIBP2P_UPGRADER_ERR_AGAIN;
+        }
+        if (r < 0)
+            return op_fail(op, op->phase == OP_MUX_SELECT ? LIBP2P_UPGRADER_ERR_MUXER : LIBP2P_UPGRADER_ERR_HANDSHAKE);
+
+        switch (op->phase) {
+        case OP_SEC_SELECT:
+        case OP_MUX_SELECT:
+            r = ms_step(op);
+            break;
+        case OP_NOISE:
+            r = noise_step(op);
+            break;
+        case OP_DONE: {
+            libp2p_uconn_t *uc = calloc(1, sizeof(*uc));
+            if (!uc)
+                return op_fail(op, LIBP2P_UPGRADER_ERR_INTERNAL);
+            uc->conn = op->secured;
+            uc->remote_peer = op->remote_peer;
+            uc->muxer = op->muxer;
+            uc->dialer = op->dialer;
+            uc->timings = op->timings;
+            uc->timings.total_us = op->mark_us - op->start_us;
+            op->secured = op->conn = NULL;
+            op->remote_peer = NULL;
+            op->phase = OP_FINISHED;
+            op->wants = 0;
+            record_success(op->ctx, uc);
+            *out = uc;
+            return LIBP2P_UPGRADER_OK;
+        }
+        default:
+            return op_fail(op, LIBP2P_UPGRADER_ERR_INTERNAL);
+        }
+        if (r == 0) {
+            op->wants = LIBP2P_UPGRADE_WANT_READ;
+            return LIBP2P_UPGRADER_ERR_AGAIN;
+        }
+        if (r < 0)
+            return op_fail(op, (libp2p_upgrader_err_t)r);
+    }
+}
+
+int libp2p_upgrade_op_wants(const libp2p_upgrade_op_t *op)
+{
+    return op ? op->wants : 0;
+}
+
+uint64_t libp2p_upgrade_op_deadline(const libp2p_upgrade_op_t *op)
+{
+    return op ? op->deadline : 0;
+}
+
+void libp2p_upgrade_op_free(libp2p_upgrade_op_t *op)
+{
+    if (!op)
+        return;
+    libp2p_noise_handshake_free(op->hs);
+    /* the secured connection owns the raw one once the handshake is done */
+    if (op->secured)
+        libp2p_conn_free(op->secured);
+    else if (op->raw)
+        libp2p_conn_free(op->raw);
+    if (op->remote_peer) {
+        peer_id_destroy(op->remote_peer);
+        free(op->remote_peer);
+    }
+    libp2p_buf_release(op->tx);
+    libp2p_buf_release(op->rx);
+    free(op->mux_ids);
+    free(op->mux_owners);
+    free(op);
+}
@@ -1,8 +1,15 @@
 #include "protocol/identify/protocol_identify.h"
+#include "multiformats/multiaddr/multiaddr.h"
 #include "multiformats/unsigned_varint/unsigned_varint.h"
+#include "protocol/mplex/protocol_mplex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 static void print_standard(const char *name, const char *details, int passed)
 {
@@ -27,6 +34,152 @@ static void encode_field(uint64_t tag, const uint8_t *data, size_t len,
     *buf_len = total;
 }
 
+/* ---- socketpair connection reporting a fixed remote address ---- */
+
+typedef struct
+{
+    int fd;
+    const multiaddr_t *remote;
+} sock_ctx_t;
+
+static ssize_t sock_read(libp2p_conn_t *c, void *buf, size_t len)
+{
+    sock_ctx_t *s = c->ctx;
+    ssize_t n = read(s->fd, buf, len);
+    if (n > 0)
+        return n;
+    if (n == 0)
+        return LIBP2P_CONN_ERR_EOF;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return LIBP2P_CONN_ERR_AGAIN;
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static ssize_t sock_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    sock_ctx_t *s = c->ctx;
+    ssize_t n = send(s->fd, buf, len, MSG_NOSIGNAL);
+    if (n >= 0)
+        return n;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return LIBP2P_CONN_ERR_AGAIN;
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static libp2p_conn_err_t sock_deadline(libp2p_conn_t *c, uint64_t ms)
+{
+    (void)c;
+    (void)ms;
+    return LIBP2P_CONN_OK;
+}
+
+static const multiaddr_t *sock_local(libp2p_conn_t *c)
+{
+    (void)c;
+    return NULL;
+}
+
+static const multiaddr_t *sock_remote(libp2p_conn_t *c) { return ((sock_ctx_t *)c->ctx)->remote; }
+
+static libp2p_conn_err_t sock_close(libp2p_conn_t *c)
+{
+    shutdown(((sock_ctx_t *)c->ctx)->fd, SHUT_RDWR);
+    return LIBP2P_CONN_OK;
+}
+
+static void sock_free(libp2p_conn_t *c) { close(((sock_ctx_t *)c->ctx)->fd); }
+
+static const libp2p_conn_vtbl_t SOCK_VTBL = {
+    .read = sock_read,
+    .write = sock_write,
+    .set_deadline = sock_deadline,
+    .local_addr = sock_local,
+    .remote_addr = sock_remote,
+    .close = sock_close,
+    .free = sock_free,
+};
+
+/* ---- mplex with the listener's stream writes counted ---- */
+
+static libp2p_muxer_vtbl_t counting_vtbl;
+static _Atomic int g_writes;
+static _Atomic size_t g_last_write;
+
+static ssize_t counting_write(libp2p_stream_t *s, const void *buf, size_t len)
+{
+    atomic_fetch_add(&g_writes, 1);
+    atomic_store(&g_last_write, len);
+    return libp2p_mplex_vtbl()->stream_write(s, buf, len);
+}
+
+static uint8_t dialer_key[] = {1, 2, 3};
+static uint8_t listener_key[] = {4, 5, 6};
+static peer_id_t dialer_peer = {dialer_key, sizeof(dialer_key)};
+static peer_id_t listener_peer = {listener_key, sizeof(listener_key)};
+
+/* Asks a registered service for its record over a real stream while the
+ * listener's connection reports @p remote_str as the dialer's address. */
+static int service_over_stream(libp2p_identify_service_t *svc, const char *remote_str, libp2p_identify_t **out, size_t *frame_len)
+{
+    int sv[2];
+    int err = 0;
+    multiaddr_t *remote = multiaddr_new_from_str(remote_str, &err);
+    if (!remote || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        multiaddr_free(remote);
+        return 0;
+    }
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    sock_ctx_t dsock = {sv[0], NULL}, lsock = {sv[1], remote};
+    libp2p_conn_t dconn = {.vt = &SOCK_VTBL, .ctx = &dsock};
+    libp2p_conn_t lconn = {.vt = &SOCK_VTBL, .ctx = &lsock};
+
+    counting_vtbl = *libp2p_mplex_vtbl();
+    counting_vtbl.stream_write = counting_write;
+    libp2p_muxer_t dmux = {.vt = libp2p_mplex_vtbl()}, lmux = {.vt = &counting_vtbl};
+    libp2p_uconn_t duconn = {.conn = &dconn, .muxer = &dmux, .remote_peer = &listener_peer, .dialer = true};
+    libp2p_uconn_t luconn = {.conn = &lconn, .muxer = &lmux, .remote_peer = &dialer_peer, .dialer = false};
+
+    libp2p_protocol_handler_registry_t *dreg = libp2p_protocol_handler_registry_new();
+    libp2p_protocol_handler_registry_t *lreg = libp2p_protocol_handler_registry_new();
+    int ok = dreg && lreg && libp2p_identify_service_register(lreg, svc) == 0;
+    libp2p_protocol_handler_ctx_t *lctx = ok ? libp2p_protocol_handler_ctx_new(lreg, &luconn) : NULL;
+    libp2p_protocol_handler_ctx_t *dctx = ok ? libp2p_protocol_handler_ctx_new(dreg, &duconn) : NULL;
+    ok = lctx && dctx && libp2p_protocol_handler_start(lctx) == 0 && libp2p_protocol_handler_start(dctx) == 0;
+
+    atomic_store(&g_writes, 0);
+    libp2p_stream_t *s = NULL;
+    uint8_t buf[2048];
+    ssize_t n = -1;
+    ok = ok && libp2p_protocol_handler_open_stream(dctx, LIBP2P_IDENTIFY_PROTO_ID, &s) == 0;
+    if (ok)
+        n = libp2p_stream_read_lp(s, buf, sizeof(buf));
+    ok = ok && n > 0 && libp2p_identify_message_decode(buf, (size_t)n, out) == 0;
+    if (ok)
+        *frame_len = unsigned_varint_size((uint64_t)n) + (size_t)n;
+    if (s)
+    {
+        libp2p_stream_close(s);
+        libp2p_stream_free(s);
+    }
+
+    if (dctx)
+        libp2p_protocol_handler_stop(dctx);
+    if (lctx)
+        libp2p_protocol_handler_stop(lctx);
+    libp2p_conn_close(&dconn);
+    libp2p_conn_close(&lconn);
+    libp2p_protocol_handler_ctx_free(dctx);
+    libp2p_protocol_handler_ctx_free(lctx);
+    libp2p_protocol_handler_registry_free(dreg);
+    libp2p_protocol_handler_registry_free(lreg);
+    sock_free(&dconn);
+    sock_free(&lconn);
+    multiaddr_free(remote);
+    return ok;
+}
+
 int main(void)
 {
     uint8_t *msg = NULL; size_t msg_len = 0;
@@ -41,7 +194,6 @@ int main(void)
 
     libp2p_identify_t *id = NULL;
     int rc = libp2p_identify_message_decode(msg, msg_len, &id);
-    free(msg);
 
     int ok = rc == 0 && id && id->num_listen_addrs == 2 && id->num_protocols == 1 &&
              id->public_key_len == 2 && id->observed_addr_len == 6 &&
@@ -50,5 +202,92 @@ int main(void)
 
     print_standard("identify parse", ok ? "" : "mismatch", ok);
     libp2p_identify_free(id);
-    return ok ? 0 : 1;
+
+    /* view: fields point into the encoded message */
+    libp2p_identify_view_t view;
+    libp2p_identify_field_t f;
+    size_t it = 0;
+    int view_ok = libp2p_identify_view_decode(msg, msg_len, &view) == 0 && view.num_listen_addrs == 2 &&
+                  view.num_protocols == 1 && view.agent_version.len == 10 &&
+                  memcmp(view.agent_version.data, "libp2p/0.1", 10) == 0 &&
+                  view.public_key.data > msg && view.public_key.data < msg + msg_len;
+    view_ok = view_ok && libp2p_identify_view_next_listen_addr(&view, &it, &f) && f.len == 6 && memcmp(f.data, "/ip4/1", 6) == 0 &&
+              libp2p_identify_view_next_listen_addr(&view, &it, &f) && memcmp(f.data, "/ip4/2", 6) == 0 &&
+              !libp2p_identify_view_next_listen_addr(&view, &it, &f);
+    it = 0;
+    view_ok = view_ok && libp2p_identify_view_next_protocol(&view, &it, &f) && f.len == 12 &&
+              !libp2p_identify_view_next_protocol(&view, &it, &f);
+    view_ok = view_ok && libp2p_identify_view_decode(msg, msg_len - 1, &view) != 0;
+    print_standard("identify view decode", view_ok ? "" : "mismatch", view_ok);
+
+    /* arena: an owned copy in one block */
+    id = NULL;
+    int arena_ok = libp2p_identify_message_decode_arena(msg, msg_len, &id) == 0 && id->arena == id &&
+                   id->num_listen_addrs == 2 && id->listen_addrs_lens[1] == 6 &&
+                   memcmp(id->listen_addrs[1], "/ip4/2", 6) == 0 && id->num_protocols == 1 &&
+                   strcmp(id->protocols[0], "/mplex/6.7.0") == 0 && id->public_key_len == 2 &&
+                   id->public_key[1] == 0x02 && strcmp(id->protocol_version, "/test/1.0") == 0 &&
+                   strcmp(id->agent_version, "libp2p/0.1") == 0 && id->observed_addr_len == 6;
+    libp2p_identify_free(id);
+    print_standard("identify arena decode", arena_ok ? "" : "mismatch", arena_ok);
+    free(msg);
+
+    /* service: record encoded once, observed address appended per response */
+    uint8_t addr1[] = {0x04, 127, 0, 0, 1};
+    uint8_t *addrs[] = {addr1};
+    size_t addr_lens[] = {sizeof(addr1)};
+    char *protos[] = {"/ipfs/id/1.0.0", "/ipfs/ping/1.0.0"};
+    uint8_t stale[] = {0x04, 1, 1, 1, 1};
+    libp2p_identify_t local = {.protocol_version = "ipfs/0.1.0", .agent_version = "c-libp2p/0.1.0",
+                               .listen_addrs = addrs, .listen_addrs_lens = addr_lens, .num_listen_addrs = 1,
+                               .protocols = protos, .num_protocols = 2,
+                               .observed_addr = stale, .observed_addr_len = sizeof(stale)};
+    libp2p_identify_service_t *svc = libp2p_identify_service_new(&local);
+    const uint8_t observed[] = {0x04, 10, 0, 0, 7, 0x06, 0x10, 0x01};
+    uint8_t *enc = NULL; size_t enc_len = 0;
+    id = NULL;
+    int svc_ok = svc && libp2p_identify_service_encode(svc, observed, sizeof(observed), &enc, &enc_len) == 0 &&
+                 libp2p_identify_message_decode(enc, enc_len, &id) == 0 && id->num_listen_addrs == 1 &&
+                 id->num_protocols == 2 && strcmp(id->protocols[1], "/ipfs/ping/1.0.0") == 0 &&
+                 id->observed_addr_len == sizeof(observed) && memcmp(id->observed_addr, observed, sizeof(observed)) == 0 &&
+                 strcmp(id->agent_version, "c-libp2p/0.1.0") == 0;
+    free(enc);
+    libp2p_identify_free(id);
+
+    /* an update changes what later responses carry */
+    local.num_protocols = 1;
+    enc = NULL;
+    id = NULL;
+    svc_ok = svc_ok && libp2p_identify_service_update(svc, &local) == 0 &&
+             libp2p_identify_service_encode(svc, NULL, 0, &enc, &enc_len) == 0 &&
+             libp2p_identify_message_decode(enc, enc_len, &id) == 0 && id->num_protocols == 1 &&
+             id->observed_addr_len == 0;
+    free(enc);
+    libp2p_identify_free(id);
+    libp2p_identify_service_free(svc);
+    print_standard("identify service record", svc_ok ? "" : "mismatch", svc_ok);
+
+    /* the registered handler answers from the connection, in one write */
+    svc = libp2p_identify_service_new(&local);
+    const uint8_t seen[] = {0x04, 10, 0, 0, 7, 0x06, 0x0f, 0xa1};
+    size_t frame_len = 0;
+    id = NULL;
+    int stream_ok = svc && service_over_stream(svc, "/ip4/10.0.0.7/tcp/4001", &id, &frame_len) && id->num_protocols == 1 &&
+                    id->observed_addr_len == sizeof(seen) && memcmp(id->observed_addr, seen, sizeof(seen)) == 0;
+    /* multistream header and protocol echo, then the whole response */
+    stream_ok = stream_ok && atomic_load(&g_writes) == 3 && atomic_load(&g_last_write) == frame_len;
+    libp2p_identify_free(id);
+
+    /* an observed address too long to splice in is left out */
+    char long_addr[1024] = "";
+    for (int i = 0; i < 40; i++)
+        strcat(long_addr, "/ip4/1.2.3.4/tcp/1");
+    id = NULL;
+    stream_ok = stream_ok && service_over_stream(svc, long_addr, &id, &frame_len) && id->observed_addr_len == 0 &&
+                id->num_protocols == 1 && atomic_load(&g_writes) == 3 && atomic_load(&g_last_write) == frame_len;
+    libp2p_identify_free(id);
+    libp2p_identify_service_free(svc);
+    print_standard("identify service handler over a stream", stream_ok ? "" : "mismatch", stream_ok);
+
+    return ok && view_ok && arena_ok && svc_ok && stream_ok ? 0 : 1;
 }
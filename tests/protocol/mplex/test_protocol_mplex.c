@@ -10,7 +10,9 @@
 #include "multiformats/multiaddr/multiaddr.h"
 #include "multiformats/unsigned_varint/unsigned_varint.h"
 #include "protocol/mplex/protocol_mplex.h"
+#include "protocol/mplex/protocol_mplex_codec.h"
 #include "protocol/tcp/protocol_tcp.h"
+#include "protocol/tcp/protocol_tcp_util.h"
 #include "transport/connection.h"
 #include "transport/listener.h"
 #include "transport/transport.h"
@@ -26,6 +28,8 @@ static inline int pipe(int fds[2])
     /* size 4096, binary mode */
     return _pipe(fds, 4096, _O_BINARY);
 }
+#else
+#include <fcntl.h>
 #endif /* _WIN32 */
 
 /* dummy connection that never becomes writable to simulate a slow reader */
@@ -111,6 +115,33 @@ static const libp2p_conn_vtbl_t OK_VTBL = {
     .free = ok_free,
 };
 
+/* connection that records every write so tests can count them */
+typedef struct
+{
+    uint8_t buf[8192];
+    size_t len;
+    int writes;
+} count_ctx_t;
+static ssize_t count_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    count_ctx_t *cc = c->ctx;
+    if (cc->len + len > sizeof(cc->buf))
+        return LIBP2P_CONN_ERR_INTERNAL;
+    memcpy(cc->buf + cc->len, buf, len);
+    cc->len += len;
+    cc->writes++;
+    return (ssize_t)len;
+}
+static const libp2p_conn_vtbl_t COUNT_VTBL = {
+    .read = slow_read,
+    .write = count_write,
+    .set_deadline = ok_deadline,
+    .local_addr = ok_addr,
+    .remote_addr = ok_addr,
+    .close = ok_close,
+    .free = ok_free,
+};
+
 typedef struct
 {
     int rfd;
@@ -398,6 +429,49 @@ static void test_frame_roundtrip(void)
     libp2p_transport_free(tcp);
 }
 
+static void test_single_write_encoding(void)
+{
+    count_ctx_t cc = {0};
+    libp2p_conn_t c = {.vt = &COUNT_VTBL, .ctx = &cc};
+
+    libp2p_mplex_frame_t fr = {
+        .id = 300,
+        .flag = LIBP2P_MPLEX_MSG_RECEIVER,
+        .data = (uint8_t *)"hello",
+        .data_len = 5,
+    };
+    /* (300 << 3 | 1) = 2401 -> 0xe1 0x12, length 5 -> 0x05 */
+    const uint8_t expect[] = {0xe1, 0x12, 0x05, 'h', 'e', 'l', 'l', 'o'};
+    int ok = libp2p_mplex_send_frame(&c, &fr) == LIBP2P_MPLEX_OK && cc.writes == 1 && cc.len == sizeof(expect) &&
+             memcmp(cc.buf, expect, sizeof(expect)) == 0;
+    print_standard("mplex frame sent in one write", ok ? "" : "multiple writes or bad encoding", ok);
+
+    libp2p_conn_t a, b;
+    make_pipe_pair(&a, &b);
+    libp2p_mplex_frame_t batch[3] = {
+        {.id = 1, .flag = LIBP2P_MPLEX_NEW_STREAM, .data = (uint8_t *)"one", .data_len = 3},
+        {.id = 2, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"two", .data_len = 3},
+        {.id = 3, .flag = LIBP2P_MPLEX_CLOSE_INITIATOR, .data = NULL, .data_len = 0},
+    };
+    cc.len = 0;
+    cc.writes = 0;
+    ok = libp2p_mplex_send_frames(&c, batch, 3) == LIBP2P_MPLEX_OK && cc.writes == 1;
+    ok = ok && libp2p_mplex_send_frames(&a, batch, 3) == LIBP2P_MPLEX_OK;
+    for (size_t i = 0; i < 3 && ok; i++)
+    {
+        libp2p_mplex_frame_t rec = {0};
+        ok = libp2p_mplex_read_frame(&b, &rec) == LIBP2P_MPLEX_OK && rec.id == batch[i].id && rec.flag == batch[i].flag &&
+             rec.data_len == batch[i].data_len && (!rec.data_len || memcmp(rec.data, batch[i].data, rec.data_len) == 0);
+        libp2p_mplex_frame_free(&rec);
+    }
+    print_standard("mplex batch send", ok ? "" : "batch not coalesced or corrupted", ok);
+
+    libp2p_conn_close(&a);
+    libp2p_conn_close(&b);
+    libp2p_conn_free(&a);
+    libp2p_conn_free(&b);
+}
+
 static void test_helper_functions(void)
 {
     libp2p_transport_t *tcp = libp2p_tcp_transport_new(NULL);
@@ -565,6 +639,108 @@ static void test_length_varint_too_long(void)
     libp2p_transport_free(tcp);
 }
 
+typedef struct
+{
+    libp2p_mplex_frame_t frames[8];
+    uint8_t data[8][16];
+    size_t count;
+    const uint8_t *lo, *hi; /* input chunk bounds */
+    int sliced;             /* payloads pointing into the chunk */
+} collect_ctx_t;
+
+static libp2p_mplex_err_t collect_frame(void *arg, const libp2p_mplex_frame_t *fr)
+{
+    collect_ctx_t *cc = (collect_ctx_t *)arg;
+    if (cc->count == 8 || fr->data_len > sizeof(cc->data[0]))
+        return LIBP2P_MPLEX_ERR_INTERNAL;
+    if (fr->data_len && fr->data >= cc->lo && fr->data + fr->data_len <= cc->hi)
+        cc->sliced++;
+    cc->frames[cc->count] = *fr;
+    if (fr->data_len)
+        memcpy(cc->data[cc->count], fr->data, fr->data_len);
+    cc->frames[cc->count].data = cc->data[cc->count];
+    cc->count++;
+    return LIBP2P_MPLEX_OK;
+}
+
+static int collected_match(const collect_ctx_t *cc, const libp2p_mplex_frame_t *want, size_t n)
+{
+    if (cc->count != n)
+        return 0;
+    for (size_t i = 0; i < n; i++)
+        if (cc->frames[i].id != want[i].id || cc->frames[i].flag != want[i].flag || cc->frames[i].data_len != want[i].data_len ||
+            memcmp(cc->frames[i].data, want[i].data, want[i].data_len) != 0)
+            return 0;
+    return 1;
+}
+
+static void test_streaming_parser(void)
+{
+    count_ctx_t enc = {0};
+    libp2p_conn_t c = {.vt = &COUNT_VTBL, .ctx = &enc};
+    libp2p_mplex_frame_t batch[4] = {
+        {.id = 300, .flag = LIBP2P_MPLEX_NEW_STREAM, .data = (uint8_t *)"name", .data_len = 4},
+        {.id = 300, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"hello world", .data_len = 11},
+        {.id = 7, .flag = LIBP2P_MPLEX_CLOSE_RECEIVER, .data = NULL, .data_len = 0},
+        {.id = 300, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"x", .data_len = 1},
+    };
+    assert(libp2p_mplex_send_frames(&c, batch, 4) == LIBP2P_MPLEX_OK);
+
+    /* whole stream in one chunk: every payload is a slice of the input */
+    libp2p_mplex_parser_t p;
+    collect_ctx_t whole = {.lo = enc.buf, .hi = enc.buf + enc.len};
+    libp2p_mplex_parser_init(&p);
+    size_t used = 0;
+    int ok = libp2p_mplex_parser_feed(&p, enc.buf, enc.len, collect_frame, &whole, &used) == LIBP2P_MPLEX_OK && used == enc.len &&
+             collected_match(&whole, batch, 4) && whole.sliced == 3 && libp2p_mplex_parser_idle(&p);
+    libp2p_mplex_parser_free(&p);
+    print_standard("mplex parser whole chunk", ok ? "" : "frames differ or payload copied", ok);
+
+    /* one byte at a time: same frames, reassembled internally */
+    collect_ctx_t bytewise = {0};
+    libp2p_mplex_parser_init(&p);
+    ok = 1;
+    for (size_t i = 0; i < enc.len && ok; i++)
+        ok = libp2p_mplex_parser_feed(&p, enc.buf + i, 1, collect_frame, &bytewise, NULL) == LIBP2P_MPLEX_OK;
+    ok = ok && collected_match(&bytewise, batch, 4) && libp2p_mplex_parser_idle(&p);
+    libp2p_mplex_parser_free(&p);
+    print_standard("mplex parser byte by byte", ok ? "" : "frames differ", ok);
+
+    /* a length above the limit is rejected as soon as it is decoded */
+    uint8_t bad[12] = {0x08};
+    size_t blen = 0;
+    assert(unsigned_varint_encode(MPLEX_MAX_MSG_SIZE + 1, bad + 1, sizeof(bad) - 1, &blen) == UNSIGNED_VARINT_OK);
+    collect_ctx_t none = {0};
+    libp2p_mplex_parser_init(&p);
+    ok = libp2p_mplex_parser_feed(&p, bad, 1 + blen, collect_frame, &none, NULL) == LIBP2P_MPLEX_ERR_PROTO_MAL && none.count == 0;
+    libp2p_mplex_parser_free(&p);
+    print_standard("mplex parser oversized length", ok ? "" : "not rejected", ok);
+}
+
+static void test_ctx_feed(void)
+{
+    libp2p_conn_t dummy = {0};
+    libp2p_mplex_ctx_t *ctx = libp2p_mplex_ctx_new(&dummy);
+    assert(ctx);
+
+    count_ctx_t enc = {0};
+    libp2p_conn_t c = {.vt = &COUNT_VTBL, .ctx = &enc};
+    libp2p_mplex_frame_t batch[2] = {
+        {.id = 9, .flag = LIBP2P_MPLEX_NEW_STREAM, .data = NULL, .data_len = 0},
+        {.id = 9, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"ping", .data_len = 4},
+    };
+    assert(libp2p_mplex_send_frames(&c, batch, 2) == LIBP2P_MPLEX_OK);
+
+    /* split inside the second header */
+    int ok = libp2p_mplex_ctx_feed(ctx, enc.buf, 3) == LIBP2P_MPLEX_OK && libp2p_mplex_ctx_feed(ctx, enc.buf + 3, enc.len - 3) == LIBP2P_MPLEX_OK;
+    uint8_t out[8];
+    size_t n = 0;
+    ok = ok && libp2p_mplex_stream_recv(ctx, 9, 0, out, sizeof(out), &n) == LIBP2P_MPLEX_OK && n == 4 && memcmp(out, "ping", 4) == 0;
+    print_standard("mplex ctx feed", ok ? "" : "frames not dispatched", ok);
+
+    libp2p_mplex_ctx_free(ctx);
+}
+
 static void test_ctx_dispatch(void)
 {
     libp2p_conn_t dummy = {0};
@@ -577,15 +753,16 @@ static void test_ctx_dispatch(void)
     fr.data = NULL;
     fr.data_len = 0;
     assert(libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK);
-    assert(ctx->streams.len == 1 && ctx->streams.items[0]->id == 5 && ctx->streams.items[0]->initiator == 0);
+    libp2p_mplex_stream_t *st = mplex_stream_map_find(&ctx->streams, 5, 0);
+    assert(ctx->streams.len == 1 && st && st->id == 5 && st->initiator == 0);
 
     fr.flag = LIBP2P_MPLEX_CLOSE_INITIATOR;
     assert(libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK);
-    assert(ctx->streams.items[0]->remote_closed == 1);
+    assert(st->remote_closed == 1);
 
     fr.flag = LIBP2P_MPLEX_RESET_INITIATOR;
     assert(libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK);
-    assert(ctx->streams.len == 1 && ctx->streams.items[0]->reset == 1);
+    assert(ctx->streams.len == 1 && st->reset == 1);
 
     uint8_t tmp[4];
     size_t n = 0;
@@ -698,6 +875,175 @@ static void test_process_one(void)
     libp2p_conn_free(&s);
 }
 
+static void test_process_ready(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+    libp2p_mplex_ctx_t *ctx_s = libp2p_mplex_ctx_new(&s);
+    assert(ctx_s);
+
+    libp2p_mplex_frame_t batch[4] = {
+        {.id = 1, .flag = LIBP2P_MPLEX_NEW_STREAM},
+        {.id = 2, .flag = LIBP2P_MPLEX_NEW_STREAM},
+        {.id = 1, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"a", .data_len = 1},
+        {.id = 2, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"b", .data_len = 1},
+    };
+    assert(libp2p_mplex_send_frames(&c, batch, 4) == LIBP2P_MPLEX_OK);
+#ifndef _WIN32
+    /* the reader must see AGAIN, not block, once the burst is consumed */
+    pipe_ctx_t *pc = s.ctx;
+    fcntl(pc->rfd, F_SETFL, fcntl(pc->rfd, F_GETFL) | O_NONBLOCK);
+#endif
+
+    /* one wakeup handles the whole burst and queues both streams */
+    size_t frames = 0;
+    libp2p_mplex_stream_t *a = NULL, *b = NULL;
+    int ok = libp2p_mplex_process_ready(ctx_s, &frames) == LIBP2P_MPLEX_OK && frames == 4 &&
+             libp2p_mplex_accept_stream(ctx_s, &a) == LIBP2P_MPLEX_OK && libp2p_mplex_accept_stream(ctx_s, &b) == LIBP2P_MPLEX_OK && a->id == 1 &&
+             b->id == 2 && a->buf_len == 1 && b->buf_len == 1;
+    print_standard("mplex process ready burst", ok ? "" : "burst not drained in one call", ok);
+
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_mplex_ctx_free(ctx_s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    uint64_t id;
+} late_send_t;
+
+static void *late_send_thread(void *arg)
+{
+    late_send_t *ls = (late_send_t *)arg;
+    usleep(20000);
+    libp2p_mplex_stream_send(ls->ctx, ls->id, 1, (const uint8_t *)"late", 4);
+    return NULL;
+}
+
+static void test_recv_timeout(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+#ifndef _WIN32
+    pipe_ctx_t *pc = s.ctx;
+    fcntl(pc->rfd, F_SETFL, fcntl(pc->rfd, F_GETFL) | O_NONBLOCK);
+#endif
+    libp2p_mplex_ctx_t *ctx_c = libp2p_mplex_ctx_new(&c);
+    libp2p_mplex_ctx_t *ctx_s = libp2p_mplex_ctx_new(&s);
+    assert(ctx_c && ctx_s);
+
+    late_send_t ls = {.ctx = ctx_c};
+    assert(libp2p_mplex_stream_open(ctx_c, NULL, 0, &ls.id) == LIBP2P_MPLEX_OK);
+    assert(libp2p_mplex_process_one(ctx_s) == LIBP2P_MPLEX_OK);
+
+    /* nothing sent: a distinct timeout after roughly the deadline */
+    uint8_t out[8];
+    size_t n = 0;
+    uint64_t t0 = now_mono_ms();
+    libp2p_mplex_err_t rc = libp2p_mplex_stream_recv_timeout(ctx_s, ls.id, 0, out, sizeof(out), &n, 50);
+    uint64_t waited = now_mono_ms() - t0;
+    int ok = rc == LIBP2P_MPLEX_ERR_TIMEOUT && n == 0 && waited >= 50 && waited < 1000;
+    print_standard("mplex recv timeout", ok ? "" : "no timeout or wrong wait", ok);
+
+    /* no processing loop: the waiting reader drives the connection */
+    pthread_t th;
+    pthread_create(&th, NULL, late_send_thread, &ls);
+    rc = libp2p_mplex_stream_recv_timeout(ctx_s, ls.id, 0, out, sizeof(out), &n, 2000);
+    pthread_join(th, NULL);
+    ok = rc == LIBP2P_MPLEX_OK && n == 4 && memcmp(out, "late", 4) == 0;
+
+    /* with a processing loop: the reader sleeps until data is dispatched */
+    pthread_t tl;
+    pthread_create(&tl, NULL, loop_thread, ctx_s);
+    pthread_create(&th, NULL, late_send_thread, &ls);
+    rc = libp2p_mplex_stream_recv_timeout(ctx_s, ls.id, 0, out, sizeof(out), &n, 2000);
+    pthread_join(th, NULL);
+    ok = ok && rc == LIBP2P_MPLEX_OK && n == 4 && memcmp(out, "late", 4) == 0;
+    assert(libp2p_mplex_stream_close(ctx_c, ls.id, 1) == LIBP2P_MPLEX_OK);
+    rc = libp2p_mplex_stream_recv_timeout(ctx_s, ls.id, 0, out, sizeof(out), &n, 2000);
+    ok = ok && rc == LIBP2P_MPLEX_ERR_EOF;
+    print_standard("mplex blocking recv", ok ? "" : "data or close not delivered", ok);
+
+    libp2p_mplex_stop(ctx_s);
+    libp2p_conn_close(&c);
+    pthread_join(tl, NULL);
+    libp2p_conn_close(&s);
+    libp2p_mplex_ctx_free(ctx_c);
+    libp2p_mplex_ctx_free(ctx_s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    uint64_t id;
+    libp2p_mplex_err_t rc;
+    uint8_t out[8];
+    size_t n;
+    atomic_int done;
+} blocking_recv_t;
+
+static void *blocking_recv_thread(void *arg)
+{
+    blocking_recv_t *br = (blocking_recv_t *)arg;
+    br->rc = libp2p_mplex_stream_recv_timeout(br->ctx, br->id, 0, br->out, sizeof(br->out), &br->n, -1);
+    atomic_store(&br->done, 1);
+    return NULL;
+}
+
+static void test_recv_reader_handoff(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+#ifndef _WIN32
+    pipe_ctx_t *pc = s.ctx;
+    fcntl(pc->rfd, F_SETFL, fcntl(pc->rfd, F_GETFL) | O_NONBLOCK);
+#endif
+    libp2p_mplex_ctx_t *ctx_c = libp2p_mplex_ctx_new(&c);
+    libp2p_mplex_ctx_t *ctx_s = libp2p_mplex_ctx_new(&s);
+    assert(ctx_c && ctx_s);
+
+    blocking_recv_t a = {.ctx = ctx_s}, b = {.ctx = ctx_s};
+    assert(libp2p_mplex_stream_open(ctx_c, NULL, 0, &a.id) == LIBP2P_MPLEX_OK);
+    assert(libp2p_mplex_stream_open(ctx_c, NULL, 0, &b.id) == LIBP2P_MPLEX_OK);
+    assert(libp2p_mplex_process_one(ctx_s) == LIBP2P_MPLEX_OK);
+    assert(libp2p_mplex_process_one(ctx_s) == LIBP2P_MPLEX_OK);
+
+    /* two readers wait without a deadline; whichever reads the connection
+     * returns with its data and must hand the role to the other */
+    pthread_t ta, tb;
+    pthread_create(&ta, NULL, blocking_recv_thread, &a);
+    pthread_create(&tb, NULL, blocking_recv_thread, &b);
+    usleep(20000);
+    libp2p_mplex_stream_send(ctx_c, a.id, 1, (const uint8_t *)"one", 3);
+    for (int i = 0; i < 100 && !atomic_load(&a.done); i++)
+        usleep(10000);
+    libp2p_mplex_stream_send(ctx_c, b.id, 1, (const uint8_t *)"two", 3);
+    for (int i = 0; i < 100 && !atomic_load(&b.done); i++)
+        usleep(10000);
+    int ok = atomic_load(&a.done) && atomic_load(&b.done);
+
+    /* stopping releases anything still blocked */
+    libp2p_mplex_stop(ctx_s);
+    pthread_join(ta, NULL);
+    pthread_join(tb, NULL);
+    ok = ok && a.rc == LIBP2P_MPLEX_OK && a.n == 3 && memcmp(a.out, "one", 3) == 0;
+    ok = ok && b.rc == LIBP2P_MPLEX_OK && b.n == 3 && memcmp(b.out, "two", 3) == 0;
+    print_standard("mplex recv reader hand-off", ok ? "" : "a blocked reader was not woken", ok);
+
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_mplex_ctx_free(ctx_c);
+    libp2p_mplex_ctx_free(ctx_s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_inbound_stream_queue(void)
 {
     libp2p_conn_t c = {0}, s = {0};
@@ -744,10 +1090,7 @@ static void test_slow_reader_reset(void)
     st->initiator = 1;
     st->name = NULL;
     st->name_len = 0;
-    ctx->streams.items = malloc(sizeof(st));
-    ctx->streams.cap = 1;
-    ctx->streams.items[0] = st;
-    ctx->streams.len = 1;
+    assert(mplex_stream_map_insert(&ctx->streams, st));
 
     libp2p_mplex_err_t rc = libp2p_mplex_stream_send(ctx, 1, 1, (const uint8_t *)"hi", 2);
     int ok = (rc == LIBP2P_MPLEX_ERR_TIMEOUT && ctx->streams.len == 0);
@@ -789,6 +1132,132 @@ static void test_recv_buffer_limit_reset(void)
     libp2p_mplex_ctx_free(ctx);
 }
 
+static void test_many_streams(void)
+{
+    enum
+    {
+        N = 20000
+    };
+    libp2p_conn_t dummy = {.vt = &OK_VTBL, .ctx = NULL};
+    libp2p_mplex_ctx_t *ctx = libp2p_mplex_ctx_new(&dummy);
+    assert(ctx);
+
+    libp2p_mplex_frame_t fr = {0};
+    int ok = 1;
+
+    for (uint64_t id = 1; id <= N && ok; id++)
+    {
+        libp2p_mplex_stream_t *acc = NULL;
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_NEW_STREAM};
+        ok = libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK && libp2p_mplex_accept_stream(ctx, &acc) == LIBP2P_MPLEX_OK && acc->id == id;
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = (uint8_t *)"x", .data_len = 1};
+        ok = ok && libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK;
+    }
+    ok = ok && ctx->streams.len == N;
+
+    /* read back in reverse so lookups do not follow insertion order */
+    for (uint64_t id = N; id >= 1 && ok; id--)
+    {
+        uint8_t out[2];
+        size_t n = 0;
+        ok = libp2p_mplex_stream_recv(ctx, id, 0, out, sizeof(out), &n) == LIBP2P_MPLEX_OK && n == 1 && out[0] == 'x';
+    }
+
+    for (uint64_t id = 1; id <= N && ok; id++)
+    {
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_CLOSE_INITIATOR};
+        ok = libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK && libp2p_mplex_stream_close(ctx, id, 0) == LIBP2P_MPLEX_OK;
+    }
+    ok = ok && ctx->streams.len == 0 && ctx->streams.spare_len == MPLEX_STREAM_POOL;
+
+    print_standard("mplex many streams", ok ? "" : "stream lookup or cleanup failed", ok);
+
+    libp2p_mplex_ctx_free(ctx);
+}
+
+typedef struct
+{
+    libp2p_mplex_ctx_t *ctx;
+    uint64_t id;
+    int chunks;
+} bp_sender_t;
+
+static void *bp_send_thread(void *arg)
+{
+    bp_sender_t *snd = (bp_sender_t *)arg;
+    uint8_t chunk[4096];
+    memset(chunk, 'b', sizeof(chunk));
+    for (int i = 0; i < snd->chunks; i++)
+        if (libp2p_mplex_stream_send(snd->ctx, snd->id, 1, chunk, sizeof(chunk)) != LIBP2P_MPLEX_OK)
+            break;
+    return NULL;
+}
+
+static void test_backpressure(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+    libp2p_mplex_ctx_t *ctx_c = libp2p_mplex_ctx_new(&c);
+    libp2p_mplex_ctx_t *ctx_s = libp2p_mplex_ctx_new(&s);
+    assert(ctx_c && ctx_s);
+    assert(libp2p_mplex_set_backpressure(ctx_s, 32 * 1024, 8 * 1024, 0) == LIBP2P_MPLEX_OK);
+
+    bp_sender_t snd = {.ctx = ctx_c, .chunks = 64};
+    assert(libp2p_mplex_stream_open(ctx_c, NULL, 0, &snd.id) == LIBP2P_MPLEX_OK);
+    pthread_t th;
+    pthread_create(&th, NULL, bp_send_thread, &snd);
+
+    /* without a consumer the reader must stop just past the high watermark */
+    libp2p_mplex_err_t rc;
+    while ((rc = libp2p_mplex_process_one(ctx_s)) == LIBP2P_MPLEX_OK)
+        ;
+    libp2p_mplex_stream_t *st = mplex_stream_map_find(&ctx_s->streams, snd.id, 0);
+    int ok = rc == LIBP2P_MPLEX_ERR_AGAIN && libp2p_mplex_recv_paused(ctx_s) && st && !st->reset && ctx_s->buffered > 32 * 1024 &&
+             ctx_s->buffered <= 36 * 1024;
+
+    /* draining resumes reading; no data is lost and nothing is reset */
+    size_t total = 0, peak = 0;
+    uint8_t out[2048];
+    while (ok && total < 64 * 4096)
+    {
+        size_t n = 0;
+        ok = libp2p_mplex_stream_recv(ctx_s, snd.id, 0, out, sizeof(out), &n) == LIBP2P_MPLEX_OK;
+        total += n;
+        if (n == 0)
+        {
+            rc = libp2p_mplex_process_one(ctx_s);
+            ok = ok && (rc == LIBP2P_MPLEX_OK || rc == LIBP2P_MPLEX_ERR_AGAIN);
+        }
+        if (ctx_s->buffered > peak)
+            peak = ctx_s->buffered;
+    }
+    pthread_join(th, NULL);
+    ok = ok && total == 64 * 4096 && peak <= 36 * 1024 && !libp2p_mplex_recv_paused(ctx_s);
+    print_standard("mplex receive backpressure", ok ? "" : "reader not paused or data lost", ok);
+
+    /* the session cap pauses reads even when each stream is below high */
+    libp2p_mplex_frame_t fr = {0};
+    uint8_t data[20 * 1024] = {0};
+    assert(libp2p_mplex_set_backpressure(ctx_s, 32 * 1024, 8 * 1024, 32 * 1024) == LIBP2P_MPLEX_OK);
+    for (uint64_t id = 100; id < 102; id++)
+    {
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_NEW_STREAM};
+        assert(libp2p_mplex_dispatch_frame(ctx_s, &fr) == LIBP2P_MPLEX_OK);
+        fr = (libp2p_mplex_frame_t){.id = id, .flag = LIBP2P_MPLEX_MSG_INITIATOR, .data = data, .data_len = sizeof(data)};
+        assert(libp2p_mplex_dispatch_frame(ctx_s, &fr) == LIBP2P_MPLEX_OK);
+    }
+    ok = libp2p_mplex_recv_paused(ctx_s);
+    ok = ok && libp2p_mplex_stream_reset(ctx_s, 100, 0) == LIBP2P_MPLEX_OK && !libp2p_mplex_recv_paused(ctx_s);
+    print_standard("mplex session memory cap", ok ? "" : "cap not enforced or not released", ok);
+
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_mplex_ctx_free(ctx_c);
+    libp2p_mplex_ctx_free(ctx_s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_remote_close_eof(void)
 {
     libp2p_conn_t dummy = {0};
@@ -913,6 +1382,43 @@ static void test_remote_reset_error(void)
     libp2p_mplex_ctx_free(ctx);
 }
 
+static void test_late_frames_ignored(void)
+{
+    libp2p_conn_t dummy = {0};
+    libp2p_mplex_ctx_t *ctx = libp2p_mplex_ctx_new(&dummy);
+    assert(ctx);
+
+    libp2p_mplex_frame_t fr = {0};
+    fr.id = 10;
+    fr.flag = LIBP2P_MPLEX_NEW_STREAM;
+    assert(libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK);
+    fr.flag = LIBP2P_MPLEX_RESET_INITIATOR;
+    assert(libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK);
+    uint8_t out[1];
+    size_t n = 0;
+    assert(libp2p_mplex_stream_recv(ctx, 10, 0, out, sizeof(out), &n) == LIBP2P_MPLEX_ERR_RESET);
+
+    /* frames racing the reset, or for ids never seen, are dropped */
+    const libp2p_mplex_flag_t flags[] = {LIBP2P_MPLEX_MSG_INITIATOR, LIBP2P_MPLEX_CLOSE_INITIATOR, LIBP2P_MPLEX_RESET_INITIATOR,
+                                               LIBP2P_MPLEX_MSG_RECEIVER, LIBP2P_MPLEX_CLOSE_RECEIVER, LIBP2P_MPLEX_RESET_RECEIVER};
+    int ok = 1;
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+    {
+        int msg = flags[i] == LIBP2P_MPLEX_MSG_INITIATOR || flags[i] == LIBP2P_MPLEX_MSG_RECEIVER;
+        fr.flag = flags[i];
+        fr.data = msg ? (uint8_t *)"x" : NULL;
+        fr.data_len = msg ? 1 : 0;
+        fr.id = 10;
+        ok = ok && libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK;
+        fr.id = 99;
+        ok = ok && libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK;
+    }
+    ok = ok && !atomic_load_explicit(&ctx->stop, memory_order_relaxed) && ctx->streams.len == 0;
+    print_standard("mplex late frames ignored", ok ? "" : "", ok);
+
+    libp2p_mplex_ctx_free(ctx);
+}
+
 static void test_stream_id_limit(void)
 {
     libp2p_conn_t dummy = {0};
@@ -943,10 +1449,7 @@ static void test_duplicate_stream_id(void)
     st->initiator = 1;
     st->name = NULL;
     st->name_len = 0;
-    ctx->streams.items = malloc(sizeof(st));
-    ctx->streams.cap = 1;
-    ctx->streams.items[0] = st;
-    ctx->streams.len = 1;
+    assert(mplex_stream_map_insert(&ctx->streams, st));
 
     libp2p_mplex_frame_t fr = {0};
     fr.id = sid;
@@ -955,17 +1458,8 @@ static void test_duplicate_stream_id(void)
     fr.data_len = 0;
     assert(libp2p_mplex_dispatch_frame(ctx, &fr) == LIBP2P_MPLEX_OK);
 
-    int have_local = 0, have_remote = 0;
-    for (size_t i = 0; i < ctx->streams.len; i++)
-    {
-        if (ctx->streams.items[i]->id == sid)
-        {
-            if (ctx->streams.items[i]->initiator)
-                have_local = 1;
-            else
-                have_remote = 1;
-        }
-    }
+    int have_local = mplex_stream_map_find(&ctx->streams, sid, 1) == st;
+    int have_remote = mplex_stream_map_find(&ctx->streams, sid, 0) != NULL;
     int ok = (ctx->streams.len == 2 && have_local && have_remote);
     print_standard("mplex duplicate stream id", ok ? "" : "", ok);
 
@@ -984,10 +1478,7 @@ static void test_duplicate_stream_id_io(void)
     local->initiator = 1;
     local->name = NULL;
     local->name_len = 0;
-    ctx->streams.items = malloc(sizeof(local));
-    ctx->streams.cap = 1;
-    ctx->streams.items[0] = local;
-    ctx->streams.len = 1;
+    assert(mplex_stream_map_insert(&ctx->streams, local));
 
     libp2p_mplex_frame_t fr = {0};
     fr.id = sid;
@@ -1017,21 +1508,30 @@ int main(void)
     test_negotiate_success();
     test_muxer_wrapper();
     test_frame_roundtrip();
+    test_single_write_encoding();
     test_helper_functions();
     test_header_varint_too_long();
     test_length_varint_too_long();
+    test_streaming_parser();
+    test_ctx_feed();
     test_ctx_dispatch();
     test_stream_recv_buffer();
     test_process_loop();
     test_process_one();
+    test_process_ready();
+    test_recv_timeout();
+    test_recv_reader_handoff();
     test_inbound_stream_queue();
     test_slow_reader_reset();
     test_recv_buffer_limit_reset();
+    test_many_streams();
+    test_backpressure();
     test_remote_close_eof();
     test_data_after_remote_close();
     test_close_payload();
     test_reset_payload();
     test_remote_reset_error();
+    test_late_frames_ignored();
     test_stream_id_limit();
     test_duplicate_stream_id();
     test_duplicate_stream_id_io();
@@ -197,6 +197,156 @@ static void test_reject_missing_header(void)
     libp2p_transport_free(tcp);
 }
 
+static char g_lazy_payload[8] = {0};
+static libp2p_multiselect_err_t g_lazy_listen_rc = LIBP2P_MULTISELECT_OK;
+
+/* Listener side of the lazy tests: negotiate, then read the five bytes the
+ * dialer wrote right behind its proposal. */
+static void *lazy_listen_thread(void *arg)
+{
+    libp2p_conn_t *s = (libp2p_conn_t *)arg;
+    libp2p_multiselect_config_t cfg = libp2p_multiselect_config_default();
+    cfg.handshake_timeout_ms = 2000;
+    g_lazy_listen_rc = libp2p_multiselect_listen(s, g_supported, &cfg, NULL);
+    if (g_lazy_listen_rc != LIBP2P_MULTISELECT_OK)
+        return NULL;
+    size_t got = 0;
+    while (got < 5)
+    {
+        ssize_t n = libp2p_conn_read(s, g_lazy_payload + got, 5 - got);
+        if (n > 0)
+            got += (size_t)n;
+        else if (n != LIBP2P_CONN_ERR_AGAIN)
+            break;
+    }
+    return NULL;
+}
+
+static void test_lazy_dial(void)
+{
+    libp2p_transport_t *tcp = libp2p_tcp_transport_new(NULL);
+    assert(tcp);
+
+    int ma_err;
+    multiaddr_t *addr = multiaddr_new_from_str("/ip4/127.0.0.1/tcp/4013", &ma_err);
+    assert(addr && ma_err == 0);
+
+    libp2p_listener_t *lst = NULL;
+    assert(libp2p_transport_listen(tcp, addr, &lst) == LIBP2P_TRANSPORT_OK);
+
+    /* supported protocol: the payload travels with the proposal */
+    libp2p_conn_t *c = NULL;
+    assert(libp2p_transport_dial(tcp, addr, &c) == LIBP2P_TRANSPORT_OK);
+    libp2p_conn_t *s = NULL;
+    while (libp2p_listener_accept(lst, &s) == LIBP2P_LISTENER_ERR_AGAIN)
+        ;
+    assert(s);
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, lazy_listen_thread, s) == 0);
+    libp2p_multiselect_err_t rc = libp2p_multiselect_dial_lazy(c, "/myproto/1.0.0");
+    assert(rc == LIBP2P_MULTISELECT_OK);
+    conn_write_all(c, (const uint8_t *)"hello", 5);
+    rc = libp2p_multiselect_dial_lazy_confirm(c, "/myproto/1.0.0", 5000);
+    pthread_join(tid, NULL);
+    int ok = rc == LIBP2P_MULTISELECT_OK && g_lazy_listen_rc == LIBP2P_MULTISELECT_OK && memcmp(g_lazy_payload, "hello", 5) == 0;
+    print_standard("multiselect lazy dial confirmed", ok ? "" : "negotiation or payload mismatch", ok);
+
+    libp2p_conn_close(c);
+    libp2p_conn_close(s);
+    libp2p_conn_free(c);
+    libp2p_conn_free(s);
+
+    /* unsupported protocol: the rejection surfaces on confirm */
+    c = NULL;
+    s = NULL;
+    assert(libp2p_transport_dial(tcp, addr, &c) == LIBP2P_TRANSPORT_OK);
+    while (libp2p_listener_accept(lst, &s) == LIBP2P_LISTENER_ERR_AGAIN)
+        ;
+    assert(s);
+
+    assert(pthread_create(&tid, NULL, lazy_listen_thread, s) == 0);
+    assert(libp2p_multiselect_dial_lazy(c, "/missing/1.0.0") == LIBP2P_MULTISELECT_OK);
+    rc = libp2p_multiselect_dial_lazy_confirm(c, "/missing/1.0.0", 5000);
+    libp2p_conn_close(c);
+    pthread_join(tid, NULL);
+    print_standard("multiselect lazy dial rejected", "expected UNAVAIL", rc == LIBP2P_MULTISELECT_ERR_UNAVAIL);
+
+    libp2p_conn_close(s);
+    libp2p_conn_free(c);
+    libp2p_conn_free(s);
+
+    libp2p_listener_close(lst);
+    libp2p_transport_close(tcp);
+    multiaddr_free(addr);
+    libp2p_transport_free(tcp);
+}
+
+static bool prefix_supports(const char *protocol_id, void *arg)
+{
+    const char *prefix = (const char *)arg;
+    return strncmp(protocol_id, prefix, strlen(prefix)) == 0;
+}
+
+static char g_hook_result[64] = {0};
+
+static void *hook_listen_thread(void *arg)
+{
+    libp2p_conn_t *s = (libp2p_conn_t *)arg;
+    libp2p_multiselect_config_t cfg = libp2p_multiselect_config_default();
+    cfg.handshake_timeout_ms = 2000;
+    cfg.supports = prefix_supports;
+    cfg.supports_arg = (void *)"/myproto/";
+    const char *accepted_heap = NULL;
+    if (libp2p_multiselect_listen(s, g_supported, &cfg, &accepted_heap) == LIBP2P_MULTISELECT_OK)
+    {
+        strncpy(g_hook_result, accepted_heap, sizeof(g_hook_result) - 1);
+        free((void *)accepted_heap);
+    }
+    return NULL;
+}
+
+static void test_supports_hook(void)
+{
+    libp2p_transport_t *tcp = libp2p_tcp_transport_new(NULL);
+    assert(tcp);
+
+    int ma_err;
+    multiaddr_t *addr = multiaddr_new_from_str("/ip4/127.0.0.1/tcp/4014", &ma_err);
+    assert(addr && ma_err == 0);
+
+    libp2p_listener_t *lst = NULL;
+    assert(libp2p_transport_listen(tcp, addr, &lst) == LIBP2P_TRANSPORT_OK);
+
+    libp2p_conn_t *c = NULL;
+    assert(libp2p_transport_dial(tcp, addr, &c) == LIBP2P_TRANSPORT_OK);
+    libp2p_conn_t *s = NULL;
+    while (libp2p_listener_accept(lst, &s) == LIBP2P_LISTENER_ERR_AGAIN)
+        ;
+    assert(s);
+
+    /* "/other/1.0.0" is in the static list but the hook replaces it */
+    static const char *const proposals[] = {"/other/1.0.0", "/myproto/2.1.0", NULL};
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, hook_listen_thread, s) == 0);
+    const char *accepted = NULL;
+    libp2p_multiselect_err_t rc = libp2p_multiselect_dial(c, proposals, 5000, &accepted);
+    pthread_join(tid, NULL);
+    int ok = rc == LIBP2P_MULTISELECT_OK && accepted && strcmp(accepted, "/myproto/2.1.0") == 0 &&
+             strcmp(g_hook_result, "/myproto/2.1.0") == 0;
+    print_standard("multiselect listener supports hook", ok ? "" : "hook not consulted", ok);
+
+    libp2p_conn_close(c);
+    libp2p_conn_close(s);
+    libp2p_conn_free(c);
+    libp2p_conn_free(s);
+
+    libp2p_listener_close(lst);
+    libp2p_transport_close(tcp);
+    multiaddr_free(addr);
+    libp2p_transport_free(tcp);
+}
+
 /* ------------------------------------------------------------------------- */
 /*  Main                                                                     */
 /* ------------------------------------------------------------------------- */
@@ -205,5 +355,7 @@ int main(void)
 {
     test_handshake_success();
     test_reject_missing_header();
+    test_lazy_dial();
+    test_supports_hook();
     return 0;
 }
@@ -7,6 +7,7 @@
 
 #include "multiformats/multiaddr/multiaddr.h"
 #include "protocol/tcp/protocol_tcp.h"
+#include "protocol/tcp/protocol_tcp_conn.h"
 #include "transport/connection.h"
 #include "transport/listener.h"
 #include "transport/transport.h"
@@ -137,6 +138,19 @@ static void test_end_to_end(void)
     TEST_OK("Second connection data integrity", n == sizeof(msg2) && memcmp(buf, msg2, sizeof(msg2)) == 0, "read %zd bytes (expected %zu)", n,
             sizeof(msg2));
 
+    /* waiting for data leaves the deadline other users armed alone */
+    libp2p_conn_set_deadline(cli2, 60000);
+    uint64_t armed = atomic_load(&((tcp_conn_ctx_t *)cli2->ctx)->deadline_at);
+    libp2p_conn_err_t wrc = cli2->vt->wait_readable(cli2, 20);
+    TEST_OK("wait_readable times out with nothing to read", wrc == LIBP2P_CONN_ERR_AGAIN, "rc=%d", wrc);
+    (void)libp2p_conn_write(srv2, pong, sizeof(pong));
+    wrc = cli2->vt->wait_readable(cli2, 2000);
+    n = libp2p_conn_read(cli2, buf, sizeof(buf));
+    TEST_OK("wait_readable wakes for data", wrc == LIBP2P_CONN_OK && n == sizeof(pong), "rc=%d read=%zd", wrc, n);
+    uint64_t after = atomic_load(&((tcp_conn_ctx_t *)cli2->ctx)->deadline_at);
+    TEST_OK("wait_readable keeps the connection deadline", after == armed, "deadline %llu -> %llu", (unsigned long long)armed,
+            (unsigned long long)after);
+
     libp2p_conn_close(cli);
     libp2p_conn_close(srv);
     libp2p_conn_close(cli2);
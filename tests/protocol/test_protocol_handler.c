@@ -0,0 +1,1093 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "protocol/mplex/protocol_mplex.h"
+#include "protocol/protocol_handler.h"
+#include "protocol/yamux/protocol_yamux.h"
+#include "protocol/tcp/protocol_tcp_util.h"
+#include "transport/connection.h"
+#include "transport/upgrader.h"
+
+static void print_standard(const char *name, const char *details, int passed)
+{
+    if (passed)
+        printf("TEST: %-50s | PASS\n", name);
+    else
+        printf("TEST: %-50s | FAIL: %s\n", name, details);
+}
+
+/* ---- socketpair connection that honours deadlines like TCP ---- */
+
+typedef struct
+{
+    int fd;
+    _Atomic uint64_t deadline_at; /* 0 = none; monotonic ms */
+} sock_ctx_t;
+
+static ssize_t sock_read(libp2p_conn_t *c, void *buf, size_t len)
+{
+    sock_ctx_t *s = c->ctx;
+    uint64_t deadline_at = atomic_load(&s->deadline_at);
+    uint64_t now = now_mono_ms();
+    if (deadline_at > now)
+    {
+        struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+        if (poll(&pfd, 1, (int)(deadline_at - now)) == 0)
+            return LIBP2P_CONN_ERR_AGAIN;
+    }
+    ssize_t n = read(s->fd, buf, len);
+    if (n > 0)
+        return n;
+    if (n == 0)
+        return LIBP2P_CONN_ERR_EOF;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return LIBP2P_CONN_ERR_AGAIN;
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static ssize_t sock_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    sock_ctx_t *s = c->ctx;
+    /* the peer may already be gone while a session tears down */
+    ssize_t n = send(s->fd, buf, len, MSG_NOSIGNAL);
+    if (n >= 0)
+        return n;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return LIBP2P_CONN_ERR_AGAIN;
+    return LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static libp2p_conn_err_t sock_deadline(libp2p_conn_t *c, uint64_t ms)
+{
+    sock_ctx_t *s = c->ctx;
+    atomic_store(&s->deadline_at, ms ? now_mono_ms() + ms : 0);
+    return LIBP2P_CONN_OK;
+}
+
+static libp2p_conn_err_t sock_wait(libp2p_conn_t *c, uint64_t ms)
+{
+    sock_ctx_t *s = c->ctx;
+    struct pollfd pfd = {.fd = s->fd, .events = POLLIN};
+    int r = poll(&pfd, 1, (int)ms);
+    if (r > 0)
+        return LIBP2P_CONN_OK;
+    return r == 0 || errno == EINTR ? LIBP2P_CONN_ERR_AGAIN : LIBP2P_CONN_ERR_INTERNAL;
+}
+
+static const multiaddr_t *sock_addr(libp2p_conn_t *c)
+{
+    (void)c;
+    return NULL;
+}
+
+/* Only shuts the socket down: a session reader may still be in read() on
+ * it. The descriptor is released by sock_free(). */
+static libp2p_conn_err_t sock_close(libp2p_conn_t *c)
+{
+    sock_ctx_t *s = c->ctx;
+    shutdown(s->fd, SHUT_RDWR);
+    return LIBP2P_CONN_OK;
+}
+
+static void sock_free(libp2p_conn_t *c)
+{
+    sock_ctx_t *s = c->ctx;
+    close(s->fd);
+    free(s);
+}
+
+static const libp2p_conn_vtbl_t SOCK_VTBL = {
+    .read = sock_read,
+    .write = sock_write,
+    .set_deadline = sock_deadline,
+    .wait_readable = sock_wait,
+    .local_addr = sock_addr,
+    .remote_addr = sock_addr,
+    .close = sock_close,
+    .free = sock_free,
+};
+
+/* ---- two handler contexts over one connection ---- */
+
+static uint8_t dialer_key[] = {1, 2, 3};
+static uint8_t listener_key[] = {4, 5, 6};
+static peer_id_t dialer_peer = {dialer_key, sizeof(dialer_key)};
+static peer_id_t listener_peer = {listener_key, sizeof(listener_key)};
+
+typedef struct
+{
+    libp2p_conn_t dconn;
+    libp2p_conn_t lconn;
+    libp2p_uconn_t duconn;
+    libp2p_uconn_t luconn;
+    libp2p_muxer_t *dmux;
+    libp2p_muxer_t *lmux;
+    libp2p_protocol_handler_registry_t *dreg;
+    libp2p_protocol_handler_registry_t *lreg;
+    libp2p_protocol_handler_ctx_t *dctx;
+    libp2p_protocol_handler_ctx_t *lctx;
+} handler_pair_t;
+
+/* Registries are created first so the caller can configure them. */
+static int pair_init(handler_pair_t *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->dreg = libp2p_protocol_handler_registry_new();
+    p->lreg = libp2p_protocol_handler_registry_new();
+    return p->dreg && p->lreg ? 0 : -1;
+}
+
+static int sock_pair(libp2p_conn_t *a, libp2p_conn_t *b)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        return -1;
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+    fcntl(sv[1], F_SETFL, O_NONBLOCK);
+    sock_ctx_t *sa = calloc(1, sizeof(*sa));
+    sock_ctx_t *sb = calloc(1, sizeof(*sb));
+    if (!sa || !sb)
+        return -1;
+    sa->fd = sv[0];
+    sb->fd = sv[1];
+    *a = (libp2p_conn_t){.vt = &SOCK_VTBL, .ctx = sa};
+    *b = (libp2p_conn_t){.vt = &SOCK_VTBL, .ctx = sb};
+    return 0;
+}
+
+/* Without @p dialer_ctx the dialing side runs no session of its own. */
+static int pair_start(handler_pair_t *p, libp2p_muxer_t *(*muxer_new)(void), int dialer_ctx)
+{
+    if (sock_pair(&p->dconn, &p->lconn) != 0)
+        return -1;
+    p->dmux = muxer_new();
+    p->lmux = muxer_new();
+    if (!p->dmux || !p->lmux)
+        return -1;
+    p->duconn = (libp2p_uconn_t){.conn = &p->dconn, .muxer = p->dmux, .remote_peer = &listener_peer, .dialer = true};
+    p->luconn = (libp2p_uconn_t){.conn = &p->lconn, .muxer = p->lmux, .remote_peer = &dialer_peer, .dialer = false};
+    p->lctx = libp2p_protocol_handler_ctx_new(p->lreg, &p->luconn);
+    if (!p->lctx || libp2p_protocol_handler_start(p->lctx) != 0)
+        return -1;
+    if (!dialer_ctx)
+        return 0;
+    p->dctx = libp2p_protocol_handler_ctx_new(p->dreg, &p->duconn);
+    if (!p->dctx || libp2p_protocol_handler_start(p->dctx) != 0)
+        return -1;
+    return 0;
+}
+
+static void pair_free(handler_pair_t *p)
+{
+    if (p->dctx)
+        libp2p_protocol_handler_stop(p->dctx);
+    if (p->lctx)
+        libp2p_protocol_handler_stop(p->lctx);
+    if (p->dconn.vt)
+        libp2p_conn_close(&p->dconn);
+    if (p->lconn.vt)
+        libp2p_conn_close(&p->lconn);
+    libp2p_protocol_handler_ctx_free(p->dctx);
+    libp2p_protocol_handler_ctx_free(p->lctx);
+    libp2p_protocol_handler_registry_free(p->dreg);
+    libp2p_protocol_handler_registry_free(p->lreg);
+    libp2p_muxer_free(p->dmux);
+    libp2p_muxer_free(p->lmux);
+    if (p->dconn.vt)
+        sock_free(&p->dconn);
+    if (p->lconn.vt)
+        sock_free(&p->lconn);
+}
+
+/* ---- handler that holds its stream until the test opens a gate ---- */
+
+typedef struct
+{
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    int entered;
+    int open;
+} gate_t;
+
+static gate_t g_gate = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+
+static void gate_reset(void)
+{
+    pthread_mutex_lock(&g_gate.mtx);
+    g_gate.entered = 0;
+    g_gate.open = 0;
+    pthread_mutex_unlock(&g_gate.mtx);
+}
+
+static void gate_open(void)
+{
+    pthread_mutex_lock(&g_gate.mtx);
+    g_gate.open = 1;
+    pthread_cond_broadcast(&g_gate.cond);
+    pthread_mutex_unlock(&g_gate.mtx);
+}
+
+static int gate_wait_entered(int n)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 5;
+    int ok = 1;
+    pthread_mutex_lock(&g_gate.mtx);
+    while (g_gate.entered < n && ok)
+        ok = pthread_cond_timedwait(&g_gate.cond, &g_gate.mtx, &ts) == 0;
+    ok = g_gate.entered >= n;
+    pthread_mutex_unlock(&g_gate.mtx);
+    return ok;
+}
+
+/* Replies with @p user_data, or "ok" without one. */
+static int gated_handler(libp2p_stream_t *stream, void *user_data)
+{
+    const char *reply = user_data ? user_data : "ok";
+    pthread_mutex_lock(&g_gate.mtx);
+    g_gate.entered++;
+    pthread_cond_broadcast(&g_gate.cond);
+    while (!g_gate.open)
+        pthread_cond_wait(&g_gate.cond, &g_gate.mtx);
+    pthread_mutex_unlock(&g_gate.mtx);
+    libp2p_stream_write(stream, reply, strlen(reply));
+    libp2p_stream_close(stream);
+    return 0;
+}
+
+#define GATE_PROTO "/test/gate/1.0.0"
+
+/* Opens a stream and waits for the listener to accept the protocol. */
+typedef struct
+{
+    libp2p_protocol_handler_ctx_t *ctx;
+    libp2p_stream_t *stream;
+    int rc;
+    pthread_t th;
+} opener_t;
+
+static void *opener_thread(void *arg)
+{
+    opener_t *o = arg;
+    o->rc = libp2p_protocol_handler_open_stream(o->ctx, GATE_PROTO, &o->stream);
+    if (o->rc == 0)
+        o->rc = libp2p_stream_await_protocol(o->stream);
+    return NULL;
+}
+
+static void opener_start(opener_t *o, libp2p_protocol_handler_ctx_t *ctx)
+{
+    memset(o, 0, sizeof(*o));
+    o->ctx = ctx;
+    o->rc = -1;
+    pthread_create(&o->th, NULL, opener_thread, o);
+}
+
+static void opener_finish(opener_t *o)
+{
+    pthread_join(o->th, NULL);
+    if (o->stream)
+    {
+        libp2p_stream_close(o->stream);
+        libp2p_stream_free(o->stream);
+    }
+}
+
+/* Polls the listener's pool until @p pred holds or a few seconds pass. */
+static int stats_wait(libp2p_protocol_handler_registry_t *reg, int (*pred)(const libp2p_protocol_handler_stats_t *),
+                      libp2p_protocol_handler_stats_t *out)
+{
+    uint64_t until = now_mono_ms() + 5000;
+    do
+    {
+        libp2p_protocol_handler_get_stats(reg, out);
+        if (pred(out))
+            return 1;
+        usleep(1000);
+    } while (now_mono_ms() < until);
+    return 0;
+}
+
+static int one_queued_full(const libp2p_protocol_handler_stats_t *s) { return s->queued == 2 && s->rejected == 1; }
+static int three_completed(const libp2p_protocol_handler_stats_t *s) { return s->completed == 3 && s->running == 0; }
+static int one_limited(const libp2p_protocol_handler_stats_t *s) { return s->rejected == 1 && s->running == 1; }
+
+static void test_pool_queue_and_stats(void)
+{
+    handler_pair_t p;
+    char details[128] = "";
+    int ok = pair_init(&p) == 0;
+    gate_reset();
+    ok = ok && libp2p_protocol_handler_set_workers(p.lreg, 1, 2) == 0;
+    ok = ok && libp2p_register_protocol_handler(p.lreg, GATE_PROTO, gated_handler, NULL) == 0;
+    ok = ok && pair_start(&p, libp2p_mplex_new, 1) == 0;
+
+    /* the first stream occupies the only worker */
+    opener_t o[4];
+    opener_start(&o[0], p.dctx);
+    ok = ok && gate_wait_entered(1);
+
+    /* two more fill the queue and the fourth is turned away */
+    for (int i = 1; i < 4; i++)
+        opener_start(&o[i], p.dctx);
+    libp2p_protocol_handler_stats_t st = {0};
+    int queued = ok && stats_wait(p.lreg, one_queued_full, &st);
+    if (!queued)
+        snprintf(details, sizeof(details), "queued=%zu rejected=%llu", st.queued, (unsigned long long)st.rejected);
+    ok = ok && queued && st.workers == 1 && st.running == 1 && st.peak_queued == 2 && st.completed == 0;
+
+    gate_open();
+    int completed = stats_wait(p.lreg, three_completed, &st);
+    if (ok && !completed)
+        snprintf(details, sizeof(details), "completed=%llu", (unsigned long long)st.completed);
+    ok = ok && completed && st.queued == 0 && st.peak_queued == 2 && st.rejected == 1;
+
+    int accepted = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        opener_finish(&o[i]);
+        if (o[i].rc == 0)
+            accepted++;
+    }
+    if (ok && accepted != 3)
+        snprintf(details, sizeof(details), "accepted=%d", accepted);
+    ok = ok && accepted == 3;
+
+    pair_free(&p);
+    print_standard("handler pool queue and stats", details, ok);
+}
+
+static void test_max_concurrent_busy(void)
+{
+    handler_pair_t p;
+    char details[128] = "";
+    int ok = pair_init(&p) == 0;
+    gate_reset();
+    ok = ok && libp2p_register_protocol_handler(p.lreg, GATE_PROTO, gated_handler, NULL) == 0;
+    ok = ok && libp2p_protocol_handler_set_concurrency(p.lreg, GATE_PROTO, 1) == 0;
+    ok = ok && libp2p_protocol_handler_set_concurrency(p.lreg, "/test/none/1.0.0", 1) == LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+    ok = ok && pair_start(&p, libp2p_mplex_new, 1) == 0;
+
+    opener_t first, second;
+    opener_start(&first, p.dctx);
+    ok = ok && gate_wait_entered(1);
+
+    /* a free worker picks the second stream up but the protocol is at its limit */
+    opener_start(&second, p.dctx);
+    pthread_join(second.th, NULL);
+    if (ok && second.rc == 0)
+        snprintf(details, sizeof(details), "second stream was accepted");
+    ok = ok && second.rc != 0;
+
+    /* the reset stream counts as rejected once its worker is done */
+    libp2p_protocol_handler_stats_t st = {0};
+    int limited = stats_wait(p.lreg, one_limited, &st);
+    if (ok && !limited)
+        snprintf(details, sizeof(details), "running=%zu rejected=%llu", st.running, (unsigned long long)st.rejected);
+    ok = ok && limited;
+
+    gate_open();
+    pthread_join(first.th, NULL);
+    if (ok && first.rc != 0)
+        snprintf(details, sizeof(details), "first stream rc=%d", first.rc);
+    ok = ok && first.rc == 0;
+    if (first.stream)
+    {
+        char buf[4] = {0};
+        ssize_t n = libp2p_stream_read(first.stream, buf, sizeof(buf));
+        if (ok && (n != 2 || memcmp(buf, "ok", 2) != 0))
+            snprintf(details, sizeof(details), "handler reply n=%zd", n);
+        ok = ok && n == 2 && memcmp(buf, "ok", 2) == 0;
+        libp2p_stream_close(first.stream);
+        libp2p_stream_free(first.stream);
+    }
+    if (second.stream)
+        libp2p_stream_free(second.stream);
+
+    pair_free(&p);
+    print_standard("handler max_concurrent resets with BUSY", details, ok);
+}
+
+static int one_running(const libp2p_protocol_handler_stats_t *s) { return s->running == 1; }
+static int two_completed(const libp2p_protocol_handler_stats_t *s) { return s->completed == 2 && s->running == 0; }
+
+static void test_unregister_while_running(void)
+{
+    handler_pair_t p;
+    char details[128] = "";
+    char *reply = strdup("late");
+    int ok = reply && pair_init(&p) == 0;
+    gate_reset();
+    ok = ok && libp2p_register_protocol_handler(p.lreg, GATE_PROTO, gated_handler, reply) == 0;
+    ok = ok && pair_start(&p, libp2p_mplex_new, 1) == 0;
+
+    opener_t first;
+    opener_start(&first, p.dctx);
+    libp2p_protocol_handler_stats_t st = {0};
+    ok = ok && gate_wait_entered(1) && stats_wait(p.lreg, one_running, &st);
+    if (!ok)
+        snprintf(details, sizeof(details), "handler did not start");
+
+    /* the grace period waits for lookups, not for running handlers */
+    uint64_t t0 = now_mono_ms();
+    int rc = libp2p_unregister_protocol_handler(p.lreg, GATE_PROTO);
+    uint64_t took = now_mono_ms() - t0;
+    if (ok && (rc != 0 || took > 1000))
+        snprintf(details, sizeof(details), "unregister rc=%d took %llums", rc, (unsigned long long)took);
+    ok = ok && rc == 0 && took <= 1000;
+    ok = ok && !libp2p_protocol_handler_supports(GATE_PROTO, p.lreg);
+    ok = ok && libp2p_unregister_protocol_handler(p.lreg, GATE_PROTO) == LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+
+    /* new streams are refused while the old handler is still running */
+    opener_t second;
+    opener_start(&second, p.dctx);
+    pthread_join(second.th, NULL);
+    if (ok && second.rc == 0)
+        snprintf(details, sizeof(details), "stream accepted after unregister");
+    ok = ok && second.rc != 0;
+    if (second.stream)
+        libp2p_stream_free(second.stream);
+
+    /* the running handler keeps its entry and user data until it returns */
+    gate_open();
+    pthread_join(first.th, NULL);
+    if (ok && first.rc != 0)
+        snprintf(details, sizeof(details), "first stream rc=%d", first.rc);
+    ok = ok && first.rc == 0;
+    if (first.stream)
+    {
+        char buf[8] = {0};
+        ssize_t n = libp2p_stream_read(first.stream, buf, sizeof(buf));
+        if (ok && (n != 4 || memcmp(buf, "late", 4) != 0))
+            snprintf(details, sizeof(details), "handler reply n=%zd", n);
+        ok = ok && n == 4 && memcmp(buf, "late", 4) == 0;
+        libp2p_stream_close(first.stream);
+        libp2p_stream_free(first.stream);
+    }
+    /* the refused stream's worker finishes too */
+    int completed = stats_wait(p.lreg, two_completed, &st);
+    if (ok && !completed)
+        snprintf(details, sizeof(details), "completed=%llu running=%zu", (unsigned long long)st.completed, st.running);
+    ok = ok && completed;
+
+    pair_free(&p);
+    free(reply);
+    print_standard("unregister while a handler runs", details, ok);
+}
+
+/* ---- muxer-independent handler paths ---- */
+
+#define ECHO_PROTO "/test/echo/1.0.0"
+#define UNKNOWN_PROTO "/test/unknown/1.0.0"
+
+static int echo_handler(libp2p_stream_t *stream, void *user_data)
+{
+    (void)user_data;
+    char buf[64];
+    ssize_t n = libp2p_stream_read(stream, buf, sizeof(buf));
+    if (n > 0)
+        libp2p_stream_write(stream, buf, (size_t)n);
+    libp2p_stream_close(stream);
+    return 0;
+}
+
+/* Sends @p msg and expects it back, then the end of the stream. */
+static int echo_roundtrip(libp2p_stream_t *s, const char *msg)
+{
+    size_t len = strlen(msg);
+    if (libp2p_stream_write(s, msg, len) != (ssize_t)len)
+        return 0;
+    char buf[64];
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = libp2p_stream_read(s, buf + got, sizeof(buf) - got);
+        if (n <= 0)
+            return 0;
+        got += (size_t)n;
+    }
+    return got == len && memcmp(buf, msg, len) == 0 && libp2p_stream_read(s, buf, sizeof(buf)) == 0;
+}
+
+static void test_handler_over_muxer(const char *name, libp2p_muxer_t *(*muxer_new)(void))
+{
+    handler_pair_t p;
+    int ok = pair_init(&p) == 0;
+    ok = ok && libp2p_register_protocol_handler(p.lreg, ECHO_PROTO, echo_handler, NULL) == 0;
+    ok = ok && pair_start(&p, muxer_new, 1) == 0;
+
+    /* several streams share the context's session; the first open waits
+     * for the confirmation, later ones know the peer accepts the protocol */
+    for (int i = 0; ok && i < 3; i++)
+    {
+        libp2p_stream_t *s = NULL;
+        ok = libp2p_protocol_handler_open_stream(p.dctx, ECHO_PROTO, &s) == 0;
+        ok = ok && s->negotiation == (i == 0 ? 0 : 1);
+        ok = ok && echo_roundtrip(s, "hello");
+        ok = ok && s->protocol_id && strcmp(s->protocol_id, ECHO_PROTO) == 0;
+        ok = ok && libp2p_stream_remote_peer(s) == &listener_peer;
+        if (s)
+        {
+            libp2p_stream_close(s);
+            libp2p_stream_free(s);
+        }
+    }
+
+    /* an unknown protocol is refused by the open itself */
+    libp2p_stream_t *s = NULL;
+    ok = ok && libp2p_protocol_handler_open_stream(p.dctx, UNKNOWN_PROTO, &s) == LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT && !s;
+
+    /* a stale cache entry opens optimistically and is refused on the first read */
+    libp2p_protocol_support_cache_t *cache = libp2p_protocol_handler_support_cache(p.dreg);
+    libp2p_protocol_support_record(cache, &listener_peer, UNKNOWN_PROTO, 1);
+    ok = ok && libp2p_protocol_handler_open_stream(p.dctx, UNKNOWN_PROTO, &s) == 0 && s->negotiation == 1;
+    ok = ok && libp2p_stream_await_protocol(s) == LIBP2P_PROTOCOL_HANDLER_ERR_MULTISELECT;
+    ok = ok && libp2p_protocol_support_lookup(cache, &listener_peer, UNKNOWN_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    libp2p_stream_free(s);
+
+    pair_free(&p);
+    print_standard(name, "", ok);
+}
+
+static void test_open_stream_owns_session(const char *name, libp2p_muxer_t *(*muxer_new)(void))
+{
+    handler_pair_t p;
+    int ok = pair_init(&p) == 0;
+    ok = ok && libp2p_register_protocol_handler(p.lreg, ECHO_PROTO, echo_handler, NULL) == 0;
+    ok = ok && pair_start(&p, muxer_new, 0) == 0;
+
+    /* the stream brings its own session and ends it when freed */
+    libp2p_stream_t *s = NULL;
+    ok = ok && libp2p_protocol_open_stream(&p.duconn, ECHO_PROTO, &s) == 0;
+    ok = ok && s->session && s->session->ctx;
+    ok = ok && echo_roundtrip(s, "solo");
+    if (s)
+    {
+        libp2p_stream_close(s);
+        libp2p_stream_free(s);
+    }
+
+    pair_free(&p);
+    print_standard(name, "", ok);
+}
+
+/* ---- registry lookups ---- */
+
+static int noop_handler(libp2p_stream_t *stream, void *user_data)
+{
+    (void)user_data;
+    libp2p_stream_close(stream);
+    return 0;
+}
+
+#define HASH_IDS 200
+
+static void test_registry_table(void)
+{
+    libp2p_protocol_handler_registry_t *reg = libp2p_protocol_handler_registry_new();
+    char details[128] = "";
+    char id[64];
+    int ok = reg != NULL;
+
+    /* enough IDs to grow the table several times and collide in it */
+    for (int i = 0; ok && i < HASH_IDS; i++)
+    {
+        snprintf(id, sizeof(id), "/test/hash/%d/1.0.0", i);
+        ok = libp2p_register_protocol_handler(reg, id, noop_handler, NULL) == 0;
+    }
+    ok = ok && libp2p_register_protocol_handler(reg, "/test/hash/7/1.0.0", noop_handler, NULL) == LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_EXISTS;
+    int found = 0;
+    for (int i = 0; i < HASH_IDS; i++)
+    {
+        snprintf(id, sizeof(id), "/test/hash/%d/1.0.0", i);
+        found += libp2p_protocol_handler_supports(id, reg);
+    }
+    if (ok && found != HASH_IDS)
+        snprintf(details, sizeof(details), "found %d of %d", found, HASH_IDS);
+    ok = ok && found == HASH_IDS;
+
+    /* exact entries match the whole ID only */
+    ok = ok && !libp2p_protocol_handler_supports("/test/hash/7", reg);
+    ok = ok && !libp2p_protocol_handler_supports("/test/hash/7/1.0.0/", reg);
+    ok = ok && !libp2p_protocol_handler_supports("/test/hash/200/1.0.0", reg);
+    ok = ok && !libp2p_protocol_handler_supports("", reg);
+
+    /* removing half leaves the other half reachable past the holes */
+    for (int i = 0; ok && i < HASH_IDS; i += 2)
+    {
+        snprintf(id, sizeof(id), "/test/hash/%d/1.0.0", i);
+        ok = libp2p_unregister_protocol_handler(reg, id) == 0;
+    }
+    int wrong = 0;
+    for (int i = 0; i < HASH_IDS; i++)
+    {
+        snprintf(id, sizeof(id), "/test/hash/%d/1.0.0", i);
+        wrong += libp2p_protocol_handler_supports(id, reg) != (i % 2 == 1);
+    }
+    if (ok && wrong)
+        snprintf(details, sizeof(details), "%d lookups wrong after unregister", wrong);
+    ok = ok && wrong == 0;
+    ok = ok && libp2p_unregister_protocol_handler(reg, "/test/hash/0/1.0.0") == LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND;
+
+    libp2p_protocol_handler_registry_free(reg);
+    print_standard("registry hash table lookups", details, ok);
+}
+
+static void test_registry_matchers(void)
+{
+    libp2p_protocol_handler_registry_t *reg = libp2p_protocol_handler_registry_new();
+    char details[128] = "";
+    int ok = reg != NULL;
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/v/", "1.0.0", "2.0.0", noop_handler, NULL) == 0;
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/open/", "1.2", NULL, noop_handler, NULL) == 0;
+    ok = ok && libp2p_register_protocol_prefix_handler(reg, "/p/", noop_handler, NULL) == 0;
+
+    static const struct
+    {
+        const char *id;
+        bool supported;
+    } cases[] = {
+        /* [min, max) edges, missing parts read as 0 */
+        {"/v/1", true},
+        {"/v/1.0.0", true},
+        {"/v/1.9.9", true},
+        {"/v/1.10", true},
+        {"/v/0.9.9", false},
+        {"/v/2", false},
+        {"/v/2.0.0", false},
+        {"/open/1.2", true},
+        {"/open/1.1.9", false},
+        {"/open/4294967295.0.0", true},
+        /* malformed versions */
+        {"/v/", false},
+        {"/v/1.", false},
+        {"/v/1..2", false},
+        {"/v/.1", false},
+        {"/v/1.2.3.4", false},
+        {"/v/1.x", false},
+        {"/v/-1", false},
+        {"/v/1.5 ", false},
+        {"/open/4294967296", false},
+        {"/open/99999999999999999999", false},
+        /* prefixes */
+        {"/p/", true},
+        {"/p/anything/1.0.0", true},
+        {"/p", false},
+        {"/q/x", false},
+    };
+    for (size_t i = 0; ok && i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (libp2p_protocol_handler_supports(cases[i].id, reg) != cases[i].supported)
+        {
+            snprintf(details, sizeof(details), "%s should %sbe supported", cases[i].id, cases[i].supported ? "" : "not ");
+            ok = 0;
+        }
+    }
+
+    /* malformed or empty ranges are refused at registration */
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/r/", "2.0.0", "2.0.0", noop_handler, NULL) == LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/r/", "2.0.0", "1.0.0", noop_handler, NULL) == LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/r/", "1.x", NULL, noop_handler, NULL) == LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/r/", "1.0", "2.", noop_handler, NULL) == LIBP2P_PROTOCOL_HANDLER_ERR_INTERNAL;
+    ok = ok && !libp2p_protocol_handler_supports("/r/1.5", reg);
+    ok = ok && libp2p_register_protocol_version_handler(reg, "/v/", "3", NULL, noop_handler, NULL) == LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_EXISTS;
+
+    /* matchers are removed by the string they were registered under */
+    ok = ok && libp2p_unregister_protocol_handler(reg, "/v/") == 0 && !libp2p_protocol_handler_supports("/v/1.0.0", reg);
+    ok = ok && libp2p_unregister_protocol_handler(reg, "/p/") == 0 && !libp2p_protocol_handler_supports("/p/x", reg);
+    ok = ok && libp2p_protocol_handler_supports("/open/2", reg);
+
+    libp2p_protocol_handler_registry_free(reg);
+    print_standard("registry prefix and version matchers", details, ok);
+}
+
+/* Replies with the tag it was registered with. */
+static int tag_handler(libp2p_stream_t *stream, void *user_data)
+{
+    libp2p_stream_write(stream, user_data, strlen(user_data));
+    libp2p_stream_close(stream);
+    return 0;
+}
+
+/* Opens @p id and returns the tag of the handler that answered it. */
+static int dispatched_to(libp2p_protocol_handler_ctx_t *ctx, const char *id, char *tag, size_t cap)
+{
+    libp2p_stream_t *s = NULL;
+    size_t got = 0;
+    tag[0] = '\0';
+    if (libp2p_protocol_handler_open_stream(ctx, id, &s) != 0)
+        return 0;
+    ssize_t n;
+    while (got < cap - 1 && (n = libp2p_stream_read(s, tag + got, cap - 1 - got)) > 0)
+        got += (size_t)n;
+    tag[got] = '\0';
+    libp2p_stream_close(s);
+    libp2p_stream_free(s);
+    return got > 0;
+}
+
+static void test_registry_precedence(void)
+{
+    handler_pair_t p;
+    char details[128] = "";
+    int ok = pair_init(&p) == 0;
+    ok = ok && libp2p_register_protocol_prefix_handler(p.lreg, "/t/", tag_handler, "short") == 0;
+    ok = ok && libp2p_register_protocol_prefix_handler(p.lreg, "/t/a/", tag_handler, "long") == 0;
+    ok = ok && libp2p_register_protocol_handler(p.lreg, "/t/a/1.0.0", tag_handler, "exact") == 0;
+    ok = ok && libp2p_register_protocol_version_handler(p.lreg, "/t/v/", "1", "2", tag_handler, "version") == 0;
+    ok = ok && pair_start(&p, libp2p_mplex_new, 1) == 0;
+
+    static const struct
+    {
+        const char *id;
+        const char *tag;
+    } cases[] = {
+        {"/t/a/1.0.0", "exact"},   /* exact beats both prefixes */
+        {"/t/a/2.0.0", "long"},    /* longest prefix wins */
+        {"/t/b/1.0.0", "short"},
+        {"/t/v/1.5", "version"},   /* longer than "/t/" */
+        {"/t/v/2.0", "short"},     /* out of range falls through */
+    };
+    char tag[16];
+    for (size_t i = 0; ok && i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        if (!dispatched_to(p.dctx, cases[i].id, tag, sizeof(tag)) || strcmp(tag, cases[i].tag) != 0)
+        {
+            snprintf(details, sizeof(details), "%s went to '%s', want '%s'", cases[i].id, tag, cases[i].tag);
+            ok = 0;
+        }
+    }
+
+    /* dropping the exact entry hands its ID to the longest prefix */
+    ok = ok && libp2p_unregister_protocol_handler(p.lreg, "/t/a/1.0.0") == 0;
+    ok = ok && dispatched_to(p.dctx, "/t/a/1.0.0", tag, sizeof(tag)) && strcmp(tag, "long") == 0;
+
+    pair_free(&p);
+    print_standard("registry exact and longest-match precedence", details, ok);
+}
+
+/* ---- protocol support cache ---- */
+
+static uint8_t other_key[] = {7, 8, 9};
+static peer_id_t other_peer = {other_key, sizeof(other_key)};
+
+static void test_support_cache_lru(void)
+{
+    libp2p_protocol_support_cache_t *c = libp2p_protocol_support_cache_new(2);
+    int ok = c != NULL;
+    libp2p_protocol_support_record(c, &dialer_peer, ECHO_PROTO, 1);
+    libp2p_protocol_support_record(c, &listener_peer, ECHO_PROTO, 1);
+
+    /* a lookup refreshes the dialer, so the listener is evicted */
+    ok = ok && libp2p_protocol_support_lookup(c, &dialer_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+    libp2p_protocol_support_record(c, &other_peer, ECHO_PROTO, 0);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    ok = ok && libp2p_protocol_support_lookup(c, &dialer_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+    ok = ok && libp2p_protocol_support_lookup(c, &other_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    ok = ok && libp2p_protocol_support_lookup(c, &other_peer, UNKNOWN_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+
+    libp2p_protocol_support_forget(c, &dialer_peer);
+    ok = ok && libp2p_protocol_support_lookup(c, &dialer_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    ok = ok && libp2p_protocol_support_lookup(NULL, &dialer_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+
+    libp2p_protocol_support_cache_free(c);
+    print_standard("support cache LRU eviction", "", ok);
+}
+
+#define TEST_TTL_MS 50
+
+static void test_support_cache_ttl(void)
+{
+    libp2p_protocol_support_cache_t *c = libp2p_protocol_support_cache_new(0);
+    int ok = c != NULL;
+    libp2p_protocol_support_set_reject_ttl(c, TEST_TTL_MS);
+
+    /* rejections seen in negotiation expire, acceptances do not */
+    libp2p_protocol_support_record(c, &listener_peer, UNKNOWN_PROTO, 0);
+    libp2p_protocol_support_record(c, &listener_peer, ECHO_PROTO, 1);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, UNKNOWN_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    usleep(2 * TEST_TTL_MS * 1000);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, UNKNOWN_PROTO) == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+
+    /* a later acceptance overrides a rejection */
+    libp2p_protocol_support_record(c, &listener_peer, UNKNOWN_PROTO, 0);
+    libp2p_protocol_support_record(c, &listener_peer, UNKNOWN_PROTO, 1);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, UNKNOWN_PROTO) == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+
+    libp2p_protocol_support_cache_free(c);
+    print_standard("support cache rejection TTL", "", ok);
+}
+
+static void test_support_cache_identify(void)
+{
+    libp2p_protocol_support_cache_t *c = libp2p_protocol_support_cache_new(0);
+    int ok = c != NULL;
+    libp2p_protocol_support_set_reject_ttl(c, TEST_TTL_MS);
+    static const char *const listed[] = {"/a/1.0.0", "/b/1.0.0"};
+
+    /* a complete list rules out everything else, for a while */
+    libp2p_protocol_support_record(c, &listener_peer, "/c/1.0.0", 1);
+    libp2p_protocol_support_set_protocols(c, &listener_peer, listed, 2);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/a/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/c/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    usleep(2 * TEST_TTL_MS * 1000);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/c/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/b/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+
+    /* negotiation outcomes refine the list */
+    libp2p_protocol_support_set_protocols(c, &listener_peer, listed, 2);
+    libp2p_protocol_support_record(c, &listener_peer, "/b/1.0.0", 0);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/b/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    libp2p_protocol_support_record(c, &listener_peer, "/c/1.0.0", 1);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/c/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/d/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+
+    /* a list too long to store proves nothing about absent IDs */
+    static char names[LIBP2P_PROTOCOL_SUPPORT_MAX_IDS + 1][24];
+    const char *many[LIBP2P_PROTOCOL_SUPPORT_MAX_IDS + 1];
+    for (int i = 0; i <= LIBP2P_PROTOCOL_SUPPORT_MAX_IDS; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "/many/%d", i);
+        many[i] = names[i];
+    }
+    libp2p_protocol_support_set_protocols(c, &listener_peer, many, LIBP2P_PROTOCOL_SUPPORT_MAX_IDS + 1);
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/a/1.0.0") == LIBP2P_PROTOCOL_SUPPORT_UNKNOWN;
+    ok = ok && libp2p_protocol_support_lookup(c, &listener_peer, "/many/128") == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+
+    libp2p_protocol_support_cache_free(c);
+    print_standard("support cache identify lists", "", ok);
+}
+
+/* Opens one of @p n numbered missing protocols followed by ECHO_PROTO. */
+static int open_after_missing(libp2p_protocol_handler_ctx_t *ctx, const char *tag, int n, libp2p_stream_t **s)
+{
+    char names[16][32];
+    const char *ids[17];
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(names[i], sizeof(names[i]), "/test/%s/%d", tag, i);
+        ids[i] = names[i];
+    }
+    ids[n] = ECHO_PROTO;
+    return libp2p_protocol_handler_open_stream_any(ctx, ids, (size_t)n + 1, s);
+}
+
+static void test_open_stream_any(void)
+{
+    handler_pair_t p;
+    char details[128] = "";
+    int ok = pair_init(&p) == 0;
+    ok = ok && libp2p_register_protocol_handler(p.lreg, ECHO_PROTO, echo_handler, NULL) == 0;
+    ok = ok && pair_start(&p, libp2p_mplex_new, 1) == 0;
+    libp2p_protocol_support_cache_t *cache = libp2p_protocol_handler_support_cache(p.dreg);
+    libp2p_protocol_support_set_reject_ttl(cache, TEST_TTL_MS);
+
+    /* the listener stops answering after LIBP2P_PROTOCOL_MAX_PROPOSALS */
+    libp2p_stream_t *s = NULL;
+    int rc = open_after_missing(p.dctx, "over", LIBP2P_PROTOCOL_MAX_PROPOSALS, &s);
+    if (ok && (rc == 0 || s))
+        snprintf(details, sizeof(details), "%d proposals accepted", LIBP2P_PROTOCOL_MAX_PROPOSALS + 1);
+    ok = ok && rc != 0 && !s;
+
+    /* falls back on one stream and records every answer */
+    rc = open_after_missing(p.dctx, "under", LIBP2P_PROTOCOL_MAX_PROPOSALS - 1, &s);
+    if (ok && rc != 0)
+        snprintf(details, sizeof(details), "fallback rc=%d", rc);
+    ok = ok && rc == 0 && s && strcmp(s->protocol_id, ECHO_PROTO) == 0 && echo_roundtrip(s, "any");
+    if (s)
+    {
+        libp2p_stream_close(s);
+        libp2p_stream_free(s);
+        s = NULL;
+    }
+    ok = ok && libp2p_protocol_support_lookup(cache, &listener_peer, "/test/under/0") == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    ok = ok && libp2p_protocol_support_lookup(cache, &listener_peer, ECHO_PROTO) == LIBP2P_PROTOCOL_SUPPORT_SUPPORTED;
+
+    /* a known protocol is opened lazily without walking the list */
+    const char *ids[] = {"/test/under/0", ECHO_PROTO};
+    ok = ok && libp2p_protocol_handler_open_stream_any(p.dctx, ids, 2, &s) == 0 && s->negotiation == 1 && echo_roundtrip(s, "lazy");
+    if (s)
+    {
+        libp2p_stream_close(s);
+        libp2p_stream_free(s);
+        s = NULL;
+    }
+
+    /* absence from an identify list holds off retries only until it expires */
+    static const char *const listed[] = {"/test/other/1.0.0"};
+    libp2p_protocol_support_set_protocols(cache, &listener_peer, listed, 1);
+    rc = libp2p_protocol_handler_open_stream_any(p.dctx, ids + 1, 1, &s);
+    if (ok && rc != LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND)
+        snprintf(details, sizeof(details), "unlisted protocol rc=%d", rc);
+    ok = ok && rc == LIBP2P_PROTOCOL_HANDLER_ERR_PROTOCOL_NOT_FOUND && !s;
+    usleep(2 * TEST_TTL_MS * 1000);
+    rc = libp2p_protocol_handler_open_stream_any(p.dctx, ids, 2, &s);
+    if (ok && rc != 0)
+        snprintf(details, sizeof(details), "retry after expiry rc=%d", rc);
+    ok = ok && rc == 0 && s && strcmp(s->protocol_id, ECHO_PROTO) == 0 && echo_roundtrip(s, "again");
+    if (s)
+    {
+        libp2p_stream_close(s);
+        libp2p_stream_free(s);
+    }
+
+    pair_free(&p);
+    print_standard("open_stream_any fallback, cache and proposal cap", details, ok);
+}
+
+static void test_rejected_lazy_open(void)
+{
+    handler_pair_t p;
+    char details[128] = "";
+    int ok = pair_init(&p) == 0;
+    ok = ok && libp2p_register_protocol_handler(p.lreg, ECHO_PROTO, echo_handler, NULL) == 0;
+    ok = ok && pair_start(&p, libp2p_mplex_new, 1) == 0;
+    libp2p_protocol_support_cache_t *cache = libp2p_protocol_handler_support_cache(p.dreg);
+
+    /* a stale cache entry opens lazily; the listener refuses it and also
+     * answers the early message, which races the dialer's reset */
+    libp2p_protocol_support_record(cache, &listener_peer, "/test/gone", 1);
+    libp2p_stream_t *s = NULL;
+    ok = ok && libp2p_protocol_handler_open_stream(p.dctx, "/test/gone", &s) == 0 && s && s->negotiation == 1;
+    if (s)
+    {
+        ok = ok && libp2p_stream_write_lp(s, "/early\n", 7) == 0;
+        char buf[16];
+        ok = ok && libp2p_stream_read(s, buf, sizeof(buf)) < 0 && s->negotiation == -1;
+        libp2p_stream_free(s);
+        s = NULL;
+    }
+    ok = ok && libp2p_protocol_support_lookup(cache, &listener_peer, "/test/gone") == LIBP2P_PROTOCOL_SUPPORT_UNSUPPORTED;
+    usleep(50000);
+
+    /* the connection survives and carries the next stream */
+    int rc = libp2p_protocol_handler_open_stream(p.dctx, ECHO_PROTO, &s);
+    if (ok && rc != 0)
+        snprintf(details, sizeof(details), "open after rejection rc=%d", rc);
+    ok = ok && rc == 0 && s && echo_roundtrip(s, "alive");
+    if (s)
+    {
+        libp2p_stream_close(s);
+        libp2p_stream_free(s);
+    }
+
+    pair_free(&p);
+    print_standard("rejected lazy open keeps the connection", details, ok);
+}
+
+/* ---- yamux through the generic muxer table ---- */
+
+static ssize_t read_full(libp2p_muxer_t *mx, libp2p_stream_t *s, char *buf, size_t len)
+{
+    size_t got = 0;
+    while (got < len)
+    {
+        ssize_t n = mx->vt->stream_read(s, buf + got, len - got);
+        if (n <= 0)
+            return n;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static void test_yamux_vtable_ops(void)
+{
+    libp2p_conn_t dconn = {0}, lconn = {0};
+    libp2p_muxer_t *tmpl = libp2p_yamux_new();
+    libp2p_muxer_t d = {0}, l = {0};
+    int ok = tmpl && sock_pair(&dconn, &lconn) == 0;
+    if (ok)
+    {
+        d.vt = l.vt = tmpl->vt;
+        ok = d.vt->protocol_id && strcmp(d.vt->protocol_id, LIBP2P_YAMUX_PROTO_ID) == 0;
+        ok = ok && d.vt->session_new(&d, &dconn, true) == LIBP2P_MUXER_OK;
+        ok = ok && l.vt->session_new(&l, &lconn, false) == LIBP2P_MUXER_OK;
+    }
+
+    /* open, accept, write and read in both directions */
+    libp2p_stream_t *ds = NULL, *ls = NULL;
+    char buf[16];
+    ok = ok && d.vt->open_stream(&d, NULL, 0, &ds) == LIBP2P_MUXER_OK && ds->initiator == 1;
+    ok = ok && d.vt->stream_write(ds, "ping", 4) == 4;
+    ok = ok && l.vt->accept_stream(&l, &ls) == LIBP2P_MUXER_OK && ls->initiator == 0 && ls->stream_id == ds->stream_id;
+    if (ds)
+        ds->read_timeout_ms = 2000;
+    if (ls)
+        ls->read_timeout_ms = 2000;
+    ok = ok && read_full(&l, ls, buf, 4) == 4 && memcmp(buf, "ping", 4) == 0;
+    ok = ok && l.vt->stream_write(ls, "pong", 4) == 4;
+    ok = ok && read_full(&d, ds, buf, 4) == 4 && memcmp(buf, "pong", 4) == 0;
+
+    /* close is a half-close: the other side reads the end of the stream */
+    if (ok)
+        d.vt->stream_close(ds);
+    ok = ok && l.vt->stream_read(ls, buf, sizeof(buf)) == 0;
+    free(ds);
+    free(ls);
+    ds = ls = NULL;
+
+    /* reset fails the other side's reads */
+    ok = ok && d.vt->open_stream(&d, NULL, 0, &ds) == LIBP2P_MUXER_OK;
+    ok = ok && d.vt->stream_write(ds, "x", 1) == 1;
+    ok = ok && l.vt->accept_stream(&l, &ls) == LIBP2P_MUXER_OK;
+    if (ls)
+        ls->read_timeout_ms = 2000;
+    ok = ok && read_full(&l, ls, buf, 1) == 1;
+    if (ok)
+        d.vt->stream_reset(ds);
+    ok = ok && l.vt->stream_read(ls, buf, sizeof(buf)) < 0;
+    free(ds);
+    free(ls);
+
+    /* a stopped session ends accept */
+    if (l.ctx)
+        l.vt->session_stop(&l);
+    ok = ok && l.vt->accept_stream(&l, &ls) == LIBP2P_MUXER_ERR_EOF;
+
+    if (d.ctx)
+        d.vt->session_free(&d);
+    if (l.ctx)
+        l.vt->session_free(&l);
+    if (dconn.vt)
+    {
+        libp2p_conn_close(&dconn);
+        libp2p_conn_close(&lconn);
+        sock_free(&dconn);
+        sock_free(&lconn);
+    }
+    libp2p_muxer_free(tmpl);
+    print_standard("yamux muxer table open/read/write/close/reset/accept", "", ok);
+}
+
+int main(void)
+{
+    test_registry_table();
+    test_registry_matchers();
+    test_registry_precedence();
+    test_pool_queue_and_stats();
+    test_max_concurrent_busy();
+    test_unregister_while_running();
+    test_handler_over_muxer("handler echo over mplex", libp2p_mplex_new);
+    test_handler_over_muxer("handler echo over yamux", libp2p_yamux_new);
+    test_open_stream_owns_session("open_stream session lifetime over mplex", libp2p_mplex_new);
+    test_open_stream_owns_session("open_stream session lifetime over yamux", libp2p_yamux_new);
+    test_support_cache_lru();
+    test_support_cache_ttl();
+    test_support_cache_identify();
+    test_open_stream_any();
+    test_rejected_lazy_open();
+    test_yamux_vtable_ops();
+    return 0;
+}
@@ -2,10 +2,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <arpa/inet.h>
 
 #ifdef _WIN32
 #include "protocol/tcp/sys/socket.h"
@@ -432,6 +434,180 @@ static void test_stream_id_parity(void)
     libp2p_conn_free(&s);
 }
 
+static void test_late_frame_after_reset(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *srv = libp2p_yamux_ctx_new(&s, 0, YAMUX_INITIAL_WINDOW);
+    assert(srv);
+
+    assert(libp2p_yamux_open_stream(&c, 1, YAMUX_INITIAL_WINDOW) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_process_one(srv) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_stream_reset(srv, 1) == LIBP2P_YAMUX_OK);
+
+    /* data racing the reset is dropped without failing the session */
+    assert(libp2p_yamux_send_msg(&c, 1, (const uint8_t *)"late", 4, 0) == LIBP2P_YAMUX_OK);
+    int ok = (libp2p_yamux_process_one(srv) == LIBP2P_YAMUX_OK && !atomic_load(&srv->stop));
+
+    /* a stream id the peer never opened is still a protocol error */
+    assert(libp2p_yamux_send_msg(&c, 5, (const uint8_t *)"bad", 3, 0) == LIBP2P_YAMUX_OK);
+    ok = ok && (libp2p_yamux_process_one(srv) == LIBP2P_YAMUX_ERR_PROTO_MAL);
+    printf("TEST: yamux late frame after reset %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(srv);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+static void test_process_batch(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *srv = libp2p_yamux_ctx_new(&s, 0, YAMUX_INITIAL_WINDOW);
+    assert(srv);
+
+    assert(libp2p_yamux_open_stream(&c, 1, YAMUX_INITIAL_WINDOW) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_open_stream(&c, 3, YAMUX_INITIAL_WINDOW) == LIBP2P_YAMUX_OK);
+    for (int i = 0; i < 10; i++)
+    {
+        assert(libp2p_yamux_send_msg(&c, 1, (const uint8_t *)"ab", 2, 0) == LIBP2P_YAMUX_OK);
+        assert(libp2p_yamux_send_msg(&c, 3, (const uint8_t *)"cd", 2, 0) == LIBP2P_YAMUX_OK);
+    }
+
+    /* a frame split across reads stays buffered between calls */
+    uint8_t partial[16] = {0, LIBP2P_YAMUX_DATA, 0, 0, 0, 0, 0, 1, 0, 0, 0, 4, 'w', 'x', 'y', 'z'};
+    assert(libp2p_conn_write(&c, partial, 14) == 14);
+
+    size_t frames = 0;
+    libp2p_yamux_err_t rc = libp2p_yamux_process_batch(srv, &frames);
+    int ok = (rc == LIBP2P_YAMUX_OK && frames == 22);
+
+    uint8_t buf[64];
+    size_t n = 0;
+    ok = ok && libp2p_yamux_stream_recv(srv, 1, buf, sizeof(buf), &n) == LIBP2P_YAMUX_OK && n == 20 &&
+         memcmp(buf, "abababababababababab", 20) == 0;
+    ok = ok && libp2p_yamux_stream_recv(srv, 3, buf, sizeof(buf), &n) == LIBP2P_YAMUX_OK && n == 20 && buf[19] == 'd';
+
+    assert(libp2p_conn_write(&c, partial + 14, 2) == 2);
+    ok = ok && libp2p_yamux_process_one(srv) == LIBP2P_YAMUX_OK;
+    ok = ok && libp2p_yamux_stream_recv(srv, 1, buf, sizeof(buf), &n) == LIBP2P_YAMUX_OK && n == 4 && memcmp(buf, "wxyz", 4) == 0;
+    printf("TEST: yamux batched dispatch %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(srv);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+static void test_memory_budget(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *srv = libp2p_yamux_ctx_new(&s, 0, YAMUX_INITIAL_WINDOW);
+    assert(srv);
+    assert(libp2p_yamux_set_memory_limit(srv, 8) == LIBP2P_YAMUX_OK);
+
+    assert(libp2p_yamux_open_stream(&c, 1, YAMUX_INITIAL_WINDOW) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_send_msg(&c, 1, (const uint8_t *)"0123456789abcdef", 16, 0) == LIBP2P_YAMUX_OK);
+    size_t frames = 0;
+    while (frames < 2)
+    {
+        size_t n = 0;
+        assert(libp2p_yamux_process_batch(srv, &n) == LIBP2P_YAMUX_OK);
+        frames += n;
+    }
+
+    size_t used = 0;
+    assert(libp2p_yamux_get_memory_usage(srv, &used) == LIBP2P_YAMUX_OK);
+    int ok = (used == 16 && libp2p_yamux_process_memory_usage() >= 16);
+
+    /* the server acknowledges the stream with its first data */
+    libp2p_yamux_frame_t fr = {0};
+    ok = ok && libp2p_yamux_read_frame(&c, &fr) == LIBP2P_YAMUX_OK && (fr.flags & LIBP2P_YAMUX_ACK);
+    libp2p_yamux_frame_free(&fr);
+
+    /* still over budget after the first read: credit is withheld */
+    uint8_t buf[16];
+    size_t n = 0;
+    ok = ok && libp2p_yamux_stream_recv(srv, 1, buf, 4, &n) == LIBP2P_YAMUX_OK && n == 4;
+    uint8_t probe;
+    ok = ok && libp2p_conn_read(&c, &probe, 1) == LIBP2P_CONN_ERR_AGAIN;
+
+    /* back under budget: withheld and new credit are returned together */
+    ok = ok && libp2p_yamux_stream_recv(srv, 1, buf, 8, &n) == LIBP2P_YAMUX_OK && n == 8;
+    ok = ok && libp2p_yamux_read_frame(&c, &fr) == LIBP2P_YAMUX_OK && fr.type == LIBP2P_YAMUX_WINDOW_UPDATE && fr.length == 12;
+    libp2p_yamux_frame_free(&fr);
+
+    ok = ok && libp2p_yamux_stream_recv(srv, 1, buf, sizeof(buf), &n) == LIBP2P_YAMUX_OK && n == 4;
+    ok = ok && libp2p_yamux_get_memory_usage(srv, &used) == LIBP2P_YAMUX_OK && used == 0;
+    printf("TEST: yamux memory budget %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(srv);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+static void test_recv_buffer_reuse(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *srv = libp2p_yamux_ctx_new(&s, 0, YAMUX_INITIAL_WINDOW);
+    assert(srv);
+    libp2p_yamux_frame_t fr = {
+        .version = 0,
+        .type = LIBP2P_YAMUX_DATA,
+        .flags = LIBP2P_YAMUX_SYN,
+        .stream_id = 1,
+        .length = 10,
+        .data = (uint8_t *)"0123456789",
+        .data_len = 10,
+    };
+    assert(libp2p_yamux_dispatch_frame(srv, &fr) == LIBP2P_YAMUX_OK);
+
+    /* a partial read leaves room at the tail: no compaction on append */
+    uint8_t buf[4];
+    size_t n = 0;
+    assert(libp2p_yamux_stream_recv(srv, 1, buf, sizeof(buf), &n) == LIBP2P_YAMUX_OK && n == 4);
+    fr.flags = 0;
+    assert(libp2p_yamux_dispatch_frame(srv, &fr) == LIBP2P_YAMUX_OK);
+    pthread_mutex_lock(&srv->mtx);
+    libp2p_yamux_stream_t *st = srv->streams[0];
+    int ok = st->buf_pos == 4 && st->buf_len == 20;
+    pthread_mutex_unlock(&srv->mtx);
+
+    /* a large drained buffer is released instead of kept at full size */
+    size_t big = 128 * 1024;
+    uint8_t *data = calloc(1, big);
+    assert(data);
+    fr.length = (uint32_t)big;
+    fr.data = data;
+    fr.data_len = big;
+    assert(libp2p_yamux_dispatch_frame(srv, &fr) == LIBP2P_YAMUX_OK);
+    size_t total = 0;
+    while (total < 16 + big && libp2p_yamux_stream_recv(srv, 1, data, big, &n) == LIBP2P_YAMUX_OK)
+        total += n;
+    pthread_mutex_lock(&srv->mtx);
+    ok = ok && total == 16 + big && st->buf == NULL && st->buf_cap == 0 && srv->mem_used == 0;
+    pthread_mutex_unlock(&srv->mtx);
+    free(data);
+    printf("TEST: yamux recv buffer reuse %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(srv);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_window_update(void)
 {
     libp2p_conn_t c = {0}, s = {0};
@@ -519,6 +695,52 @@ static void test_ping_callback(void)
     libp2p_conn_free(&s);
 }
 
+static void test_ping_rtt_stats(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    assert(ctx);
+
+    libp2p_yamux_rtt_t rtt = {0};
+    assert(libp2p_yamux_get_rtt(ctx, &rtt) == LIBP2P_YAMUX_OK);
+    int ok = (rtt.samples == 0);
+
+    /* more pings than ring slots: a colliding ping is refused and the
+     * unanswered one keeps its send time */
+    for (uint32_t v = 0; v < LIBP2P_YAMUX_PING_SLOTS; v++)
+    {
+        assert(libp2p_yamux_ctx_ping(ctx, v) == LIBP2P_YAMUX_OK);
+        libp2p_yamux_frame_t fr = {0};
+        assert(libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK);
+        libp2p_yamux_frame_free(&fr);
+    }
+    uint64_t first_sent = ctx->pings[0].sent_us;
+    usleep(1000);
+    for (uint32_t v = LIBP2P_YAMUX_PING_SLOTS; v < LIBP2P_YAMUX_PING_SLOTS + 4; v++)
+        ok = ok && (libp2p_yamux_ctx_ping(ctx, v) == LIBP2P_YAMUX_ERR_AGAIN);
+    ok = ok && (ctx->num_pings == LIBP2P_YAMUX_PING_SLOTS && ctx->pings[0].value == 0 && ctx->pings[0].sent_us == first_sent);
+
+    usleep(2000);
+    for (uint32_t v = 0; v < LIBP2P_YAMUX_PING_SLOTS; v++)
+    {
+        assert(libp2p_yamux_ping(&s, v, LIBP2P_YAMUX_ACK) == LIBP2P_YAMUX_OK);
+        assert(libp2p_yamux_process_one(ctx) == LIBP2P_YAMUX_OK);
+    }
+
+    assert(libp2p_yamux_get_rtt(ctx, &rtt) == LIBP2P_YAMUX_OK);
+    ok = ok && (ctx->num_pings == 0 && rtt.samples == LIBP2P_YAMUX_PING_SLOTS && rtt.min_rtt_us >= 1000 &&
+                rtt.min_rtt_us <= rtt.srtt_us && rtt.last_rtt_us >= rtt.min_rtt_us);
+    printf("TEST: yamux ping rtt stats %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(ctx);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_ping_bad_flags(void)
 {
     libp2p_conn_t c = {0}, s = {0};
@@ -616,6 +838,31 @@ static void test_open_after_stop(void)
     libp2p_conn_free(&s);
 }
 
+static void test_open_write_failure(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    assert(ctx);
+
+    /* the SYN cannot be written: the stream is rolled back, and so is the
+     * next open whose SYN the failed scheduler refuses to queue */
+    libp2p_conn_close(&s);
+    uint32_t id = 0;
+    libp2p_yamux_err_t rc1 = libp2p_yamux_stream_open(ctx, &id);
+    libp2p_yamux_err_t rc2 = libp2p_yamux_stream_open(ctx, &id);
+    pthread_mutex_lock(&ctx->mtx);
+    int ok = rc1 != LIBP2P_YAMUX_OK && rc2 != LIBP2P_YAMUX_OK && id == 0 && ctx->num_streams == 0 && ctx->ack_backlog == 0;
+    pthread_mutex_unlock(&ctx->mtx);
+    printf("TEST: yamux open write failure %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(ctx);
+    libp2p_conn_close(&c);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_ctx_free_go_away(void)
 {
     libp2p_conn_t c = {0}, s = {0};
@@ -695,6 +942,66 @@ static void test_send_window(void)
     libp2p_conn_free(&s);
 }
 
+static void *window_update_thread(void *arg)
+{
+    libp2p_yamux_ctx_t *ctx = arg;
+    usleep(20000);
+    libp2p_yamux_frame_t fr = {
+        .version = 0,
+        .type = LIBP2P_YAMUX_WINDOW_UPDATE,
+        .flags = 0,
+        .stream_id = 1,
+        .length = 3,
+        .data = NULL,
+        .data_len = 0,
+    };
+    assert(libp2p_yamux_dispatch_frame(ctx, &fr) == LIBP2P_YAMUX_OK);
+    return NULL;
+}
+
+static void test_send_window_wait(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    assert(ctx);
+    uint32_t id = 0;
+    assert(libp2p_yamux_stream_open(ctx, &id) == LIBP2P_YAMUX_OK && id == 1);
+    libp2p_yamux_frame_t fr = {0};
+    assert(libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK);
+    libp2p_yamux_frame_free(&fr);
+
+    pthread_mutex_lock(&ctx->mtx);
+    ctx->streams[0]->send_window = 1;
+    pthread_mutex_unlock(&ctx->mtx);
+
+    /* what fits goes out, then the closed window times out */
+    uint8_t buf[4] = {1, 2, 3, 4};
+    size_t sent = 0;
+    int ok = libp2p_yamux_stream_send_timeout(ctx, id, buf, sizeof(buf), &sent, 50) == LIBP2P_YAMUX_ERR_TIMEOUT && sent == 1;
+
+    /* a window update wakes the waiting sender */
+    pthread_t th;
+    pthread_create(&th, NULL, window_update_thread, ctx);
+    ok = ok && libp2p_yamux_stream_send_timeout(ctx, id, buf + 1, 3, &sent, 2000) == LIBP2P_YAMUX_OK && sent == 3;
+    pthread_join(th, NULL);
+
+    const size_t expect_len[] = {1, 3};
+    for (size_t i = 0; i < 2; i++)
+    {
+        ok = ok && libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK && fr.data_len == expect_len[i] && fr.data[0] == (uint8_t)(i + 1);
+        libp2p_yamux_frame_free(&fr);
+    }
+    printf("TEST: yamux send waits for window %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(ctx);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_recv_window_update(void)
 {
     libp2p_conn_t c = {0}, s = {0};
@@ -872,6 +1179,54 @@ static void test_keepalive(void)
     libp2p_conn_free(&s);
 }
 
+static void test_ping_timeout(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    assert(ctx);
+
+    /* the peer never answers, so the first keepalive ping must time out */
+    assert(libp2p_yamux_set_ping_timeout(ctx, 50) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_enable_keepalive(ctx, 20) == LIBP2P_YAMUX_OK);
+    for (int i = 0; i < 100 && !atomic_load(&ctx->stop); i++)
+        usleep(10000);
+    int ok = atomic_load(&ctx->stop);
+
+    libp2p_yamux_ctx_free(ctx);
+    ok = ok && (ytimer_count() == 0);
+    printf("TEST: yamux ping timeout %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+static void test_idle_timeout(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    assert(ctx);
+    assert(libp2p_yamux_set_idle_timeout(ctx, 30) == LIBP2P_YAMUX_OK);
+    for (int i = 0; i < 100 && !atomic_load(&ctx->stop); i++)
+        usleep(10000);
+
+    libp2p_yamux_frame_t fr = {0};
+    libp2p_yamux_err_t rc = libp2p_yamux_read_frame(&s, &fr);
+    int ok = (rc == LIBP2P_YAMUX_OK && fr.type == LIBP2P_YAMUX_GO_AWAY && fr.length == LIBP2P_YAMUX_GOAWAY_OK);
+    printf("TEST: yamux idle timeout %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_frame_free(&fr);
+    libp2p_yamux_ctx_free(ctx);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 static void test_recv_go_away(void)
 {
     libp2p_conn_t c = {0}, s = {0};
@@ -897,30 +1252,265 @@ static void test_recv_go_away(void)
     libp2p_conn_free(&s);
 }
 
+static void test_reader_mode(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *cli = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    libp2p_yamux_ctx_t *srv = libp2p_yamux_ctx_new(&s, 0, YAMUX_INITIAL_WINDOW);
+    assert(cli && srv);
+    assert(libp2p_yamux_start_reader(cli) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_start_reader(srv) == LIBP2P_YAMUX_OK);
+
+    libp2p_yamux_stream_t *st = NULL;
+    int ok = (libp2p_yamux_accept_stream_timeout(srv, &st, 20) == LIBP2P_YAMUX_ERR_TIMEOUT);
+
+    uint32_t id = 0;
+    assert(libp2p_yamux_stream_open(cli, &id) == LIBP2P_YAMUX_OK);
+    ok = ok && (libp2p_yamux_accept_stream_timeout(srv, &st, 1000) == LIBP2P_YAMUX_OK && st && st->id == id);
+
+    uint8_t rbuf[16];
+    size_t n = 0;
+    ok = ok && (libp2p_yamux_stream_recv_timeout(srv, id, rbuf, sizeof(rbuf), &n, 20) == LIBP2P_YAMUX_ERR_TIMEOUT && n == 0);
+
+    const char *msg = "wake";
+    assert(libp2p_yamux_stream_send(cli, id, (const uint8_t *)msg, 4, 0) == LIBP2P_YAMUX_OK);
+    ok = ok && (libp2p_yamux_stream_recv_timeout(srv, id, rbuf, sizeof(rbuf), &n, 1000) == LIBP2P_YAMUX_OK && n == 4 &&
+                memcmp(rbuf, msg, 4) == 0);
+
+    assert(libp2p_yamux_stream_close(cli, id) == LIBP2P_YAMUX_OK);
+    ok = ok && (libp2p_yamux_stream_recv_timeout(srv, id, rbuf, sizeof(rbuf), &n, 1000) == LIBP2P_YAMUX_ERR_EOF);
+
+    printf("TEST: yamux reader mode %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(cli);
+    libp2p_yamux_ctx_free(srv);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+static void test_reader_keepalive(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    libp2p_yamux_ctx_t *cli = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    libp2p_yamux_ctx_t *srv = libp2p_yamux_ctx_new(&s, 0, YAMUX_INITIAL_WINDOW);
+    assert(cli && srv);
+    assert(libp2p_yamux_start_reader(cli) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_start_reader(srv) == LIBP2P_YAMUX_OK);
+
+    /* the timer hands keepalives to the reader, which sends them and
+     * reads the answers before the ping timeout fires */
+    assert(libp2p_yamux_set_ping_timeout(cli, 500) == LIBP2P_YAMUX_OK);
+    assert(libp2p_yamux_enable_keepalive(cli, 20) == LIBP2P_YAMUX_OK);
+    uint64_t samples = 0;
+    for (int i = 0; i < 100 && samples < 2; i++)
+    {
+        usleep(10000);
+        pthread_mutex_lock(&cli->mtx);
+        samples = cli->rtt.samples;
+        pthread_mutex_unlock(&cli->mtx);
+    }
+    int ok = samples >= 2 && !atomic_load(&cli->stop);
+    printf("TEST: yamux reader keepalive %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(cli);
+    libp2p_yamux_ctx_free(srv);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+static yamux_send_entry_t *sched_entry(libp2p_yamux_type_t type, uint32_t id, size_t payload_len)
+{
+    uint8_t hdr[12] = {0};
+    hdr[1] = (uint8_t)type;
+    uint32_t sid = htonl(id);
+    memcpy(hdr + 4, &sid, 4);
+    uint32_t len = htonl((uint32_t)payload_len);
+    memcpy(hdr + 8, &len, 4);
+    uint8_t *payload = calloc(1, payload_len ? payload_len : 1);
+    assert(payload);
+    yamux_send_entry_t *e = ys_entry_new(hdr, payload, payload_len);
+    free(payload);
+    assert(e);
+    return e;
+}
+
+static void test_send_scheduler(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    yamux_send_sched_t sched;
+    ys_init(&sched);
+
+    /* three quantum-sized frames on stream 1, then a small one on stream 3 */
+    yamux_send_entry_t *bulk = sched_entry(LIBP2P_YAMUX_DATA, 1, YAMUX_SCHED_QUANTUM);
+    bulk->next = sched_entry(LIBP2P_YAMUX_DATA, 1, YAMUX_SCHED_QUANTUM);
+    bulk->next->next = sched_entry(LIBP2P_YAMUX_DATA, 1, YAMUX_SCHED_QUANTUM);
+    assert(ys_push(&sched, bulk, 1, 1) == LIBP2P_CONN_OK);
+    assert(ys_push(&sched, sched_entry(LIBP2P_YAMUX_DATA, 3, 10), 3, 1) == LIBP2P_CONN_OK);
+    assert(ys_push(&sched, sched_entry(LIBP2P_YAMUX_PING, 0, 0), YAMUX_SCHED_CONTROL, 0) == LIBP2P_CONN_OK);
+    assert(ys_flush(&sched, &c) == LIBP2P_CONN_OK);
+
+    const uint32_t expect_id[] = {0, 1, 3, 1, 1};
+    int ok = (ys_pending(&sched) == 0);
+    for (size_t i = 0; i < sizeof(expect_id) / sizeof(expect_id[0]); i++)
+    {
+        libp2p_yamux_frame_t fr = {0};
+        ok = ok && (libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK && fr.stream_id == expect_id[i]);
+        libp2p_yamux_frame_free(&fr);
+    }
+    ys_free(&sched);
+
+    /* large sends are split into quantum-sized frames with FIN on the last */
+    libp2p_yamux_ctx_t *ctx = libp2p_yamux_ctx_new(&c, 1, YAMUX_INITIAL_WINDOW);
+    assert(ctx);
+    uint32_t id = 0;
+    assert(libp2p_yamux_stream_open(ctx, &id) == LIBP2P_YAMUX_OK);
+    libp2p_yamux_frame_t fr = {0};
+    assert(libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK);
+    libp2p_yamux_frame_free(&fr);
+
+    size_t big = YAMUX_SCHED_QUANTUM * 2 + 100;
+    uint8_t *data = calloc(1, big);
+    assert(data);
+    assert(libp2p_yamux_stream_send(ctx, id, data, big, LIBP2P_YAMUX_FIN) == LIBP2P_YAMUX_OK);
+    const size_t expect_len[] = {YAMUX_SCHED_QUANTUM, YAMUX_SCHED_QUANTUM, 100};
+    for (size_t i = 0; i < 3; i++)
+    {
+        assert(libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK);
+        int fin = (fr.flags & LIBP2P_YAMUX_FIN) != 0;
+        ok = ok && fr.data_len == expect_len[i] && fin == (i == 2);
+        libp2p_yamux_frame_free(&fr);
+    }
+    free(data);
+    printf("TEST: yamux send scheduler %s\n", ok ? "PASS" : "FAIL");
+
+    libp2p_yamux_ctx_free(ctx);
+    libp2p_conn_close(&c);
+    libp2p_conn_close(&s);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
+typedef struct
+{
+    yamux_send_sched_t *sched;
+    libp2p_conn_t *conn;
+    uint32_t push_flow;
+    atomic_int done;
+    libp2p_conn_err_t rc;
+} flush_arg_t;
+
+static void *flush_thread(void *arg)
+{
+    flush_arg_t *fa = arg;
+    if (fa->push_flow)
+        assert(ys_push(fa->sched, sched_entry(LIBP2P_YAMUX_DATA, fa->push_flow, 10), fa->push_flow, 1) == LIBP2P_CONN_OK);
+    fa->rc = ys_flush(fa->sched, fa->conn);
+    atomic_store(&fa->done, 1);
+    return NULL;
+}
+
+static void test_send_backpressure(void)
+{
+    libp2p_conn_t c = {0}, s = {0};
+    make_pipe_pair(&c, &s);
+
+    yamux_send_sched_t sched;
+    ys_init(&sched);
+
+    /* eight quanta on stream 1 overflow the pipe; a reader flush only sends
+     * the ping and the header-only RST queued on stream 3 */
+    yamux_send_entry_t *bulk = NULL;
+    for (int i = 0; i < 8; i++)
+    {
+        yamux_send_entry_t *e = sched_entry(LIBP2P_YAMUX_DATA, 1, YAMUX_SCHED_QUANTUM);
+        e->next = bulk;
+        bulk = e;
+    }
+    assert(ys_push(&sched, bulk, 1, 1) == LIBP2P_CONN_OK);
+    assert(ys_push(&sched, sched_entry(LIBP2P_YAMUX_DATA, 3, 0), 3, 1) == LIBP2P_CONN_OK);
+    assert(ys_push(&sched, sched_entry(LIBP2P_YAMUX_PING, 0, 0), YAMUX_SCHED_CONTROL, 0) == LIBP2P_CONN_OK);
+    assert(ys_flush_control(&sched, &c) == LIBP2P_CONN_OK);
+    int ok = ys_pending(&sched) == 8 * (12 + YAMUX_SCHED_QUANTUM);
+    const uint32_t expect_id[] = {0, 3};
+    for (size_t i = 0; i < 2; i++)
+    {
+        libp2p_yamux_frame_t fr = {0};
+        ok = ok && (libp2p_yamux_read_frame(&s, &fr) == LIBP2P_YAMUX_OK && fr.stream_id == expect_id[i]);
+        libp2p_yamux_frame_free(&fr);
+    }
+
+    /* nobody reads: the writer keeps waiting past the stall limit */
+    flush_arg_t writer = {.sched = &sched, .conn = &c, .push_flow = 0, .done = 0, .rc = LIBP2P_CONN_OK};
+    pthread_t wth;
+    pthread_create(&wth, NULL, flush_thread, &writer);
+    usleep((YAMUX_SCHED_STALL_MS + 100) * 1000);
+    ok = ok && !atomic_load(&writer.done);
+
+    /* a sender queued behind the writer hears about the loss */
+    flush_arg_t joiner = {.sched = &sched, .conn = &c, .push_flow = 5, .done = 0, .rc = LIBP2P_CONN_OK};
+    pthread_t jth;
+    pthread_create(&jth, NULL, flush_thread, &joiner);
+    usleep(20000);
+    ok = ok && !atomic_load(&joiner.done);
+    libp2p_conn_close(&s);
+    pthread_join(wth, NULL);
+    pthread_join(jth, NULL);
+    ok = ok && writer.rc != LIBP2P_CONN_OK && joiner.rc == writer.rc && ys_pending(&sched) == 0;
+    printf("TEST: yamux send backpressure %s\n", ok ? "PASS" : "FAIL");
+
+    ys_free(&sched);
+    libp2p_conn_close(&c);
+    libp2p_conn_free(&c);
+    libp2p_conn_free(&s);
+}
+
 int main(void)
 {
+#ifndef _WIN32
+    /* pipes have no MSG_NOSIGNAL; a reply racing teardown must not kill the run */
+    signal(SIGPIPE, SIG_IGN);
+#endif
     test_negotiate();
     test_muxer_wrapper();
     test_frame_roundtrip();
     test_invalid_version();
     test_stream_id_zero();
     test_stream_id_parity();
+    test_late_frame_after_reset();
     test_window_update();
     test_ping_pong();
     test_ping_callback();
+    test_ping_rtt_stats();
     test_ping_bad_flags();
     test_go_away();
     test_stop_go_away();
     test_open_after_stop();
+    test_open_write_failure();
     test_ctx_free_go_away();
     test_go_away_flags();
     test_send_window();
+    test_send_window_wait();
     test_recv_window_update();
     test_initial_window_syn();
     test_initial_window_ack();
     test_delayed_ack();
     test_keepalive();
+    test_ping_timeout();
+    test_idle_timeout();
     test_large_frame();
     test_recv_go_away();
+    test_reader_mode();
+    test_reader_keepalive();
+    test_send_scheduler();
+    test_send_backpressure();
+    test_process_batch();
+    test_memory_budget();
+    test_recv_buffer_reuse();
     return 0;
 }
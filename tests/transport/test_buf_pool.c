@@ -0,0 +1,218 @@
+#include "transport/buf_pool.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Simple test helper output */
+static void print_standard(const char *name, const char *details, int passed)
+{
+    if (passed)
+        printf("TEST: %-70s | PASS\n", name);
+    else
+        printf("TEST: %-70s | FAIL: %s\n", name, details);
+}
+
+static int failures = 0;
+
+#define TEST_OK(name, cond, fmt, ...)                                                                                                                \
+    do                                                                                                                                               \
+    {                                                                                                                                                \
+        if (cond)                                                                                                                                    \
+            print_standard(name, "", 1);                                                                                                             \
+        else                                                                                                                                         \
+        {                                                                                                                                            \
+            char _d[256];                                                                                                                            \
+            snprintf(_d, sizeof(_d), fmt, ##__VA_ARGS__);                                                                                            \
+            print_standard(name, _d, 0);                                                                                                             \
+            failures++;                                                                                                                              \
+        }                                                                                                                                            \
+    } while (0)
+
+static libp2p_buf_pool_stats_t stats(void)
+{
+    libp2p_buf_pool_stats_t st;
+    libp2p_buf_pool_get_stats(&st);
+    return st;
+}
+
+/* Each scenario runs on its own thread so it starts with an empty cache. */
+static void run_in_thread(void *(*fn)(void *))
+{
+    pthread_t th;
+    if (pthread_create(&th, NULL, fn, NULL) != 0)
+    {
+        print_standard("pthread_create", "failed", 0);
+        failures++;
+        return;
+    }
+    pthread_join(th, NULL);
+}
+
+static void *size_classes_thread(void *arg)
+{
+    (void)arg;
+    static const struct
+    {
+        size_t size;
+        size_t cap;
+    } cases[] = {
+        {0, 256}, {1, 256}, {256, 256}, {257, 512}, {4096, 4096}, {4097, 8192}, {65535, 65536}, {65536, 65536},
+    };
+    size_t n = sizeof(cases) / sizeof(cases[0]);
+    uint8_t *bufs[sizeof(cases) / sizeof(cases[0])];
+    int ok = 1, aligned = 1;
+    char bad[64] = "";
+    for (size_t i = 0; i < n; i++)
+    {
+        bufs[i] = libp2p_buf_alloc(cases[i].size);
+        if (!bufs[i] || libp2p_buf_capacity(bufs[i]) != cases[i].cap)
+        {
+            if (ok)
+                snprintf(bad, sizeof(bad), "size %zu -> cap %zu", cases[i].size, bufs[i] ? libp2p_buf_capacity(bufs[i]) : 0);
+            ok = 0;
+        }
+        else
+        {
+            memset(bufs[i], 0xab, cases[i].cap);
+            if ((uintptr_t)bufs[i] % 16)
+                aligned = 0;
+        }
+    }
+    TEST_OK("sizes round up to power-of-two classes", ok, "%s", bad);
+    TEST_OK("pooled buffers are 16-byte aligned", aligned, "misaligned payload");
+    TEST_OK("capacity of NULL is zero", libp2p_buf_capacity(NULL) == 0, "non-zero");
+    for (size_t i = 0; i < n; i++)
+        libp2p_buf_release(bufs[i]);
+
+    libp2p_buf_pool_stats_t before = stats();
+    uint8_t *big = libp2p_buf_alloc(LIBP2P_BUF_MAX_SIZE + 1);
+    libp2p_buf_pool_stats_t after = stats();
+    TEST_OK("oversized request gets its exact size", big && libp2p_buf_capacity(big) == LIBP2P_BUF_MAX_SIZE + 1, "cap %zu",
+            libp2p_buf_capacity(big));
+    TEST_OK("oversized request is counted", after.oversized == before.oversized + 1 && after.misses == before.misses, "oversized +%llu misses +%llu",
+            (unsigned long long)(after.oversized - before.oversized), (unsigned long long)(after.misses - before.misses));
+    libp2p_buf_release(big);
+    after = stats();
+    TEST_OK("oversized release bypasses the shared lists", after.shared_free == before.shared_free, "shared %zu -> %zu", before.shared_free,
+            after.shared_free);
+    return NULL;
+}
+
+static void *retain_release_thread(void *arg)
+{
+    (void)arg;
+    uint8_t *b = libp2p_buf_alloc(1000);
+    libp2p_buf_retain(b);
+    libp2p_buf_release(b);
+    uint8_t *other = libp2p_buf_alloc(1000);
+    TEST_OK("retained buffer survives one release", other && other != b, "block reused while referenced");
+    libp2p_buf_release(other);
+    libp2p_buf_release(b);
+    uint8_t *again = libp2p_buf_alloc(1000);
+    TEST_OK("last release recycles into the thread cache", again == b, "got a different block");
+
+    libp2p_buf_slice_t s;
+    libp2p_buf_slice(&s, again, 10, 20);
+    TEST_OK("slice points into its base", s.base == again && s.data == again + 10 && s.len == 20, "base %p data %p len %zu", (void *)s.base,
+            (void *)s.data, s.len);
+    libp2p_buf_release(again);
+    other = libp2p_buf_alloc(1000);
+    TEST_OK("slice keeps its base alive", other != again, "block reused while sliced");
+    libp2p_buf_release(other);
+    libp2p_buf_slice_release(&s);
+    TEST_OK("slice release clears the slice", !s.base && !s.data && s.len == 0, "fields left set");
+    uint8_t *last = libp2p_buf_alloc(1000);
+    TEST_OK("slice release drops the last reference", last == again, "block not recycled");
+    libp2p_buf_release(last);
+
+    libp2p_buf_retain(NULL);
+    libp2p_buf_release(NULL);
+    libp2p_buf_slice_release(NULL);
+    return NULL;
+}
+
+#define SPILL_SIZE LIBP2P_BUF_MAX_SIZE
+#define SPILL_LIMIT (LIBP2P_BUF_SHARED_BYTES / LIBP2P_BUF_MAX_SIZE)
+#define SPILL_BLOCKS (2 * LIBP2P_BUF_THREAD_CACHE)
+
+static void *cache_spill_thread(void *arg)
+{
+    (void)arg;
+    uint8_t *bufs[SPILL_BLOCKS];
+    libp2p_buf_pool_stats_t base = stats();
+    for (int i = 0; i < SPILL_BLOCKS; i++)
+        bufs[i] = libp2p_buf_alloc(SPILL_SIZE);
+    libp2p_buf_pool_stats_t st = stats();
+    TEST_OK("empty pool allocates from malloc", st.misses == base.misses + SPILL_BLOCKS, "misses +%llu",
+            (unsigned long long)(st.misses - base.misses));
+
+    for (int i = 0; i < LIBP2P_BUF_THREAD_CACHE; i++)
+        libp2p_buf_release(bufs[i]);
+    st = stats();
+    TEST_OK("releases fill the thread cache first", st.shared_free == base.shared_free, "shared +%zu", st.shared_free - base.shared_free);
+
+    libp2p_buf_release(bufs[LIBP2P_BUF_THREAD_CACHE]);
+    st = stats();
+    TEST_OK("full thread cache spills half to the shared list", st.shared_free == base.shared_free + LIBP2P_BUF_THREAD_CACHE / 2, "shared +%zu",
+            st.shared_free - base.shared_free);
+
+    for (int i = LIBP2P_BUF_THREAD_CACHE + 1; i < SPILL_BLOCKS; i++)
+        libp2p_buf_release(bufs[i]);
+    libp2p_buf_pool_flush_thread();
+    st = stats();
+    TEST_OK("shared list is capped at its byte budget", st.shared_free == base.shared_free + SPILL_LIMIT, "shared +%zu, limit %d",
+            st.shared_free - base.shared_free, SPILL_LIMIT);
+
+    libp2p_buf_pool_stats_t full = st;
+    for (int i = 0; i < LIBP2P_BUF_THREAD_CACHE / 2; i++)
+        bufs[i] = libp2p_buf_alloc(SPILL_SIZE);
+    st = stats();
+    TEST_OK("empty thread cache refills from the shared list",
+            st.misses == full.misses && st.shared_free == full.shared_free - LIBP2P_BUF_THREAD_CACHE / 2, "misses +%llu shared -%zu",
+            (unsigned long long)(st.misses - full.misses), full.shared_free - st.shared_free);
+    for (int i = 0; i < LIBP2P_BUF_THREAD_CACHE / 2; i++)
+        libp2p_buf_release(bufs[i]);
+    return NULL;
+}
+
+static uint8_t *g_handoff[4];
+
+static void *release_and_exit_thread(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < 4; i++)
+        libp2p_buf_release(g_handoff[i]);
+    return NULL;
+}
+
+static void test_thread_exit_spills(void)
+{
+    libp2p_buf_pool_stats_t base = stats();
+    for (int i = 0; i < 4; i++)
+        g_handoff[i] = libp2p_buf_alloc(2048);
+    run_in_thread(release_and_exit_thread);
+    libp2p_buf_pool_stats_t st = stats();
+    TEST_OK("blocks released on another thread return at its exit", st.shared_free == base.shared_free + 4, "shared +%zu",
+            st.shared_free - base.shared_free);
+
+    uint8_t *b = libp2p_buf_alloc(2048);
+    libp2p_buf_pool_stats_t after = stats();
+    TEST_OK("spilled blocks are reused by other threads", after.misses == st.misses, "misses +%llu", (unsigned long long)(after.misses - st.misses));
+    libp2p_buf_release(b);
+}
+
+int main(void)
+{
+    /* first, while the shared lists are still empty */
+    run_in_thread(cache_spill_thread);
+    run_in_thread(size_classes_thread);
+    run_in_thread(retain_release_thread);
+    test_thread_exit_spills();
+    if (failures)
+        printf("\nSome tests failed - total failures: %d\n", failures);
+    else
+        printf("\nAll buf_pool tests passed!\n");
+    return failures ? 1 : 0;
+}
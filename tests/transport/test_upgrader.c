@@ -3,13 +3,17 @@
 #include "peer_id/peer_id_ed25519.h"
 #include "protocol/noise/protocol_noise.h"
 #include "protocol/mplex/protocol_mplex.h"
+#include "protocol/yamux/protocol_yamux.h"
 #include "protocol/tcp/protocol_tcp.h"
 #include "protocol/tcp/protocol_tcp_conn.h"
 #include "transport/listener.h"
 #include "transport/transport.h"
 #include "transport/upgrader.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <noise/protocol.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -114,6 +118,12 @@ static int peer_id_from_ed25519_priv(const uint8_t *sk, peer_id_t *pid)
     return ret == PEER_ID_SUCCESS ? 0 : -1;
 }
 
+static void count_timings(const libp2p_uconn_t *uc, void *arg)
+{
+    if (uc && uc->timings.total_us)
+        (*(int *)arg)++;
+}
+
 static void test_upgrade_handshake(void)
 {
     uint8_t static_cli[32];
@@ -149,12 +159,19 @@ static void test_upgrade_handshake(void)
     libp2p_security_t *sec_list_cli[] = {sec_cli, NULL};
     libp2p_security_t *sec_list_srv[] = {sec_srv, NULL};
     libp2p_muxer_t *mux = libp2p_mplex_new();
+    libp2p_muxer_t *ymux = libp2p_yamux_new();
     libp2p_muxer_t *mux_list[] = {mux, NULL};
+    /* the client prefers yamux, which the server lacks, so both sides must
+     * settle on mplex within the same negotiation */
+    libp2p_muxer_t *mux_list_cli[] = {ymux, mux, NULL};
     libp2p_upgrader_config_t uc = libp2p_upgrader_config_default();
     uc.security = (const libp2p_security_t *const *)sec_list_cli;
     uc.n_security = 1;
-    uc.muxers = (const libp2p_muxer_t *const *)mux_list;
-    uc.n_muxers = 1;
+    uc.muxers = (const libp2p_muxer_t *const *)mux_list_cli;
+    uc.n_muxers = 2;
+    int timing_reports = 0;
+    uc.on_timings = count_timings;
+    uc.on_timings_arg = &timing_reports;
     libp2p_upgrader_t *up_cli = libp2p_upgrader_new(&uc);
     uc.security = (const libp2p_security_t *const *)sec_list_srv;
     uc.n_security = 1;
@@ -213,6 +230,34 @@ static void test_upgrade_handshake(void)
     TEST_OK("server saw client", srv_args.out && srv_args.out->remote_peer && peer_id_equals(srv_args.out->remote_peer, &pid_cli) == 1, "match=%d",
             srv_args.out && srv_args.out->remote_peer ? peer_id_equals(srv_args.out->remote_peer, &pid_cli) : -1);
 
+    TEST_OK("muxer fallback to mplex", cli_args.out && srv_args.out && cli_args.out->muxer == mux && srv_args.out->muxer == mux,
+            "cli=%p srv=%p", cli_args.out ? (const void *)cli_args.out->muxer : NULL,
+            srv_args.out ? (const void *)srv_args.out->muxer : NULL);
+
+    /* every phase is timed; only the dialing side knows its connect time */
+    const uint32_t handshake_bits = (1u << LIBP2P_UPGRADE_PHASE_SECURITY) | (1u << LIBP2P_UPGRADE_PHASE_NOISE_MSG1) |
+                                    (1u << LIBP2P_UPGRADE_PHASE_NOISE_MSG2) | (1u << LIBP2P_UPGRADE_PHASE_NOISE_MSG3) |
+                                    (1u << LIBP2P_UPGRADE_PHASE_VERIFY) | (1u << LIBP2P_UPGRADE_PHASE_MUXER);
+    uint32_t cm = cli_args.out ? cli_args.out->timings.measured : 0;
+    uint32_t sm = srv_args.out ? srv_args.out->timings.measured : 0;
+    TEST_OK("setup timings measured", cm == (handshake_bits | (1u << LIBP2P_UPGRADE_PHASE_CONNECT)) && sm == handshake_bits,
+            "cli=%#x srv=%#x", cm, sm);
+    TEST_OK("setup timings key type", cli_args.out && srv_args.out && cli_args.out->timings.remote_key_type == PEER_ID_ED25519_KEY_TYPE &&
+                                          srv_args.out->timings.remote_key_type == PEER_ID_ED25519_KEY_TYPE && cli_args.out->timings.total_us > 0,
+            "cli=%d srv=%d", cli_args.out ? cli_args.out->timings.remote_key_type : -2,
+            srv_args.out ? srv_args.out->timings.remote_key_type : -2);
+
+    libp2p_upgrader_stats_t ust;
+    memset(&ust, 0, sizeof(ust));
+    libp2p_upgrader_get_stats(up_cli, &ust);
+    TEST_OK("upgrader stats", ust.total.count == 1 && ust.phase[LIBP2P_UPGRADE_PHASE_NOISE_MSG2].count == 1 &&
+                                  ust.verify_by_key[PEER_ID_ED25519_KEY_TYPE].count == 1 && ust.failures == 0 && timing_reports == 1,
+            "total=%llu verify=%llu failures=%llu reports=%d", (unsigned long long)ust.total.count,
+            (unsigned long long)ust.verify_by_key[PEER_ID_ED25519_KEY_TYPE].count, (unsigned long long)ust.failures, timing_reports);
+    libp2p_upgrader_reset_stats(up_cli);
+    libp2p_upgrader_get_stats(up_cli, &ust);
+    TEST_OK("upgrader stats reset", ust.total.count == 0, "total=%llu", (unsigned long long)ust.total.count);
+
     libp2p_mplex_ctx_t *ctx_c = libp2p_mplex_ctx_new(cli_args.out->conn);
     libp2p_mplex_ctx_t *ctx_s = libp2p_mplex_ctx_new(srv_args.out->conn);
     TEST_OK("mplex ctx", ctx_c && ctx_s, "ctx");
@@ -270,16 +315,418 @@ static void test_upgrade_handshake(void)
     libp2p_upgrader_free(up_cli);
     libp2p_upgrader_free(up_srv);
     libp2p_muxer_free(mux);
+    libp2p_muxer_free(ymux);
     libp2p_security_free(sec_cli);
     libp2p_security_free(sec_srv);
     peer_id_destroy(&pid_cli);
     peer_id_destroy(&pid_srv);
 }
 
+/* Many handshakes, all driven by this one thread through the nonblocking
+ * upgrade ops and poll(). */
+#define ASYNC_PAIRS 16
+
+static void test_upgrade_async(void)
+{
+    uint8_t static_cli[32];
+    uint8_t static_srv[32];
+    noise_randstate_generate_simple(static_cli, sizeof(static_cli));
+    noise_randstate_generate_simple(static_srv, sizeof(static_srv));
+
+    uint8_t id_cli[32] = {0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+                          0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60};
+    uint8_t id_srv[32] = {0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6, 0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f,
+                          0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab, 0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb};
+
+    peer_id_t pid_cli = {0}, pid_srv = {0};
+    TEST_OK("async: derive peer ids", peer_id_from_ed25519_priv(id_cli, &pid_cli) == 0 && peer_id_from_ed25519_priv(id_srv, &pid_srv) == 0,
+            "pid fail");
+
+    libp2p_noise_config_t ncli = {.static_private_key = static_cli,
+                                  .static_private_key_len = sizeof(static_cli),
+                                  .identity_private_key = id_cli,
+                                  .identity_private_key_len = sizeof(id_cli),
+                                  .identity_key_type = PEER_ID_ED25519_KEY_TYPE};
+    libp2p_noise_config_t nsrv = {.static_private_key = static_srv,
+                                  .static_private_key_len = sizeof(static_srv),
+                                  .identity_private_key = id_srv,
+                                  .identity_private_key_len = sizeof(id_srv),
+                                  .identity_key_type = PEER_ID_ED25519_KEY_TYPE};
+    libp2p_security_t *sec_cli = libp2p_noise_security_new(&ncli);
+    libp2p_security_t *sec_srv = libp2p_noise_security_new(&nsrv);
+    libp2p_muxer_t *mux = libp2p_mplex_new();
+    libp2p_muxer_t *ymux = libp2p_yamux_new();
+    libp2p_security_t *sec_list_cli[] = {sec_cli, NULL};
+    libp2p_security_t *sec_list_srv[] = {sec_srv, NULL};
+    libp2p_muxer_t *mux_list_cli[] = {ymux, mux, NULL};
+    libp2p_muxer_t *mux_list_srv[] = {mux, NULL};
+
+    libp2p_upgrader_config_t uc = libp2p_upgrader_config_default();
+    uc.handshake_timeout_ms = 5000;
+    uc.security = (const libp2p_security_t *const *)sec_list_cli;
+    uc.n_security = 1;
+    uc.muxers = (const libp2p_muxer_t *const *)mux_list_cli;
+    uc.n_muxers = 2;
+    libp2p_upgrader_t *up_cli = libp2p_upgrader_new(&uc);
+    uc.security = (const libp2p_security_t *const *)sec_list_srv;
+    uc.muxers = (const libp2p_muxer_t *const *)mux_list_srv;
+    uc.n_muxers = 1;
+    libp2p_upgrader_t *up_srv = libp2p_upgrader_new(&uc);
+    TEST_OK("async: setup", sec_cli && sec_srv && mux && ymux && up_cli && up_srv, "alloc");
+    if (!sec_cli || !sec_srv || !mux || !ymux || !up_cli || !up_srv)
+        return;
+
+    int port = 9000 + (rand() % 1000);
+    char addr_str[64];
+    snprintf(addr_str, sizeof(addr_str), "/ip4/127.0.0.1/tcp/%d", port);
+    int ma_err = 0;
+    multiaddr_t *addr = multiaddr_new_from_str(addr_str, &ma_err);
+    libp2p_transport_t *tcp = libp2p_tcp_transport_new(NULL);
+    libp2p_listener_t *lst = NULL;
+    int rc = libp2p_transport_listen(tcp, addr, &lst);
+    TEST_OK("async: listener create", addr && rc == 0 && lst, "rc=%d", rc);
+
+    /* even slots dial, odd slots accept */
+    libp2p_upgrade_op_t *ops[2 * ASYNC_PAIRS] = {0};
+    libp2p_uconn_t *outs[2 * ASYNC_PAIRS] = {0};
+    libp2p_upgrader_err_t rcs[2 * ASYNC_PAIRS];
+    int fds[2 * ASYNC_PAIRS];
+    int started = 0;
+    for (int i = 0; i < ASYNC_PAIRS; i++)
+    {
+        libp2p_conn_t *cli = NULL, *srv = NULL;
+        if (libp2p_transport_dial(tcp, addr, &cli) != 0 || accept_with_timeout(lst, &srv, 100, 2000) != 0)
+        {
+            if (cli)
+                libp2p_conn_free(cli);
+            break;
+        }
+        fds[2 * i] = ((tcp_conn_ctx_t *)cli->ctx)->fd;
+        fds[2 * i + 1] = ((tcp_conn_ctx_t *)srv->ctx)->fd;
+        ops[2 * i] = libp2p_upgrade_op_new_outbound(up_cli, cli, &pid_srv);
+        ops[2 * i + 1] = libp2p_upgrade_op_new_inbound(up_srv, srv);
+        rcs[2 * i] = rcs[2 * i + 1] = LIBP2P_UPGRADER_ERR_AGAIN;
+        started++;
+    }
+    TEST_OK("async: connections set up", started == ASYNC_PAIRS, "started=%d", started);
+
+    uint64_t start = (uint64_t)time(NULL);
+    int pending = 2 * started;
+    while (pending > 0 && (uint64_t)time(NULL) - start < 10)
+    {
+        struct pollfd pfds[2 * ASYNC_PAIRS];
+        int np = 0;
+        for (int i = 0; i < 2 * started; i++)
+        {
+            if (rcs[i] != LIBP2P_UPGRADER_ERR_AGAIN)
+                continue;
+            rcs[i] = ops[i] ? libp2p_upgrade_op_step(ops[i], &outs[i]) : LIBP2P_UPGRADER_ERR_INTERNAL;
+            if (rcs[i] != LIBP2P_UPGRADER_ERR_AGAIN)
+            {
+                pending--;
+                continue;
+            }
+            int wants = libp2p_upgrade_op_wants(ops[i]);
+            pfds[np].fd = fds[i];
+            pfds[np].events = (short)(((wants & LIBP2P_UPGRADE_WANT_READ) ? POLLIN : 0) | ((wants & LIBP2P_UPGRADE_WANT_WRITE) ? POLLOUT : 0));
+            pfds[np].revents = 0;
+            np++;
+        }
+        if (np)
+            poll(pfds, (nfds_t)np, 50);
+    }
+
+    int ok = 0, peers_ok = 0, mux_ok = 0;
+    for (int i = 0; i < 2 * started; i++)
+    {
+        if (rcs[i] != LIBP2P_UPGRADER_OK || !outs[i])
+            continue;
+        ok++;
+        const peer_id_t *want = (i % 2 == 0) ? &pid_srv : &pid_cli;
+        if (outs[i]->remote_peer && peer_id_equals(outs[i]->remote_peer, want) == 1)
+            peers_ok++;
+        if (outs[i]->muxer == mux && outs[i]->dialer == (i % 2 == 0))
+            mux_ok++;
+    }
+    TEST_OK("async: all upgrades complete", ok == 2 * started, "ok=%d of %d", ok, 2 * started);
+    TEST_OK("async: remote peers verified", peers_ok == 2 * started, "ok=%d", peers_ok);
+    TEST_OK("async: muxer fallback to mplex", mux_ok == 2 * started, "ok=%d", mux_ok);
+
+    if (started > 0 && outs[0] && outs[1])
+    {
+        libp2p_mplex_ctx_t *ctx_c = libp2p_mplex_ctx_new(outs[0]->conn);
+        libp2p_mplex_ctx_t *ctx_s = libp2p_mplex_ctx_new(outs[1]->conn);
+        uint64_t sid = 0;
+        int sent = ctx_c && ctx_s && libp2p_mplex_stream_open(ctx_c, (const uint8_t *)"s", 1, &sid) == LIBP2P_MPLEX_OK &&
+                   libp2p_mplex_stream_send(ctx_c, sid, 1, (const uint8_t *)"ping", 4) == LIBP2P_MPLEX_OK;
+        uint8_t buf[8];
+        size_t n = 0;
+        libp2p_mplex_err_t mrc = LIBP2P_MPLEX_ERR_INTERNAL;
+        if (sent)
+        {
+            libp2p_mplex_process_one(ctx_s);
+            libp2p_mplex_process_one(ctx_s);
+            mrc = libp2p_mplex_stream_recv(ctx_s, sid, 0, buf, sizeof(buf), &n);
+        }
+        TEST_OK("async: data after upgrade", mrc == LIBP2P_MPLEX_OK && n == 4 && memcmp(buf, "ping", 4) == 0, "mrc=%d n=%zu", mrc, n);
+        libp2p_mplex_ctx_free(ctx_c);
+        libp2p_mplex_ctx_free(ctx_s);
+    }
+
+    for (int i = 0; i < 2 * started; i++)
+    {
+        libp2p_upgrade_op_free(ops[i]);
+        if (!outs[i])
+            continue;
+        libp2p_conn_close(outs[i]->conn);
+        libp2p_conn_free(outs[i]->conn);
+        if (outs[i]->remote_peer)
+        {
+            peer_id_destroy(outs[i]->remote_peer);
+            free(outs[i]->remote_peer);
+        }
+        free(outs[i]);
+    }
+    libp2p_listener_close(lst);
+    libp2p_transport_close(tcp);
+    libp2p_transport_free(tcp);
+    multiaddr_free(addr);
+    libp2p_upgrader_free(up_cli);
+    libp2p_upgrader_free(up_srv);
+    libp2p_muxer_free(mux);
+    libp2p_muxer_free(ymux);
+    libp2p_security_free(sec_cli);
+    libp2p_security_free(sec_srv);
+    peer_id_destroy(&pid_cli);
+    peer_id_destroy(&pid_srv);
+}
+
+/* Raw connection over one end of a socketpair that moves at most a few
+ * bytes per call and reports AGAIN on every other call, so each layer above
+ * sees short transfers and must resume where it stopped. */
+typedef struct
+{
+    int fd;
+    unsigned calls;
+} choppy_conn_t;
+
+static ssize_t choppy_read(libp2p_conn_t *c, void *buf, size_t len)
+{
+    choppy_conn_t *cc = c->ctx;
+    if (cc->calls++ % 2 == 0)
+        return LIBP2P_CONN_ERR_AGAIN;
+    ssize_t n = read(cc->fd, buf, len > 5 ? 5 : len);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? LIBP2P_CONN_ERR_AGAIN : LIBP2P_CONN_ERR_INTERNAL;
+    return n == 0 ? LIBP2P_CONN_ERR_EOF : n;
+}
+
+static ssize_t choppy_write(libp2p_conn_t *c, const void *buf, size_t len)
+{
+    choppy_conn_t *cc = c->ctx;
+    if (cc->calls++ % 2 == 0)
+        return LIBP2P_CONN_ERR_AGAIN;
+    ssize_t n = write(cc->fd, buf, len > 7 ? 7 : len);
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? LIBP2P_CONN_ERR_AGAIN : LIBP2P_CONN_ERR_INTERNAL;
+    return n;
+}
+
+static libp2p_conn_err_t choppy_set_deadline(libp2p_conn_t *c, uint64_t ms)
+{
+    (void)c;
+    (void)ms;
+    return LIBP2P_CONN_OK;
+}
+
+static const multiaddr_t *choppy_addr(libp2p_conn_t *c)
+{
+    (void)c;
+    return NULL;
+}
+
+static libp2p_conn_err_t choppy_close(libp2p_conn_t *c)
+{
+    shutdown(((choppy_conn_t *)c->ctx)->fd, SHUT_RDWR);
+    return LIBP2P_CONN_OK;
+}
+
+static void choppy_free(libp2p_conn_t *c)
+{
+    close(((choppy_conn_t *)c->ctx)->fd);
+    free(c->ctx);
+    free(c);
+}
+
+static const libp2p_conn_vtbl_t CHOPPY_VTBL = {
+    .read = choppy_read,
+    .write = choppy_write,
+    .set_deadline = choppy_set_deadline,
+    .local_addr = choppy_addr,
+    .remote_addr = choppy_addr,
+    .close = choppy_close,
+    .free = choppy_free,
+};
+
+static libp2p_conn_t *choppy_new(int fd)
+{
+    libp2p_conn_t *c = calloc(1, sizeof(*c));
+    choppy_conn_t *cc = calloc(1, sizeof(*cc));
+    if (!c || !cc || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0)
+    {
+        free(c);
+        free(cc);
+        close(fd);
+        return NULL;
+    }
+    cc->fd = fd;
+    c->vt = &CHOPPY_VTBL;
+    c->ctx = cc;
+    return c;
+}
+
+#define CHOPPY_MSGS 40
+#define CHOPPY_MAX 3000
+
+static size_t choppy_msg_len(int m) { return 1 + ((size_t)m * 97) % CHOPPY_MAX; }
+
+/* Both upgrade ops stepped in turn over connections that keep returning
+ * AGAIN and short counts, then records sent across the secured pair the
+ * same way. A write retried after AGAIN must finish its record rather than
+ * encrypt the bytes again under the next nonce. */
+static void test_upgrade_choppy(void)
+{
+    uint8_t static_cli[32];
+    uint8_t static_srv[32];
+    noise_randstate_generate_simple(static_cli, sizeof(static_cli));
+    noise_randstate_generate_simple(static_srv, sizeof(static_srv));
+
+    uint8_t id_cli[32] = {0x9d, 0x61, 0xb1, 0x9d, 0xef, 0xfd, 0x5a, 0x60, 0xba, 0x84, 0x4a, 0xf4, 0x92, 0xec, 0x2c, 0xc4,
+                          0x44, 0x49, 0xc5, 0x69, 0x7b, 0x32, 0x69, 0x19, 0x70, 0x3b, 0xac, 0x03, 0x1c, 0xae, 0x7f, 0x60};
+    uint8_t id_srv[32] = {0x4c, 0xcd, 0x08, 0x9b, 0x28, 0xff, 0x96, 0xda, 0x9d, 0xb6, 0xc3, 0x46, 0xec, 0x11, 0x4e, 0x0f,
+                          0x5b, 0x8a, 0x31, 0x9f, 0x35, 0xab, 0xa6, 0x24, 0xda, 0x8c, 0xf6, 0xed, 0x4f, 0xb8, 0xa6, 0xfb};
+
+    libp2p_noise_config_t ncli = {.static_private_key = static_cli,
+                                  .static_private_key_len = sizeof(static_cli),
+                                  .identity_private_key = id_cli,
+                                  .identity_private_key_len = sizeof(id_cli),
+                                  .identity_key_type = PEER_ID_ED25519_KEY_TYPE};
+    libp2p_noise_config_t nsrv = {.static_private_key = static_srv,
+                                  .static_private_key_len = sizeof(static_srv),
+                                  .identity_private_key = id_srv,
+                                  .identity_private_key_len = sizeof(id_srv),
+                                  .identity_key_type = PEER_ID_ED25519_KEY_TYPE};
+    libp2p_security_t *sec_cli = libp2p_noise_security_new(&ncli);
+    libp2p_security_t *sec_srv = libp2p_noise_security_new(&nsrv);
+    libp2p_muxer_t *mux = libp2p_mplex_new();
+    libp2p_security_t *sec_list_cli[] = {sec_cli, NULL};
+    libp2p_security_t *sec_list_srv[] = {sec_srv, NULL};
+    libp2p_muxer_t *mux_list[] = {mux, NULL};
+
+    libp2p_upgrader_config_t uc = libp2p_upgrader_config_default();
+    uc.handshake_timeout_ms = 5000;
+    uc.security = (const libp2p_security_t *const *)sec_list_cli;
+    uc.n_security = 1;
+    uc.muxers = (const libp2p_muxer_t *const *)mux_list;
+    uc.n_muxers = 1;
+    libp2p_upgrader_t *up_cli = libp2p_upgrader_new(&uc);
+    uc.security = (const libp2p_security_t *const *)sec_list_srv;
+    libp2p_upgrader_t *up_srv = libp2p_upgrader_new(&uc);
+
+    int sv[2] = {-1, -1};
+    int ok = sec_cli && sec_srv && mux && up_cli && up_srv && socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0;
+    libp2p_conn_t *cli = ok ? choppy_new(sv[0]) : NULL;
+    libp2p_conn_t *srv = ok ? choppy_new(sv[1]) : NULL;
+    libp2p_upgrade_op_t *ops[2] = {cli ? libp2p_upgrade_op_new_outbound(up_cli, cli, NULL) : NULL,
+                                   srv ? libp2p_upgrade_op_new_inbound(up_srv, srv) : NULL};
+    TEST_OK("choppy: setup", ops[0] && ops[1], "alloc");
+    if (!ops[0] && cli)
+        libp2p_conn_free(cli);
+    if (!ops[1] && srv)
+        libp2p_conn_free(srv);
+
+    libp2p_uconn_t *outs[2] = {NULL, NULL};
+    libp2p_upgrader_err_t rcs[2] = {LIBP2P_UPGRADER_ERR_AGAIN, LIBP2P_UPGRADER_ERR_AGAIN};
+    for (int spins = 0; ops[0] && ops[1] && spins < 1000000; spins++)
+    {
+        for (int i = 0; i < 2; i++)
+            if (rcs[i] == LIBP2P_UPGRADER_ERR_AGAIN)
+                rcs[i] = libp2p_upgrade_op_step(ops[i], &outs[i]);
+        if (rcs[0] != LIBP2P_UPGRADER_ERR_AGAIN && rcs[1] != LIBP2P_UPGRADER_ERR_AGAIN)
+            break;
+    }
+    TEST_OK("choppy: upgrades complete", rcs[0] == LIBP2P_UPGRADER_OK && rcs[1] == LIBP2P_UPGRADER_OK, "cli=%d srv=%d", rcs[0], rcs[1]);
+
+    if (outs[0] && outs[1])
+    {
+        static uint8_t got[CHOPPY_MSGS * CHOPPY_MAX];
+        uint8_t msg[CHOPPY_MAX];
+        size_t total = 0, have = 0;
+        ssize_t err = 0;
+        for (int m = 0; m < CHOPPY_MSGS && !err; m++)
+        {
+            size_t len = choppy_msg_len(m);
+            for (size_t i = 0; i < len; i++)
+                msg[i] = (uint8_t)(m + i);
+            total += len;
+            size_t off = 0;
+            while (!err && (off < len || have < total))
+            {
+                if (off < len)
+                {
+                    ssize_t n = libp2p_conn_write(outs[0]->conn, msg + off, len - off);
+                    if (n > 0)
+                        off += (size_t)n;
+                    else if (n != LIBP2P_CONN_ERR_AGAIN)
+                        err = n;
+                }
+                ssize_t n = libp2p_conn_read(outs[1]->conn, got + have, sizeof(got) - have);
+                if (n > 0)
+                    have += (size_t)n;
+                else if (n != LIBP2P_CONN_ERR_AGAIN)
+                    err = n;
+            }
+        }
+        int match = !err && have == total;
+        size_t pos = 0;
+        for (int m = 0; match && m < CHOPPY_MSGS; m++)
+        {
+            size_t len = choppy_msg_len(m);
+            for (size_t i = 0; i < len; i++)
+                if (got[pos + i] != (uint8_t)(m + i))
+                    match = 0;
+            pos += len;
+        }
+        TEST_OK("choppy: records survive AGAIN and short writes", match, "err=%zd have=%zu total=%zu", err, have, total);
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        libp2p_upgrade_op_free(ops[i]);
+        if (!outs[i])
+            continue;
+        libp2p_conn_close(outs[i]->conn);
+        libp2p_conn_free(outs[i]->conn);
+        if (outs[i]->remote_peer)
+        {
+            peer_id_destroy(outs[i]->remote_peer);
+            free(outs[i]->remote_peer);
+        }
+        free(outs[i]);
+    }
+    libp2p_upgrader_free(up_cli);
+    libp2p_upgrader_free(up_srv);
+    libp2p_muxer_free(mux);
+    libp2p_security_free(sec_cli);
+    libp2p_security_free(sec_srv);
+}
+
 int main(void)
 {
     srand((unsigned)time(NULL));
     test_upgrade_handshake();
+    test_upgrade_async();
+    test_upgrade_choppy();
     if (failures)
         printf("\nSome tests failed - total failures: %d\n", failures);
     else